@@ -0,0 +1,432 @@
+#include "incremental.h"
+
+/// @brief Grows an array to hold at least needed elements, doubling its capacity
+static void *reserve(void *data, size_t elem_size, size_t needed, uint32_t *capacity)
+{
+    if (data && needed <= *capacity)
+        return data;
+
+    size_t new_capacity = *capacity ? *capacity : 256;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+
+    data = realloc(data, new_capacity * elem_size);
+    if (!data)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    *capacity = new_capacity;
+    return data;
+}
+
+/// @brief Length of the common start of two buffers, compared a block at a time
+static size_t common_prefix(const char *a, const char *b, size_t len)
+{
+    size_t n = 0;
+    while (n + 4096 <= len && !memcmp(a + n, b + n, 4096))
+        n += 4096;
+    while (n < len && a[n] == b[n])
+        n++;
+    return n;
+}
+
+/// @brief Length of the common end of two buffers that end at a and b
+static size_t common_suffix(const char *a, const char *b, size_t len)
+{
+    size_t n = 0;
+    while (n + 4096 <= len && !memcmp(a - n - 4096, b - n - 4096, 4096))
+        n += 4096;
+    while (n < len && *(a - n - 1) == *(b - n - 1))
+        n++;
+    return n;
+}
+
+/// @brief Index of the first reference to a word at or after word, references are sorted by word
+static uint32_t find_reference(const IncrementalAssembly *inc, uint32_t word)
+{
+    uint32_t lo = 0, hi = inc->num_refs;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (inc->refs[mid].word < word)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/// @brief Marks the words from first up to but not including end to be written
+static void mark_dirty(IncrementalAssembly *inc, uint32_t first, uint32_t end)
+{
+    if (first >= end)
+        return;
+    if (first < inc->first_dirty)
+        inc->first_dirty = first;
+    if (end - 1 > inc->last_dirty)
+        inc->last_dirty = end - 1;
+}
+
+void init_incremental(IncrementalAssembly *inc, uint32_t origin)
+{
+    *inc = (IncrementalAssembly){.origin = origin, .first_dirty = UINT32_MAX, .written_words = -1};
+}
+
+/// @brief Fills in the label fields of the references from first up to but not including end
+/// @return 0 if successful, 1 if a label is not defined or out of range
+static int resolve_references(IncrementalAssembly *inc, uint32_t first, uint32_t end)
+{
+    int status = 0;
+
+    for (uint32_t n = first; n < end; n++)
+    {
+        const Reference *ref = &inc->refs[n];
+        const char *name = inc->symbols.names + ref->name;
+        const Symbol *symbol = find_symbol(&inc->symbols, name, ref->len);
+        uint32_t value;
+
+        if (!symbol->defined)
+        {
+            fprintf(stderr, "Error: Label '%.*s' is not defined, used at line %u\n", (int)ref->len, name, ref->line);
+            status = 1;
+            continue;
+        }
+        if (resolve_reference(inc->origin, ref->kind, ref->word, symbol->addr, &value))
+        {
+            fprintf(stderr, "Error: Label '%.*s' is out of range at line %u\n", (int)ref->len, name, ref->line);
+            status = 1;
+            continue;
+        }
+
+        uint32_t mask = fixup_mask(ref->kind);
+        uint32_t word = (inc->words[ref->word] & ~mask) | value;
+        if (word != inc->words[ref->word])
+        {
+            inc->words[ref->word] = word;
+            mark_dirty(inc, ref->word, ref->word + 1);
+        }
+    }
+
+    return status;
+}
+
+/// @brief Assembles lines on their own, every label reference is left as a fixup and the address of each label
+/// is relative to the first line.
+/// @param text the lines, the last one does not have to end with a newline
+/// @param len
+/// @param lines the length, word and label count of each line, freed by the caller
+/// @param num_lines
+/// @return 0 if successful, 1 otherwise
+static int assemble_changed(Assembler *as, const char *text, size_t len, uint32_t first_line, CachedLine **lines,
+                            uint32_t *num_lines)
+{
+    char *line = NULL;
+    size_t line_capacity = 0;
+    uint32_t lines_capacity = 0;
+    int status = 0;
+
+    init_assembler(as, NULL, 0);
+    as->defer_labels = 1;
+    as->line = first_line;
+    *lines = NULL;
+    *num_lines = 0;
+
+    for (const char *start = text, *end = text + len; start < end;)
+    {
+        const char *newline = memchr(start, '\n', end - start);
+        size_t line_len = newline ? (size_t)(newline - start) + 1 : (size_t)(end - start);
+
+        if (line_len + 1 > line_capacity)
+        {
+            line_capacity = (line_len + 1) * 2;
+            line = realloc(line, line_capacity);
+            if (!line)
+            {
+                perror("Failed to allocate memory");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memcpy(line, start, line_len);
+        line[line_len] = '\0';
+        start += line_len;
+
+        uint32_t count = as->count;
+        status = assemble_line(as, line);
+        if (status)
+        {
+            fprintf(stderr, "Error: Assembly stopped at line %u\n", as->line);
+            break;
+        }
+
+        *lines = reserve(*lines, sizeof(CachedLine), *num_lines + 1, &lines_capacity);
+        CachedLine *cached = &(*lines)[(*num_lines)++];
+        *cached = (CachedLine){.len = line_len, .num_words = as->count - count};
+        for (int t = 0; t < as->tokens.size; t++)
+            cached->num_labels += as->tokens.data[t].type == TOKEN_LABEL;
+    }
+
+    free(line);
+    if (status)
+        return 1;
+
+    // the data section and the padding of the last word belong to the last line
+    uint32_t count = as->count;
+    status = finish_source(as);
+    if (*num_lines > 0)
+        (*lines)[*num_lines - 1].num_words += as->count - count;
+    return status;
+}
+
+int update_incremental(IncrementalAssembly *inc, const char *source, size_t len)
+{
+    if (!inc->valid)
+    {
+        // start over, the whole output is written again
+        inc->num_lines = inc->num_words = inc->num_refs = 0;
+        inc->source_len = 0;
+        free_symbols(&inc->symbols);
+        inc->written_words = -1;
+    }
+
+    // Bytes at the start and the end that did not change, some sources are assembled as a whole
+    int whole_source = needs_whole_source(source, len);
+    size_t limit = whole_source || inc->whole_source ? 0 : len < inc->source_len ? len : inc->source_len;
+    size_t same_start = common_prefix(inc->source, source, limit);
+    size_t same_end = common_suffix(inc->source + inc->source_len, source + len, limit - same_start);
+
+    // The whole lines within them are kept, lines [first, old_end) of the cache are replaced
+    uint32_t first = 0, old_end = inc->num_lines;
+    size_t first_byte = 0, kept_end = 0;
+    while (first < inc->num_lines && first_byte + inc->lines[first].len <= same_start &&
+           inc->source[first_byte + inc->lines[first].len - 1] == '\n')
+        first_byte += inc->lines[first++].len;
+    while (old_end > first && kept_end + inc->lines[old_end - 1].len <= same_end)
+        kept_end += inc->lines[--old_end].len;
+    // a kept line at the end only starts a line of the new source if a newline is in front of it
+    if (kept_end > 0 && kept_end == same_end && len - kept_end > 0 && source[len - kept_end - 1] != '\n')
+        kept_end -= inc->lines[old_end++].len;
+
+    Assembler as;
+    CachedLine *lines;
+    uint32_t new_lines;
+    if (assemble_changed(&as, source + first_byte, len - kept_end - first_byte, first, &lines, &new_lines))
+    {
+        free_assembler(&as);
+        free(lines);
+        return 1;
+    }
+    uint32_t new_end = first + new_lines;
+    uint32_t num_lines = new_end + inc->num_lines - old_end;
+
+    // A label defined twice is found before anything changes, so the cache stays valid
+    int status = 0;
+    for (uint32_t n = 0; n < as.symbols.capacity; n++)
+    {
+        const Symbol *symbol = &as.symbols.entries[n];
+        if (symbol->len == 0 || !symbol->defined)
+            continue;
+
+        const Symbol *label = find_symbol(&inc->symbols, symbol_name(&as.symbols, symbol), symbol->len);
+        if (!label || !label->defined || (label->line > first && label->line <= old_end))
+            continue;
+
+        // report the second definition, with the line number of the new source
+        uint32_t line = label->line > old_end ? label->line + new_end - old_end : label->line;
+        fprintf(stderr, "Error: Label '%.*s' is defined twice at line %u\n", (int)symbol->len,
+                symbol_name(&as.symbols, symbol), symbol->line > line ? symbol->line : line);
+        status = 1;
+    }
+    if (status)
+    {
+        free_assembler(&as);
+        free(lines);
+        return 1;
+    }
+
+    uint32_t first_word = 0, old_words = 0, old_labels = 0, new_labels = 0;
+    for (uint32_t n = 0; n < first; n++)
+        first_word += inc->lines[n].num_words;
+    for (uint32_t n = first; n < old_end; n++)
+    {
+        old_words += inc->lines[n].num_words;
+        old_labels += inc->lines[n].num_labels;
+    }
+    for (uint32_t n = 0; n < new_lines; n++)
+        new_labels += lines[n].num_labels;
+
+    int64_t word_shift = (int64_t)as.count - old_words;
+    int64_t line_shift = (int64_t)new_end - old_end;
+    uint32_t moved_lines = inc->num_lines - old_end;
+    uint32_t moved_words = inc->num_words - first_word - old_words;
+
+    // Replace the lines and words of the changed part
+    inc->lines = reserve(inc->lines, sizeof(CachedLine), num_lines, &inc->lines_capacity);
+    memmove(inc->lines + new_end, inc->lines + old_end, moved_lines * sizeof(CachedLine));
+    if (new_lines)
+        memcpy(inc->lines + first, lines, new_lines * sizeof(CachedLine));
+    inc->num_lines = num_lines;
+
+    if (len > inc->source_capacity)
+    {
+        inc->source_capacity = len * 2;
+        inc->source = realloc(inc->source, inc->source_capacity);
+        if (!inc->source)
+        {
+            perror("Failed to allocate memory");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memmove(inc->source + len - kept_end, inc->source + inc->source_len - kept_end, kept_end);
+    memcpy(inc->source + first_byte, source + first_byte, len - kept_end - first_byte);
+    inc->source_len = len;
+
+    inc->words = reserve(inc->words, sizeof(uint32_t), first_word + as.count + moved_words, &inc->words_capacity);
+    memmove(inc->words + first_word + as.count, inc->words + first_word + old_words, moved_words * sizeof(uint32_t));
+    if (as.count)
+        memcpy(inc->words + first_word, as.words, as.count * sizeof(uint32_t));
+    inc->num_words = first_word + as.count + moved_words;
+
+    // Replace the references of the changed part, those after it move with their words
+    uint32_t first_ref = find_reference(inc, first_word);
+    uint32_t old_end_ref = find_reference(inc, first_word + old_words);
+    uint32_t new_refs = as.symbols.num_fixups;
+    uint32_t moved_refs = inc->num_refs - old_end_ref;
+
+    inc->refs = reserve(inc->refs, sizeof(Reference), first_ref + new_refs + moved_refs, &inc->refs_capacity);
+    memmove(inc->refs + first_ref + new_refs, inc->refs + old_end_ref, moved_refs * sizeof(Reference));
+    inc->num_refs = first_ref + new_refs + moved_refs;
+
+    if (word_shift != 0 || line_shift != 0)
+    {
+        for (uint32_t n = first_ref + new_refs; n < inc->num_refs; n++)
+        {
+            inc->refs[n].word += word_shift;
+            inc->refs[n].line += line_shift;
+        }
+    }
+
+    // fixups are added in the order of their words, so their indices keep the references sorted
+    for (uint32_t n = 0; n < as.symbols.capacity; n++)
+    {
+        const Symbol *symbol = &as.symbols.entries[n];
+        if (symbol->len == 0 || symbol->fixups == -1)
+            continue;
+
+        uint32_t name = get_symbol(&inc->symbols, symbol_name(&as.symbols, symbol), symbol->len)->name;
+        for (int32_t f = symbol->fixups; f != -1; f = as.symbols.fixups[f].next)
+        {
+            const Fixup *fixup = &as.symbols.fixups[f];
+            inc->refs[first_ref + f] = (Reference){.word = first_word + fixup->word, .line = fixup->line,
+                                                   .name = name, .len = symbol->len, .kind = fixup->kind};
+        }
+    }
+
+    // Labels of the replaced lines are removed and the labels after them move
+    int labels_moved = old_labels > 0 || new_labels > 0 || word_shift != 0 || line_shift != 0;
+
+    if (labels_moved)
+    {
+        for (uint32_t n = 0; n < inc->symbols.capacity; n++)
+        {
+            Symbol *symbol = &inc->symbols.entries[n];
+            if (symbol->len == 0 || !symbol->defined || symbol->line <= first)
+                continue;
+
+            if (symbol->line <= old_end)
+            {
+                symbol->defined = 0;
+            }
+            else
+            {
+                symbol->line += line_shift;
+                symbol->addr += word_shift * 4;
+            }
+        }
+    }
+
+    for (uint32_t n = 0; n < as.symbols.capacity; n++)
+    {
+        const Symbol *symbol = &as.symbols.entries[n];
+        if (symbol->len == 0 || !symbol->defined)
+            continue;
+
+        Symbol *label = get_symbol(&inc->symbols, symbol_name(&as.symbols, symbol), symbol->len);
+        label->defined = 1;
+        label->addr = inc->origin + first_word * 4 + symbol->addr;
+        label->line = symbol->line;
+    }
+
+    mark_dirty(inc, first_word, first_word + as.count);
+    if (word_shift != 0)
+        mark_dirty(inc, first_word, inc->num_words);
+
+    // Branch offsets only change if the branch or its label moved relative to the other, and jump targets if the
+    // label moved, so without moved labels only the new references are resolved
+    if (labels_moved)
+        status = resolve_references(inc, 0, inc->num_refs);
+    else
+        status = resolve_references(inc, first_ref, first_ref + new_refs);
+
+    inc->changed_lines = new_end - first;
+    inc->valid = !status;
+    inc->whole_source = whole_source;
+
+    free_assembler(&as);
+    free(lines);
+    return status;
+}
+
+int write_incremental(IncrementalAssembly *inc, const char *filename, OutputFormat format)
+{
+    if (!inc->valid)
+        return 1;
+
+    int status = 0;
+    if (inc->written_words == inc->num_words)
+    {
+        if (inc->first_dirty > inc->last_dirty)
+            return 0;
+
+        status = patch_output(filename, format, inc->words, inc->first_dirty, inc->last_dirty - inc->first_dirty + 1);
+    }
+
+    // The size changed, or the format cannot be patched
+    if (inc->written_words != inc->num_words || status)
+    {
+        Output out;
+        if (open_output(&out, filename, format, inc->origin))
+            return 1;
+
+        status = 0;
+        for (uint32_t n = 0; !status && n < inc->num_words; n += OUTPUT_CHUNK_WORDS)
+        {
+            uint32_t count = inc->num_words - n < OUTPUT_CHUNK_WORDS ? inc->num_words - n : OUTPUT_CHUNK_WORDS;
+            status = write_output(&out, inc->words + n, count);
+        }
+
+        if (status)
+        {
+            discard_output(&out);
+            return 1;
+        }
+        if (close_output(&out))
+            return 1;
+    }
+
+    inc->written_words = inc->num_words;
+    inc->first_dirty = UINT32_MAX;
+    inc->last_dirty = 0;
+    return 0;
+}
+
+void free_incremental(IncrementalAssembly *inc)
+{
+    free(inc->source);
+    free(inc->lines);
+    free(inc->words);
+    free(inc->refs);
+    free_symbols(&inc->symbols);
+    *inc = (IncrementalAssembly){0};
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "mips_asm.h"
+
+/// @brief A line of the source as it was last assembled
+typedef struct
+{
+    // length of the line, including the newline
+    uint32_t len;
+    // number of words the line assembles to
+    uint32_t num_words;
+    // number of labels defined on the line
+    uint32_t num_labels;
+} CachedLine;
+
+/// @brief A word that references a label, kept so it can be resolved again when addresses shift
+typedef struct
+{
+    // number of the word that holds the reference
+    uint32_t word;
+    // source line of the reference, for error messages
+    uint32_t line;
+    // name of the label in IncrementalAssembly.symbols.names
+    uint32_t name;
+    uint32_t len;
+    FixupKind kind;
+} Reference;
+
+/// @brief An assembly kept in memory line by line, so a changed source is reassembled by encoding only the lines
+/// that changed. Zero initialize with init_incremental and release with free_incremental.
+typedef struct
+{
+    // address the program is loaded at
+    uint32_t origin;
+
+    // the source that was last assembled, to find the part that changed
+    char *source;
+    size_t source_len;
+    size_t source_capacity;
+
+    CachedLine *lines;
+    uint32_t num_lines;
+    uint32_t lines_capacity;
+
+    // the program, the label fields are filled in
+    uint32_t *words;
+    uint32_t num_words;
+    uint32_t words_capacity;
+
+    // every label reference, sorted by word
+    Reference *refs;
+    uint32_t num_refs;
+    uint32_t refs_capacity;
+
+    // labels, Symbol.line is the line of the definition
+    SymbolTable symbols;
+
+    // words changed since the output was last written, first_dirty > last_dirty if none did
+    uint32_t first_dirty;
+    uint32_t last_dirty;
+    // number of words of the output that was last written, -1 if there is none
+    int64_t written_words;
+    // number of lines encoded by the last update
+    uint32_t changed_lines;
+    // the cache matches the last source, after an error the next update assembles everything
+    uint8_t valid;
+    // the last source was assembled as a whole, see needs_whole_source
+    uint8_t whole_source;
+} IncrementalAssembly;
+
+/// @brief Starts an empty incremental assembly.
+/// @param inc
+/// @param origin address the program is loaded at
+void init_incremental(IncrementalAssembly *inc, uint32_t origin);
+
+/// @brief Assembles a new version of the source. Lines before and after the part that differs from the last
+/// source are taken from the cache, the labels after it move with it and only the references whose fields can change are resolved again.
+/// @param inc
+/// @param source
+/// @param len length of the source, it does not have to be null terminated
+/// @return 0 if successful, 1 otherwise. The words are unchanged if the changed lines have errors.
+int update_incremental(IncrementalAssembly *inc, const char *source, size_t len);
+
+/// @brief Writes the words that changed since the last write. Raw, bits and ELF files of the same size are
+/// patched in place, otherwise the whole file is written again.
+/// @param inc
+/// @param filename
+/// @param format
+/// @return 0 if successful, 1 otherwise
+int write_incremental(IncrementalAssembly *inc, const char *filename, OutputFormat format);
+
+/// @brief Frees the memory of an incremental assembly.
+/// @param inc
+void free_incremental(IncrementalAssembly *inc);
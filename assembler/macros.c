@@ -0,0 +1,168 @@
+#include "macros.h"
+
+/// @brief Grows an array to hold at least needed elements, doubling its capacity.
+static void *grow(void *data, size_t elem_size, size_t needed, size_t *capacity)
+{
+    if (needed <= *capacity)
+        return data;
+
+    size_t new_capacity = *capacity ? *capacity : 16;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+
+    data = realloc(data, new_capacity * elem_size);
+    if (!data)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    *capacity = new_capacity;
+    return data;
+}
+
+int begin_macro(MacroTable *table, const Token *tokens, int num_tokens, int *index, uint32_t line)
+{
+    if (*index >= num_tokens || tokens[*index].type != TOKEN_INSTRUCTION)
+    {
+        fprintf(stderr, "Error: Expected a macro name after .macro at line %u\n", line);
+        return 1;
+    }
+
+    const Token *name = &tokens[(*index)++];
+    Symbol *symbol = get_symbol(&table->names, name->value, name->len);
+    if (symbol->defined)
+    {
+        fprintf(stderr, "Error: Macro '%.*s' is defined twice at line %u\n", (int)name->len, name->value, line);
+        return 1;
+    }
+
+    Macro macro = {.line = line};
+    // .macro name [param[, param...]]
+    while (*index < num_tokens && tokens[*index].type == TOKEN_INSTRUCTION)
+    {
+        const Token *param = &tokens[(*index)++];
+        Symbol *slot = get_symbol(&macro.params, param->value, param->len);
+        if (slot->defined)
+        {
+            fprintf(stderr, "Error: Parameter '%.*s' of macro '%.*s' is defined twice at line %u\n", (int)param->len,
+                    param->value, (int)name->len, name->value, line);
+            free_symbols(&macro.params);
+            return 1;
+        }
+        if (macro.params.count > MACRO_MAX_PARAMS)
+        {
+            fprintf(stderr, "Error: Macro '%.*s' has more than %d parameters at line %u\n", (int)name->len,
+                    name->value, MACRO_MAX_PARAMS, line);
+            free_symbols(&macro.params);
+            return 1;
+        }
+        slot->defined = 1;
+        slot->addr = macro.params.count - 1;
+
+        if (*index < num_tokens && tokens[*index].type == TOKEN_COMMA)
+            (*index)++;
+    }
+
+    size_t capacity = table->capacity;
+    table->macros = grow(table->macros, sizeof(Macro), table->count + 1, &capacity);
+    table->capacity = capacity;
+
+    symbol->defined = 1;
+    symbol->addr = table->count;
+    table->macros[table->count++] = macro;
+    table->open = 1;
+    return 0;
+}
+
+void add_macro_line(MacroTable *table, const char *line)
+{
+    Macro *macro = &table->macros[table->count - 1];
+    size_t len = strlen(line);
+
+    // every line ends with a newline, so a comment at its end does not run into the next line
+    macro->text = grow(macro->text, 1, macro->text_len + len + 2, &macro->text_capacity);
+    memcpy(macro->text + macro->text_len, line, len);
+    macro->text_len += len;
+    if (len == 0 || line[len - 1] != '\n')
+        macro->text[macro->text_len++] = '\n';
+    macro->text[macro->text_len] = '\0';
+}
+
+int end_macro(MacroTable *table)
+{
+    Macro *macro = &table->macros[table->count - 1];
+    table->open = 0;
+
+    // the text does not change any more, so the tokens can point into it
+    if (macro->text && tokenize(macro->text, &macro->body))
+        return 1;
+
+    macro->slots = malloc((macro->body.size + 1) * sizeof(int32_t));
+    if (!macro->slots)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int n = 0; n < macro->body.size; n++)
+    {
+        const Token *token = &macro->body.data[n];
+        const Symbol *param =
+            token->type == TOKEN_INSTRUCTION ? find_symbol(&macro->params, token->value, token->len) : NULL;
+        macro->slots[n] = param ? (int32_t)param->addr : -1;
+    }
+
+    return 0;
+}
+
+const Macro *find_macro(MacroTable *table, const char *name, uint32_t len)
+{
+    const Symbol *symbol = find_symbol(&table->names, name, len);
+    return symbol && symbol->defined ? &table->macros[symbol->addr] : NULL;
+}
+
+int expand_macro(const Macro *macro, const Token *tokens, int num_tokens, int *index, TokenList *out)
+{
+    const Token *name = &tokens[(*index)++];
+    // the tokens may be in out themselves, so the arguments are copied before out grows
+    Token args[MACRO_MAX_PARAMS];
+    uint32_t num_args = macro->params.count;
+
+    for (uint32_t n = 0; n < num_args; n++)
+    {
+        if (n > 0 && (*index >= num_tokens || tokens[(*index)++].type != TOKEN_COMMA))
+        {
+            fprintf(stderr, "Error: Expected comma after argument %u of macro '%.*s'\n", n, (int)name->len,
+                    name->value);
+            return 1;
+        }
+        if (*index >= num_tokens || tokens[*index].type == TOKEN_COMMA || tokens[*index].type == TOKEN_LABEL)
+        {
+            fprintf(stderr, "Error: Macro '%.*s' takes %u arguments\n", (int)name->len, name->value, num_args);
+            return 1;
+        }
+        args[n] = tokens[(*index)++];
+    }
+
+    for (int n = 0; n < macro->body.size; n++)
+        push_token(out, macro->slots[n] >= 0 ? &args[macro->slots[n]] : &macro->body.data[n]);
+
+    return 0;
+}
+
+void free_macros(MacroTable *table)
+{
+    for (uint32_t n = 0; n < table->count; n++)
+    {
+        Macro *macro = &table->macros[n];
+        free_symbols(&macro->params);
+        free_tokens(&macro->body);
+        free(macro->text);
+        free(macro->slots);
+    }
+
+    free_symbols(&table->names);
+    free(table->macros);
+    *table = (MacroTable){0};
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "tokenizer.h"
+#include "symbols.h"
+
+// Most parameters a macro can have
+#define MACRO_MAX_PARAMS 16
+// Deepest nesting of macro invocations, a deeper one is taken to be a macro that invokes itself
+#define MACRO_MAX_DEPTH 16
+
+/// @brief A macro defined with .macro name [param, ...] and the lines up to .endm. The body is tokenized once
+/// when the macro is defined, an invocation copies its tokens with the arguments in place of the parameters.
+typedef struct
+{
+    // Symbol.addr is the number of the parameter
+    SymbolTable params;
+    // text of the body, the tokens point into it
+    char *text;
+    size_t text_len;
+    size_t text_capacity;
+    TokenList body;
+    // for each token of the body the number of the parameter it stands for, -1 if it is copied as it is
+    int32_t *slots;
+    // line of the .macro directive, for error messages
+    uint32_t line;
+} Macro;
+
+/// @brief Macros of an assembly, zero initialize before use and release with free_macros.
+typedef struct
+{
+    // Symbol.addr is the index of the macro in macros
+    SymbolTable names;
+    Macro *macros;
+    uint32_t count;
+    uint32_t capacity;
+    // 1 while the lines of the last macro are read up to .endm
+    uint8_t open;
+} MacroTable;
+
+/// @brief Starts the definition of a macro, the lines up to .endm are added with add_macro_line.
+/// @param table
+/// @param tokens
+/// @param num_tokens
+/// @param index the token after .macro, advanced past the parameters
+/// @param line line of the directive, for error messages
+/// @return 0 if successful, 1 if the name or a parameter is missing or defined twice
+int begin_macro(MacroTable *table, const Token *tokens, int num_tokens, int *index, uint32_t line);
+
+/// @brief Adds a line to the body of the open macro.
+/// @param table
+/// @param line
+void add_macro_line(MacroTable *table, const char *line);
+
+/// @brief Closes the open macro and tokenizes its body.
+/// @param table
+/// @return 0 if successful, 1 if the body cannot be tokenized
+int end_macro(MacroTable *table);
+
+/// @brief Looks up a macro.
+/// @param table
+/// @param name
+/// @param len
+/// @return The macro, or NULL if there is no macro of that name
+const Macro *find_macro(MacroTable *table, const char *name, uint32_t len);
+
+/// @brief Appends the body of a macro to a token list with the arguments of an invocation in place of the
+/// parameters. Every argument is a single token and they are separated by commas.
+/// @param macro
+/// @param tokens
+/// @param num_tokens
+/// @param index the name of the macro, advanced past the arguments
+/// @param out
+/// @return 0 if successful, 1 if the arguments do not match the parameters
+int expand_macro(const Macro *macro, const Token *tokens, int num_tokens, int *index, TokenList *out);
+
+/// @brief Frees the macros and empties the table.
+/// @param table
+void free_macros(MacroTable *table);
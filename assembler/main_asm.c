@@ -1,28 +1,252 @@
 #include "mips_asm.h"
+#include "incremental.h"
+#include "object.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// How often --watch checks whether the input changed
+#define WATCH_INTERVAL_MS 100
+
+/// @brief Prints how to use the assembler.
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [--format raw|hex|bits|elf] [--jobs n] [--map file] [--watch | --object] <input file> <output file> "
+            "[address (hex)]\n",
+            name);
+    fprintf(stderr, "Use - as the input or output file for stdin or stdout\n");
+    fprintf(stderr, "Large input files are assembled on n threads, the number of processors by default\n");
+    fprintf(stderr, "--object writes a relocatable object file for mipsld instead of a program\n");
+    fprintf(stderr, "--map writes the source line and label of every address to a file, for the emulator\n");
+    fprintf(stderr, "--watch assembles the changed lines again whenever the input file changes, until stopped\n");
+    fprintf(stderr, "Labels are addresses relative to the address the program is loaded at, 0 by default\n");
+}
+
+/// @brief Assembles a regular file mapped into memory on several threads, other inputs are streamed.
+/// @return 0 if successful, 1 otherwise
+static int assemble_input(FILE *in, Output *out, int jobs)
+{
+    struct stat st;
+    if (fstat(fileno(in), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return assemble_stream(in, out);
+
+    char *source = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+    if (source == MAP_FAILED)
+        return assemble_stream(in, out);
+
+    int status = assemble_parallel(source, st.st_size, out, jobs);
+    munmap(source, st.st_size);
+    return status;
+}
+
+/// @brief Assembles the input one line at a time and writes the source map of the program.
+/// @return 0 if successful, 1 otherwise
+static int assemble_with_map(FILE *in, Output *out, const char *input_filename, const char *map_filename)
+{
+    SourceMap map = {0};
+    Assembler as;
+    init_assembler(&as, out, out->origin);
+    as.map = &map;
+    set_source_file(&map, input_filename);
+
+    int status = assemble_lines(&as, in) || write_source_map(&map, map_filename);
+
+    free_assembler(&as);
+    free_source_map(&map);
+    return status;
+}
+
+/// @brief Checks whether two stats are of the same version of a file
+static int same_file_version(const struct stat *a, const struct stat *b)
+{
+    return a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+           a->st_size == b->st_size && a->st_ino == b->st_ino;
+}
+
+/// @brief Assembles the input whenever it is modified, reusing the lines that did not change. Never returns
+/// unless the input cannot be read.
+/// @return 1
+static int watch(const char *input_filename, const char *output_filename, OutputFormat format, uint32_t origin)
+{
+    IncrementalAssembly inc;
+    struct stat seen = {0}, assembled = {0};
+    init_incremental(&inc, origin);
+
+    for (;; nanosleep(&(struct timespec){.tv_nsec = WATCH_INTERVAL_MS * 1000000L}, NULL))
+    {
+        // editors may truncate or replace the file while saving, so it is assembled once it stops changing
+        struct stat st;
+        if (stat(input_filename, &st) != 0)
+            continue;
+        if (!same_file_version(&st, &seen))
+        {
+            seen = st;
+            continue;
+        }
+        if (same_file_version(&st, &assembled))
+            continue;
+        assembled = st;
+
+        int fd = open(input_filename, O_RDONLY);
+        if (fd < 0)
+            continue;
+
+        char *source = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+        close(fd);
+        if (source == MAP_FAILED)
+        {
+            fprintf(stderr, "Error: Could not read file %s\n", input_filename);
+            break;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int status = update_incremental(&inc, source, st.st_size) || write_incremental(&inc, output_filename, format);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (st.st_size)
+            munmap(source, st.st_size);
+
+        double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        if (status)
+            fprintf(stderr, "Error: %s not assembled, waiting for changes\n", input_filename);
+        else
+            fprintf(stderr, "Assembled %u of %u lines into %u words in %.3f ms\n", inc.changed_lines, inc.num_lines,
+                    inc.num_words, ms);
+    }
+
+    free_incremental(&inc);
+    return 1;
+}
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    OutputFormat format = FORMAT_RAW;
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int watching = 0, object = 0;
+    const char *map_filename = NULL;
+    int arg = 1;
+
+    while (argc - arg > 1 && !strncmp(argv[arg], "--", 2))
+    {
+        if (!strcmp(argv[arg], "--watch"))
+        {
+            watching = 1;
+            arg++;
+        }
+        else if (!strcmp(argv[arg], "--object"))
+        {
+            object = 1;
+            arg++;
+        }
+        else if (!strcmp(argv[arg], "--format"))
+        {
+            if (parse_output_format(argv[arg + 1], &format))
+            {
+                fprintf(stderr, "Error: Unknown output format %s\n", argv[arg + 1]);
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            arg += 2;
+        }
+        else if (!strcmp(argv[arg], "--map"))
+        {
+            map_filename = argv[arg + 1];
+            arg += 2;
+        }
+        else if (!strcmp(argv[arg], "--jobs") && atoi(argv[arg + 1]) > 0)
+        {
+            jobs = atoi(argv[arg + 1]);
+            arg += 2;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[arg]);
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (jobs < 1)
+        jobs = 1;
+
+    if (argc - arg != 2 && argc - arg != 3)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *input_filename = argv[arg];
+    const char *output_filename = argv[arg + 1];
+    uint32_t origin = argc - arg == 3 ? strtoul(argv[arg + 2], NULL, 16) : 0;
+
+    if (origin & 3)
     {
-        fprintf(stderr, "Usage: %s <input file> <output file>\n", argv[0]);
+        fprintf(stderr, "Error: The address must be a multiple of 4\n");
         return EXIT_FAILURE;
     }
 
-    const char *input_filename = argv[1];
-    const char *output_filename = argv[2];
+    if (object && argc - arg != 2)
+    {
+        fprintf(stderr, "Error: Objects are placed by the linker, they take no address\n");
+        return EXIT_FAILURE;
+    }
 
-    Token tokens[MAX_TOKENS];
-    int token_count = 0;
-    AST program;
+    if (map_filename && (watching || object))
+    {
+        fprintf(stderr, "Error: --map only works when a program is assembled once\n");
+        return EXIT_FAILURE;
+    }
 
-    char *input = read_file(input_filename);
+    if (watching)
+    {
+        if (!strcmp(input_filename, "-") || !strcmp(output_filename, "-"))
+        {
+            fprintf(stderr, "Error: --watch needs an input and an output file\n");
+            return EXIT_FAILURE;
+        }
+        return watch(input_filename, output_filename, format, origin) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    FILE *in = strcmp(input_filename, "-") ? fopen(input_filename, "r") : stdin;
+    if (!in)
+    {
+        fprintf(stderr, "Error: Could not open file %s\n", input_filename);
+        return EXIT_FAILURE;
+    }
+
+    if (object)
+    {
+        Object obj;
+        int status = assemble_object(&obj, in, input_filename) || write_object(&obj, output_filename);
+        if (in != stdin)
+            fclose(in);
+        free_object(&obj);
+        return status ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    Output out;
+    if (open_output(&out, output_filename, format, origin))
+    {
+        if (in != stdin)
+            fclose(in);
+        return EXIT_FAILURE;
+    }
 
-    tokenize(input, tokens, &token_count);
-    parse_tokens(tokens, token_count, &program);
-    generate_code(&program, output_filename);
+    // the map is built line by line, so the input is not split over threads
+    int status = map_filename ? assemble_with_map(in, &out, input_filename, map_filename)
+                              : assemble_input(in, &out, jobs);
 
-    // Free allocated memory.
-    free(input);
+    if (in != stdin)
+        fclose(in);
+    if (status)
+        discard_output(&out);
+    else if (close_output(&out))
+        status = 1;
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+#include "object.h"
+
+/// @brief Prints how to use the linker.
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--format raw|hex|bits|elf] [--address hex] <output file> <object files...>\n", name);
+    fprintf(stderr, "Use - as the output file for stdout, objects are made with asm --object\n");
+    fprintf(stderr, "The objects are placed in the order they are given, from the address on (0 by default)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    OutputFormat format = FORMAT_RAW;
+    uint32_t origin = 0;
+    int arg = 1;
+
+    while (argc - arg > 1 && !strncmp(argv[arg], "--", 2))
+    {
+        if (!strcmp(argv[arg], "--format"))
+        {
+            if (parse_output_format(argv[arg + 1], &format))
+            {
+                fprintf(stderr, "Error: Unknown output format %s\n", argv[arg + 1]);
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp(argv[arg], "--address"))
+        {
+            origin = strtoul(argv[arg + 1], NULL, 16);
+        }
+        else
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[arg]);
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        arg += 2;
+    }
+
+    if (argc - arg < 2)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (origin & 3)
+    {
+        fprintf(stderr, "Error: The address must be a multiple of 4\n");
+        return EXIT_FAILURE;
+    }
+
+    const char *output_filename = argv[arg++];
+    int count = argc - arg;
+    Object *objs = calloc(count, sizeof(Object));
+    if (!objs)
+    {
+        perror("Failed to allocate memory");
+        return EXIT_FAILURE;
+    }
+
+    int status = 0;
+    for (int n = 0; n < count && !status; n++)
+        status = read_object(&objs[n], argv[arg + n]);
+
+    Output out;
+    if (!status && !open_output(&out, output_filename, format, origin))
+    {
+        status = link_objects(objs, count, &out);
+        if (status)
+            discard_output(&out);
+        else if (close_output(&out))
+            status = 1;
+    }
+    else
+    {
+        status = 1;
+    }
+
+    for (int n = 0; n < count; n++)
+        free_object(&objs[n]);
+    free(objs);
+
+    return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
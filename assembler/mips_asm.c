@@ -1,5 +1,7 @@
 #include "mips_asm.h"
 
+#include <pthread.h>
+
 char *read_file(const char *filename)
 {
     FILE *file = fopen(filename, "r");
@@ -27,72 +29,1257 @@ char *read_file(const char *filename)
     return buffer;
 }
 
-// This will print the binary representation of the instruction but as a string of 1s and 0s
-void print_binary(FILE *file, uint32_t instruction)
+uint32_t encode_node(const ASTNode *node)
 {
-    for (int i = 31; i >= 0; i--)
+    Instruction instr = {.id = node->id};
+
+    // The opcode, funct and operand layout all come from the ISA table
+    switch (get_instr_type(isa_desc[node->id].format))
     {
-        fprintf(file, "%d", (instruction >> i) & 1);
-        // if (i % 4 == 0)
-        //     fprintf(file, " "); // Add space for readability TODO remove later
+    case R_TYPE:
+        instr.r = (RArgs){.rs = node->rs, .rt = node->rt, .rd = node->rd, .shamt = node->shamt};
+        break;
+    case I_TYPE:
+        instr.i = (IArgs){.rs = node->rs, .rt = node->rt, .imm = node->value};
+        break;
+    case J_TYPE:
+        instr.j.target = node->value;
+        break;
     }
-    fprintf(file, "\n");
+
+    return encode_instr(&instr);
 }
 
-// This will write the binary representation of the instruction to the file
-void write_binary(FILE *file, uint32_t instruction)
+void init_assembler(Assembler *as, Output *out, uint32_t origin)
 {
-    // Convert to big-endian before writing NOTE: VERY IMPORTANT!!!
-    uint32_t big_endian_instruction = htonl(instruction);
-    fwrite(&big_endian_instruction, sizeof(uint32_t), 1, file);
+    *as = (Assembler){.out = out, .origin = origin};
 }
 
-void generate_code(AST *ast, const char *output_filename)
+void init_assembler_at(Assembler *as, uint32_t *mem, uint32_t size, uint32_t origin)
 {
-    FILE *file = fopen(output_filename, "w");
-    if (!file)
+    *as = (Assembler){.origin = origin, .words = mem, .words_capacity = size, .fixed = 1};
+}
+
+/// @brief Writes the first count held back words to the output, unless the assembly is kept in memory.
+/// @return 0 if successful, 1 otherwise
+static int flush_words(Assembler *as, uint32_t count)
+{
+    if (as->out == NULL || count == 0)
+        return 0;
+
+    int status = write_output(as->out, as->words, count);
+    as->words_base += count;
+    as->num_words -= count;
+    memmove(as->words, as->words + count, as->num_words * sizeof(uint32_t));
+    return status;
+}
+
+/// @brief Writes the full chunks of words once no label reference is pending. Only whole chunks are written,
+/// so the output is cut into the same writes (and HEX records) wherever the references were pending.
+/// @return 0 if successful, 1 otherwise
+static int flush_chunk(Assembler *as)
+{
+    if (as->unresolved > 0 || as->num_words < OUTPUT_CHUNK_WORDS)
+        return 0;
+    return flush_words(as, as->num_words - as->num_words % OUTPUT_CHUNK_WORDS);
+}
+
+/// @brief Makes room for count more words after the held back ones.
+/// @return 0 if successful, 1 if they do not fit in the memory of init_assembler_at or in 4 GiB
+static int reserve_words(Assembler *as, uint32_t count)
+{
+    if (as->words_capacity - as->num_words >= count)
+        return 0;
+
+    if (as->fixed)
+    {
+        fprintf(stderr, "Error: The program does not fit in memory at line %u\n", as->line);
+        return 1;
+    }
+    if (count > UINT32_MAX / 2 - as->num_words || count > UINT32_MAX / 4 - as->count)
     {
-        fprintf(stderr, "Error: Could not open file %s\n", output_filename);
+        fprintf(stderr, "Error: The program is larger than 4 GiB at line %u\n", as->line);
+        return 1;
+    }
+
+    uint32_t capacity = as->words_capacity ? as->words_capacity * 2 : 256;
+    while (capacity - as->num_words < count)
+        capacity *= 2;
+
+    uint32_t *words = realloc(as->words, capacity * sizeof(uint32_t));
+    if (!words)
+    {
+        perror("Failed to allocate memory");
         exit(EXIT_FAILURE);
     }
 
-    uint32_t instruction;
+    as->words = words;
+    as->words_capacity = capacity;
+    return 0;
+}
+
+/// @brief Adds the next word of the program, words are written in chunks of OUTPUT_CHUNK_WORDS.
+/// @return 0 if successful, 1 if the output could not be written
+static int emit_word(Assembler *as, uint32_t word)
+{
+    if (reserve_words(as, 1))
+        return 1;
+
+    as->words[as->num_words++] = word;
+    as->count++;
+    return flush_chunk(as);
+}
+
+/// @brief Adds a byte to the word that is being filled, the first byte is the most significant one like in
+/// guest memory.
+/// @return 0 if successful, 1 otherwise
+static int emit_byte(Assembler *as, uint8_t byte)
+{
+    as->partial |= (uint32_t)byte << (24 - 8 * as->partial_bytes);
+    if (++as->partial_bytes < 4)
+        return 0;
+
+    uint32_t word = as->partial;
+    as->partial = 0;
+    as->partial_bytes = 0;
+    return emit_word(as, word);
+}
+
+/// @brief Adds bytes to the program. The whole words among them are packed and copied a chunk at a time, so
+/// large tables do not go through emit_word one by one.
+/// @param bytes the bytes, or NULL for zeros
+/// @return 0 if successful, 1 otherwise
+static int emit_bytes(Assembler *as, const uint8_t *bytes, size_t len)
+{
+    for (; len > 0 && as->partial_bytes > 0; len--)
+    {
+        if (emit_byte(as, bytes ? *bytes++ : 0))
+            return 1;
+    }
+
+    while (len >= 4)
+    {
+        uint32_t count = len / 4 < OUTPUT_CHUNK_WORDS ? len / 4 : OUTPUT_CHUNK_WORDS;
+        if (reserve_words(as, count))
+            return 1;
+
+        uint32_t *words = as->words + as->num_words;
+        if (bytes)
+        {
+            for (uint32_t n = 0; n < count; n++, bytes += 4)
+                words[n] = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+        }
+        else
+        {
+            memset(words, 0, count * sizeof(uint32_t));
+        }
+
+        as->num_words += count;
+        as->count += count;
+        len -= (size_t)count * 4;
+        if (flush_chunk(as))
+            return 1;
+    }
+
+    for (; len > 0; len--)
+    {
+        if (emit_byte(as, bytes ? *bytes++ : 0))
+            return 1;
+    }
+    return 0;
+}
+
+/// @brief Pads the program with zeros up to a multiple of size bytes from its start.
+/// @return 0 if successful, 1 otherwise
+static int align_to(Assembler *as, uint32_t size)
+{
+    uint64_t offset = (uint64_t)as->count * 4 + as->partial_bytes;
+    return emit_bytes(as, NULL, (size - offset % size) % size);
+}
+
+int resolve_reference(uint32_t origin, FixupKind kind, uint32_t word, uint32_t addr, uint32_t *value)
+{
+    if (kind == FIXUP_WORD)
+    {
+        *value = addr;
+        return 0;
+    }
+    if (kind == FIXUP_JUMP)
+    {
+        *value = addr;
+        return addr > 0x3FFFFFF;
+    }
+    // la loads the address with lui and ori, so the halves are not adjusted for a sign extension
+    if (kind == FIXUP_HI || kind == FIXUP_LO)
+    {
+        *value = kind == FIXUP_HI ? addr >> 16 : addr & 0xFFFF;
+        return 0;
+    }
+
+    // Branch offsets are in words and relative to the instruction after the branch
+    int64_t offset = ((int64_t)addr - (origin + (int64_t)word * 4 + 4)) / 4;
+    *value = (uint32_t)offset & 0xFFFF;
+    return offset < INT16_MIN || offset > INT16_MAX;
+}
+
+/// @brief Fills in a label operand of a node, or records a fixup if the label is not defined yet.
+static int reference_label(Assembler *as, ASTNode *node, const Token *token)
+{
+    FixupKind kind = node->fixup;
+    Symbol *symbol = get_symbol(&as->symbols, token->value, token->len);
+
+    if (!symbol->defined || as->defer_labels)
+    {
+        // the node is emitted as the word after the ones assembled so far
+        add_fixup(&as->symbols, symbol, kind, as->count, as->line);
+        as->unresolved++;
+        return 0;
+    }
+
+    uint32_t value;
+    if (resolve_reference(as->origin, kind, as->count, symbol->addr, &value))
+    {
+        fprintf(stderr, "Error: Label '%.*s' is out of range at line %u\n", (int)token->len, token->value, as->line);
+        return 1;
+    }
+
+    node->value = value;
+    return 0;
+}
+
+/// @brief Gets the address of the next byte that is assembled
+static uint32_t next_address(const Assembler *as)
+{
+    return as->origin + as->count * 4 + as->partial_bytes;
+}
+
+/// @brief Defines a label at the next word and patches the words that referenced it before.
+static int define_label(Assembler *as, const Token *token)
+{
+    // the token includes the colon
+    uint32_t len = token->len - 1;
+    Symbol *symbol = get_symbol(&as->symbols, token->value, len);
+
+    if (symbol->defined)
+    {
+        fprintf(stderr, "Error: Label '%.*s' is defined twice at line %u\n", (int)len, token->value, as->line);
+        return 1;
+    }
+
+    symbol->defined = 1;
+    symbol->addr = next_address(as);
+    symbol->line = as->line;
 
-    for (int i = 0; i < ast->size; i++)
+    // the fixups are patched by assemble_parallel once the address of the chunk is known
+    if (as->defer_labels)
+        return 0;
+
+    for (int32_t n = symbol->fixups; n != -1; n = as->symbols.fixups[n].next)
     {
-        ASTNode node = ast->nodes[i];
-        switch (node.type)
+        const Fixup *fixup = &as->symbols.fixups[n];
+        // words are held back from the first unresolved reference on, so the word is still in memory
+        uint32_t *word = &as->words[fixup->word - as->words_base];
+        uint32_t value;
+
+        if (resolve_reference(as->origin, fixup->kind, fixup->word, symbol->addr, &value))
         {
-            // TODO: have a case for each format type (op rs rs rt vs op rs rt)
-        case NODE_R_TYPE:
-            uint8_t opcode = get_opcode_from_mnemonic(node.data.rtype.op.value);
-            int rd = get_register_number_from_name(node.data.rtype.rd.value);
-            int rs = get_register_number_from_name(node.data.rtype.rs.value);
-            int rt = get_register_number_from_name(node.data.rtype.rt.value);
-            int shamt = 0;
-            int funct = 0;
-            funct = 0x20; // hard coded to add for now
-            // TODO: implement funct
+            fprintf(stderr, "Error: Label '%.*s' is out of range at line %u\n", (int)len, token->value, fixup->line);
+            return 1;
+        }
+
+        *word |= value;
+        as->unresolved--;
+    }
+    symbol->fixups = -1;
+
+    return flush_chunk(as);
+}
+
+/// @brief Checks if a token is the given directive
+static int is_directive(const Token *token, const char *name)
+{
+    return token->type == TOKEN_DIRECTIVE && token->len == strlen(name) && !strncmp(token->value, name, token->len);
+}
+
+/// @brief Checks if a token is a decimal or hexadecimal constant
+static int is_constant(const Token *token)
+{
+    return token->type == TOKEN_DEC_CONST || token->type == TOKEN_HEX_CONST || token->type == TOKEN_ZERO;
+}
 
-            instruction = (opcode << 26) | (rs << 21) | (rt << 16) | (rd << 11) | (shamt << 6) | funct;
+// Largest .align, in powers of 2
+#define MAX_ALIGN 16
+
+/// @brief Assembles the operands of .word, .half or .byte: constants separated by commas, for .word labels too.
+/// Words are stored in place and the line is flushed once, smaller values are packed a buffer at a time.
+/// @param size size of a value in bytes
+/// @return 0 if successful, 1 otherwise
+static int assemble_data(Assembler *as, const Token *directive, uint32_t size, const Token *tokens, int num_tokens,
+                         int *index)
+{
+    uint8_t bytes[256];
+    size_t num_bytes = 0;
+
+    // values are aligned to their size
+    if (align_to(as, size))
+        return 1;
+
+    do
+    {
+        const Token *token = *index < num_tokens ? &tokens[*index] : NULL;
+        int32_t value;
+
+        if (token != NULL && is_constant(token))
+        {
+            value = token->number;
+        }
+        else if (token != NULL && token->type == TOKEN_INSTRUCTION && size == 4)
+        {
+            // the address of a label, a forward reference is patched like the ones of instructions
+            ASTNode node = {.fixup = FIXUP_WORD};
+            if (reference_label(as, &node, token))
+                return 1;
+            value = node.value;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Expected a %s after %.*s at line %u\n", size == 4 ? "constant or label" : "constant",
+                    (int)directive->len, directive->value, as->line);
+            return 1;
+        }
+        (*index)++;
+
+        if (size == 4)
+        {
+            if (reserve_words(as, 1))
+                return 1;
+            as->words[as->num_words++] = value;
+            as->count++;
+            continue;
+        }
+
+        if (value < -(1 << (size * 8 - 1)) || value >= 1 << (size * 8))
+        {
+            fprintf(stderr, "Error: %d does not fit in %.*s at line %u\n", value, (int)directive->len,
+                    directive->value, as->line);
+            return 1;
+        }
+        if (size == 2)
+            bytes[num_bytes++] = value >> 8;
+        bytes[num_bytes++] = value;
+
+        if (num_bytes > sizeof(bytes) - 2)
+        {
+            if (emit_bytes(as, bytes, num_bytes))
+                return 1;
+            num_bytes = 0;
+        }
+    } while (*index < num_tokens && tokens[*index].type == TOKEN_COMMA && ++(*index));
+
+    return emit_bytes(as, bytes, num_bytes) || flush_chunk(as);
+}
+
+/// @brief Gets the byte a character after a backslash stands for
+/// @return The byte, or -1 if the escape is unknown
+static int unescape(char c)
+{
+    switch (c)
+    {
+    case 'n':
+        return '\n';
+    case 't':
+        return '\t';
+    case 'r':
+        return '\r';
+    case '0':
+        return 0;
+    case '\\':
+    case '"':
+        return c;
+    default:
+        return -1;
+    }
+}
+
+/// @brief Assembles the string of .ascii or .asciiz, the escapes \n \t \r \0 \\ and \" stand for one byte.
+/// @param terminate 1 to add a null byte
+/// @return 0 if successful, 1 otherwise
+static int assemble_string(Assembler *as, const Token *directive, int terminate, const Token *tokens, int num_tokens,
+                           int *index)
+{
+    if (*index >= num_tokens || tokens[*index].type != TOKEN_STRING)
+    {
+        fprintf(stderr, "Error: Expected a string after %.*s at line %u\n", (int)directive->len, directive->value,
+                as->line);
+        return 1;
+    }
+
+    // the token includes the quotes, the text between them is copied in runs up to the next escape
+    const Token *string = &tokens[(*index)++];
+    const char *c = string->value + 1, *end = string->value + string->len - 1;
+    while (c < end)
+    {
+        const char *escape = memchr(c, '\\', end - c);
+        const char *run_end = escape ? escape : end;
+        if (emit_bytes(as, (const uint8_t *)c, run_end - c))
+            return 1;
+        if (!escape)
             break;
-        case NODE_I_TYPE:
-            opcode = get_opcode_from_mnemonic(node.data.itype.op.value);
-            rs = get_register_number_from_name(node.data.itype.rs.value);
-            rt = get_register_number_from_name(node.data.itype.rt.value);
-            int immediate = atoi(node.data.itype.immediate.value);
 
-            instruction = (opcode << 26) | (rs << 21) | (rt << 16) | immediate;
+        int byte = unescape(escape[1]);
+        if (byte < 0)
+        {
+            fprintf(stderr, "Error: Unknown escape \\%c at line %u\n", escape[1], as->line);
+            return 1;
+        }
+        if (emit_byte(as, byte))
+            return 1;
+        c = escape + 2;
+    }
+
+    return terminate && emit_byte(as, 0);
+}
+
+/// @brief Reads the constant operand of a directive.
+/// @return 0 if successful, 1 if it is missing or out of [min, max]
+static int directive_operand(Assembler *as, const Token *directive, const Token *tokens, int num_tokens, int *index,
+                             int32_t min, int32_t max, int32_t *value)
+{
+    if (*index >= num_tokens || !is_constant(&tokens[*index]) || tokens[*index].number < min ||
+        tokens[*index].number > max)
+    {
+        fprintf(stderr, "Error: Expected a constant from %d to %d after %.*s at line %u\n", min, max,
+                (int)directive->len, directive->value, as->line);
+        return 1;
+    }
+
+    *value = tokens[(*index)++].number;
+    return 0;
+}
+
+/// @brief Assembles the directive at tokens[*index] and its operands.
+/// @return 0 if successful, 1 otherwise
+static int assemble_directive(Assembler *as, const Token *tokens, int num_tokens, int *index)
+{
+    const Token *directive = &tokens[(*index)++];
+
+    if (is_directive(directive, ".globl") || is_directive(directive, ".global"))
+    {
+        // .globl name[, name...]
+        do
+        {
+            if (*index >= num_tokens || tokens[*index].type != TOKEN_INSTRUCTION)
+            {
+                fprintf(stderr, "Error: Expected a label name after %.*s at line %u\n", (int)directive->len,
+                        directive->value, as->line);
+                return 1;
+            }
+            get_symbol(&as->symbols, tokens[*index].value, tokens[*index].len)->global = 1;
+            (*index)++;
+        } while (*index < num_tokens && tokens[*index].type == TOKEN_COMMA && ++(*index));
+
+        return 0;
+    }
+
+    if (is_directive(directive, ".macro"))
+        return begin_macro(&as->macros, tokens, num_tokens, index, as->line);
+
+    if (is_directive(directive, ".word"))
+        return assemble_data(as, directive, 4, tokens, num_tokens, index);
+    if (is_directive(directive, ".half"))
+        return assemble_data(as, directive, 2, tokens, num_tokens, index);
+    if (is_directive(directive, ".byte"))
+        return assemble_data(as, directive, 1, tokens, num_tokens, index);
+    if (is_directive(directive, ".ascii") || is_directive(directive, ".asciiz"))
+        return assemble_string(as, directive, directive->len == 7, tokens, num_tokens, index);
+
+    int32_t value;
+    if (is_directive(directive, ".space"))
+        return directive_operand(as, directive, tokens, num_tokens, index, 0, INT32_MAX, &value) ||
+               emit_bytes(as, NULL, value);
+    if (is_directive(directive, ".align"))
+        return directive_operand(as, directive, tokens, num_tokens, index, 0, MAX_ALIGN, &value) ||
+               align_to(as, 1u << value);
+
+    if (is_directive(directive, ".text") || is_directive(directive, ".data"))
+    {
+        fprintf(stderr, "Error: %.*s has to start a line at line %u\n", (int)directive->len, directive->value,
+                as->line);
+        return 1;
+    }
+
+    if (is_directive(directive, ".endm"))
+    {
+        fprintf(stderr, "Error: .endm without .macro at line %u\n", as->line);
+        return 1;
+    }
+
+    fprintf(stderr, "Error: Unknown directive %.*s at line %u\n", (int)directive->len, directive->value, as->line);
+    return 1;
+}
+
+static int assemble_tokens(Assembler *as, const TokenList *list, int start, int end, int depth);
+
+/// @brief Gets the alignment of what a token starts: 4 for instructions and .word, 2 for .half, 1 otherwise
+static uint32_t item_alignment(const Token *token)
+{
+    if (token->type == TOKEN_INSTRUCTION || is_directive(token, ".word"))
+        return 4;
+    return is_directive(token, ".half") ? 2 : 1;
+}
+
+/// @brief Assembles the invocation of a macro at tokens[*index]. Its body is expanded at the end of
+/// as->expansion and removed again once it is assembled.
+/// @return 0 if successful, 1 otherwise
+static int assemble_macro(Assembler *as, const Macro *macro, const Token *tokens, int num_tokens, int *index,
+                          int depth)
+{
+    if (depth == MACRO_MAX_DEPTH)
+    {
+        fprintf(stderr, "Error: Macros are invoked more than %d deep at line %u\n", MACRO_MAX_DEPTH, as->line);
+        return 1;
+    }
+
+    int start = as->expansion.size;
+    int status = expand_macro(macro, tokens, num_tokens, index, &as->expansion) ||
+                 assemble_tokens(as, &as->expansion, start, as->expansion.size, depth + 1);
+    as->expansion.size = start;
+    return status;
+}
+
+/// @brief Assembles the labels, directives and statements of the tokens [start, end) of a list.
+/// @param depth number of macro invocations the tokens are expanded from
+/// @return 0 if successful, 1 otherwise
+static int assemble_tokens(Assembler *as, const TokenList *list, int start, int end, int depth)
+{
+    for (int index = 0; index < end - start;)
+    {
+        // a macro invocation can grow the list, so it is read again for every statement
+        const Token *tokens = list->data + start;
+        int num_tokens = end - start;
+
+        if (tokens[index].type == TOKEN_LABEL)
+        {
+            // a label in front of a word or instruction on the same line gets its aligned address
+            if (index + 1 < num_tokens && as->partial_bytes > 0 && align_to(as, item_alignment(&tokens[index + 1])))
+                return 1;
+            if (define_label(as, &tokens[index]))
+                return 1;
+            index++;
+            continue;
+        }
+
+        if (tokens[index].type == TOKEN_DIRECTIVE)
+        {
+            if (assemble_directive(as, tokens, num_tokens, &index))
+                return 1;
+            continue;
+        }
+
+        const Macro *macro = tokens[index].type == TOKEN_INSTRUCTION
+                                 ? find_macro(&as->macros, tokens[index].value, tokens[index].len)
+                                 : NULL;
+        if (macro)
+        {
+            if (assemble_macro(as, macro, tokens, num_tokens, &index, depth))
+                return 1;
+            continue;
+        }
+
+        ASTNode nodes[MAX_STATEMENT_NODES];
+        int num_nodes;
+        if (parse_statement(tokens, num_tokens, &index, nodes, &num_nodes))
+            return 1;
+        if (as->partial_bytes > 0 && align_to(as, 4))
+            return 1;
+
+        // every word is emitted before the next label is referenced, the fixup of a reference is the next word
+        for (int n = 0; n < num_nodes; n++)
+        {
+            if (nodes[n].label >= 0 && reference_label(as, &nodes[n], &tokens[nodes[n].label]))
+                return 1;
+            if (emit_word(as, encode_node(&nodes[n])))
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+/// @brief Adds a line to the body of the macro being defined, or closes it at .endm.
+/// @return 0 if successful, 1 otherwise
+static int define_macro_line(Assembler *as, const char *line)
+{
+    const Token *first = as->tokens.size > 0 ? &as->tokens.data[0] : NULL;
+
+    if (first && is_directive(first, ".endm"))
+        return end_macro(&as->macros) || assemble_tokens(as, &as->tokens, 1, as->tokens.size, 0);
+
+    if (first && is_directive(first, ".macro"))
+    {
+        fprintf(stderr, "Error: .macro inside the macro defined at line %u, at line %u\n",
+                as->macros.macros[as->macros.count - 1].line, as->line);
+        return 1;
+    }
+
+    add_macro_line(&as->macros, line);
+    return 0;
+}
+
+/// @brief Keeps the rest of a line of the data section until the text ends, see finish_source
+static void add_data_line(Assembler *as, const char *text)
+{
+    DataLines *data = &as->data;
+    size_t len = strlen(text) + 1;
+
+    if (data->len + len > data->capacity)
+    {
+        data->capacity = (data->len + len) * 2;
+        data->text = realloc(data->text, data->capacity);
+    }
+    if (data->num_lines == data->lines_capacity)
+    {
+        data->lines_capacity = data->lines_capacity ? data->lines_capacity * 2 : 64;
+        data->lines = realloc(data->lines, data->lines_capacity * sizeof(uint32_t));
+    }
+    if (!data->text || !data->lines)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(data->text + data->len, text, len);
+    data->len += len;
+    data->lines[data->num_lines++] = as->line;
+}
+
+/// @brief Checks if a line starts with .text or .data, without tokenizing it
+static int starts_section(const char *line)
+{
+    while (*line == ' ' || *line == '\t')
+        line++;
+    return (!strncmp(line, ".text", 5) || !strncmp(line, ".data", 5)) && !isalnum((unsigned char)line[5]);
+}
+
+int assemble_line(Assembler *as, const char *line)
+{
+    as->line++;
+
+    // Lines of the data section are tokenized once, when they are assembled after the text
+    if (as->section == SECTION_DATA && !as->macros.open && !starts_section(line))
+    {
+        add_data_line(as, line);
+        return 0;
+    }
+
+    as->tokens.size = 0;
+
+    if (tokenize(line, &as->tokens))
+        return 1;
+
+    if (as->macros.open)
+        return define_macro_line(as, line);
+
+    int first = 0;
+    for (; first < as->tokens.size; first++)
+    {
+        if (is_directive(&as->tokens.data[first], ".text"))
+            as->section = SECTION_TEXT;
+        else if (is_directive(&as->tokens.data[first], ".data"))
+            as->section = SECTION_DATA;
+        else
             break;
-        case NODE_J_TYPE:
-            opcode = get_opcode_from_mnemonic(node.data.jtype.op.value);
-            int address = atoi(node.data.jtype.address.value);
+    }
+
+    if (as->section == SECTION_DATA)
+    {
+        if (first < as->tokens.size)
+            add_data_line(as, as->tokens.data[first].value);
+        return 0;
+    }
+
+    // The tokens point into line, so every statement is encoded before returning
+    uint32_t addr = next_address(as);
+    int status = assemble_tokens(as, &as->tokens, first, as->tokens.size, 0);
+
+    if (as->map && !status && next_address(as) != addr)
+        add_source_line(as->map, addr, as->line);
+    return status;
+}
+
+int finish_source(Assembler *as)
+{
+    if (as->macros.open)
+    {
+        fprintf(stderr, "Error: The macro defined at line %u has no .endm\n",
+                as->macros.macros[as->macros.count - 1].line);
+        return 1;
+    }
+
+    // The data section follows the text from the next word on, its lines are assembled like text lines
+    DataLines data = as->data;
+    as->data = (DataLines){0};
+    as->section = SECTION_TEXT;
+    int status = align_to(as, 4);
+
+    const char *text = data.text;
+    for (uint32_t n = 0; !status && n < data.num_lines; n++)
+    {
+        as->line = data.lines[n] - 1;
+        status = assemble_line(as, text);
+        if (status)
+            fprintf(stderr, "Error: Assembly stopped at line %u\n", as->line);
+        text += strlen(text) + 1;
+    }
+
+    free(data.text);
+    free(data.lines);
+    return status || align_to(as, 4);
+}
+
+int finish_assembly(Assembler *as)
+{
+    if (finish_source(as))
+        return 1;
+
+    if (as->unresolved > 0)
+    {
+        for (uint32_t n = 0; n < as->symbols.capacity; n++)
+        {
+            const Symbol *symbol = &as->symbols.entries[n];
+            // a .globl label that is never used has no fixup and is not an error
+            if (symbol->len != 0 && !symbol->defined && symbol->fixups != -1)
+            {
+                fprintf(stderr, "Error: Label '%.*s' is not defined, used at line %u\n", (int)symbol->len,
+                        symbol_name(&as->symbols, symbol), as->symbols.fixups[symbol->fixups].line);
+            }
+        }
+        return 1;
+    }
+
+    if (as->map)
+        end_source_map(as->map, next_address(as), &as->symbols);
+    return flush_words(as, as->num_words);
+}
+
+void free_assembler(Assembler *as)
+{
+    free_symbols(&as->symbols);
+    free_macros(&as->macros);
+    free_tokens(&as->tokens);
+    free_tokens(&as->expansion);
+    free(as->data.text);
+    free(as->data.lines);
+    if (!as->fixed)
+        free(as->words);
+    *as = (Assembler){0};
+}
+
+int assemble_lines(Assembler *as, FILE *in)
+{
+    char *line = NULL;
+    size_t line_capacity = 0;
+    int status = 0;
+
+    // Statements end at the end of a line, so only the current line and its tokens are held in memory
+    while (!status && getline(&line, &line_capacity, in) != -1)
+    {
+        status = assemble_line(as, line);
+        if (status)
+            fprintf(stderr, "Error: Assembly stopped at line %u\n", as->line);
+    }
 
-            instruction = (opcode << 26) | address;
+    if (!status && ferror(in))
+    {
+        perror("Failed to read input");
+        status = 1;
+    }
+
+    free(line);
+    return status || finish_assembly(as);
+}
+
+int assemble_stream(FILE *in, Output *out)
+{
+    Assembler as;
+    init_assembler(&as, out, out->origin);
+
+    int status = assemble_lines(&as, in);
+
+    free_assembler(&as);
+    return status;
+}
+
+/// @brief Copies the line at start into a null terminated buffer and moves start to the next line.
+/// @return Length of the line, including its newline
+static size_t next_line(const char **start, const char *end, char **line, size_t *capacity)
+{
+    const char *newline = memchr(*start, '\n', end - *start);
+    size_t len = newline ? (size_t)(newline - *start) + 1 : (size_t)(end - *start);
+
+    if (len + 1 > *capacity)
+    {
+        *capacity = (len + 1) * 2;
+        *line = realloc(*line, *capacity);
+        if (!*line)
+        {
+            perror("Failed to allocate memory");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(*line, *start, len);
+    (*line)[len] = '\0';
+    *start += len;
+    return len;
+}
+
+/// @brief Checks if a token is one of the directives in a NULL terminated list
+static int is_any_directive(const Token *token, const char *const *names)
+{
+    for (; *names; names++)
+    {
+        if (is_directive(token, *names))
+            return 1;
+    }
+    return 0;
+}
+
+// Directives that make a text line depend on the lines before it: macros are invoked anywhere after their
+// definition and the data directives below word size lay out bytes across lines
+static const char *const layout_directives[] = {".macro", ".endm",  ".byte",  ".half",
+                                                ".ascii", ".asciiz", ".space", ".align", NULL};
+
+int needs_whole_source(const char *source, size_t len)
+{
+    static const char *const directives[] = {".data",  ".macro",  ".endm",  ".byte",  ".half",
+                                             ".ascii", ".asciiz", ".space", ".align", NULL};
+    TokenList tokens = {0};
+    char *line = NULL;
+    size_t capacity = 0;
+    int whole = 0;
+
+    for (const char *start = source, *end = source + len; !whole && start < end;)
+    {
+        // only lines with a dot can hold a directive, comments and strings are told apart by the tokenizer
+        size_t line_len = next_line(&start, end, &line, &capacity);
+        if (!memchr(line, '.', line_len))
+            continue;
+
+        tokens.size = 0;
+        // a line that does not tokenize is reported by the assembly
+        whole = tokenize(line, &tokens) != 0;
+        for (int n = 0; !whole && n < tokens.size; n++)
+            whole = is_any_directive(&tokens.data[n], directives);
+    }
+
+    free(line);
+    free_tokens(&tokens);
+    return whole;
+}
+
+/// @brief Where a chunk of assemble_parallel ends when it starts in a section, see scan_line
+typedef struct
+{
+    uint8_t section;
+    // the chunk has to be assembled after the lines before it, so the source is assembled serially
+    uint8_t serial;
+} ChunkScan;
+
+/// @brief Part of a source assembled by one thread of assemble_parallel
+typedef struct
+{
+    const char *start;
+    const char *end;
+    // number of lines before the chunk
+    uint32_t first_line;
+    // section of the first line, and the scan of the chunk for each section it can start in
+    uint8_t section;
+    ChunkScan scans[2];
+    // number of the first word of the chunk in the program
+    uint32_t base;
+    Assembler as;
+    int status;
+
+    // labels of the whole program, read only while the chunks are patched
+    Assembler *program;
+    // where the words of the chunk go in the program
+    uint32_t *dest;
+} Chunk;
+
+/// @brief Chunks shared by the threads of assemble_parallel, each thread takes the next chunk until none is left
+typedef struct
+{
+    Chunk *chunks;
+    int num_chunks;
+    int next;
+} ChunkQueue;
+
+/// @brief Assembles the lines between start and end, every line is copied to be null terminated.
+/// @return 0 if successful, 1 otherwise
+static int assemble_range(Assembler *as, const char *start, const char *end)
+{
+    char *line = NULL;
+    size_t line_capacity = 0;
+    int status = 0;
+
+    while (!status && start < end)
+    {
+        next_line(&start, end, &line, &line_capacity);
+        status = assemble_line(as, line);
+        if (status)
+            fprintf(stderr, "Error: Assembly stopped at line %u\n", as->line);
+    }
+
+    free(line);
+    return status;
+}
+
+/// @brief Follows the sections of a tokenized line like assemble_line does, and checks that a text line does
+/// not depend on the lines before it. Lines of the data section are assembled after the text, in order, like
+/// finish_source does, so they can hold any directive.
+static void scan_line(ChunkScan *scan, const char *line, const TokenList *tokens)
+{
+    if (scan->section == SECTION_DATA && !starts_section(line))
+        return;
+
+    int n = 0;
+    for (; n < tokens->size; n++)
+    {
+        if (is_directive(&tokens->data[n], ".text"))
+            scan->section = SECTION_TEXT;
+        else if (is_directive(&tokens->data[n], ".data"))
+            scan->section = SECTION_DATA;
+        else
             break;
+    }
+
+    for (; scan->section == SECTION_TEXT && n < tokens->size; n++)
+    {
+        if (is_any_directive(&tokens->data[n], layout_directives))
+            scan->serial = 1;
+    }
+}
+
+/// @brief Counts the lines of a chunk so it can report errors at the line numbers of the whole source, and
+/// follows its sections from both sections it can start in, which are only known once every chunk is scanned
+static void scan_chunk(Chunk *chunk)
+{
+    TokenList tokens = {0};
+    char *line = NULL;
+    size_t capacity = 0;
+
+    chunk->scans[SECTION_TEXT] = (ChunkScan){.section = SECTION_TEXT};
+    chunk->scans[SECTION_DATA] = (ChunkScan){.section = SECTION_DATA};
+
+    for (const char *start = chunk->start; start < chunk->end;)
+    {
+        const char *newline = memchr(start, '\n', chunk->end - start);
+        chunk->first_line += newline != NULL;
+
+        // lines without a dot have no directive, which leaves the section and the layout as they are
+        const char *line_end = newline ? newline + 1 : chunk->end;
+        if (!memchr(start, '.', line_end - start))
+        {
+            start = line_end;
+            continue;
         }
 
-        write_binary(file, instruction);
+        next_line(&start, chunk->end, &line, &capacity);
+        tokens.size = 0;
+        if (tokenize(line, &tokens))
+        {
+            // the error is reported by the serial assembly
+            chunk->scans[SECTION_TEXT].serial = chunk->scans[SECTION_DATA].serial = 1;
+            continue;
+        }
+        scan_line(&chunk->scans[SECTION_TEXT], line, &tokens);
+        scan_line(&chunk->scans[SECTION_DATA], line, &tokens);
     }
-    fclose(file);
+
+    free(line);
+    free_tokens(&tokens);
+}
+
+/// @brief Assembles a chunk on its own, the address of each label is relative to the start of the chunk.
+/// The lines of the data section are kept in chunk->as.data for the data chunk, see assemble_parallel.
+static void assemble_chunk(Chunk *chunk)
+{
+    init_assembler(&chunk->as, NULL, 0);
+    chunk->as.defer_labels = 1;
+    chunk->as.line = chunk->first_line;
+    chunk->as.section = chunk->section;
+    chunk->status = assemble_range(&chunk->as, chunk->start, chunk->end);
+}
+
+/// @brief Patches the label references of a chunk and copies its words to their place in the program
+static void patch_chunk(Chunk *chunk)
+{
+    SymbolTable *symbols = &chunk->as.symbols;
+
+    for (uint32_t n = 0; n < symbols->capacity; n++)
+    {
+        const Symbol *symbol = &symbols->entries[n];
+        if (symbol->len == 0 || symbol->fixups == -1)
+            continue;
+
+        const char *name = symbol_name(symbols, symbol);
+        const Symbol *label = find_symbol(&chunk->program->symbols, name, symbol->len);
+
+        for (int32_t f = symbol->fixups; f != -1; f = symbols->fixups[f].next)
+        {
+            const Fixup *fixup = &symbols->fixups[f];
+            uint32_t value;
+
+            if (resolve_reference(chunk->program->origin, fixup->kind, chunk->base + fixup->word, label->addr, &value))
+            {
+                fprintf(stderr, "Error: Label '%.*s' is out of range at line %u\n", (int)symbol->len, name,
+                        fixup->line);
+                chunk->status = 1;
+            }
+            chunk->as.words[fixup->word] |= value;
+        }
+    }
+
+    // a chunk of data lines has no words of its own
+    if (chunk->as.count)
+        memcpy(chunk->dest, chunk->as.words, chunk->as.count * sizeof(uint32_t));
+}
+
+typedef struct
+{
+    ChunkQueue *queue;
+    void (*work)(Chunk *);
+} Worker;
+
+static void *run_worker(void *arg)
+{
+    Worker *worker = arg;
+    ChunkQueue *queue = worker->queue;
+
+    for (int n; (n = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->num_chunks;)
+        worker->work(&queue->chunks[n]);
+
+    return NULL;
+}
+
+/// @brief Runs work on every chunk with a pool of threads and waits until all chunks are done
+static void run_pool(ChunkQueue *queue, int threads, void (*work)(Chunk *))
+{
+    Worker worker = {.queue = queue, .work = work};
+    pthread_t *pool = malloc(threads * sizeof(pthread_t));
+    int started = 0;
+
+    queue->next = 0;
+    // the calling thread works too, and does all the work if no thread can be started
+    while (started < threads - 1 && pool && pthread_create(&pool[started], NULL, run_worker, &worker) == 0)
+        started++;
+    run_worker(&worker);
+
+    for (int n = 0; n < started; n++)
+        pthread_join(pool[n], NULL);
+    free(pool);
+}
+
+/// @brief Enters the labels of the chunks in the program and checks every referenced label is defined.
+/// Chunks are visited in order, so a label defined twice is reported at its second definition.
+/// @return 0 if successful, 1 otherwise
+static int merge_labels(Assembler *program, Chunk *chunks, int num_chunks)
+{
+    int status = 0;
+
+    for (int c = 0; c < num_chunks; c++)
+    {
+        const SymbolTable *symbols = &chunks[c].as.symbols;
+        for (uint32_t n = 0; n < symbols->capacity; n++)
+        {
+            const Symbol *symbol = &symbols->entries[n];
+            if (symbol->len == 0 || !symbol->defined)
+                continue;
+
+            Symbol *label = get_symbol(&program->symbols, symbol_name(symbols, symbol), symbol->len);
+            if (label->defined)
+            {
+                fprintf(stderr, "Error: Label '%.*s' is defined twice at line %u\n", (int)symbol->len,
+                        symbol_name(symbols, symbol), symbol->line);
+                status = 1;
+            }
+
+            label->defined = 1;
+            label->addr = program->origin + chunks[c].base * 4 + symbol->addr;
+            label->line = symbol->line;
+        }
+    }
+
+    for (int c = 0; c < num_chunks; c++)
+    {
+        const SymbolTable *symbols = &chunks[c].as.symbols;
+        for (uint32_t n = 0; n < symbols->capacity; n++)
+        {
+            const Symbol *symbol = &symbols->entries[n];
+            if (symbol->len == 0 || symbol->fixups == -1)
+                continue;
+
+            // undefined labels are entered as well, so each one is reported once
+            Symbol *label = get_symbol(&program->symbols, symbol_name(symbols, symbol), symbol->len);
+            if (!label->defined && label->fixups == -1)
+            {
+                fprintf(stderr, "Error: Label '%.*s' is not defined, used at line %u\n", (int)symbol->len,
+                        symbol_name(symbols, symbol), symbols->fixups[symbol->fixups].line);
+                label->fixups = 0;
+                status = 1;
+            }
+        }
+    }
+
+    return status;
+}
+
+/// @brief Splits a source into chunks that end after the newline following an even share of the source, and
+/// scans them on threads.
+/// @return 1 if the chunks can be assembled on their own, 0 if the source has to be assembled serially
+static int plan_chunks(ChunkQueue *queue, Assembler *program, const char *source, size_t len, int threads)
+{
+    int num_chunks = threads > 1 ? threads * 4 : 1;
+    if ((size_t)num_chunks > len / PARALLEL_MIN_CHUNK)
+        num_chunks = len / PARALLEL_MIN_CHUNK;
+    if (num_chunks <= 1)
+        return 0;
+
+    // one more for the lines of the data section
+    *queue = (ChunkQueue){.chunks = calloc(num_chunks + 1, sizeof(Chunk))};
+    if (!queue->chunks)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    const char *start = source, *end = source + len;
+    for (int n = 1; n <= num_chunks && start < end; n++)
+    {
+        const char *split = n == num_chunks ? end : source + len / num_chunks * n;
+        if (split < start)
+            split = start;
+
+        const char *newline = memchr(split, '\n', end - split);
+        split = newline ? newline + 1 : end;
+
+        queue->chunks[queue->num_chunks++] = (Chunk){.start = start, .end = split, .program = program};
+        start = split;
+    }
+
+    // The section of each chunk follows from the chunks before it
+    run_pool(queue, threads, scan_chunk);
+    uint32_t lines = 0;
+    uint8_t section = SECTION_TEXT;
+    int serial = 0;
+    for (int n = 0; n < queue->num_chunks; n++)
+    {
+        Chunk *chunk = &queue->chunks[n];
+        uint32_t chunk_lines = chunk->first_line;
+        chunk->first_line = lines;
+        lines += chunk_lines;
+
+        chunk->section = section;
+        serial |= chunk->scans[section].serial;
+        section = chunk->scans[section].section;
+    }
+
+    return !serial;
+}
+
+int count_parallel_chunks(const char *source, size_t len, int threads)
+{
+    ChunkQueue queue = {0};
+    int num_chunks = plan_chunks(&queue, NULL, source, len, threads) ? queue.num_chunks : 1;
+    free(queue.chunks);
+    return num_chunks;
+}
+
+/// @brief Assembles the lines of the data section of every chunk, in order and after the text like
+/// finish_source, as one more chunk.
+static void assemble_data_chunk(ChunkQueue *queue)
+{
+    Chunk *data = &queue->chunks[queue->num_chunks];
+    *data = (Chunk){.program = queue->chunks[0].program};
+    init_assembler(&data->as, NULL, 0);
+    data->as.defer_labels = 1;
+
+    for (int n = 0; n < queue->num_chunks; n++)
+    {
+        const DataLines *lines = &queue->chunks[n].as.data;
+        const char *text = lines->text;
+        for (uint32_t i = 0; i < lines->num_lines; i++)
+        {
+            data->as.line = lines->lines[i];
+            add_data_line(&data->as, text);
+            text += strlen(text) + 1;
+        }
+    }
+
+    data->status = finish_source(&data->as);
+    queue->num_chunks++;
+}
+
+int assemble_parallel(const char *source, size_t len, Output *out, int threads)
+{
+    Assembler program;
+    init_assembler(&program, out, out->origin);
+
+    // chunks cannot expand the macros of other chunks or continue their bytes
+    ChunkQueue queue = {0};
+    if (!plan_chunks(&queue, &program, source, len, threads))
+    {
+        free(queue.chunks);
+        int status = assemble_range(&program, source, source + len) || finish_assembly(&program);
+        free_assembler(&program);
+        return status;
+    }
+
+    run_pool(&queue, threads, assemble_chunk);
+    int status = 0;
+    for (int n = 0; n < queue.num_chunks; n++)
+        status |= queue.chunks[n].status;
+    if (!status)
+    {
+        assemble_data_chunk(&queue);
+        status = queue.chunks[queue.num_chunks - 1].status;
+    }
+
+    uint32_t count = 0;
+    for (int n = 0; n < queue.num_chunks; n++)
+    {
+        queue.chunks[n].base = count;
+        count += queue.chunks[n].as.count;
+    }
+
+    if (!status)
+        status = merge_labels(&program, queue.chunks, queue.num_chunks);
+
+    uint32_t *words = NULL;
+    if (!status)
+    {
+        words = malloc((size_t)count * sizeof(uint32_t) + 1);
+        if (!words)
+        {
+            perror("Failed to allocate memory");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int n = 0; n < queue.num_chunks; n++)
+            queue.chunks[n].dest = words + queue.chunks[n].base;
+        run_pool(&queue, threads, patch_chunk);
+        for (int n = 0; n < queue.num_chunks; n++)
+            status |= queue.chunks[n].status;
+    }
+
+    // Written in the chunks of assemble_stream so the output is the same
+    for (uint32_t n = 0; !status && n < count; n += OUTPUT_CHUNK_WORDS)
+        status = write_output(out, words + n, count - n < OUTPUT_CHUNK_WORDS ? count - n : OUTPUT_CHUNK_WORDS);
+
+    for (int n = 0; n < queue.num_chunks; n++)
+        free_assembler(&queue.chunks[n].as);
+    free(queue.chunks);
+    free(words);
+    free_assembler(&program);
+    return status;
 }
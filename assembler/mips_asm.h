@@ -4,16 +4,179 @@
 #include <stdint.h>
 #include <arpa/inet.h>
 
-
 #include "tokenizer.h"
 #include "parser.h"
+#include "symbols.h"
+#include "macros.h"
+#include "srcmap.h"
+#include "output.h"
 #include "../utils.h"
 
+// Smallest part of a source given to a thread by assemble_parallel, smaller sources are assembled serially
+#define PARALLEL_MIN_CHUNK (256 * 1024)
+
 /// @brief Reads the contents of a file into a buffer.
 /// @param filename
 /// @return
 char *read_file(const char *filename);
 
-/// @brief Generates the MIPS assembly code and writes it to a file.
-/// @param output_filename
-void generate_code(AST *ast, const char *output_filename);
\ No newline at end of file
+/// @brief Encodes an AST node into an instruction word.
+/// @param node
+/// @return
+uint32_t encode_node(const ASTNode *node);
+
+/// @brief Computes the field of a label reference.
+/// @param origin address the program is loaded at
+/// @param kind
+/// @param word number of the word that holds the reference
+/// @param addr address of the label
+/// @param value the 16 bit branch offset, the 26 bit jump target, the address or one of its halves
+/// @return 0 if successful, 1 if the label is out of range
+int resolve_reference(uint32_t origin, FixupKind kind, uint32_t word, uint32_t addr, uint32_t *value);
+
+/// @brief Section the lines of a source are assembled into
+typedef enum
+{
+    SECTION_TEXT,
+    // lines after .data, they are assembled after the text so the data follows the code
+    SECTION_DATA
+} Section;
+
+/// @brief Lines of the data section, held until the text ends, see finish_source
+typedef struct
+{
+    // the lines back to back, each one null terminated
+    char *text;
+    size_t len;
+    size_t capacity;
+    // source line number of each line
+    uint32_t *lines;
+    uint32_t num_lines;
+    uint32_t lines_capacity;
+} DataLines;
+
+/// @brief State of an assembly in progress, see init_assembler.
+/// Words are written in chunks of OUTPUT_CHUNK_WORDS. While a label is referenced before it is defined, the words
+/// from the first such reference on are held back until every pending reference is patched.
+typedef struct
+{
+    // output file, NULL keeps every word in words
+    Output *out;
+    // address the program is loaded at, labels are addresses relative to it
+    uint32_t origin;
+    // number of words assembled so far
+    uint32_t count;
+    // number of the line being assembled, for error messages
+    uint32_t line;
+
+    SymbolTable symbols;
+    MacroTable macros;
+    // tokens of the current line
+    TokenList tokens;
+    // bodies of the macro invocations being assembled, a nested invocation is expanded after its caller
+    TokenList expansion;
+
+    // words not written to out yet, words[0] is word number words_base
+    uint32_t *words;
+    uint32_t words_base;
+    uint32_t num_words;
+    uint32_t words_capacity;
+    // number of references to labels that are not defined yet
+    uint32_t unresolved;
+
+    // bytes of a word that .byte, .half, .ascii or .space started, from the most significant one on
+    uint32_t partial;
+    uint8_t partial_bytes;
+    // Section of the current line
+    uint8_t section;
+    DataLines data;
+
+    // if set, the source line of every assembled line is added to it and finish_assembly ends it with the
+    // labels, the parallel and incremental assemblies do not fill it
+    SourceMap *map;
+
+    // words is memory of the caller with room for words_capacity words, see init_assembler_at
+    uint8_t fixed;
+    // labels are only recorded and every reference is left as a fixup, see assemble_parallel
+    uint8_t defer_labels;
+} Assembler;
+
+/// @brief Starts an assembly.
+/// @param as
+/// @param out output the words are written to, or NULL to keep them in as->words
+/// @param origin address the program is loaded at
+void init_assembler(Assembler *as, Output *out, uint32_t origin);
+
+/// @brief Starts an assembly straight into memory of the caller. Words are stored as host integers, the
+/// way the emulator memory holds them, and the assembly fails if they do not fit.
+/// @param as
+/// @param mem where the first word is stored
+/// @param size number of words mem has room for
+/// @param origin address of mem[0]
+void init_assembler_at(Assembler *as, uint32_t *mem, uint32_t size, uint32_t origin);
+
+/// @brief Assembles the statements and label definitions of a line. The line does not have to outlive the call.
+/// Lines between .macro and .endm are kept as the body of the macro, which is assembled where it is invoked.
+/// .text and .data at the start of a line select the section of the rest of the line and the lines after it.
+/// @param as
+/// @param line
+/// @return 0 if successful, 1 otherwise
+int assemble_line(Assembler *as, const char *line);
+
+/// @brief Ends the lines of a source: checks that the last macro definition was closed, assembles the lines of
+/// the data section after the text and pads the last word. finish_assembly calls it.
+/// @param as
+/// @return 0 if successful, 1 otherwise
+int finish_source(Assembler *as);
+
+/// @brief Checks that every referenced label was defined and writes the remaining words.
+/// The output is not closed.
+/// @param as
+/// @return 0 if successful, 1 otherwise
+int finish_assembly(Assembler *as);
+
+/// @brief Frees the memory of an assembly.
+/// @param as
+void free_assembler(Assembler *as);
+
+/// @brief Assembles the lines of a stream and finishes the assembly, see finish_assembly.
+/// @param as
+/// @param in
+/// @return 0 if successful, 1 otherwise
+int assemble_lines(Assembler *as, FILE *in);
+
+/// @brief Assembles a source one line at a time and writes the words in chunks as soon as they are final.
+/// Works on any stream, including stdin and named pipes, the memory used only grows with the number of
+/// labels and the words following a forward reference.
+/// @param in
+/// @param out output opened at the address the program is loaded at, it is not closed
+/// @return 0 if successful, 1 otherwise
+int assemble_stream(FILE *in, Output *out);
+
+/// @brief Checks if a source has to be assembled from the start: a macro can be invoked anywhere after its
+/// definition, the data directives below word size lay out bytes across lines and .data lines move after the text.
+/// Only directive tokens count, a directive inside a comment or a string does not.
+/// @param source
+/// @param len
+/// @return 1 if the source has one of the directives .macro, .data, .byte, .half, .ascii, .asciiz, .space or .align
+int needs_whole_source(const char *source, size_t len);
+
+/// @brief Assembles a source held in memory on several threads. The source is split at line boundaries into
+/// chunks that are tokenized, parsed and encoded independently, then the labels of all chunks are merged, the
+/// references between chunks are patched and the words are written in order. The lines of the .data sections of
+/// all chunks are assembled after the text as one more chunk. The output is byte identical to assemble_stream,
+/// errors are reported for the first failing line of each chunk. A source whose text section has .macro or a data
+/// directive below word size is assembled on the calling thread.
+/// @param source
+/// @param len length of the source, it does not have to be null terminated
+/// @param out output opened at the address the program is loaded at, it is not closed
+/// @param threads number of threads to use, including the calling one
+/// @return 0 if successful, 1 otherwise
+int assemble_parallel(const char *source, size_t len, Output *out, int threads);
+
+/// @brief Counts the chunks assemble_parallel splits a source into, without assembling it
+/// @param source
+/// @param len
+/// @param threads
+/// @return number of chunks, 1 if the source is assembled on the calling thread
+int count_parallel_chunks(const char *source, size_t len, int threads);
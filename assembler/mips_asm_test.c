@@ -1,5 +1,12 @@
+// fmemopen
+#define _POSIX_C_SOURCE 200809L
+
 #include "../minunit.h"
 #include "mips_asm.h"
+#include "incremental.h"
+#include "object.h"
+
+#include <unistd.h>
 
 // Function prototypes
 void token_add_instr_rg_off_rg(Token tokens[], int *count, char *instr, char *reg1, char *offset, char *reg2);
@@ -7,6 +14,12 @@ void token_add_instr_rg_rg_rg(Token tokens[], int *count, char *instr, char *reg
 void token_add_instr_rg_rg_const(Token tokens[], int *count, char *instr, char *reg1, char *reg2, char *const_val);
 void token_add_instr_const(Token tokens[], int *count, char *instr, char *const_val);
 void token_add_directive_no_arg(Token tokens[], int *count, char *direc);
+size_t read_output(void *buf, size_t size);
+int output_matches(const char *code, uint32_t origin);
+int parallel_matches(const char *code, size_t len);
+
+// File the output tests write to
+#define OUTPUT_FILE "asmtest.bin"
 
 // ********* function tests ********* //
 
@@ -23,12 +36,11 @@ MU_TEST(test_add_asm)
                  "#ignore my comment again\n"
                  "beq $t0, $t3, 9\n";
 
-    Token tokens[MAX_TOKENS];
-    int token_count = 0;
+    TokenList list = {0};
+    tokenize(code, &list);
+    Token *tokens = list.data;
 
-    tokenize(code, tokens, &token_count);
-
-    mu_assert(token_count == 43, "Token count wrong");
+    mu_assert(list.size == 43, "Token count wrong");
 
     Token correct_tokens[43];
     int count = 0;
@@ -42,28 +54,884 @@ MU_TEST(test_add_asm)
     token_add_instr_rg_off_rg(correct_tokens, &count, "lw", "$t3", "0X38", "$zero");
     token_add_instr_rg_rg_const(correct_tokens, &count, "beq", "$t0", "$t3", "9");
 
-    char error_msg[50];
+    char error_msg[64];
 
     for (size_t i = 0; i < 40; i++)
     {
         TokenType type = tokens[i].type;
-        char *value = tokens[i].value;
+        const char *value = tokens[i].value;
+        int len = tokens[i].len;
 
         TokenType cor_type = correct_tokens[i].type;
-        char *cor_value = correct_tokens[i].value;
+        const char *cor_value = correct_tokens[i].value;
 
         // Currently returning struct integer rather than string
         sprintf(error_msg, "Type error at token %ld: %d, should be: %d", i, type, cor_type);
         mu_assert(cor_type == type, error_msg);
 
-        sprintf(error_msg, "Value error at token %ld: %s, should be: %s", i, value, cor_value);
-        mu_assert(!strcmp(cor_value, value), error_msg);
+        // Tokens are views into the source, so they are not null terminated
+        sprintf(error_msg, "Value error at token %ld: %.*s, should be: %s", i, len, value, cor_value);
+        mu_assert(strlen(cor_value) == (size_t)len && !strncmp(cor_value, value, len), error_msg);
+    }
+
+    free_tokens(&list);
+}
+
+MU_TEST(test_token_values)
+{
+    char *code = "lw $t1, -8($sp)\n"
+                 "jal 0xFFFFFFFF\n"
+                 "addi $8, $0, 0x7fff";
+
+    TokenList list = {0};
+    mu_assert(tokenize(code, &list) == 0, "Tokenize failed");
+    mu_assert_int_eq(15, list.size);
+    Token *tokens = list.data;
+
+    // Tokens point into the source instead of copies of it
+    mu_check(tokens[0].value == code);
+    mu_check(tokens[3].value == code + 8);
+    mu_assert_int_eq(2, tokens[3].len);
+
+    // Registers and constants are parsed while lexing
+    mu_assert_int_eq(9, tokens[1].number);
+    mu_assert_int_eq(-8, tokens[3].number);
+    mu_assert_int_eq(29, tokens[5].number);
+    mu_assert_int_eq(-1, tokens[8].number);
+    mu_assert_int_eq(8, tokens[10].number);
+    mu_assert_int_eq(0, tokens[12].number);
+    mu_assert_int_eq(0x7fff, tokens[14].number);
+
+    // Constants that do not fit in 32 bits are rejected
+    mu_check(tokenize("jal 0x100000000\n", &list) == 1);
+    mu_check(tokenize("addi $t0, $t0, -2147483649\n", &list) == 1);
+
+    free_tokens(&list);
+}
+
+/// @brief Tokenizes a copy of text with the SIMD and the scalar scanners. The copy starts offset bytes into its
+/// allocation and ends it, so a scan past the null terminator is caught by sanitizers.
+/// @return 1 if both give the same tokens, 0 otherwise
+static int scans_match(const char *text, size_t offset)
+{
+    size_t len = strlen(text) + 1;
+    char *buf = malloc(offset + len);
+    char *copy = memcpy(buf + offset, text, len);
+    TokenList simd = {0}, scalar = {0};
+
+    set_simd_scan(1);
+    int simd_status = tokenize(copy, &simd);
+    set_simd_scan(0);
+    int scalar_status = tokenize(copy, &scalar);
+    set_simd_scan(1);
+
+    int match = simd_status == scalar_status && simd.size == scalar.size;
+    for (int i = 0; match && i < simd.size; i++)
+        match = simd.data[i].type == scalar.data[i].type && simd.data[i].len == scalar.data[i].len &&
+                simd.data[i].value == scalar.data[i].value;
+
+    free_tokens(&simd);
+    free_tokens(&scalar);
+    free(buf);
+    return match;
+}
+
+MU_TEST(test_simd_scan)
+{
+    // every kind of whitespace, in runs longer than a 32 byte block
+    static const char spaces[] = " \t\r\v\f";
+    char text[640];
+    int mismatches = 0;
+
+    for (int run = 0; run <= 100; run++)
+    {
+        char blank[128];
+        for (int i = 0; i < run; i++)
+            blank[i] = spaces[i % 5];
+        blank[run] = '\0';
+
+        for (size_t offset = 0; offset < 64; offset += 3)
+        {
+            // blanks between tokens, at the start and at the end of the input
+            snprintf(text, sizeof(text), "%saddu%s$t0,%s$t1,$t2%s", blank, blank, blank, blank);
+            mismatches += !scans_match(text, offset);
+
+            // comments that cross block boundaries, with and without a newline at their end
+            snprintf(text, sizeof(text), "lw $t1, 4($t2)%s# comment%s#\n%ssyscall #%s", blank, blank, blank, blank);
+            mismatches += !scans_match(text, offset);
+
+            // blank lines
+            snprintf(text, sizeof(text), "%s\n%s\n\n%s# x\nsyscall\n%s", blank, blank, blank, blank);
+            mismatches += !scans_match(text, offset);
+        }
+    }
+
+    mu_assert_int_eq(0, mismatches);
+}
+
+MU_TEST(test_generate_code)
+{
+    char *code = "addi $sp, $sp, -4\n"
+                 "mfc0 $t0, $14\n"
+                 "sll $t1, $t2, 4\n"
+                 "syscall\n"
+                 "lw $t1, -8($sp)\n"
+                 "jal 0x40\n";
+    uint32_t expected[] = {0x23bdfffc, 0x40087000, 0x000a4900, 0x0000000c, 0x8fa9fff8, 0x0c000040};
+
+    // Without an output file the words are kept in memory
+    Assembler as;
+    init_assembler(&as, NULL, 0);
+    mu_assert(assemble_line(&as, code) == 0, "Assembly failed");
+    mu_assert(finish_assembly(&as) == 0, "Assembly failed");
+
+    mu_assert_int_eq(6, as.num_words);
+    for (size_t i = 0; i < as.num_words; i++)
+        mu_assert_int_eq(expected[i], as.words[i]);
+
+    free_assembler(&as);
+}
+
+MU_TEST(test_labels)
+{
+    // Backward and forward branches, a jump to a later label and labels on their own line
+    char *code = "start: addi $t0, $zero, 3\n"
+                 "loop:\n"
+                 "addi $t0, $t0, -1\n"
+                 "beq $t0, $zero, done\n"
+                 "bne $t0, $zero, loop\n"
+                 "j end\n"
+                 "done: jal start\n"
+                 "end: syscall\n";
+    uint32_t expected[] = {
+        0x20080003, // addi $t0, $zero, 3
+        0x2108ffff, // addi $t0, $t0, -1
+        0x31000002, // beq $t0, $zero, 2
+        0x1500fffd, // bne $t0, $zero, -3
+        0x08000118, // j 0x118
+        0x0c000100, // jal 0x100
+        0x0000000c, // syscall
+    };
+
+    Assembler as;
+    init_assembler(&as, NULL, 0x100);
+    mu_assert(assemble_line(&as, code) == 0, "Assembly failed");
+    mu_assert(finish_assembly(&as) == 0, "Assembly failed");
+
+    mu_assert_int_eq(7, as.num_words);
+    for (size_t i = 0; i < as.num_words; i++)
+        mu_assert_int_eq(expected[i], as.words[i]);
+
+    Symbol *symbol = find_symbol(&as.symbols, "done", 4);
+    mu_check(symbol != NULL && symbol->defined);
+    mu_assert_int_eq(0x114, symbol->addr);
+    mu_check(find_symbol(&as.symbols, "missing", 7) == NULL);
+    free_assembler(&as);
+
+    // Words are held back until the forward reference in them is patched
+    Output out;
+    uint32_t written[4];
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_RAW, 0) == 0, "Could not open output");
+    init_assembler(&as, &out, 0);
+    mu_assert(assemble_line(&as, "syscall\nbeq $t0, $t1, skip\nsyscall\n") == 0, "Assembly failed");
+    mu_assert_int_eq(1, as.unresolved);
+    mu_assert(assemble_line(&as, "skip: syscall\n") == 0, "Assembly failed");
+    mu_assert_int_eq(0, as.unresolved);
+    mu_assert(finish_assembly(&as) == 0, "Assembly failed");
+    free_assembler(&as);
+    mu_assert_int_eq(0, close_output(&out));
+    mu_assert_int_eq(16, read_output(written, sizeof(written)));
+    mu_assert_int_eq(0x31090001, ntohl(written[1]));
+    remove(OUTPUT_FILE);
+
+    // Undefined and duplicate labels are errors
+    init_assembler(&as, NULL, 0);
+    mu_assert(assemble_line(&as, "j nowhere\n") == 0, "Assembly failed");
+    mu_check(finish_assembly(&as) == 1);
+    free_assembler(&as);
+
+    // a .globl label that is only declared has no use to report
+    init_assembler(&as, NULL, 0);
+    mu_assert(assemble_line(&as, ".globl ext\nj missing\nadd $t0, $t1, $t2\n") == 0, "Assembly failed");
+    mu_check(finish_assembly(&as) == 1);
+    free_assembler(&as);
+
+    init_assembler(&as, NULL, 0);
+    mu_check(assemble_line(&as, "a: syscall\na: syscall\n") == 1);
+    free_assembler(&as);
+}
+
+MU_TEST(test_many_labels)
+{
+    // Enough labels to grow the symbol table several times, each branch refers to the label after it
+    Assembler as;
+    char line[64];
+    const int labels = 1000;
+
+    init_assembler(&as, NULL, 0);
+    for (int i = 0; i < labels; i++)
+    {
+        sprintf(line, "label_%d: bne $t0, $zero, label_%d\n", i, i + 1);
+        mu_assert(assemble_line(&as, line) == 0, "Assembly failed");
+    }
+    sprintf(line, "label_%d: syscall\n", labels);
+    mu_assert(assemble_line(&as, line) == 0, "Assembly failed");
+    mu_assert(finish_assembly(&as) == 0, "Assembly failed");
+
+    mu_assert_int_eq(labels + 1, as.symbols.count);
+    for (int i = 0; i < labels; i++)
+        mu_assert_int_eq(0x15000000, as.words[i]);
+
+    free_assembler(&as);
+}
+
+MU_TEST(test_assemble_stream)
+{
+    // The last line has no newline, a line is indented and a comment follows an instruction
+    char code[] = "addi $sp, $sp, -4\n"
+                  "\n"
+                  "mfc0 $t0, $14 # epc\n"
+                  "sll $t1, $t2, 4\n"
+                  "    syscall\n"
+                  "lw $t1, -8($sp)\n"
+                  "jal 0x40";
+    uint32_t expected[] = {0x23bdfffc, 0x40087000, 0x000a4900, 0x0000000c, 0x8fa9fff8, 0x0c000040};
+
+    FILE *in = fmemopen(code, strlen(code), "r");
+    Output out;
+    mu_assert(in != NULL, "Could not open stream");
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_RAW, 0) == 0, "Could not open output");
+    mu_assert_int_eq(0, assemble_stream(in, &out));
+    mu_assert_int_eq(0, close_output(&out));
+    fclose(in);
+
+    uint32_t words[8];
+    size_t count = read_output(words, sizeof(words)) / sizeof(uint32_t);
+
+    mu_assert_int_eq(6, count);
+    for (size_t i = 0; i < count; i++)
+        mu_assert_int_eq(expected[i], ntohl(words[i]));
+
+    // Errors stop the assembly, and the output of the previous run is kept
+    char bad[] = "syscall\nadd $t0, $t1\nsyscall\n";
+    in = fmemopen(bad, strlen(bad), "r");
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_RAW, 0) == 0, "Could not open output");
+    mu_assert_int_eq(1, assemble_stream(in, &out));
+    mu_check(out.temp_name != NULL && access(out.temp_name, F_OK) == 0);
+    char temp_name[256];
+    snprintf(temp_name, sizeof(temp_name), "%s", out.temp_name);
+    discard_output(&out);
+    fclose(in);
+    mu_assert_int_eq(6 * sizeof(uint32_t), read_output(words, sizeof(words)));
+    mu_check(access(temp_name, F_OK) != 0);
+
+    // nothing is created when there was no file
+    remove(OUTPUT_FILE);
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_RAW, 0) == 0, "Could not open output");
+    mu_assert_int_eq(0, write_output(&out, expected, 2));
+    discard_output(&out);
+    mu_check(access(OUTPUT_FILE, F_OK) != 0);
+}
+
+MU_TEST(test_output_formats)
+{
+    const uint32_t words[] = {0x8c090030, 0x012a4020, 0x0000000c};
+    uint8_t buf[256];
+    Output out;
+
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_RAW, 0) == 0, "Could not open output");
+    mu_assert_int_eq(0, write_output(&out, words, 3));
+    mu_assert_int_eq(0, close_output(&out));
+    mu_assert_int_eq(12, read_output(buf, sizeof(buf)));
+    mu_check(!memcmp(buf, "\x8c\x09\x00\x30\x01\x2a\x40\x20\x00\x00\x00\x0c", 12));
+
+    // Two chunks, the file is grown and mapped for each
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_BITS, 0) == 0, "Could not open output");
+    mu_assert_int_eq(0, write_output(&out, words, 2));
+    mu_assert_int_eq(0, write_output(&out, words + 2, 1));
+    mu_assert_int_eq(0, close_output(&out));
+    const char *bits = "10001100000010010000000000110000\n"
+                       "00000001001010100100000000100000\n"
+                       "00000000000000000000000000001100\n";
+    mu_assert_int_eq(strlen(bits), read_output(buf, sizeof(buf)));
+    mu_check(!memcmp(buf, bits, strlen(bits)));
+
+    // Records do not cross a 64 KiB boundary, the upper address bits are set by a type 04 record
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_HEX, 0xfff8) == 0, "Could not open output");
+    mu_assert_int_eq(0, write_output(&out, words, 3));
+    mu_assert_int_eq(0, close_output(&out));
+    const char *hex = ":08FFF8008C090030012A4020B1\n"
+                      ":020000040001F9\n"
+                      ":040000000000000CF0\n"
+                      ":00000001FF\n";
+    mu_assert_int_eq(strlen(hex), read_output(buf, sizeof(buf)));
+    mu_check(!memcmp(buf, hex, strlen(hex)));
+
+    // The header is written first and its sizes are filled in when the output is closed
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_ELF, 0x400) == 0, "Could not open output");
+    mu_assert_int_eq(0, write_output(&out, words, 3));
+    mu_assert_int_eq(0, close_output(&out));
+    mu_assert_int_eq(ELF_HEADER_SIZE + ELF_PHDR_SIZE + 12, read_output(buf, sizeof(buf)));
+    mu_check(!memcmp(buf, "\x7f" "ELF\x01\x02\x01", 7));
+    mu_check(!memcmp(buf + 24, "\x00\x00\x04\x00", 4)); // e_entry
+    mu_check(!memcmp(buf + ELF_HEADER_SIZE + 16, "\x00\x00\x00\x0c", 4)); // p_filesz
+    mu_check(!memcmp(buf + ELF_HEADER_SIZE + 24, "\x00\x00\x00\x07", 4)); // p_flags: RWX
+    mu_check(!memcmp(buf + ELF_HEADER_SIZE + ELF_PHDR_SIZE, "\x8c\x09\x00\x30", 4));
+
+    remove(OUTPUT_FILE);
+}
+
+MU_TEST(test_large_program)
+{
+    // Far more instructions than the initial capacity of the token list and the word buffer
+    const int lines = 5000;
+    const char *line = "addiu $t0, $t0, 1\n";
+    char *code = malloc(lines * strlen(line) + 1);
+    code[0] = '\0';
+    for (int i = 0; i < lines; i++)
+        strcat(code + i * strlen(line), line);
+
+    Assembler as;
+    init_assembler(&as, NULL, 0);
+
+    mu_assert(assemble_line(&as, code) == 0, "Assembly failed");
+    mu_assert_int_eq(lines * 6, as.tokens.size);
+    mu_assert(finish_assembly(&as) == 0, "Assembly failed");
+    mu_assert_int_eq(lines, as.num_words);
+    mu_assert_int_eq(0x25080001, as.words[lines - 1]);
+
+    free_assembler(&as);
+    free(code);
+}
+
+MU_TEST(test_assemble_parallel)
+{
+    // Enough blocks for several chunks, each branching back, forward and jumping to the last block
+    const int blocks = 12000;
+    char *code = malloc(blocks * 128);
+    size_t len = 0;
+    for (int i = 0; i < blocks; i++)
+    {
+        len += sprintf(code + len, "b%d: addiu $t0, $t0, %d\n", i, i);
+        len += sprintf(code + len, "beq $t0, $t1, b%d\n", i > 0 ? i - 1 : 0);
+        len += sprintf(code + len, "bne $t0, $t1, b%d\n", i < blocks - 1 ? i + 1 : i);
+        len += sprintf(code + len, "jal b%d # far\n", blocks - 1);
+    }
+    mu_assert(len > 2 * PARALLEL_MIN_CHUNK, "Source too small to be split");
+
+    // HEX takes 11 bytes per word
+    size_t size = blocks * 4 * 16;
+    uint8_t *serial = malloc(size), *parallel = malloc(size);
+    Output out;
+
+    FILE *in = fmemopen(code, len, "r");
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_HEX, 0x400000) == 0, "Could not open the output");
+    mu_assert(assemble_stream(in, &out) == 0, "Serial assembly failed");
+    mu_assert(close_output(&out) == 0, "Could not close the output");
+    fclose(in);
+    size_t serial_len = read_output(serial, size);
+
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_HEX, 0x400000) == 0, "Could not open the output");
+    mu_assert(assemble_parallel(code, len, &out, 4) == 0, "Parallel assembly failed");
+    mu_assert(close_output(&out) == 0, "Could not close the output");
+    size_t parallel_len = read_output(parallel, size);
+
+    mu_assert(serial_len > 0 && serial_len < size && serial_len == parallel_len, "Output sizes differ");
+    mu_assert(!memcmp(serial, parallel, serial_len), "Outputs differ");
+
+    // a label that is only referenced is an error
+    len += sprintf(code + len, "j missing\n");
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_RAW, 0) == 0, "Could not open the output");
+    mu_assert(assemble_parallel(code, len, &out, 4) == 1, "Undefined label accepted");
+    discard_output(&out);
+
+    remove(OUTPUT_FILE);
+    free(serial);
+    free(parallel);
+    free(code);
+}
+
+MU_TEST(test_assemble_parallel_data)
+{
+    // Text with small .data sections in between and one large enough for a chunk to start inside it
+    const int blocks = 12000, words = 40000;
+    char *code = malloc(blocks * 160 + words * 16 + 64);
+    size_t len = 0;
+    for (int i = 0; i < blocks; i++)
+    {
+        len += sprintf(code + len, "b%d: addiu $t0, $t0, %d # not .data or .macro\n", i, i);
+        len += sprintf(code + len, "jal d%d\n", i / 1000);
+        if (i % 1000 == 0)
+        {
+            len += sprintf(code + len, ".data\nd%d: .word b%d, %d\n.asciiz \".byte\"\n", i / 1000, i, i);
+            len += sprintf(code + len, ".byte 1, 2, 3\n.text\n");
+        }
+        if (i == blocks / 2)
+        {
+            len += sprintf(code + len, ".data .align 2\n");
+            for (int n = 0; n < words; n++)
+                len += sprintf(code + len, ".word %d\n", n);
+            len += sprintf(code + len, ".text\n");
+        }
     }
+    mu_assert(len > 2 * PARALLEL_MIN_CHUNK, "Source too small to be split");
+
+    mu_check(count_parallel_chunks(code, len, 4) > 1);
+    mu_check(parallel_matches(code, len));
+
+    // a directive only in a comment or a string does not make the text depend on the lines before it
+    char *text = malloc(blocks * 3 * 64);
+    size_t text_len = 0;
+    for (int i = 0; i < blocks * 3; i++)
+        text_len += sprintf(text + text_len, "b%d: j b%d # .data .macro\n", i, blocks * 3 - 1 - i);
+    mu_check(count_parallel_chunks(text, text_len, 4) > 1);
+    mu_check(parallel_matches(text, text_len));
+
+    // bytes and macros in the text are assembled serially, with the same output
+    text_len += sprintf(text + text_len, ".byte 1\n");
+    mu_assert_int_eq(1, count_parallel_chunks(text, text_len, 4));
+    mu_check(parallel_matches(text, text_len));
+    text_len += sprintf(text + text_len, ".macro nothing\n.endm\n");
+    mu_assert_int_eq(1, count_parallel_chunks(text, text_len, 4));
+
+    remove(OUTPUT_FILE);
+    free(text);
+    free(code);
+}
+
+MU_TEST(test_incremental)
+{
+    char code[512] = "start: addiu $t0, $zero, 3\n"
+                     "loop: addiu $t0, $t0, -1\n"
+                     "bne $t0, $zero, loop\n"
+                     "j end\n"
+                     "addiu $t1, $t1, 1\n"
+                     "end: beq $zero, $zero, start\n";
+    IncrementalAssembly inc;
+    init_incremental(&inc, 0x400000);
+
+    mu_assert_int_eq(0, update_incremental(&inc, code, strlen(code)));
+    mu_assert_int_eq(6, inc.changed_lines);
+    mu_assert_int_eq(0, write_incremental(&inc, OUTPUT_FILE, FORMAT_RAW));
+    mu_check(output_matches(code, 0x400000));
+
+    // Only the edited line is encoded again and the file is patched in place
+    strcpy(strstr(code, "$t1, 1"), "$t1, 2\nend: beq $zero, $zero, start\n");
+    mu_assert_int_eq(0, update_incremental(&inc, code, strlen(code)));
+    mu_assert_int_eq(1, inc.changed_lines);
+    mu_assert_int_eq(4, inc.first_dirty);
+    mu_assert_int_eq(4, inc.last_dirty);
+    mu_assert_int_eq(0, write_incremental(&inc, OUTPUT_FILE, FORMAT_RAW));
+    mu_check(output_matches(code, 0x400000));
+
+    // An inserted line moves the labels after it, so the jump and the last branch are resolved again
+    strcpy(strstr(code, "end:"), "sll $t1, $t1, 2\nend: beq $zero, $zero, start\n");
+    mu_assert_int_eq(0, update_incremental(&inc, code, strlen(code)));
+    mu_assert_int_eq(1, inc.changed_lines);
+    mu_assert_int_eq(7, inc.num_words);
+    mu_assert_int_eq(0, write_incremental(&inc, OUTPUT_FILE, FORMAT_RAW));
+    mu_check(output_matches(code, 0x400000));
+
+    // A label defined twice is found before the cache changes
+    char broken[512];
+    strcpy(broken, code);
+    memcpy(strstr(broken, "loop:"), "end: ", 5);
+    mu_assert_int_eq(1, update_incremental(&inc, broken, strlen(broken)));
+    mu_assert_int_eq(0, update_incremental(&inc, code, strlen(code)));
+    mu_assert_int_eq(0, inc.changed_lines);
+
+    // Removing a label that is still used fails, the next update starts over
+    strcpy(broken, code);
+    memcpy(strstr(broken, "loop:"), "     ", 5);
+    mu_assert_int_eq(1, update_incremental(&inc, broken, strlen(broken)));
+    mu_assert_int_eq(1, write_incremental(&inc, OUTPUT_FILE, FORMAT_RAW));
+    mu_assert_int_eq(0, update_incremental(&inc, code, strlen(code)));
+    mu_assert_int_eq(0, write_incremental(&inc, OUTPUT_FILE, FORMAT_RAW));
+    mu_check(output_matches(code, 0x400000));
+
+    free_incremental(&inc);
+    remove(OUTPUT_FILE);
+}
+
+MU_TEST(test_objects)
+{
+    // Both modules have a local label loop, only the .globl labels are shared
+    char *main_code = ".globl main\n"
+                      "main: addiu $a0, $zero, 5\n"
+                      "loop: jal double\n"
+                      "addiu $a0, $a0, -1\n"
+                      "bne $a0, $zero, loop\n"
+                      "j end\n";
+    char *lib_code = ".globl double, end\n"
+                     "double: add $v0, $a0, $a0\n"
+                     "loop: beq $zero, $zero, loop\n"
+                     "jr $ra\n"
+                     "end: beq $zero, $zero, end\n";
+    char *flat_code = "main: addiu $a0, $zero, 5\n"
+                      "loop: jal double\n"
+                      "addiu $a0, $a0, -1\n"
+                      "bne $a0, $zero, loop\n"
+                      "j end\n"
+                      "double: add $v0, $a0, $a0\n"
+                      "loop2: beq $zero, $zero, loop2\n"
+                      "jr $ra\n"
+                      "end: beq $zero, $zero, end\n";
+    Object objs[2];
+    Output out;
+
+    FILE *in = fmemopen(main_code, strlen(main_code), "r");
+    mu_assert_int_eq(0, assemble_object(&objs[0], in, "main"));
+    fclose(in);
+    in = fmemopen(lib_code, strlen(lib_code), "r");
+    mu_assert_int_eq(0, assemble_object(&objs[1], in, "lib"));
+    fclose(in);
+
+    // every reference is left to the linker, the words hold no label fields yet
+    mu_assert_int_eq(5, objs[0].num_words);
+    mu_assert_int_eq(3, objs[0].num_relocs);
+    mu_assert_int_eq(0x0C000000, objs[0].words[1]);
+
+    // The objects are the same after a round trip through a file
+    mu_assert_int_eq(0, write_object(&objs[1], OUTPUT_FILE));
+    free_object(&objs[1]);
+    mu_assert_int_eq(0, read_object(&objs[1], OUTPUT_FILE));
+    mu_assert_int_eq(4, objs[1].num_words);
+    mu_assert_int_eq(3, objs[1].num_symbols);
+    mu_assert_int_eq(2, objs[1].num_relocs);
+
+    // bits left in a label field are replaced by the linker
+    objs[0].words[1] |= 0x3FFFFFF;
+
+    mu_assert_int_eq(0, open_output(&out, OUTPUT_FILE, FORMAT_RAW, 0x400000));
+    mu_assert_int_eq(0, link_objects(objs, 2, &out));
+    mu_assert_int_eq(0, close_output(&out));
+    mu_check(output_matches(flat_code, 0x400000));
+
+    // Without the library its labels are not defined, and twice it defines them twice
+    mu_assert_int_eq(0, open_output(&out, OUTPUT_FILE, FORMAT_RAW, 0));
+    mu_assert_int_eq(1, link_objects(objs, 1, &out));
+    Object twice[3] = {objs[0], objs[1], objs[1]};
+    mu_assert_int_eq(1, link_objects(twice, 3, &out));
+    discard_output(&out);
+    mu_check(output_matches(flat_code, 0x400000));
+
+    free_object(&objs[0]);
+    free_object(&objs[1]);
+    remove(OUTPUT_FILE);
+}
+
+MU_TEST(test_pseudo_instructions)
+{
+    char *code = "start: li $t0, -5\n"
+                 "li $t1, 0xBEEF\n"
+                 "li $t2, 0x12345678\n"
+                 "la $a0, data\n"
+                 "move $v0, $a0\n"
+                 "nop\n"
+                 "blt $t0, $t1, start\n"
+                 "bge $t0, $t1, data\n"
+                 "data: b start\n";
+    uint32_t expected[] = {
+        0x2408fffb, // addiu $t0, $zero, -5
+        0x3409beef, // ori $t1, $zero, 0xbeef
+        0x3c0a1234, // lui $t2, 0x1234
+        0x354a5678, // ori $t2, $t2, 0x5678
+        0x3c040000, // lui $a0, 0
+        0x34840130, // ori $a0, $a0, 0x130
+        0x00801021, // addu $v0, $a0, $zero
+        0x00000000, // sll $zero, $zero, 0
+        0x0109082a, // slt $at, $t0, $t1
+        0x1420fff6, // bne $at, $zero, -10
+        0x0109082a, // slt $at, $t0, $t1
+        0x30200000, // beq $at, $zero, 0
+        0x3000fff3, // beq $zero, $zero, -13
+    };
+
+    Assembler as;
+    init_assembler(&as, NULL, 0x100);
+    mu_assert(assemble_line(&as, code) == 0, "Assembly failed");
+    mu_assert(finish_assembly(&as) == 0, "Assembly failed");
+
+    mu_assert_int_eq(13, as.num_words);
+    for (size_t i = 0; i < as.num_words; i++)
+        mu_assert_int_eq(expected[i], as.words[i]);
+    free_assembler(&as);
+
+    // Both halves of la are filled in when the label is defined later
+    init_assembler(&as, NULL, 0x12340000);
+    mu_assert(assemble_line(&as, "la $t0, later\nnop\nlater: nop\n") == 0, "Assembly failed");
+    mu_assert(finish_assembly(&as) == 0, "Assembly failed");
+    mu_assert_int_eq(0x3c081234, as.words[0]);
+    mu_assert_int_eq(0x3508000c, as.words[1]);
+    free_assembler(&as);
+
+    // Pseudo-instructions take the operands of their pattern
+    init_assembler(&as, NULL, 0);
+    mu_check(assemble_line(&as, "move $t0, 4\n") == 1);
+    mu_check(assemble_line(&as, "blt $t0, $t1\n") == 1);
+    mu_check(assemble_line(&as, "bogus $t0\n") == 1);
+    free_assembler(&as);
+}
+
+MU_TEST(test_immediate_ranges)
+{
+    const uint32_t expected[] = {0x000947c0, 0x21288000, 0x21297fff, 0x3508ffff, 0x3c08ffff, 0x8d49fffc, 0x24088000};
+    Assembler as;
+
+    // the ends of each range are accepted
+    init_assembler(&as, NULL, 0);
+    mu_assert(assemble_line(&as, "sll $t0, $t1, 31\n"
+                                 "addi $t0, $t1, -32768\n"
+                                 "addi $t1, $t1, 32767\n"
+                                 "ori $t0, $t0, 0xFFFF\n"
+                                 "lui $t0, 65535\n"
+                                 "lw $t1, -4($t2)\n"
+                                 "li $t0, -32768\n") == 0,
+              "Assembly failed");
+    mu_assert(finish_assembly(&as) == 0, "Assembly failed");
+    mu_assert_int_eq(7, as.num_words);
+    for (size_t i = 0; i < as.num_words; i++)
+        mu_assert_int_eq(expected[i], as.words[i]);
+    free_assembler(&as);
+
+    // anything past them is an error instead of being cut to the field
+    init_assembler(&as, NULL, 0);
+    mu_check(assemble_line(&as, "sll $t0, $t1, 40\n") == 1);
+    mu_check(assemble_line(&as, "srl $t0, $t1, -1\n") == 1);
+    mu_check(assemble_line(&as, "addi $t0, $t1, 70000\n") == 1);
+    mu_check(assemble_line(&as, "addiu $t0, $t1, -32769\n") == 1);
+    mu_check(assemble_line(&as, "slti $t0, $t1, 0x8000\n") == 1);
+    mu_check(assemble_line(&as, "sw $t0, 32768($sp)\n") == 1);
+    mu_check(assemble_line(&as, "ori $t0, $t1, -1\n") == 1);
+    mu_check(assemble_line(&as, "xori $t0, $t1, 0x10000\n") == 1);
+    mu_check(assemble_line(&as, "lui $t0, 65536\n") == 1);
+    free_assembler(&as);
+}
+
+MU_TEST(test_macros)
+{
+    char *code = ".macro push reg\n"
+                 "addi $sp, $sp, -4\n"
+                 "sw reg, 0($sp) # the body can have comments\n"
+                 ".endm\n"
+                 ".macro swap a, b\n"
+                 "push a\n"
+                 "move a, b\n"
+                 "lw b, 0($sp)\n"
+                 "addi $sp, $sp, 4\n"
+                 ".endm\n"
+                 "swap $t0, $t1\n"
+                 "push $ra\n";
+    char *expanded = "addi $sp, $sp, -4\n"
+                     "sw $t0, 0($sp)\n"
+                     "move $t0, $t1\n"
+                     "lw $t1, 0($sp)\n"
+                     "addi $sp, $sp, 4\n"
+                     "addi $sp, $sp, -4\n"
+                     "sw $ra, 0($sp)\n";
+
+    // A definition ends at the end of a line, so the source is read one line at a time
+    Assembler as, reference;
+    FILE *in = fmemopen(code, strlen(code), "r");
+    init_assembler(&as, NULL, 0);
+    init_assembler(&reference, NULL, 0);
+    mu_assert(assemble_lines(&as, in) == 0, "Assembly failed");
+    fclose(in);
+    mu_assert(assemble_line(&reference, expanded) == 0, "Assembly failed");
+    mu_assert_int_eq(7, as.num_words);
+    mu_check(reference.num_words == as.num_words && !memcmp(as.words, reference.words, as.num_words * 4));
+    free_assembler(&reference);
+
+    // The lines of a definition are assembled when the macro is invoked
+    mu_assert(assemble_line(&as, ".macro skip\n") == 0, "Definition failed");
+    mu_assert(assemble_line(&as, "j out\n") == 0, "Definition failed");
+    mu_assert_int_eq(7, as.count);
+    mu_assert(assemble_line(&as, ".endm\n") == 0, "Definition failed");
+    mu_assert(assemble_line(&as, "skip\nout: nop\n") == 0, "Assembly failed");
+    mu_assert(finish_assembly(&as) == 0, "Assembly failed");
+    mu_assert_int_eq(0x08000020, as.words[7]);
+    free_assembler(&as);
+
+    // Wrong arguments, macros that invoke themselves and unclosed definitions are errors
+    init_assembler(&as, NULL, 0);
+    const char *definitions[] = {".macro two a, b\n", "move a, b\n", ".endm\n", ".macro self\n", "self\n", ".endm\n"};
+    for (size_t i = 0; i < sizeof(definitions) / sizeof(definitions[0]); i++)
+        mu_assert(assemble_line(&as, definitions[i]) == 0, "Definition failed");
+    mu_check(assemble_line(&as, "two $t0\n") == 1);
+    mu_check(assemble_line(&as, "two $t0 $t1\n") == 1);
+    mu_check(assemble_line(&as, "self\n") == 1);
+    mu_check(assemble_line(&as, ".macro two\n") == 1);
+    mu_check(assemble_line(&as, ".endm\n") == 1);
+    mu_assert(assemble_line(&as, ".macro open\n") == 0, "Definition failed");
+    mu_check(assemble_line(&as, ".macro nested\n") == 1);
+    mu_check(finish_assembly(&as) == 1);
+    free_assembler(&as);
+
+    // Sources with macros are assembled serially
+    mu_check(needs_whole_source(code, strlen(code)));
+    mu_check(!needs_whole_source(expanded, strlen(expanded)));
+}
+
+MU_TEST(test_data_directives)
+{
+    // Strings keep their quotes and can contain escaped quotes, spaces and #
+    TokenList list = {0};
+    mu_assert(tokenize(".asciiz \"a \\\"b\\\" # c\", 1\n", &list) == 0, "Tokenizing failed");
+    mu_assert_int_eq(4, list.size);
+    mu_assert_int_eq(TOKEN_STRING, list.data[1].type);
+    mu_assert_int_eq(13, list.data[1].len);
+    mu_assert_int_eq(TOKEN_COMMA, list.data[2].type);
+    list.size = 0;
+    mu_check(tokenize(".asciiz \"open\n", &list) == 1);
+    free_tokens(&list);
+
+    // The data section is placed after the text, labels in front of a word are aligned
+    char *code = ".data\n"
+                 "msg: .asciiz \"hi\\n\\\"x\\\"\"\n"
+                 ".align 2\n"
+                 "table: .word 1, -1, 0x12345678, main\n"
+                 ".half 0x1234, -2\n"
+                 ".byte 1, 2, 3\n"
+                 ".space 6\n"
+                 "end: .word end\n"
+                 ".text\n"
+                 "main: la $a0, msg\n"
+                 "lw $t0, 4($a0)\n"
+                 ".byte 7\n"
+                 "x: nop\n";
+    uint32_t expected[] = {0x3c040040, 0x34840014, 0x8c880004, 0x07000000, 0x00000000, 0x68690a22,
+                           0x78220000, 0x00000001, 0xffffffff, 0x12345678, 0x00400000, 0x1234fffe,
+                           0x01020300, 0x00000000, 0x00000000, 0x0040003c};
+
+    Assembler as;
+    FILE *in = fmemopen(code, strlen(code), "r");
+    init_assembler(&as, NULL, 0x400000);
+    mu_assert(assemble_lines(&as, in) == 0, "Assembly failed");
+    fclose(in);
+    mu_assert_int_eq(16, as.num_words);
+    for (size_t i = 0; i < as.num_words; i++)
+        mu_assert_int_eq(expected[i], as.words[i]);
+    mu_assert_int_eq(0x400010, find_symbol(&as.symbols, "x", 1)->addr);
+    free_assembler(&as);
+
+    // Large tables are written in chunks, the same as the words of instructions
+    char big[] = "j 0\n.data\n.space 1000000\n.word 5\n.text\n.byte 1\n";
+    Output out;
+    in = fmemopen(big, strlen(big), "r");
+    mu_assert(open_output(&out, OUTPUT_FILE, FORMAT_RAW, 0) == 0, "Could not open output");
+    mu_assert_int_eq(0, assemble_stream(in, &out));
+    mu_assert_int_eq(0, close_output(&out));
+    fclose(in);
+
+    uint32_t *words = malloc(250004 * sizeof(uint32_t));
+    mu_assert_int_eq(250003 * sizeof(uint32_t), read_output(words, 250004 * sizeof(uint32_t)));
+    mu_assert_int_eq(0x01000000, ntohl(words[1]));
+    mu_assert_int_eq(0, words[250001]);
+    mu_assert_int_eq(5, ntohl(words[250002]));
+    free(words);
+    remove(OUTPUT_FILE);
+
+    // Data does not fit in memory of the caller that is too small
+    uint32_t mem[4];
+    init_assembler_at(&as, mem, 4, 0);
+    mu_check(assemble_line(&as, ".space 20\n") == 1);
+    free_assembler(&as);
+
+    init_assembler(&as, NULL, 0);
+    mu_check(assemble_line(&as, ".byte 256\n") == 1);
+    mu_check(assemble_line(&as, ".half -32769\n") == 1);
+    mu_check(assemble_line(&as, ".word\n") == 1);
+    mu_check(assemble_line(&as, ".byte label\n") == 1);
+    mu_check(assemble_line(&as, ".asciiz 5\n") == 1);
+    mu_check(assemble_line(&as, ".ascii \"\\q\"\n") == 1);
+    mu_check(assemble_line(&as, ".align 17\n") == 1);
+    mu_check(assemble_line(&as, ".space -1\n") == 1);
+    mu_check(assemble_line(&as, "nop .data\n") == 1);
+    free_assembler(&as);
+
+    // Data lines are only assembled after the text, errors in them are reported when the source ends
+    init_assembler(&as, NULL, 0);
+    mu_assert(assemble_line(&as, ".data\n") == 0, "Assembly failed");
+    mu_assert(assemble_line(&as, ".word nowhere\n") == 0, "Assembly failed");
+    mu_assert_int_eq(0, as.count);
+    mu_check(finish_assembly(&as) == 1);
+    free_assembler(&as);
+}
+
+MU_TEST(test_source_map)
+{
+    char *code = ".macro twice r\n"
+                 "addi r, r, 1\n"
+                 "addi r, r, 1\n"
+                 ".endm\n"
+                 ".data\n"
+                 "value: .word 7\n"
+                 ".text\n"
+                 "main: lw $t0, 0($zero)\n"
+                 "\n"
+                 "loop: twice $t0\n"
+                 "bne $t0, $zero, loop\n";
+
+    SourceMap map = {0};
+    Assembler as;
+    FILE *in = fmemopen(code, strlen(code), "r");
+    init_assembler(&as, NULL, 0x400000);
+    as.map = &map;
+    set_source_file(&map, "prog.asm");
+    mu_assert(assemble_lines(&as, in) == 0, "Assembly failed");
+    fclose(in);
+    free_assembler(&as);
+
+    // one line per source line that emitted something, the words of a macro belong to its invocation
+    mu_assert_int_eq(4, map.num_lines);
+    mu_assert_int_eq(3, map.num_labels);
+    mu_assert_int_eq(0x400014, map.end);
+    mu_assert(write_source_map(&map, OUTPUT_FILE) == 0, "Could not write the map");
+    free_source_map(&map);
+
+    mu_assert(load_source_map(&map, OUTPUT_FILE) == 0, "Could not load the map");
+    SourceLocation loc;
+    mu_check(lookup_source(&map, 0x400008, &loc));
+    mu_check(strcmp(loc.file, "prog.asm") == 0);
+    mu_assert_int_eq(10, loc.line);
+    mu_check(strcmp(loc.label, "loop") == 0);
+    mu_assert_int_eq(4, loc.offset);
+    mu_check(lookup_source(&map, 0x400010, &loc));
+    mu_check(strcmp(loc.label, "value") == 0);
+    mu_assert_int_eq(6, loc.line);
+    mu_check(!lookup_source(&map, 0x400014, &loc));
+    mu_check(!lookup_source(&map, 0x3ffffc, &loc));
+
+    char text[16];
+    mu_assert_int_eq(15, format_source(&map, 0x40000c, text, sizeof(text)));
+    mu_check(strcmp(text, "loop+0x8 prog.a") == 0);
+    free_source_map(&map);
+
+    // other files are not taken for maps
+    mu_check(load_source_map(&map, "add.asm") == 1);
+    remove(OUTPUT_FILE);
 }
 
 MU_TEST_SUITE(tokenizer_tests)
 {
     MU_RUN_TEST(test_add_asm);
+    MU_RUN_TEST(test_token_values);
+    MU_RUN_TEST(test_simd_scan);
+    MU_RUN_TEST(test_generate_code);
+    MU_RUN_TEST(test_labels);
+    MU_RUN_TEST(test_many_labels);
+    MU_RUN_TEST(test_assemble_stream);
+    MU_RUN_TEST(test_output_formats);
+    MU_RUN_TEST(test_large_program);
+    MU_RUN_TEST(test_assemble_parallel);
+    MU_RUN_TEST(test_assemble_parallel_data);
+    MU_RUN_TEST(test_incremental);
+    MU_RUN_TEST(test_objects);
+    MU_RUN_TEST(test_pseudo_instructions);
+    MU_RUN_TEST(test_immediate_ranges);
+    MU_RUN_TEST(test_macros);
+    MU_RUN_TEST(test_data_directives);
+    MU_RUN_TEST(test_source_map);
 }
 
 int main()
@@ -76,6 +944,61 @@ int main()
 
 // ********* Helper functions ********* //
 
+/// Reads the file the output tests write to, returns the number of bytes read
+size_t read_output(void *buf, size_t size)
+{
+    FILE *file = fopen(OUTPUT_FILE, "rb");
+    if (file == NULL)
+        return 0;
+
+    size_t len = fread(buf, 1, size, file);
+    fclose(file);
+    return len;
+}
+
+/// Checks that assemble_parallel writes the same raw output as assemble_stream
+int parallel_matches(const char *code, size_t len)
+{
+    size_t size = len + 64;
+    uint8_t *serial = malloc(size), *parallel = malloc(size);
+    Output out;
+
+    FILE *in = fmemopen((void *)code, len, "r");
+    int status = open_output(&out, OUTPUT_FILE, FORMAT_RAW, 0x400000) || assemble_stream(in, &out) ||
+                 close_output(&out);
+    fclose(in);
+    size_t serial_len = read_output(serial, size);
+
+    status = status || open_output(&out, OUTPUT_FILE, FORMAT_RAW, 0x400000) ||
+             assemble_parallel(code, len, &out, 4) || close_output(&out);
+    size_t parallel_len = read_output(parallel, size);
+
+    int match = !status && serial_len > 0 && serial_len == parallel_len && !memcmp(serial, parallel, serial_len);
+    free(serial);
+    free(parallel);
+    return match;
+}
+
+/// Checks that the raw output file holds the words of code assembled at origin
+int output_matches(const char *code, uint32_t origin)
+{
+    Assembler as;
+    init_assembler(&as, NULL, origin);
+
+    FILE *in = fmemopen((void *)code, strlen(code), "r");
+    int status = assemble_lines(&as, in);
+    fclose(in);
+
+    uint32_t words[64];
+    size_t len = read_output(words, sizeof(words));
+    int match = !status && len == as.num_words * sizeof(uint32_t);
+    for (uint32_t n = 0; match && n < as.num_words; n++)
+        match = ntohl(words[n]) == as.words[n];
+
+    free_assembler(&as);
+    return match;
+}
+
 TokenType get_const_token_type(char *const_val)
 {
     if (strlen(const_val) < 2 || const_val[0] != '0')
@@ -102,10 +1025,10 @@ void token_add_instr_rg_off_rg(Token tokens[], int *count, char *instr, char *re
     tokens[(*count)++] = (Token){.type = TOKEN_INSTRUCTION, .value = instr};
     tokens[(*count)++] = (Token){.type = TOKEN_REGISTER, .value = reg1};
     tokens[(*count)++] = (Token){.type = TOKEN_COMMA, .value = ","};
-    tokens[(*count)++] = (Token){.type = get_const_token_type(offset), offset};
-    tokens[(*count)++] = (Token){.type = TOKEN_L_PAREN, "("};
-    tokens[(*count)++] = (Token){.type = TOKEN_REGISTER, reg2};
-    tokens[(*count)++] = (Token){.type = TOKEN_R_PAREN, ")"};
+    tokens[(*count)++] = (Token){.type = get_const_token_type(offset), .value = offset};
+    tokens[(*count)++] = (Token){.type = TOKEN_L_PAREN, .value = "("};
+    tokens[(*count)++] = (Token){.type = TOKEN_REGISTER, .value = reg2};
+    tokens[(*count)++] = (Token){.type = TOKEN_R_PAREN, .value = ")"};
 }
 
 /// Adds proper tokens to array for an add $reg1, $reg2, $reg3 type instruction
@@ -0,0 +1,384 @@
+#include "object.h"
+
+int assemble_object(Object *obj, FILE *in, const char *name)
+{
+    Assembler as;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    int status = 0;
+
+    // every reference becomes a relocation, the labels of the module are resolved by the linker as well
+    init_assembler(&as, NULL, 0);
+    as.defer_labels = 1;
+    *obj = (Object){.name = name};
+
+    while (!status && getline(&line, &line_capacity, in) != -1)
+    {
+        status = assemble_line(&as, line);
+        if (status)
+            fprintf(stderr, "Error: Assembly of %s stopped at line %u\n", name, as.line);
+    }
+    if (!status && ferror(in))
+    {
+        perror("Failed to read input");
+        status = 1;
+    }
+    free(line);
+    status = status || finish_source(&as);
+
+    if (status)
+    {
+        free_assembler(&as);
+        return 1;
+    }
+
+    const SymbolTable *symbols = &as.symbols;
+    uint32_t *indices = malloc((symbols->capacity + 1) * sizeof(uint32_t));
+    obj->symbols = malloc((symbols->count + 1) * sizeof(ObjectSymbol));
+    obj->relocs = malloc((symbols->num_fixups + 1) * sizeof(Relocation));
+    obj->names = malloc(symbols->names_len + 1);
+    if (!indices || !obj->symbols || !obj->relocs || !obj->names)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    // the names keep their offsets
+    memcpy(obj->names, symbols->names, symbols->names_len);
+    obj->names_len = symbols->names_len;
+
+    for (uint32_t n = 0; n < symbols->capacity; n++)
+    {
+        const Symbol *symbol = &symbols->entries[n];
+        if (symbol->len == 0)
+            continue;
+
+        indices[n] = obj->num_symbols;
+        obj->symbols[obj->num_symbols++] = (ObjectSymbol){
+            .name = symbol->name,
+            .len = symbol->len,
+            .value = symbol->addr,
+            .flags = (symbol->defined ? OBJECT_SYMBOL_DEFINED : 0) | (symbol->global ? OBJECT_SYMBOL_GLOBAL : 0),
+        };
+
+        // fixups are numbered in the order of their words, so are the relocations
+        for (int32_t f = symbol->fixups; f != -1; f = symbols->fixups[f].next)
+            obj->relocs[f] = (Relocation){.word = symbols->fixups[f].word, .symbol = indices[n],
+                                          .kind = symbols->fixups[f].kind};
+    }
+    obj->num_relocs = symbols->num_fixups;
+
+    // the object takes over the words
+    obj->words = as.words;
+    obj->num_words = as.count;
+    as.words = NULL;
+
+    free(indices);
+    free_assembler(&as);
+    return 0;
+}
+
+int write_object(const Object *obj, const char *filename)
+{
+    size_t num_fields = OBJECT_HEADER_WORDS + obj->num_words + obj->num_symbols * 4 + obj->num_relocs * 3;
+    uint32_t *fields = malloc(num_fields * sizeof(uint32_t));
+    if (!fields)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t *field = fields;
+    const uint32_t header[OBJECT_HEADER_WORDS] = {OBJECT_MAGIC,     OBJECT_VERSION,   obj->num_words,
+                                                  obj->num_symbols, obj->num_relocs, obj->names_len};
+    for (int n = 0; n < OBJECT_HEADER_WORDS; n++)
+        *field++ = htonl(header[n]);
+    for (uint32_t n = 0; n < obj->num_words; n++)
+        *field++ = htonl(obj->words[n]);
+    for (uint32_t n = 0; n < obj->num_symbols; n++)
+    {
+        const ObjectSymbol *symbol = &obj->symbols[n];
+        *field++ = htonl(symbol->name);
+        *field++ = htonl(symbol->len);
+        *field++ = htonl(symbol->value);
+        *field++ = htonl(symbol->flags);
+    }
+    for (uint32_t n = 0; n < obj->num_relocs; n++)
+    {
+        *field++ = htonl(obj->relocs[n].word);
+        *field++ = htonl(obj->relocs[n].symbol);
+        *field++ = htonl(obj->relocs[n].kind);
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        free(fields);
+        return 1;
+    }
+
+    int status = fwrite(fields, sizeof(uint32_t), num_fields, file) != num_fields ||
+                 fwrite(obj->names, 1, obj->names_len, file) != obj->names_len;
+    status = fclose(file) != 0 || status;
+    if (status)
+        fprintf(stderr, "Error: Could not write file %s\n", filename);
+
+    free(fields);
+    return status;
+}
+
+/// @brief Reads the next big endian field of an object file
+static uint32_t next_field(const uint8_t **data)
+{
+    uint32_t field;
+    memcpy(&field, *data, sizeof(field));
+    *data += sizeof(field);
+    return ntohl(field);
+}
+
+/// @brief Checks the symbols and relocations of an object refer to its names, symbols and words
+static int check_object(const Object *obj)
+{
+    for (uint32_t n = 0; n < obj->num_symbols; n++)
+    {
+        const ObjectSymbol *symbol = &obj->symbols[n];
+        if (symbol->len == 0 || symbol->name > obj->names_len || symbol->len > obj->names_len - symbol->name)
+            return 1;
+        if ((symbol->flags & OBJECT_SYMBOL_DEFINED) && symbol->value > (uint64_t)obj->num_words * 4)
+            return 1;
+    }
+
+    for (uint32_t n = 0; n < obj->num_relocs; n++)
+    {
+        const Relocation *reloc = &obj->relocs[n];
+        if (reloc->word >= obj->num_words || reloc->symbol >= obj->num_symbols || reloc->kind > FIXUP_LO)
+            return 1;
+    }
+
+    return 0;
+}
+
+int read_object(Object *obj, const char *filename)
+{
+    *obj = (Object){.name = filename};
+
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return 1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *buffer = malloc(length > 0 ? length : 1);
+    if (!buffer)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    int status = length < 0 || fread(buffer, 1, length, file) != (size_t)length;
+    fclose(file);
+
+    const uint8_t *data = buffer;
+    uint32_t header[OBJECT_HEADER_WORDS] = {0};
+    if (!status && length >= OBJECT_HEADER_WORDS * 4)
+    {
+        for (int n = 0; n < OBJECT_HEADER_WORDS; n++)
+            header[n] = next_field(&data);
+    }
+
+    if (status || header[0] != OBJECT_MAGIC || header[1] != OBJECT_VERSION)
+    {
+        fprintf(stderr, "Error: %s is not an object file\n", filename);
+        free(buffer);
+        return 1;
+    }
+
+    obj->num_words = header[2];
+    obj->num_symbols = header[3];
+    obj->num_relocs = header[4];
+    obj->names_len = header[5];
+
+    uint64_t expected = (OBJECT_HEADER_WORDS + (uint64_t)obj->num_words + (uint64_t)obj->num_symbols * 4 +
+                         (uint64_t)obj->num_relocs * 3) * 4 + obj->names_len;
+    if (expected != (uint64_t)length)
+    {
+        fprintf(stderr, "Error: %s is corrupt\n", filename);
+        free(buffer);
+        return 1;
+    }
+
+    obj->words = malloc(((size_t)obj->num_words + 1) * sizeof(uint32_t));
+    obj->symbols = malloc(((size_t)obj->num_symbols + 1) * sizeof(ObjectSymbol));
+    obj->relocs = malloc(((size_t)obj->num_relocs + 1) * sizeof(Relocation));
+    obj->names = malloc((size_t)obj->names_len + 1);
+    if (!obj->words || !obj->symbols || !obj->relocs || !obj->names)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t n = 0; n < obj->num_words; n++)
+        obj->words[n] = next_field(&data);
+    for (uint32_t n = 0; n < obj->num_symbols; n++)
+    {
+        ObjectSymbol *symbol = &obj->symbols[n];
+        symbol->name = next_field(&data);
+        symbol->len = next_field(&data);
+        symbol->value = next_field(&data);
+        symbol->flags = next_field(&data);
+    }
+    for (uint32_t n = 0; n < obj->num_relocs; n++)
+    {
+        obj->relocs[n].word = next_field(&data);
+        obj->relocs[n].symbol = next_field(&data);
+        obj->relocs[n].kind = next_field(&data);
+    }
+    memcpy(obj->names, data, obj->names_len);
+    free(buffer);
+
+    if (check_object(obj))
+    {
+        fprintf(stderr, "Error: %s is corrupt\n", filename);
+        free_object(obj);
+        return 1;
+    }
+
+    return 0;
+}
+
+/// @brief Enters the global labels of every object, the line of each symbol is the index of its object
+/// @return 0 if successful, 1 if a label is defined in two objects
+static int define_globals(SymbolTable *globals, const Object *objs, int count, const uint32_t *bases, uint32_t origin)
+{
+    int status = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        for (uint32_t n = 0; n < objs[i].num_symbols; n++)
+        {
+            const ObjectSymbol *symbol = &objs[i].symbols[n];
+            const char *name = objs[i].names + symbol->name;
+            if ((symbol->flags & (OBJECT_SYMBOL_DEFINED | OBJECT_SYMBOL_GLOBAL)) !=
+                (OBJECT_SYMBOL_DEFINED | OBJECT_SYMBOL_GLOBAL))
+                continue;
+
+            Symbol *label = get_symbol(globals, name, symbol->len);
+            if (label->defined)
+            {
+                fprintf(stderr, "Error: Label '%.*s' is defined in %s and %s\n", (int)symbol->len, name,
+                        objs[label->line].name, objs[i].name);
+                status = 1;
+                continue;
+            }
+
+            label->defined = 1;
+            label->addr = origin + bases[i] * 4 + symbol->value;
+            label->line = i;
+        }
+    }
+
+    return status;
+}
+
+int link_objects(const Object *objs, int count, Output *out)
+{
+    SymbolTable globals = {0};
+    uint32_t *bases = malloc((count + 1) * sizeof(uint32_t));
+    uint64_t num_words = 0;
+    if (!bases)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    // The objects are laid out in the order they are given
+    for (int i = 0; i < count; i++)
+    {
+        bases[i] = num_words;
+        num_words += objs[i].num_words;
+    }
+    if (num_words * 4 > UINT32_MAX - (uint64_t)out->origin)
+    {
+        fprintf(stderr, "Error: The program does not fit in the address space\n");
+        free(bases);
+        return 1;
+    }
+
+    uint32_t *words = malloc((num_words + 1) * sizeof(uint32_t));
+    if (!words)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    int status = define_globals(&globals, objs, count, bases, out->origin);
+
+    for (int i = 0; i < count; i++)
+    {
+        const Object *obj = &objs[i];
+        memcpy(words + bases[i], obj->words, obj->num_words * sizeof(uint32_t));
+
+        for (uint32_t n = 0; n < obj->num_relocs; n++)
+        {
+            const Relocation *reloc = &obj->relocs[n];
+            const ObjectSymbol *symbol = &obj->symbols[reloc->symbol];
+            const char *name = obj->names + symbol->name;
+            uint32_t addr, value;
+
+            // labels of the module come first, the others have to be global in another module
+            if (symbol->flags & OBJECT_SYMBOL_DEFINED)
+            {
+                addr = out->origin + bases[i] * 4 + symbol->value;
+            }
+            else
+            {
+                Symbol *label = get_symbol(&globals, name, symbol->len);
+                if (!label->defined)
+                {
+                    // reported once per label, the fixups of the global table are not used otherwise
+                    if (label->fixups == -1)
+                        fprintf(stderr, "Error: Label '%.*s' is not defined, used in %s\n", (int)symbol->len, name,
+                                obj->name);
+                    label->fixups = 0;
+                    status = 1;
+                    continue;
+                }
+                addr = label->addr;
+            }
+
+            if (resolve_reference(out->origin, reloc->kind, bases[i] + reloc->word, addr, &value))
+            {
+                fprintf(stderr, "Error: Label '%.*s' is out of range in %s\n", (int)symbol->len, name, obj->name);
+                status = 1;
+                continue;
+            }
+            // a hand made object can have bits in the label field, they are replaced like in resolve_references
+            uint32_t *word = &words[bases[i] + reloc->word];
+            *word = (*word & ~fixup_mask(reloc->kind)) | value;
+        }
+    }
+
+    // Written in the chunks of assemble_stream so the output is the same
+    for (uint32_t n = 0; !status && n < num_words; n += OUTPUT_CHUNK_WORDS)
+        status = write_output(out, words + n, num_words - n < OUTPUT_CHUNK_WORDS ? num_words - n : OUTPUT_CHUNK_WORDS);
+
+    free_symbols(&globals);
+    free(words);
+    free(bases);
+    return status;
+}
+
+void free_object(Object *obj)
+{
+    free(obj->words);
+    free(obj->symbols);
+    free(obj->relocs);
+    free(obj->names);
+    *obj = (Object){0};
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "mips_asm.h"
+
+// Relocatable object files start with "MOBJ" and a version, all fields are big endian 32 bit words:
+//   header:  magic, version, number of words, number of symbols, number of relocations, length of the names
+//   words:   the code of the module, the label fields of relocated words are 0
+//   symbols: name offset, name length, byte offset in the module, flags
+//   relocations: number of the word, symbol index, FixupKind
+//   names:   the symbol names back to back, not null terminated
+#define OBJECT_MAGIC 0x4D4F424A
+#define OBJECT_VERSION 1
+#define OBJECT_HEADER_WORDS 6
+
+// Flags of an object symbol
+#define OBJECT_SYMBOL_DEFINED 1
+#define OBJECT_SYMBOL_GLOBAL 2
+
+/// @brief A label of a module, defined in it or referenced from it
+typedef struct
+{
+    // offset of the name in Object.names
+    uint32_t name;
+    uint32_t len;
+    // byte offset of the label from the start of the module
+    uint32_t value;
+    uint32_t flags;
+} ObjectSymbol;
+
+/// @brief A word whose label field is filled in by the linker
+typedef struct
+{
+    // number of the word in the module
+    uint32_t word;
+    // index in Object.symbols
+    uint32_t symbol;
+    FixupKind kind;
+} Relocation;
+
+/// @brief A module assembled on its own. Its labels are resolved when the objects are linked, a label defined
+/// with .globl in one module can be used by all of them. Release with free_object.
+typedef struct
+{
+    // name of the file or source, for error messages
+    const char *name;
+
+    uint32_t *words;
+    uint32_t num_words;
+
+    ObjectSymbol *symbols;
+    uint32_t num_symbols;
+
+    Relocation *relocs;
+    uint32_t num_relocs;
+
+    char *names;
+    uint32_t names_len;
+} Object;
+
+/// @brief Assembles the lines of a stream into an object, labels that are not defined are left to the linker.
+/// @param obj
+/// @param in
+/// @param name name of the source, for error messages
+/// @return 0 if successful, 1 otherwise
+int assemble_object(Object *obj, FILE *in, const char *name);
+
+/// @brief Writes an object file.
+/// @param obj
+/// @param filename
+/// @return 0 if successful, 1 otherwise
+int write_object(const Object *obj, const char *filename);
+
+/// @brief Reads an object file and checks that it is consistent.
+/// @param obj
+/// @param filename
+/// @return 0 if successful, 1 otherwise
+int read_object(Object *obj, const char *filename);
+
+/// @brief Lays the objects out one after the other at the address of the output, fills in every relocation
+/// and writes the program.
+/// @param objs
+/// @param count
+/// @param out output opened at the address the program is loaded at, it is not closed
+/// @return 0 if successful, 1 if a label is undefined, defined twice or out of range, or the output fails
+int link_objects(const Object *objs, int count, Output *out);
+
+/// @brief Frees the memory of an object.
+/// @param obj
+void free_object(Object *obj);
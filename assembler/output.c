@@ -0,0 +1,443 @@
+#include "output.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Longest Intel HEX record per word: a one word data record plus an extended linear address record
+#define HEX_DATA_RECORD_SIZE(bytes) (12 + 2 * (bytes))
+#define HEX_ADDRESS_RECORD_SIZE 16
+#define HEX_EOF_RECORD ":00000001FF\n"
+
+int parse_output_format(const char *name, OutputFormat *format)
+{
+    static const char *const names[] = {[FORMAT_RAW] = "raw", [FORMAT_HEX] = "hex", [FORMAT_BITS] = "bits",
+                                        [FORMAT_ELF] = "elf"};
+
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++)
+    {
+        if (!strcmp(name, names[n]))
+        {
+            *format = n;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/// @brief Stores a word big endian at any alignment
+static inline void store_be32(uint8_t *dst, uint32_t word)
+{
+    word = __builtin_bswap32(word);
+    memcpy(dst, &word, sizeof(word));
+}
+
+/// @brief Stores a half word big endian
+static inline void store_be16(uint8_t *dst, uint16_t half)
+{
+    dst[0] = half >> 8;
+    dst[1] = half;
+}
+
+/// @brief Upper bound of the encoded size of count words
+static size_t encoded_bound(OutputFormat format, size_t count)
+{
+    switch (format)
+    {
+    case FORMAT_HEX:
+        return count * (HEX_DATA_RECORD_SIZE(4) + HEX_ADDRESS_RECORD_SIZE);
+    case FORMAT_BITS:
+        return count * 33;
+    default:
+        return count * 4;
+    }
+}
+
+/// @brief Writes an Intel HEX record and returns its length
+static size_t hex_record(uint8_t *dst, uint8_t type, uint16_t addr, const uint8_t *data, size_t len)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    uint8_t header[4] = {len, addr >> 8, addr, type};
+    uint8_t sum = 0;
+    size_t n = 0;
+
+    dst[n++] = ':';
+    for (size_t i = 0; i < 4 + len; i++)
+    {
+        uint8_t byte = i < 4 ? header[i] : data[i - 4];
+        sum += byte;
+        dst[n++] = digits[byte >> 4];
+        dst[n++] = digits[byte & 0xF];
+    }
+
+    // the checksum makes the sum of all bytes of the record 0
+    sum = -sum;
+    dst[n++] = digits[sum >> 4];
+    dst[n++] = digits[sum & 0xF];
+    dst[n++] = '\n';
+    return n;
+}
+
+/// @brief Encodes Intel HEX data records of up to 16 bytes, which never cross a 64 KiB boundary
+static size_t encode_hex(Output *out, const uint32_t *words, size_t count, uint8_t *dst)
+{
+    size_t len = 0;
+
+    for (size_t n = 0; n < count;)
+    {
+        uint32_t addr = out->origin + (out->words + n) * 4;
+        if (addr >> 16 != out->hex_upper)
+        {
+            uint8_t upper[2];
+            out->hex_upper = addr >> 16;
+            store_be16(upper, out->hex_upper);
+            len += hex_record(dst + len, 0x04, 0, upper, 2);
+        }
+
+        size_t record_words = (0x10000 - (addr & 0xFFFF)) / 4;
+        if (record_words > 4)
+            record_words = 4;
+        if (record_words > count - n)
+            record_words = count - n;
+
+        uint8_t data[16];
+        for (size_t i = 0; i < record_words; i++)
+            store_be32(data + i * 4, words[n + i]);
+
+        len += hex_record(dst + len, 0x00, addr & 0xFFFF, data, record_words * 4);
+        n += record_words;
+    }
+
+    return len;
+}
+
+/// @brief Encodes words in the format of the output, dst must have room for encoded_bound bytes
+static size_t encode_words(Output *out, const uint32_t *words, size_t count, uint8_t *dst)
+{
+    // the text of each nibble, so a word takes 8 copies instead of 32 digit conversions
+    static const char nibble_bits[16][4] = {
+        "0000", "0001", "0010", "0011", "0100", "0101", "0110", "0111",
+        "1000", "1001", "1010", "1011", "1100", "1101", "1110", "1111",
+    };
+
+    switch (out->format)
+    {
+    case FORMAT_HEX:
+        return encode_hex(out, words, count, dst);
+    case FORMAT_BITS:
+        for (size_t n = 0; n < count; n++)
+        {
+            uint8_t *line = dst + n * 33;
+            for (int i = 0; i < 8; i++)
+                memcpy(line + i * 4, nibble_bits[(words[n] >> (28 - i * 4)) & 0xF], 4);
+            line[32] = '\n';
+        }
+        return count * 33;
+    default:
+        // byte swap the whole chunk in one loop, which the compiler vectorizes
+        for (size_t n = 0; n < count; n++)
+            store_be32(dst + n * 4, words[n]);
+        return count * 4;
+    }
+}
+
+/// @brief Builds the ELF header and program header for a program of count words
+static void elf_header(uint8_t *dst, uint32_t origin, uint32_t count)
+{
+    static const uint8_t ident[16] = {0x7F, 'E', 'L', 'F', 1 /* 32 bit */, 2 /* big endian */, 1 /* version */};
+    uint8_t *phdr = dst + ELF_HEADER_SIZE;
+
+    memset(dst, 0, ELF_HEADER_SIZE + ELF_PHDR_SIZE);
+    memcpy(dst, ident, sizeof(ident));
+    store_be16(dst + 16, 2);               // e_type: executable
+    store_be16(dst + 18, 8);               // e_machine: MIPS
+    store_be32(dst + 20, 1);               // e_version
+    store_be32(dst + 24, origin);          // e_entry
+    store_be32(dst + 28, ELF_HEADER_SIZE); // e_phoff
+    store_be16(dst + 40, ELF_HEADER_SIZE); // e_ehsize
+    store_be16(dst + 42, ELF_PHDR_SIZE);   // e_phentsize
+    store_be16(dst + 44, 1);               // e_phnum
+
+    store_be32(phdr + 0, 1);                               // p_type: loadable
+    store_be32(phdr + 4, ELF_HEADER_SIZE + ELF_PHDR_SIZE); // p_offset
+    store_be32(phdr + 8, origin);                          // p_vaddr
+    store_be32(phdr + 12, origin);                         // p_paddr
+    store_be32(phdr + 16, count * 4);                      // p_filesz
+    store_be32(phdr + 20, count * 4);                      // p_memsz
+    // the segment holds the .data words after the text, which the program can store to
+    store_be32(phdr + 24, 7);                              // p_flags: read, write and execute
+    store_be32(phdr + 28, 4);                              // p_align
+}
+
+/// @brief Writes all of buf, retrying short writes
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0)
+        {
+            perror("Failed to write output");
+            return 1;
+        }
+        buf += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/// @brief Writes bytes at the current end of the output
+static int append_bytes(Output *out, const uint8_t *data, size_t len)
+{
+    if (out->mapped)
+    {
+        if (pwrite(out->fd, data, len, out->offset) != (ssize_t)len)
+        {
+            perror("Failed to write output");
+            return 1;
+        }
+    }
+    else if (out->deferred)
+    {
+        if (out->len + len > out->capacity)
+        {
+            out->capacity = (out->len + len) * 2;
+            out->buf = realloc(out->buf, out->capacity);
+            if (!out->buf)
+            {
+                perror("Failed to allocate memory");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memcpy(out->buf + out->len, data, len);
+        out->len += len;
+    }
+    else if (write_all(out->fd, data, len))
+    {
+        return 1;
+    }
+
+    out->offset += len;
+    return 0;
+}
+
+/// @brief Opens a temporary file next to a regular output file, with the mode of the file it replaces.
+/// @return The file descriptor, or -1 on failure
+static int open_temp_output(Output *out, const char *filename, const struct stat *existing)
+{
+    size_t size = strlen(filename) + 32;
+    out->temp_name = malloc(size);
+    if (!out->temp_name)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(out->temp_name, size, "%s.%ld.tmp", filename, (long)getpid());
+
+    // read access is needed to map the file
+    int fd = open(out->temp_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0 && existing)
+        fchmod(fd, existing->st_mode & 07777);
+    return fd;
+}
+
+int open_output(Output *out, const char *filename, OutputFormat format, uint32_t origin)
+{
+    *out = (Output){.format = format, .origin = origin, .filename = filename};
+
+    struct stat st;
+    if (!strcmp(filename, "-"))
+    {
+        out->fd = STDOUT_FILENO;
+    }
+    else
+    {
+        // devices, pipes and links are written in place
+        int exists = lstat(filename, &st) == 0;
+        if (!exists || S_ISREG(st.st_mode))
+            out->fd = open_temp_output(out, filename, exists ? &st : NULL);
+        else
+            out->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+        if (out->fd < 0)
+        {
+            fprintf(stderr, "Error: Could not open file %s\n", filename);
+            free(out->temp_name);
+            out->temp_name = NULL;
+            return 1;
+        }
+    }
+
+    out->mapped = fstat(out->fd, &st) == 0 && S_ISREG(st.st_mode) && out->fd != STDOUT_FILENO;
+    out->deferred = format == FORMAT_ELF && !out->mapped;
+
+    if (format == FORMAT_ELF)
+    {
+        // the sizes are filled in by close_output
+        uint8_t header[ELF_HEADER_SIZE + ELF_PHDR_SIZE];
+        elf_header(header, origin, 0);
+        return append_bytes(out, header, sizeof(header));
+    }
+
+    return 0;
+}
+
+/// @brief Grows the file and encodes the words straight into a mapping of the new part
+static int write_mapped(Output *out, const uint32_t *words, size_t count)
+{
+    size_t bound = encoded_bound(out->format, count);
+    // mappings start at a page boundary, the chunk starts delta bytes into the mapping
+    uint64_t start = out->offset & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+    size_t delta = out->offset - start;
+
+    if (ftruncate(out->fd, out->offset + bound) != 0)
+    {
+        perror("Failed to grow output");
+        return 1;
+    }
+
+    uint8_t *map = mmap(NULL, delta + bound, PROT_READ | PROT_WRITE, MAP_SHARED, out->fd, start);
+    if (map == MAP_FAILED)
+    {
+        perror("Failed to map output");
+        return 1;
+    }
+
+    out->offset += encode_words(out, words, count, map + delta);
+    munmap(map, delta + bound);
+    return 0;
+}
+
+int write_output(Output *out, const uint32_t *words, size_t count)
+{
+    if (count == 0)
+        return 0;
+
+    int status;
+    if (out->mapped)
+    {
+        status = write_mapped(out, words, count);
+    }
+    else
+    {
+        size_t bound = encoded_bound(out->format, count);
+        if (out->len + bound > out->capacity)
+        {
+            out->capacity = (out->len + bound) * 2;
+            out->buf = realloc(out->buf, out->capacity);
+            if (!out->buf)
+            {
+                perror("Failed to allocate memory");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        size_t len = encode_words(out, words, count, out->buf + out->len);
+        out->offset += len;
+        if (out->deferred)
+        {
+            out->len += len;
+            status = 0;
+        }
+        else
+        {
+            status = write_all(out->fd, out->buf, len);
+        }
+    }
+
+    out->words += count;
+    return status;
+}
+
+int close_output(Output *out)
+{
+    int status = 0;
+
+    if (out->format == FORMAT_HEX)
+        status = append_bytes(out, (const uint8_t *)HEX_EOF_RECORD, strlen(HEX_EOF_RECORD));
+
+    if (out->format == FORMAT_ELF)
+    {
+        uint8_t header[ELF_HEADER_SIZE + ELF_PHDR_SIZE];
+        elf_header(header, out->origin, out->words);
+
+        if (out->mapped)
+        {
+            status = status || pwrite(out->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header);
+        }
+        else
+        {
+            memcpy(out->buf, header, sizeof(header));
+            status = status || write_all(out->fd, out->buf, out->len);
+        }
+    }
+
+    // the mapped file was grown by the upper bound of each chunk
+    if (out->mapped && ftruncate(out->fd, out->offset) != 0)
+        status = 1;
+
+    if (out->fd != STDOUT_FILENO && close(out->fd) != 0)
+        status = 1;
+
+    if (out->temp_name && !status && rename(out->temp_name, out->filename) != 0)
+    {
+        perror("Failed to replace the output");
+        status = 1;
+    }
+    if (out->temp_name && status)
+        unlink(out->temp_name);
+
+    if (status)
+        fprintf(stderr, "Error: Could not write the output\n");
+
+    free(out->buf);
+    free(out->temp_name);
+    out->buf = NULL;
+    out->temp_name = NULL;
+    return status;
+}
+
+void discard_output(Output *out)
+{
+    if (out->fd != STDOUT_FILENO)
+        close(out->fd);
+    if (out->temp_name)
+        unlink(out->temp_name);
+
+    free(out->buf);
+    free(out->temp_name);
+    out->buf = NULL;
+    out->temp_name = NULL;
+}
+
+int patch_output(const char *filename, OutputFormat format, const uint32_t *words, uint32_t first, uint32_t count)
+{
+    // HEX records hold several words and a checksum, so the words cannot be replaced on their own
+    if (format == FORMAT_HEX)
+        return 1;
+
+    size_t word_size = format == FORMAT_BITS ? 33 : 4;
+    uint64_t offset = (format == FORMAT_ELF ? ELF_HEADER_SIZE + ELF_PHDR_SIZE : 0) + (uint64_t)first * word_size;
+
+    int fd = open(filename, O_WRONLY);
+    if (fd < 0)
+        return 1;
+
+    Output out = {.format = format};
+    uint8_t *buf = malloc(encoded_bound(format, count) + 1);
+    if (!buf)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t len = encode_words(&out, words + first, count, buf);
+    int status = pwrite(fd, buf, len, offset) != (ssize_t)len;
+
+    free(buf);
+    return close(fd) != 0 || status;
+}
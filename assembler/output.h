@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Number of words the assembler collects before they are encoded and written in one go
+#define OUTPUT_CHUNK_WORDS 65536
+
+// Size of the ELF header and the single program header in front of the code
+#define ELF_HEADER_SIZE 52
+#define ELF_PHDR_SIZE 32
+
+/// @brief Formats the assembler can write
+typedef enum
+{
+    FORMAT_RAW,  // big endian words, the format the emulator loads
+    FORMAT_HEX,  // Intel HEX records
+    FORMAT_BITS, // one line of 32 ones and zeros per word, like memory.txt
+    FORMAT_ELF   // ELF32 big endian MIPS executable with one loadable segment
+} OutputFormat;
+
+/// @brief An output file that words are written to in chunks.
+/// Chunks are encoded straight into a memory mapping of regular files and into a buffer that is written
+/// with one write call otherwise, so the number of system calls depends on the number of chunks.
+typedef struct
+{
+    int fd;
+    OutputFormat format;
+    // address of the first word, used by the HEX and ELF formats
+    uint32_t origin;
+    // number of words written so far
+    uint32_t words;
+    // number of bytes written so far
+    uint64_t offset;
+    // the output is a regular file and chunks are encoded into a mapping of it
+    int mapped;
+    // ELF to a pipe, everything is buffered until close_output because the header holds the size
+    int deferred;
+    // upper 16 bits of the address of the last Intel HEX extended linear address record
+    uint16_t hex_upper;
+    // regular files are written to this temporary file next to them, which replaces them in close_output,
+    // so a failed run never leaves a partial output. NULL for stdout and devices.
+    char *temp_name;
+    const char *filename;
+
+    // encoded bytes of the outputs that are not mapped
+    uint8_t *buf;
+    size_t len;
+    size_t capacity;
+} Output;
+
+/// @brief Parses the name of an output format.
+/// @param name raw, hex, bits or elf
+/// @param format
+/// @return 0 if successful, 1 if the name is unknown
+int parse_output_format(const char *name, OutputFormat *format);
+
+/// @brief Opens an output file. Regular files are only replaced by close_output, see discard_output.
+/// @param out
+/// @param filename name of the file, or - for stdout. Has to stay valid until the output is closed
+/// @param format
+/// @param origin address of the first word
+/// @return 0 if successful, 1 otherwise
+int open_output(Output *out, const char *filename, OutputFormat format, uint32_t origin);
+
+/// @brief Encodes words and writes them at the end of the output.
+/// @param out
+/// @param words
+/// @param count
+/// @return 0 if successful, 1 otherwise
+int write_output(Output *out, const uint32_t *words, size_t count);
+
+/// @brief Writes the end of the format, e.g. the ELF header sizes, and closes the output.
+/// A regular file is replaced by the complete output, or left as it was if writing failed.
+/// @param out
+/// @return 0 if successful, 1 otherwise
+int close_output(Output *out);
+
+/// @brief Closes an output after a failed run, a regular file is left as it was.
+/// @param out
+void discard_output(Output *out);
+
+/// @brief Replaces words of a complete output file in place, without changing its size.
+/// @param filename
+/// @param format the file has to be raw, bits or ELF, HEX is not patched
+/// @param words every word of the program
+/// @param first number of the first word to replace
+/// @param count number of words to replace
+/// @return 0 if successful, 1 if the file has to be written again instead
+int patch_output(const char *filename, OutputFormat format, const uint32_t *words, uint32_t first, uint32_t count);
@@ -1,269 +1,290 @@
 #include "parser.h"
+#include "../utils.h"
 
-// R TYPE PARSERS
-
-/// @brief Parses an R-type instruction with the format "op rd, rs, rt" into an AST node
-/// @param tokens
-/// @param index
-/// @param ast
-void parse_r_type_f_rd_rs_rt(const Token *tokens, int *index, AST *ast)
+/// @brief Stores the value of an operand in the node.
+/// @param node
+/// @param operand a letter of the pattern, see get_template_operands
+/// @param token
+static void set_operand(ASTNode *node, char operand, const Token *token)
 {
-    ASTNode node;
-    node.type = NODE_R_TYPE;
-    // Get opcode and increment index
-    node.data.rtype.op = tokens[(*index)++];
-
-    // Check if next token is a register
-    if (tokens[*index].type != TOKEN_REGISTER)
-    {
-        printf("Error: Expected register at index %d\n", *index);
-        return;
-    }
-
-    // Get register and increment index
-    node.data.rtype.rd = tokens[(*index)++];
-
-    // Check if next token is a comma
-    if (tokens[*index].type != TOKEN_COMMA)
-    {
-        printf("Error: Expected comma at index %d\n", *index);
-        return;
-    }
-    // Increment index
-    (*index)++;
-
-    // Check if next token is a register
-    if (tokens[*index].type != TOKEN_REGISTER)
-    {
-        printf("Error: Expected register at index %d\n", *index);
-        return;
-    }
-    // Get register and increment index
-    node.data.rtype.rs = tokens[(*index)++];
-
-    // Check if next token is a comma
-    if (tokens[*index].type != TOKEN_COMMA)
-    {
-        printf("Error: Expected comma at index %d\n", *index);
-        return;
-    }
-    // Increment index
-    (*index)++;
-
-    // Check if next token is a register
-    if (tokens[*index].type != TOKEN_REGISTER)
+    switch (operand)
     {
-        printf("Error: Expected register at index %d\n", *index);
-        return;
+    case 'd':
+    case 'c':
+        node->rd = token->number;
+        break;
+    case 's':
+        node->rs = token->number;
+        break;
+    case 't':
+        node->rt = token->number;
+        break;
+    case 'h':
+        node->shamt = token->number;
+        break;
+    case 'i':
+    case 'b':
+    case 'a':
+        node->value = token->number;
+        break;
     }
-    // Get register and increment index
-    node.data.rtype.rt = tokens[(*index)++];
-
-    // No need to check for shamt and funct for now
-    node.data.rtype.shamt.type = TOKEN_ZERO;
-    node.data.rtype.shamt.value = "0";
-
-    // TODO: add function to check opcode and add correct funct
-    node.data.rtype.funct.type = TOKEN_ZERO;
-    node.data.rtype.funct.value = "0";
+}
 
-    // Add node to AST
-    ast->nodes[ast->size++] = node;
+/// @brief Checks if a token is a decimal or hexadecimal constant
+static int is_constant(const Token *token)
+{
+    return token->type == TOKEN_DEC_CONST || token->type == TOKEN_HEX_CONST || token->type == TOKEN_ZERO;
 }
 
-// I TYPE PARSERS
+/// @brief Checks that an immediate fits the 16 bits of the instruction, see imm_zero_extended
+/// @return 1 if the value fits, 0 otherwise
+static int immediate_fits(InstrId id, int32_t value)
+{
+    if (imm_zero_extended(id))
+        return value >= 0 && value <= UINT16_MAX;
+    return value >= INT16_MIN && value <= INT16_MAX;
+}
 
-/// @brief Parses an I-type instruction with the format "op rt, i(rs) into an AST node
+/// @brief Parses the operands of a statement into the node.
 /// @param tokens
-/// @param index
-/// @param ast
-void parse_i_type_rt_i_rs(const Token *tokens, int *index, AST *ast)
+/// @param num_tokens
+/// @param index the first operand, advanced past the last one
+/// @param pattern the operands, see get_template_operands
+/// @param id instruction the immediate is checked for, INSTR_UNKNOWN for pseudo-instructions, which take any
+/// 32 bit value
+/// @param out
+/// @return 0 if successful, 1 otherwise
+static int parse_operands(const Token *tokens, int num_tokens, int *index, const char *pattern, InstrId id,
+                          ASTNode *out)
 {
-    ASTNode node;
-    node.type = NODE_I_TYPE;
-    // Get opcode and increment index
-    node.data.itype.op = tokens[(*index)++];
+    ASTNode node = *out;
 
-    // Check if next token is a register
-    if (tokens[*index].type != TOKEN_REGISTER)
+    for (const char *operand = pattern; *operand; operand++)
     {
-        printf("Error: Expected register at index %d\n", *index);
-        return;
-    }
-    // Get register and increment index
-    node.data.itype.rt = tokens[(*index)++];
+        const Token *token = *index < num_tokens ? &tokens[*index] : NULL;
 
-    // Check if next token is a comma
-    if (tokens[*index].type != TOKEN_COMMA)
-    {
-        printf("Error: Expected comma at index %d\n", *index);
-        return;
-    }
-    // Increment index
-    (*index)++;
+        switch (*operand)
+        {
+        case ',':
+            if (token == NULL || token->type != TOKEN_COMMA)
+            {
+                fprintf(stderr, "Error: Expected comma at index %d\n", *index);
+                return 1;
+            }
+            break;
+        case '(':
+            if (token == NULL || token->type != TOKEN_L_PAREN)
+            {
+                fprintf(stderr, "Error: Expected left parenthesis at index %d\n", *index);
+                return 1;
+            }
+            break;
+        case ')':
+            if (token == NULL || token->type != TOKEN_R_PAREN)
+            {
+                fprintf(stderr, "Error: Expected right parenthesis at index %d\n", *index);
+                return 1;
+            }
+            break;
+        case 'b':
+        case 'a':
+            // Branch offsets and jump targets can be labels, which are resolved by the caller
+            if (token != NULL && token->type == TOKEN_INSTRUCTION)
+            {
+                node.label = *index;
+                break;
+            }
+            // fall through
+        case 'h':
+        case 'i':
+            if (token == NULL || !is_constant(token))
+            {
+                fprintf(stderr, "Error: Expected immediate at index %d\n", *index);
+                return 1;
+            }
+            if (*operand == 'h' && (token->number < 0 || token->number > 31))
+            {
+                fprintf(stderr, "Error: Shift amount %d out of range at index %d\n", token->number, *index);
+                return 1;
+            }
+            if (*operand == 'i' && id != INSTR_UNKNOWN && !immediate_fits(id, token->number))
+            {
+                fprintf(stderr, "Error: Immediate %d out of range at index %d\n", token->number, *index);
+                return 1;
+            }
+            set_operand(&node, *operand, token);
+            break;
+        default:
+            if (token == NULL || token->type != TOKEN_REGISTER)
+            {
+                fprintf(stderr, "Error: Expected register at index %d\n", *index);
+                return 1;
+            }
+            set_operand(&node, *operand, token);
+            break;
+        }
 
-    // Check if next token is a decimal or hexadecimal constant
-    if (tokens[*index].type != TOKEN_DEC_CONST && tokens[*index].type != TOKEN_HEX_CONST && tokens[*index].type != TOKEN_ZERO)
-    {
-        printf("Error: Expected immediate at index %d\n", *index);
-        return;
+        (*index)++;
     }
-    // Get immediate and increment index
-    node.data.itype.immediate = tokens[(*index)++];
 
-    // Check if next token is a left parenthesis
-    if (tokens[*index].type != TOKEN_L_PAREN)
-    {
-        printf("Error: Expected left parenthesis\n");
-        return;
-    }
-    // Increment index
-    (*index)++;
+    *out = node;
+    return 0;
+}
 
-    // Check if next token is a register
-    if (tokens[*index].type != TOKEN_REGISTER)
+// Register that holds the intermediate results of pseudo-instructions
+#define REG_AT 1
+
+// Pseudo-instructions as X(ID, mnemonic, operands), the operands follow the patterns of get_template_operands
+#define PSEUDO_TABLE(X)       \
+    X(NOP, nop, "")           \
+    X(MOVE, move, "d,s")      \
+    X(LI, li, "t,i")          \
+    X(LA, la, "t,a")          \
+    X(B, b, "b")              \
+    X(BLT, blt, "s,t,b")      \
+    X(BGT, bgt, "s,t,b")      \
+    X(BLE, ble, "s,t,b")      \
+    X(BGE, bge, "s,t,b")      \
+    X(BLTU, bltu, "s,t,b")    \
+    X(BGTU, bgtu, "s,t,b")    \
+    X(BLEU, bleu, "s,t,b")    \
+    X(BGEU, bgeu, "s,t,b")
+
+typedef enum
+{
+#define PSEUDO_ENUM(id, name, operands) PSEUDO_##id,
+    PSEUDO_TABLE(PSEUDO_ENUM)
+#undef PSEUDO_ENUM
+    PSEUDO_COUNT
+} PseudoId;
+
+typedef struct
+{
+    const char *name;
+    uint8_t len;
+    const char *operands;
+} PseudoDesc;
+
+static const PseudoDesc pseudo_desc[PSEUDO_COUNT] = {
+#define PSEUDO_DESC(id, name, operands) [PSEUDO_##id] = {#name, sizeof(#name) - 1, operands},
+    PSEUDO_TABLE(PSEUDO_DESC)
+#undef PSEUDO_DESC
+};
+
+/// @brief Loads a 32 bit constant with as few instructions as possible.
+/// @return The number of nodes
+static int load_immediate(uint8_t rt, int32_t value, ASTNode *nodes)
+{
+    if (value >= INT16_MIN && value <= INT16_MAX)
     {
-        printf("Error: Expected register at index %d\n", *index);
-        return;
+        nodes[0] = (ASTNode){.id = INSTR_ADDIU, .rt = rt, .value = value, .label = -1};
+        return 1;
     }
-    // Get register and increment index
-    node.data.itype.rs = tokens[(*index)++];
-
-    // Check if next token is a right parenthesis
-    if (tokens[*index].type != TOKEN_R_PAREN)
+    if (value >= 0 && value <= 0xFFFF)
     {
-        printf("Error: Expected right parenthesis\n");
-        return;
+        nodes[0] = (ASTNode){.id = INSTR_ORI, .rt = rt, .value = value, .label = -1};
+        return 1;
     }
-    // Increment index
-    (*index)++;
 
-    // Add node to AST
-    ast->nodes[ast->size++] = node;
+    nodes[0] = (ASTNode){.id = INSTR_LUI, .rt = rt, .value = (uint32_t)value >> 16, .label = -1};
+    if ((value & 0xFFFF) == 0)
+        return 1;
+    nodes[1] = (ASTNode){.id = INSTR_ORI, .rt = rt, .rs = rt, .value = value & 0xFFFF, .label = -1};
+    return 2;
 }
 
-/// @brief Parses an R-type instruction with the format "op rs, rt, label" into an AST node
-/// @param tokens
-/// @param index
-/// @param ast
-void parse_i_type_rs_rt_label(const Token *tokens, int *index, AST *ast)
+/// @brief Sets $at to a < b with slt or sltu, then branches to the target of args with bne or beq on $at.
+/// @return The number of nodes
+static int compare_branch(InstrId compare, uint8_t a, uint8_t b, InstrId branch, const ASTNode *args, ASTNode *nodes)
 {
-    ASTNode node;
-    node.type = NODE_I_TYPE;
-    // Get opcode and increment index
-    node.data.itype.op = tokens[(*index)++];
+    nodes[0] = (ASTNode){.id = compare, .rd = REG_AT, .rs = a, .rt = b, .label = -1};
+    nodes[1] = (ASTNode){.id = branch, .rs = REG_AT, .value = args->value, .label = args->label, .fixup = FIXUP_BRANCH};
+    return 2;
+}
 
-    // Check if next token is a register
-    if (tokens[*index].type != TOKEN_REGISTER)
+/// @brief Writes the instructions a pseudo-instruction stands for.
+/// @param id
+/// @param args the parsed operands
+/// @param nodes
+/// @return The number of nodes
+static int expand_pseudo(PseudoId id, const ASTNode *args, ASTNode *nodes)
+{
+    switch (id)
     {
-        printf("Error: Expected register at index %d\n", *index);
-        return;
+    case PSEUDO_NOP:
+        // sll $zero, $zero, 0 is the all zero word
+        nodes[0] = (ASTNode){.id = INSTR_SLL, .label = -1};
+        return 1;
+    case PSEUDO_MOVE:
+        nodes[0] = (ASTNode){.id = INSTR_ADDU, .rd = args->rd, .rs = args->rs, .label = -1};
+        return 1;
+    case PSEUDO_LI:
+        return load_immediate(args->rt, args->value, nodes);
+    case PSEUDO_LA:
+        // always two instructions, the address of a label is only known once it is defined
+        nodes[0] = (ASTNode){.id = INSTR_LUI, .rt = args->rt, .value = (uint32_t)args->value >> 16,
+                             .label = args->label, .fixup = FIXUP_HI};
+        nodes[1] = (ASTNode){.id = INSTR_ORI, .rt = args->rt, .rs = args->rt, .value = args->value & 0xFFFF,
+                             .label = args->label, .fixup = FIXUP_LO};
+        return 2;
+    case PSEUDO_B:
+        nodes[0] = (ASTNode){.id = INSTR_BEQ, .value = args->value, .label = args->label, .fixup = FIXUP_BRANCH};
+        return 1;
+    case PSEUDO_BLT:
+        return compare_branch(INSTR_SLT, args->rs, args->rt, INSTR_BNE, args, nodes);
+    case PSEUDO_BGT:
+        return compare_branch(INSTR_SLT, args->rt, args->rs, INSTR_BNE, args, nodes);
+    case PSEUDO_BLE:
+        return compare_branch(INSTR_SLT, args->rt, args->rs, INSTR_BEQ, args, nodes);
+    case PSEUDO_BGE:
+        return compare_branch(INSTR_SLT, args->rs, args->rt, INSTR_BEQ, args, nodes);
+    case PSEUDO_BLTU:
+        return compare_branch(INSTR_SLTU, args->rs, args->rt, INSTR_BNE, args, nodes);
+    case PSEUDO_BGTU:
+        return compare_branch(INSTR_SLTU, args->rt, args->rs, INSTR_BNE, args, nodes);
+    case PSEUDO_BLEU:
+        return compare_branch(INSTR_SLTU, args->rt, args->rs, INSTR_BEQ, args, nodes);
+    case PSEUDO_BGEU:
+        return compare_branch(INSTR_SLTU, args->rs, args->rt, INSTR_BEQ, args, nodes);
+    default:
+        return 0;
     }
-    // Get register and increment index
-    node.data.itype.rs = tokens[(*index)++];
+}
 
-    // Check if next token is a comma
-    if (tokens[*index].type != TOKEN_COMMA)
+int parse_statement(const Token *tokens, int num_tokens, int *index, ASTNode *nodes, int *num_nodes)
+{
+    const Token *mnemonic = &tokens[*index];
+    if (mnemonic->type != TOKEN_INSTRUCTION)
     {
-        printf("Error: Expected comma at index %d\n", *index);
-        return;
+        fprintf(stderr, "Error: Expected identifier at index %d\n", *index);
+        return 1;
     }
-    // Increment index
+    // Skip the opcode
     (*index)++;
 
-    // Check if next token is a register
-    if (tokens[*index].type != TOKEN_REGISTER)
-    {
-        printf("Error: Expected register at index %d\n", *index);
-        return;
-    }
-    // Get register and increment index
-    node.data.itype.rt = tokens[(*index)++];
-
-    // Check if next token is a comma
-    if (tokens[*index].type != TOKEN_COMMA)
+    const InstrDesc *desc = get_mnemonic_info(mnemonic->value, mnemonic->len);
+    if (desc != NULL)
     {
-        printf("Error: Expected comma at index %d\n", *index);
-        return;
+        // Operands that are not in the pattern stay $zero or 0
+        nodes[0] = (ASTNode){.id = desc->id, .label = -1};
+        nodes[0].fixup = get_instr_type(desc->format) == J_TYPE ? FIXUP_JUMP : FIXUP_BRANCH;
+        *num_nodes = 1;
+        return parse_operands(tokens, num_tokens, index, get_template_operands(desc->format), desc->id, &nodes[0]);
     }
-    // Increment index
-    (*index)++;
 
-    // Check if next token is a decimal or hexadecimal constant
-    if (tokens[*index].type != TOKEN_DEC_CONST && tokens[*index].type != TOKEN_HEX_CONST && tokens[*index].type != TOKEN_ZERO)
+    // Pseudo-instructions are only looked up once the mnemonic is not a real instruction
+    for (int id = 0; id < PSEUDO_COUNT; id++)
     {
-        printf("Error: Expected immediate at index %d\n", *index);
-        return;
+        if (pseudo_desc[id].len != mnemonic->len || memcmp(pseudo_desc[id].name, mnemonic->value, mnemonic->len))
+            continue;
+
+        ASTNode args = {.label = -1};
+        if (parse_operands(tokens, num_tokens, index, pseudo_desc[id].operands, INSTR_UNKNOWN, &args))
+            return 1;
+        *num_nodes = expand_pseudo(id, &args, nodes);
+        return 0;
     }
-    // Get immediate and increment index
-    node.data.itype.immediate = tokens[(*index)++];
-
-    // Add node to AST
-    ast->nodes[ast->size++] = node;
-}
-
-// J TYPE PARSERS
-
-/// @brief Parses a J-type instruction with the format "op label" into an AST node
-/// @param tokens
-/// @param index
-/// @param ast
-void parse_j_type_label(const Token *tokens, int *index, AST *ast)
-{
-    ASTNode node;
-    node.type = NODE_J_TYPE;
-    // Get opcode and increment index
-    node.data.jtype.op = tokens[(*index)++];
 
-    // Check if next token is an immediate
-    if (tokens[*index].type != TOKEN_DEC_CONST && tokens[*index].type != TOKEN_HEX_CONST && tokens[*index].type != TOKEN_ZERO)
-    {
-        printf("Error: Expected immediate at index %d\n", *index);
-        return;
-    }
-    // Get immediate and increment index
-    node.data.jtype.address = tokens[(*index)++];
-
-    // Add node to AST
-    ast->nodes[ast->size++] = node;
-}
-
-void parse_tokens(const Token *tokens, int num_tokens, AST *ast)
-{
-    ast->size = 0;
-    int index = 0;
-
-    while (index < num_tokens)
-    {
-        if (tokens[index].type == TOKEN_INSTRUCTION)
-        {
-            // TODO: Create function to check token instruction type
-            if (strcmp(tokens[index].value, "add") == 0)
-            {
-                parse_r_type_f_rd_rs_rt(tokens, &index, ast);
-            }
-            else if (strcmp(tokens[index].value, "lw") == 0 || strcmp(tokens[index].value, "sw") == 0)
-            {
-                parse_i_type_rt_i_rs(tokens, &index, ast);
-            }
-            else if (strcmp(tokens[index].value, "beq") == 0)
-            {
-                parse_i_type_rs_rt_label(tokens, &index, ast);
-            }
-            else if (strcmp(tokens[index].value, "j") == 0)
-            {
-                parse_j_type_label(tokens, &index, ast);
-            }
-            else
-            {
-                printf("Error: Unknown instruction %s\n", tokens[index].value);
-                return;
-            }
-        }
-        else
-        {
-            printf("Error: Expected identifier at index %d\n", index);
-            return;
-        }
-    }
+    fprintf(stderr, "Error: Unknown instruction %.*s\n", (int)mnemonic->len, mnemonic->value);
+    return 1;
 }
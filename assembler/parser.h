@@ -1,56 +1,35 @@
 #pragma once
 
 #include "tokenizer.h"
+#include "symbols.h"
 
-/// @brief Enumerates the different types of nodes in the AST
-typedef enum {
-    NODE_R_TYPE,
-    NODE_I_TYPE,
-    NODE_J_TYPE
-} NodeType;
+// Most instructions a statement is assembled into, pseudo-instructions like la expand to two
+#define MAX_STATEMENT_NODES 2
 
-/// @brief Represents an R-type instruction node in the AST
+/// @brief Represents a parsed instruction. Nodes only hold the parsed operand values, the encoding
+/// type and operand layout come from the instruction's entry in the ISA table.
 typedef struct {
-    Token op;
-    Token rd;
-    Token rs;
-    Token rt;
-    Token shamt;
-    Token funct;
-} RTypeNode;
-
-/// @brief Represents an I-type instruction node in the AST
-typedef struct {
-    Token op;
-    Token rs;
-    Token rt;
-    Token immediate;
-} ITypeNode;
-
-/// @brief Represents a J-type instruction node in the AST
-typedef struct {
-    Token op;
-    Token address;
-} JTypeNode;
-
-/// @brief Represents a node in the AST
-typedef struct {
-    NodeType type;
-    union {
-        RTypeNode rtype;
-        ITypeNode itype;
-        JTypeNode jtype;
-    } data;
+    // InstrId of the instruction
+    uint8_t id;
+    uint8_t rs;
+    uint8_t rt;
+    uint8_t rd;
+    uint8_t shamt;
+    // immediate or jump target
+    int32_t value;
+    // index of the token of a label operand, -1 if every operand is a number
+    int32_t label;
+    // FixupKind, how the address of the label is filled in
+    uint8_t fixup;
 } ASTNode;
 
-/// @brief Represents the AST
-typedef struct {
-    ASTNode nodes[MAX_TOKENS]; // Adjust size as needed
-    int size;
-} AST;
-
-/// @brief Parses the tokens into an AST
-/// @param tokens 
-/// @param num_tokens 
-/// @param ast 
-void parse_tokens(const Token *tokens, int num_tokens, AST *ast);
\ No newline at end of file
+/// @brief Parses the statement starting at tokens[*index], the operands follow the pattern of its template in the ISA table.
+/// Pseudo-instructions (nop, move, li, la, b and the blt, bgt, ble, bge family) are expanded into the instructions
+/// they stand for, the compare and branch ones use $at.
+/// @param tokens
+/// @param num_tokens
+/// @param index advanced past the statement
+/// @param nodes room for MAX_STATEMENT_NODES nodes, one for each instruction in order
+/// @param num_nodes number of nodes stored
+/// @return 0 if successful, 1 otherwise
+int parse_statement(const Token *tokens, int num_tokens, int *index, ASTNode *nodes, int *num_nodes);
@@ -0,0 +1,244 @@
+#include "srcmap.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/// @brief Grows an array to hold at least needed elements, doubling its capacity.
+static void *grow(void *data, size_t elem_size, uint32_t needed, uint32_t *capacity)
+{
+    if (needed <= *capacity)
+        return data;
+
+    uint32_t new_capacity = *capacity ? *capacity : 256;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+
+    data = realloc(data, (size_t)new_capacity * elem_size);
+    if (!data)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    *capacity = new_capacity;
+    return data;
+}
+
+/// @brief Appends a null terminated copy of a string to the strings of a map.
+/// @return Offset of the copy
+static uint32_t add_string(SourceMap *map, const char *text, size_t len)
+{
+    uint32_t offset = map->strings_size;
+    map->strings = grow(map->strings, 1, offset + len + 1, &map->strings_capacity);
+    memcpy(map->strings + offset, text, len);
+    map->strings[offset + len] = '\0';
+    map->strings_size += len + 1;
+    return offset;
+}
+
+void set_source_file(SourceMap *map, const char *name)
+{
+    map->file = add_string(map, name, strlen(name));
+}
+
+void add_source_line(SourceMap *map, uint32_t addr, uint32_t line)
+{
+    if (map->num_lines > 0)
+    {
+        SourceLine *last = &map->lines[map->num_lines - 1];
+        if (ntohl(last->line) == line && ntohl(last->file) == map->file)
+            return;
+
+        // the previous line emitted nothing after all
+        if (ntohl(last->addr) == addr)
+        {
+            *last = (SourceLine){htonl(addr), htonl(line), htonl(map->file)};
+            return;
+        }
+    }
+
+    map->lines = grow(map->lines, sizeof(SourceLine), map->num_lines + 1, &map->lines_capacity);
+    map->lines[map->num_lines++] = (SourceLine){htonl(addr), htonl(line), htonl(map->file)};
+}
+
+/// @brief Orders labels by address, in host order while the map is ended
+static int compare_labels(const void *a, const void *b)
+{
+    const SourceLabel *x = a, *y = b;
+    if (x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+    return x->name < y->name ? -1 : x->name > y->name;
+}
+
+void end_source_map(SourceMap *map, uint32_t end, const SymbolTable *symbols)
+{
+    map->end = end;
+
+    uint32_t capacity = map->num_labels;
+    for (uint32_t n = 0; n < symbols->capacity; n++)
+    {
+        const Symbol *symbol = &symbols->entries[n];
+        if (symbol->len == 0 || !symbol->defined)
+            continue;
+
+        map->labels = grow(map->labels, sizeof(SourceLabel), map->num_labels + 1, &capacity);
+        map->labels[map->num_labels++] =
+            (SourceLabel){symbol->addr, add_string(map, symbol_name(symbols, symbol), symbol->len)};
+    }
+
+    qsort(map->labels, map->num_labels, sizeof(SourceLabel), compare_labels);
+    for (uint32_t n = 0; n < map->num_labels; n++)
+        map->labels[n] = (SourceLabel){htonl(map->labels[n].addr), htonl(map->labels[n].name)};
+}
+
+int write_source_map(const SourceMap *map, const char *filename)
+{
+    FILE *file = fopen(filename, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return 1;
+    }
+
+    SourceMapHeader header = {htonl(SOURCE_MAP_MAGIC), htonl(SOURCE_MAP_VERSION), htonl(map->end),
+                              htonl(map->num_lines), htonl(map->num_labels), htonl(map->strings_size)};
+
+    int status = fwrite(&header, sizeof(header), 1, file) != 1 ||
+                 fwrite(map->lines, sizeof(SourceLine), map->num_lines, file) != map->num_lines ||
+                 fwrite(map->labels, sizeof(SourceLabel), map->num_labels, file) != map->num_labels ||
+                 fwrite(map->strings, 1, map->strings_size, file) != map->strings_size;
+    status = fclose(file) || status;
+
+    if (status)
+        fprintf(stderr, "Error: Could not write file %s\n", filename);
+    return status;
+}
+
+int load_source_map(SourceMap *map, const char *filename)
+{
+    *map = (SourceMap){0};
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return 1;
+    }
+
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SourceMapHeader))
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    const SourceMapHeader *header = mapping;
+    // the sizes are added up in 64 bits, so a corrupt count cannot wrap around
+    uint64_t size = 0;
+    if (mapping != MAP_FAILED)
+        size = sizeof(SourceMapHeader) + (uint64_t)ntohl(header->num_lines) * sizeof(SourceLine) +
+               (uint64_t)ntohl(header->num_labels) * sizeof(SourceLabel) + ntohl(header->strings_size);
+
+    if (mapping == MAP_FAILED || ntohl(header->magic) != SOURCE_MAP_MAGIC ||
+        ntohl(header->version) != SOURCE_MAP_VERSION || size != (uint64_t)st.st_size ||
+        (header->strings_size && ((const char *)mapping)[size - 1] != '\0'))
+    {
+        fprintf(stderr, "Error: %s is not a source map\n", filename);
+        if (mapping != MAP_FAILED)
+            munmap(mapping, st.st_size);
+        return 1;
+    }
+
+    map->mapping = mapping;
+    map->mapping_size = st.st_size;
+    map->end = ntohl(header->end);
+    map->num_lines = ntohl(header->num_lines);
+    map->num_labels = ntohl(header->num_labels);
+    map->strings_size = ntohl(header->strings_size);
+    map->lines = (SourceLine *)(header + 1);
+    map->labels = (SourceLabel *)(map->lines + map->num_lines);
+    map->strings = (char *)(map->labels + map->num_labels);
+    return 0;
+}
+
+/// @brief Gets a string of a map, offsets come from files that may be corrupt
+static const char *string_at(const SourceMap *map, uint32_t offset)
+{
+    return offset < map->strings_size ? map->strings + offset : "?";
+}
+
+int lookup_source(const SourceMap *map, uint32_t addr, SourceLocation *loc)
+{
+    *loc = (SourceLocation){0};
+    if (addr >= map->end)
+        return 0;
+
+    // first line after addr, the one before it covers addr
+    uint32_t low = 0, high = map->num_lines;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (ntohl(map->lines[mid].addr) <= addr)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low > 0)
+    {
+        loc->file = string_at(map, ntohl(map->lines[low - 1].file));
+        loc->line = ntohl(map->lines[low - 1].line);
+    }
+
+    low = 0, high = map->num_labels;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (ntohl(map->labels[mid].addr) <= addr)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low > 0)
+    {
+        loc->label = string_at(map, ntohl(map->labels[low - 1].name));
+        loc->offset = addr - ntohl(map->labels[low - 1].addr);
+    }
+
+    return loc->file != NULL || loc->label != NULL;
+}
+
+int format_source(const SourceMap *map, uint32_t addr, char *buf, size_t size)
+{
+    SourceLocation loc;
+    if (size == 0)
+        return 0;
+    buf[0] = '\0';
+    if (!lookup_source(map, addr, &loc))
+        return 0;
+
+    int len = 0;
+    if (loc.label)
+        len = snprintf(buf, size, loc.offset ? "%s+0x%x" : "%s", loc.label, loc.offset);
+    if (loc.file && (size_t)len < size)
+        len += snprintf(buf + len, size - len, "%s%s:%u", len ? " " : "", loc.file, loc.line);
+
+    // snprintf counts the characters that did not fit
+    return (size_t)len < size ? len : (int)size - 1;
+}
+
+void free_source_map(SourceMap *map)
+{
+    if (map->mapping)
+    {
+        munmap(map->mapping, map->mapping_size);
+    }
+    else
+    {
+        free(map->lines);
+        free(map->labels);
+        free(map->strings);
+    }
+    *map = (SourceMap){0};
+}
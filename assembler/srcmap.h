@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "symbols.h"
+
+// "MSRC", first word of a source map file
+#define SOURCE_MAP_MAGIC 0x4d535243
+#define SOURCE_MAP_VERSION 1
+
+/// @brief Start of a source map file. The file is the header, the lines, the labels and the strings back to back,
+/// every number is a big endian word like the words of the program, so a mapping of the file is used as it is.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    // address after the last byte of the program
+    uint32_t end;
+    uint32_t num_lines;
+    uint32_t num_labels;
+    // size of the null terminated strings after the labels
+    uint32_t strings_size;
+} SourceMapHeader;
+
+/// @brief The bytes from addr up to the address of the next line come from a line of a source file.
+/// Sorted by address.
+typedef struct
+{
+    uint32_t addr;
+    uint32_t line;
+    // offset of the name of the source file in the strings
+    uint32_t file;
+} SourceLine;
+
+/// @brief A label of the program, sorted by address
+typedef struct
+{
+    uint32_t addr;
+    // offset of the name in the strings
+    uint32_t name;
+} SourceLabel;
+
+/// @brief Where the byte at an address came from, see lookup_source. The strings point into the map.
+typedef struct
+{
+    // NULL if no line of the map covers the address
+    const char *file;
+    uint32_t line;
+    // closest label at or before the address, NULL if there is none
+    const char *label;
+    // distance of the address from the label
+    uint32_t offset;
+} SourceLocation;
+
+/// @brief Source lines and labels of the words of a program, built by the assembler (see Assembler.map) or loaded
+/// from a file written by it. The entries are big endian in both cases. Zero initialize before use and release
+/// with free_source_map.
+typedef struct
+{
+    SourceLine *lines;
+    uint32_t num_lines;
+    SourceLabel *labels;
+    uint32_t num_labels;
+    char *strings;
+    uint32_t strings_size;
+    uint32_t end;
+
+    // while building, the source file of the lines added next
+    uint32_t file;
+    uint32_t lines_capacity;
+    uint32_t strings_capacity;
+
+    // the arrays point into a read only mapping of a file, see load_source_map
+    void *mapping;
+    size_t mapping_size;
+} SourceMap;
+
+/// @brief Sets the source file of the lines added after it.
+/// @param map
+/// @param name
+void set_source_file(SourceMap *map, const char *name);
+
+/// @brief Records that the bytes from addr on come from a line of the current source file. Addresses have to
+/// grow from one call to the next, a line that continues the previous entry is merged into it.
+/// @param map
+/// @param addr
+/// @param line
+void add_source_line(SourceMap *map, uint32_t addr, uint32_t line);
+
+/// @brief Ends a map that is being built: records the end of the program and its defined labels.
+/// @param map
+/// @param end address after the last byte of the program
+/// @param symbols
+void end_source_map(SourceMap *map, uint32_t end, const SymbolTable *symbols);
+
+/// @brief Writes a map to a file, see SourceMapHeader for the layout.
+/// @param map
+/// @param filename
+/// @return 0 if successful, 1 otherwise
+int write_source_map(const SourceMap *map, const char *filename);
+
+/// @brief Maps a file written by write_source_map into memory.
+/// @param map
+/// @param filename
+/// @return 0 if successful, 1 if the file cannot be read or is not a source map
+int load_source_map(SourceMap *map, const char *filename);
+
+/// @brief Finds the source line and the enclosing label of an address with a binary search.
+/// @param map
+/// @param addr
+/// @param loc
+/// @return 1 if the line or the label was found, 0 if the map knows nothing about the address
+int lookup_source(const SourceMap *map, uint32_t addr, SourceLocation *loc);
+
+/// @brief Formats the location of an address, e.g. "loop+0x8 prog.asm:12".
+/// @param map
+/// @param addr
+/// @param buf
+/// @param size
+/// @return Number of characters written, 0 if the map knows nothing about the address
+int format_source(const SourceMap *map, uint32_t addr, char *buf, size_t size);
+
+/// @brief Frees or unmaps a map and empties it.
+/// @param map
+void free_source_map(SourceMap *map);
@@ -0,0 +1,128 @@
+#include "symbols.h"
+
+#include <stdio.h>
+
+/// @brief Grows an array to hold at least one more element, doubling its capacity.
+/// Exits like read_file when memory runs out.
+static void *grow_array(void *data, size_t elem_size, size_t needed, size_t *capacity, size_t init_capacity)
+{
+    if (needed <= *capacity)
+        return data;
+
+    size_t new_capacity = *capacity ? *capacity : init_capacity;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+
+    data = realloc(data, new_capacity * elem_size);
+    if (!data)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    *capacity = new_capacity;
+    return data;
+}
+
+/// @brief FNV-1a hash of a name
+static uint32_t hash_name(const char *name, size_t len)
+{
+    uint32_t h = 0x811C9DC5u;
+    for (size_t n = 0; n < len; n++)
+        h = (h ^ (uint8_t)name[n]) * 0x01000193u;
+    return h;
+}
+
+/// @brief Finds the slot of a name with linear probing, the slot is empty (len 0) if the name is not in the table
+static Symbol *find_slot(SymbolTable *table, const char *name, size_t len, uint32_t hash)
+{
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask)
+    {
+        Symbol *entry = &table->entries[slot];
+        if (entry->len == 0)
+            return entry;
+        if (entry->hash == hash && entry->len == len && !memcmp(table->names + entry->name, name, len))
+            return entry;
+    }
+}
+
+/// @brief Doubles the number of slots and reinserts every symbol
+static void rehash(SymbolTable *table)
+{
+    Symbol *old = table->entries;
+    uint32_t old_capacity = table->capacity;
+
+    table->capacity = old_capacity ? old_capacity * 2 : SYMBOL_TABLE_INIT_CAPACITY;
+    table->entries = calloc(table->capacity, sizeof(Symbol));
+    if (!table->entries)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t n = 0; n < old_capacity; n++)
+    {
+        if (old[n].len != 0)
+            *find_slot(table, table->names + old[n].name, old[n].len, old[n].hash) = old[n];
+    }
+
+    free(old);
+}
+
+Symbol *find_symbol(SymbolTable *table, const char *name, size_t len)
+{
+    if (table->count == 0 || len == 0)
+        return NULL;
+
+    Symbol *entry = find_slot(table, name, len, hash_name(name, len));
+    return entry->len ? entry : NULL;
+}
+
+Symbol *get_symbol(SymbolTable *table, const char *name, size_t len)
+{
+    uint32_t hash = hash_name(name, len);
+
+    if (table->count > 0)
+    {
+        Symbol *entry = find_slot(table, name, len, hash);
+        if (entry->len)
+            return entry;
+    }
+
+    // keep the load factor below 3/4 so probe sequences stay short
+    if ((table->count + 1) * 4 > table->capacity * 3)
+        rehash(table);
+
+    table->names = grow_array(table->names, 1, table->names_len + len, &table->names_capacity, 1024);
+    memcpy(table->names + table->names_len, name, len);
+
+    Symbol *entry = find_slot(table, name, len, hash);
+    *entry = (Symbol){.name = table->names_len, .len = len, .hash = hash, .fixups = -1};
+    table->names_len += len;
+    table->count++;
+    return entry;
+}
+
+const char *symbol_name(const SymbolTable *table, const Symbol *symbol)
+{
+    return table->names + symbol->name;
+}
+
+void add_fixup(SymbolTable *table, Symbol *symbol, FixupKind kind, uint32_t word, uint32_t line)
+{
+    size_t capacity = table->fixups_capacity;
+    table->fixups = grow_array(table->fixups, sizeof(Fixup), table->num_fixups + 1, &capacity, 64);
+    table->fixups_capacity = capacity;
+
+    table->fixups[table->num_fixups] = (Fixup){.word = word, .line = line, .next = symbol->fixups, .kind = kind};
+    symbol->fixups = table->num_fixups++;
+}
+
+void free_symbols(SymbolTable *table)
+{
+    free(table->entries);
+    free(table->names);
+    free(table->fixups);
+    *table = (SymbolTable){0};
+}
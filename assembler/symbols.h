@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Initial number of slots of the symbol table, must be a power of 2. The table doubles when it is 3/4 full.
+#define SYMBOL_TABLE_INIT_CAPACITY 64
+
+/// @brief How a reference to a label is filled in once the label is defined
+typedef enum
+{
+    FIXUP_BRANCH, // 16 bit offset in words from the instruction after the branch
+    FIXUP_JUMP,   // byte address of the label in the 26 bit target
+    FIXUP_WORD,   // byte address of the label in a whole data word
+    FIXUP_HI,     // upper 16 bits of the address in the immediate, lui of la
+    FIXUP_LO      // lower 16 bits of the address in the immediate, ori of la
+} FixupKind;
+
+/// @brief Bits of the word that a fixup fills in
+static inline uint32_t fixup_mask(FixupKind kind)
+{
+    return kind == FIXUP_WORD ? 0xFFFFFFFF : kind == FIXUP_JUMP ? 0x3FFFFFF : 0xFFFF;
+}
+
+/// @brief A reference to a label that was not defined yet when it was assembled
+typedef struct
+{
+    // number of the word to patch, counted from the start of the output
+    uint32_t word;
+    // source line of the reference, for error messages
+    uint32_t line;
+    // next fixup of the same symbol, -1 ends the list
+    int32_t next;
+    FixupKind kind;
+} Fixup;
+
+/// @brief A label, either defined or only referenced so far
+typedef struct
+{
+    // offset of the name in SymbolTable.names, names are not null terminated
+    uint32_t name;
+    uint32_t len;
+    uint32_t hash;
+    uint32_t addr;
+    // source line of the definition
+    uint32_t line;
+    // first fixup waiting for the definition, -1 if there is none
+    int32_t fixups;
+    uint8_t defined;
+    // declared with .globl, so other modules can reference it when linking
+    uint8_t global;
+} Symbol;
+
+/// @brief Open addressing hash table of labels with the fixups of forward references.
+/// Zero initialize before use and release with free_symbols.
+typedef struct
+{
+    Symbol *entries;
+    uint32_t capacity;
+    uint32_t count;
+
+    // names of all symbols, stored back to back so the source can be freed while assembling
+    char *names;
+    size_t names_len;
+    size_t names_capacity;
+
+    Fixup *fixups;
+    int num_fixups;
+    int fixups_capacity;
+} SymbolTable;
+
+/// @brief Looks up a symbol.
+/// @param table
+/// @param name
+/// @param len
+/// @return The symbol, or NULL if the name was never defined or referenced
+Symbol *find_symbol(SymbolTable *table, const char *name, size_t len);
+
+/// @brief Looks up a symbol and adds it as undefined if it is not in the table yet.
+/// The pointer is valid until the next symbol is added.
+/// @param table
+/// @param name
+/// @param len
+/// @return The symbol
+Symbol *get_symbol(SymbolTable *table, const char *name, size_t len);
+
+/// @brief Gets the name of a symbol, it is not null terminated, see Symbol.len.
+/// @param table
+/// @param symbol
+/// @return
+const char *symbol_name(const SymbolTable *table, const Symbol *symbol);
+
+/// @brief Records a reference to a symbol that is not defined yet.
+/// @param table
+/// @param symbol
+/// @param kind
+/// @param word
+/// @param line
+void add_fixup(SymbolTable *table, Symbol *symbol, FixupKind kind, uint32_t word, uint32_t line);
+
+/// @brief Frees the symbol table and empties it.
+/// @param table
+void free_symbols(SymbolTable *table);
@@ -1,4 +1,10 @@
 #include "tokenizer.h"
+#include "../utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_SIMD_SCAN
+#endif
 
 /// @brief Enumerates the possible states of the DFA. Also used to classify the token.
 typedef enum
@@ -6,17 +12,15 @@ typedef enum
     START,
     WHITESPACE,
     INSTRUCTION,
-    LABEL_INTER,
     LABEL,
     DIRECTIVE,
     STRING,
+    STRING_ESCAPE,
+    STRING_END,
     DEC_CONST,
+    MINUS,
     REGISTER_PREFIX,
-    REGISTER_INTER,
     REGISTER,
-    REGISTER_ZERO_Z,
-    REGISTER_ZERO_E,
-    REGISTER_ZERO_R,
     ZERO,
     HEX_PREFIX,
     HEX_CONST,
@@ -25,8 +29,46 @@ typedef enum
     R_PAREN,
     COMMENT,
     ERROR,
+    NUM_STATES
 } State;
 
+/// @brief Classes of input characters, characters in the same class have the same transitions in every state
+typedef enum
+{
+    C_OTHER,
+    C_SPACE,
+    C_NEWLINE,
+    C_HASH,
+    C_COMMA,
+    C_L_PAREN,
+    C_R_PAREN,
+    C_DOLLAR,
+    C_DOT,
+    C_QUOTE,
+    C_MINUS,
+    C_COLON,
+    C_UNDERSCORE,
+    C_ZERO,
+    C_DIGIT,      // 1 to 9
+    C_X,          // x and X, the hexadecimal prefix
+    C_HEX_LETTER, // a to f and A to F
+    C_LETTER,     // any other letter
+    C_BACKSLASH,  // escapes a character of a string
+    NUM_CLASSES
+} CharClass;
+
+/// @brief Character class of each byte, see build_tables
+static uint8_t char_class[256];
+
+/// @brief The DFA of next_state as a dense table, indexed by state and character class
+static uint8_t transitions[NUM_STATES][NUM_CLASSES];
+
+/// @brief Finds the first character before end that is not whitespace, or end, see select_scanners
+static const char *(*skip_space)(const char *input, const char *end);
+
+/// @brief Finds the end of a comment, the newline or end, see select_scanners
+static const char *(*find_line_end)(const char *input, const char *end);
+
 // Function prototypes
 const char *state_to_str(State state);
 TokenType state_to_token_type(State state);
@@ -58,6 +100,8 @@ State next_state(State current, char input)
             return WHITESPACE;
         if (isalpha(input))
             return INSTRUCTION;
+        if (input == '-')
+            return MINUS;
 
         if (isdigit(input))
         {
@@ -84,23 +128,14 @@ State next_state(State current, char input)
     case R_PAREN:
         return START;
 
-    // INSTRUCTION state is used to classify identifiers, either labels or instructions
+    // INSTRUCTION state is used to classify identifiers, either labels or instructions like mfc0
     case INSTRUCTION:
         if (input == ':')
             return LABEL;
-        if (isdigit(input))
-            return LABEL_INTER;
-        if (isalpha(input))
+        if (isalnum(input) || input == '_')
             return INSTRUCTION;
         return START;
 
-    case LABEL_INTER:
-        if (input == ':')
-            return LABEL;
-        if (isalnum(input))
-            return LABEL_INTER;
-        return ERROR;
-
     case LABEL:
         return START;
 
@@ -109,43 +144,36 @@ State next_state(State current, char input)
             return DIRECTIVE;
         return START;
 
+    // STRING state is the text of a string up to the closing quote, which is part of the token
     case STRING:
-        if (input != '"')
-            return STRING;
+        if (input == '"')
+            return STRING_END;
+        if (input == '\\')
+            return STRING_ESCAPE;
+        if (input == '\n')
+            return ERROR;
+        return STRING;
+
+    // STRING_ESCAPE state is the character after a backslash, it does not close the string
+    case STRING_ESCAPE:
+        if (input == '\n')
+            return ERROR;
+        return STRING;
+
+    case STRING_END:
         return START;
 
-    // REGISTER_PREFIX means $ and the next character should be a valid register name, minus zero (t, s, a, v)
+    // REGISTER_PREFIX means $, the name after it is checked with get_register_number once the token is complete
     case REGISTER_PREFIX:
-        if (input == 't' || input == 's' || input == 'a' || input == 'v')
-            return REGISTER_INTER;
-        if (input == 'z')
-            return REGISTER_ZERO_Z;
-        return ERROR;
-
-    case REGISTER_INTER:
-        if (isdigit(input))
+        if (isalnum(input))
             return REGISTER;
         return ERROR;
 
-    // REGISTER state is used to classify register names, which are $ followed by a letter and a digit
+    // REGISTER state is used to classify register names like $t0, $sp or $8
     case REGISTER:
-        return START;
-
-    case REGISTER_ZERO_Z:
-        if (input == 'e')
-            return REGISTER_ZERO_E;
-        return ERROR;
-
-    // Special cases for the zero register
-    case REGISTER_ZERO_E:
-        if (input == 'r')
-            return REGISTER_ZERO_R;
-        return ERROR;
-
-    case REGISTER_ZERO_R:
-        if (input == 'o')
+        if (isalnum(input))
             return REGISTER;
-        return ERROR;
+        return START;
 
     // ZERO state is used to classify the number 0, which can be used to represent a zero constant or a hexadecimal constant
     case ZERO:
@@ -155,6 +183,14 @@ State next_state(State current, char input)
             return ERROR;
         return START;
 
+    // MINUS state is the sign of a negative constant
+    case MINUS:
+        if (input == '0')
+            return ZERO;
+        if (isdigit(input))
+            return DEC_CONST;
+        return ERROR;
+
     // DEC_CONST state is used to classify decimal constants
     case DEC_CONST:
         if (isdigit(input))
@@ -178,37 +214,339 @@ State next_state(State current, char input)
     }
 }
 
-int tokenize(const char *input, Token *tokens, int *num_tokens)
+/// @brief Classifies a character, only used to build char_class
+static CharClass classify(int c)
 {
-    // We start in the START state with the input pointer at the beginning of the input string
-    State state = START;
+    switch (c)
+    {
+    case '\n':
+        return C_NEWLINE;
+    case '#':
+        return C_HASH;
+    case ',':
+        return C_COMMA;
+    case '(':
+        return C_L_PAREN;
+    case ')':
+        return C_R_PAREN;
+    case '$':
+        return C_DOLLAR;
+    case '.':
+        return C_DOT;
+    case '"':
+        return C_QUOTE;
+    case '-':
+        return C_MINUS;
+    case ':':
+        return C_COLON;
+    case '_':
+        return C_UNDERSCORE;
+    case '\\':
+        return C_BACKSLASH;
+    case '0':
+        return C_ZERO;
+    case 'x':
+    case 'X':
+        return C_X;
+    }
+
+    if (isspace(c))
+        return C_SPACE;
+    if (isdigit(c))
+        return C_DIGIT;
+    if (isxdigit(c))
+        return C_HEX_LETTER;
+    if (isalpha(c))
+        return C_LETTER;
+    return C_OTHER;
+}
+
+static const char *skip_space_scalar(const char *input, const char *end)
+{
+    while (input < end && isspace(*input))
+        input++;
+    return input;
+}
+
+static const char *find_line_end_scalar(const char *input, const char *end)
+{
+    while (input < end && *input != '\n')
+        input++;
+    return input;
+}
+
+#ifdef HAVE_SIMD_SCAN
+// The scans below load whole blocks only while the block lies before the end of the input, so they never read
+// past the null terminator. The last partial block is scanned by the scalar loops.
+
+/// @brief Mask of the bytes that are whitespace: space, or \t \n \v \f \r which are 9 to 13
+__attribute__((target("sse2"))) static inline uint32_t space_mask_sse2(__m128i chars)
+{
+    __m128i ctrl = _mm_sub_epi8(chars, _mm_set1_epi8(9));
+    __m128i is_ctrl = _mm_cmpeq_epi8(_mm_min_epu8(ctrl, _mm_set1_epi8(4)), ctrl);
+    __m128i is_space = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+    return _mm_movemask_epi8(_mm_or_si128(is_ctrl, is_space));
+}
+
+__attribute__((target("sse2"))) static const char *skip_space_sse2(const char *input, const char *end)
+{
+    for (; end - input >= 16; input += 16)
+    {
+        uint32_t other = ~space_mask_sse2(_mm_loadu_si128((const __m128i *)input)) & 0xFFFF;
+        if (other)
+            return input + __builtin_ctz(other);
+    }
+    return skip_space_scalar(input, end);
+}
+
+__attribute__((target("sse2"))) static const char *find_line_end_sse2(const char *input, const char *end)
+{
+    for (; end - input >= 16; input += 16)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i *)input);
+        uint32_t found = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\n')));
+        if (found)
+            return input + __builtin_ctz(found);
+    }
+    return find_line_end_scalar(input, end);
+}
+
+__attribute__((target("avx2"))) static inline uint32_t space_mask_avx2(__m256i chars)
+{
+    __m256i ctrl = _mm256_sub_epi8(chars, _mm256_set1_epi8(9));
+    __m256i is_ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, _mm256_set1_epi8(4)), ctrl);
+    __m256i is_space = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' '));
+    return _mm256_movemask_epi8(_mm256_or_si256(is_ctrl, is_space));
+}
+
+__attribute__((target("avx2"))) static const char *skip_space_avx2(const char *input, const char *end)
+{
+    for (; end - input >= 32; input += 32)
+    {
+        uint32_t other = ~space_mask_avx2(_mm256_loadu_si256((const __m256i *)input));
+        if (other)
+            return input + __builtin_ctz(other);
+    }
+    return skip_space_scalar(input, end);
+}
+
+__attribute__((target("avx2"))) static const char *find_line_end_avx2(const char *input, const char *end)
+{
+    for (; end - input >= 32; input += 32)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i *)input);
+        uint32_t found = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\n')));
+        if (found)
+            return input + __builtin_ctz(found);
+    }
+    return find_line_end_scalar(input, end);
+}
+#endif
+
+/// @brief Picks the scanners of skip_blank, the fastest the host supports or the scalar ones.
+/// @return 1 if SIMD scanners were picked, 0 otherwise
+static int select_scanners(int simd)
+{
+    skip_space = skip_space_scalar;
+    find_line_end = find_line_end_scalar;
+#ifdef HAVE_SIMD_SCAN
+    if (simd && __builtin_cpu_supports("avx2"))
+    {
+        skip_space = skip_space_avx2;
+        find_line_end = find_line_end_avx2;
+        return 1;
+    }
+    if (simd && __builtin_cpu_supports("sse2"))
+    {
+        skip_space = skip_space_sse2;
+        find_line_end = find_line_end_sse2;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+int set_simd_scan(int enabled)
+{
+    return select_scanners(enabled);
+}
+
+/// @brief Compiles next_state into the class and transition tables and picks the scanners for the host
+/// before main runs, so tokenize never checks whether they are ready.
+__attribute__((constructor)) static void build_tables(void)
+{
+    // a character of each class, every character of a class behaves the same in next_state
+    static const char examples[NUM_CLASSES] = {
+        [C_OTHER] = '~',  [C_SPACE] = ' ',      [C_NEWLINE] = '\n', [C_HASH] = '#',       [C_COMMA] = ',',
+        [C_L_PAREN] = '(', [C_R_PAREN] = ')',   [C_DOLLAR] = '$',   [C_DOT] = '.',        [C_QUOTE] = '"',
+        [C_MINUS] = '-',  [C_COLON] = ':',      [C_UNDERSCORE] = '_', [C_ZERO] = '0',     [C_DIGIT] = '1',
+        [C_X] = 'x',      [C_HEX_LETTER] = 'a', [C_LETTER] = 'g',     [C_BACKSLASH] = '\\',
+    };
+
+    for (int c = 0; c < 256; c++)
+        char_class[c] = classify(c);
+
+    for (int state = 0; state < NUM_STATES; state++)
+    {
+        for (int cls = 0; cls < NUM_CLASSES; cls++)
+            transitions[state][cls] = next_state(state, examples[cls]);
+    }
+
+    select_scanners(1);
+}
+
+/// @brief Skips whitespace and comments
+/// @param input
+/// @param end the null terminator of the input
+/// @return The start of the next token, or the null terminator
+static const char *skip_blank(const char *input, const char *end)
+{
+    // most tokens are followed by a separator or a single space, which do not need a scan
+    if (char_class[(uint8_t)*input] > C_HASH)
+        return input;
+    if (*input == ' ' && char_class[(uint8_t)input[1]] > C_HASH)
+        return input + 1;
+
+    for (;;)
+    {
+        input = skip_space(input, end);
+        if (*input != '#')
+            return input;
+        input = find_line_end(input, end);
+    }
+}
+
+/// @brief Parses a decimal or hexadecimal constant with an optional minus sign, the DFA has already checked the syntax.
+/// @param text
+/// @param len
+/// @param number
+/// @return 0 if successful, 1 if the constant does not fit in 32 bits
+static int parse_constant(const char *text, size_t len, int32_t *number)
+{
+    int negative = text[0] == '-';
+    size_t n = negative;
+    int base = 10;
+    uint64_t value = 0;
+
+    if (len - n > 2 && text[n] == '0' && (text[n + 1] == 'x' || text[n + 1] == 'X'))
+    {
+        base = 16;
+        n += 2;
+    }
+
+    for (; n < len; n++)
+    {
+        char c = text[n];
+        value = value * base + (isdigit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+        if (value > UINT32_MAX)
+            return 1;
+    }
+
+    // negative constants go down to INT32_MIN, positive ones up to UINT32_MAX so any bit pattern can be written
+    if (negative && value > (uint64_t)INT32_MAX + 1)
+        return 1;
+
+    *number = negative ? (int32_t)(0 - (uint32_t)value) : (int32_t)(uint32_t)value;
+    return 0;
+}
+
+/// @brief Makes room for one more token, doubling the capacity when the list is full.
+/// @param tokens
+static void grow_tokens(TokenList *tokens)
+{
+    if (tokens->size < tokens->capacity)
+        return;
+
+    int capacity = tokens->capacity ? tokens->capacity * 2 : TOKEN_LIST_INIT_CAPACITY;
+    Token *data = realloc(tokens->data, capacity * sizeof(Token));
+    if (!data)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    tokens->data = data;
+    tokens->capacity = capacity;
+}
+
+/// @brief Adds a token for the text [start, start + len) that the DFA classified as state.
+/// @return 0 if successful, 1 if the token is an invalid register or constant
+static int add_token(State state, const char *start, size_t len, TokenList *tokens)
+{
+    grow_tokens(tokens);
+    Token *token = &tokens->data[tokens->size];
+    token->type = state_to_token_type(state);
+    token->len = len;
+    token->value = start;
+    token->number = 0;
+
+    if (state == REGISTER)
+    {
+        token->number = get_register_number(start, len);
+        if (token->number < 0)
+        {
+            fprintf(stderr, "Error: Invalid register '%.*s' at token %d\n", (int)len, start, tokens->size);
+            return 1;
+        }
+    }
+    else if (state == STRING || state == STRING_ESCAPE)
+    {
+        fprintf(stderr, "Error: Unterminated string at token %d\n", tokens->size);
+        return 1;
+    }
+    else if (state == ZERO || state == DEC_CONST || state == HEX_CONST)
+    {
+        if (parse_constant(start, len, &token->number))
+        {
+            fprintf(stderr, "Error: Constant '%.*s' out of range at token %d\n", (int)len, start, tokens->size);
+            return 1;
+        }
+    }
+
+    tokens->size++;
+    return 0;
+}
+
+void push_token(TokenList *tokens, const Token *token)
+{
+    grow_tokens(tokens);
+    tokens->data[tokens->size++] = *token;
+}
+
+void free_tokens(TokenList *tokens)
+{
+    free(tokens->data);
+    *tokens = (TokenList){0};
+}
+
+int tokenize(const char *input, TokenList *tokens)
+{
+    // Whitespace and comments never reach the DFA, they are skipped in bulk between tokens, and the scans
+    // stop at the end of the input
+    const char *end = input + strlen(input);
+    input = skip_blank(input, end);
     const char *token_start = input;
+    State state = START;
 
     // While we haven't reached the end of the input string
     while (*input)
     {
-        // Determine the next state based on the current state and the current input character
-        State next = next_state(state, *input);
+        // Determine the next state based on the current state and the class of the current input character
+        State next = transitions[state][char_class[(uint8_t)*input]];
         if (next == ERROR)
         {
-            fprintf(stderr, "Error: Invalid character '%c' at token %d\n", *input, *num_tokens);
+            fprintf(stderr, "Error: Invalid character '%c' at token %d\n", *input, tokens->size);
             return 1; // Return 1 to indicate an error
         }
-        else if (next == START && state != START)
+        else if (next == START)
         {
-            if (state != COMMENT)
-            {
-                tokens[*num_tokens].type = state_to_token_type(state);
-                tokens[*num_tokens].value = strndup(token_start, input - token_start);
-                // printf("Token %d: %.*s, Type: %s\n", *num_tokens, (int)(input - token_start), token_start, state_to_str(state));
-                (*num_tokens)++;
-            }
-
-            while (isspace(*input))
+            // The current character ends the token and starts the next one
+            if (add_token(state, token_start, input - token_start, tokens))
             {
-                input++;
+                return 1;
             }
 
+            input = skip_blank(input, end);
             token_start = input;
             state = START;
         }
@@ -216,21 +554,16 @@ int tokenize(const char *input, Token *tokens, int *num_tokens)
         {
             state = next;
             input++;
-
-            if (state == WHITESPACE)
-            {
-                token_start = input;
-            }
         }
     }
 
     // Last token
-    if (state != START && state != WHITESPACE)
+    if (state != START)
     {
-        tokens[*num_tokens].type = state_to_token_type(state);
-        tokens[*num_tokens].value = strndup(token_start, input - token_start);
-        (*num_tokens)++;
-        printf("Token %d: %.*s, Type: %s\n", *num_tokens, (int)(input - token_start), token_start, state_to_str(state));
+        if (add_token(state, token_start, input - token_start, tokens))
+        {
+            return 1;
+        }
     }
 
     return 0; // Return 0 to indicate success
@@ -249,24 +582,20 @@ const char *state_to_str(State state)
         return "Whitespace";
     case INSTRUCTION:
         return "Instruction";
-    case LABEL_INTER:
-        return "Label Intermediate";
     case LABEL:
         return "Label";
+    case DIRECTIVE:
+        return "Directive";
+    case STRING_END:
+        return "String";
     case DEC_CONST:
         return "Decimal Constant";
+    case MINUS:
+        return "Minus";
     case REGISTER_PREFIX:
         return "Register Prefix";
-    case REGISTER_INTER:
-        return "Register Intermediate";
     case REGISTER:
         return "Register";
-    case REGISTER_ZERO_Z:
-        return "Register Zero Z";
-    case REGISTER_ZERO_E:
-        return "Register Zero E";
-    case REGISTER_ZERO_R:
-        return "Register Zero R";
     case ZERO:
         return "Zero";
     case HEX_PREFIX:
@@ -301,7 +630,7 @@ TokenType state_to_token_type(State state)
         return TOKEN_REGISTER;
     case DIRECTIVE:
         return TOKEN_DIRECTIVE;
-    case STRING:
+    case STRING_END:
         return TOKEN_STRING;
     case ZERO:
         return TOKEN_ZERO;
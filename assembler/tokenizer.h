@@ -1,10 +1,13 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdint.h>
 
-#define MAX_TOKENS 100
+// Initial capacity of a token list, it doubles whenever it is full
+#define TOKEN_LIST_INIT_CAPACITY 256
 
 typedef enum
 {
@@ -22,15 +25,42 @@ typedef enum
     TOKEN_ERROR,
 } TokenType;
 
+/// @brief A token is a view into the source text, which must outlive the tokens. Nothing is allocated per token.
 typedef struct
 {
     TokenType type;
-    char *value;
+    // length of the token text, the text is not null terminated
+    uint32_t len;
+    const char *value;
+    // value of a constant or number of a register, parsed while lexing
+    int32_t number;
 } Token;
 
-/// @brief Tokenizes the input string into an array of tokens. Returns 0 if successful, 1 otherwise.
+/// @brief Growable array of tokens, zero initialize before use and release with free_tokens.
+typedef struct
+{
+    Token *data;
+    int size;
+    int capacity;
+} TokenList;
+
+/// @brief Tokenizes the input string and appends the tokens to the list. Returns 0 if successful, 1 otherwise.
 /// @param input
 /// @param tokens
-/// @param num_tokens
 /// @return 0 if successful, 1 otherwise
-int tokenize(const char *input, Token *tokens, int *num_tokens);
\ No newline at end of file
+int tokenize(const char *input, TokenList *tokens);
+
+/// @brief Switches between the SIMD scanners that skip whitespace and comments on this host and the scalar
+/// ones, which give the same tokens. Used by the tests to compare them.
+/// @param enabled
+/// @return 1 if SIMD scanners are used, 0 if the scalar ones are
+int set_simd_scan(int enabled);
+
+/// @brief Appends a copy of a token to the list.
+/// @param tokens
+/// @param token
+void push_token(TokenList *tokens, const Token *token);
+
+/// @brief Frees the storage of a token list and empties it.
+/// @param tokens
+void free_tokens(TokenList *tokens);
\ No newline at end of file
@@ -0,0 +1,411 @@
+#include "../mips_emul.h"
+#include "../syscalls.h"
+#include "../loader.h"
+
+#include <time.h>
+#include <unistd.h>
+
+// Number of times every benchmark is timed, the minimum and the median are reported
+#define BENCH_REPEATS 5
+// File the results are written to, can be changed with the BENCH_FILE environment variable
+#define BENCH_FILE "bench_results.json"
+// Most results kept for the report
+#define MAX_RESULTS 32
+
+// Instructions emulated per repeat of the dispatch benchmark
+#define DISPATCH_STEPS 20000000
+// Words decoded per repeat of the decode benchmark, out of a table of DECODE_TABLE_WORDS
+#define DECODE_STEPS 20000000
+#define DECODE_TABLE_WORDS 4096
+// Size of the binary loaded by the file benchmark and number of loads per repeat
+#define LOAD_FILE_SIZE (512 * 1024)
+#define LOAD_FILE_LOADS 64
+// Lines of the source tokenized and assembled by the assembler benchmarks
+#define SOURCE_LINES 200000
+
+/// @brief A guest program of the corpus and the exit code that shows it ran correctly
+typedef struct
+{
+    const char *file;
+    uint32_t exit_code;
+} Kernel;
+
+static const Kernel kernels[] = {
+    {"loops.asm", 3170759232u}, {"memcpy.asm", 49156}, {"matmul.asm", 217866240}, {"sieve.asm", 17984}, {"sort.asm", 19},
+};
+
+/// @brief Timings of a benchmark, work is the number of instructions or bytes of one repeat
+typedef struct
+{
+    char name[48];
+    const char *unit;
+    double work;
+    double seconds[BENCH_REPEATS];
+} Result;
+
+static Result results[MAX_RESULTS];
+static int num_results;
+
+// read by the micro-benchmarks so the compiler keeps the work they time
+static volatile uint32_t sink;
+
+/// @brief Gets a monotonic time in seconds
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// @brief Compares two timings for qsort
+static int compare_seconds(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/// @brief Adds a benchmark to the report, the timings are filled in by the caller
+static Result *add_result(const char *name, const char *unit, double work)
+{
+    if (num_results == MAX_RESULTS)
+    {
+        fprintf(stderr, "error: More than %d benchmarks\n", MAX_RESULTS);
+        exit(EXIT_FAILURE);
+    }
+
+    Result *result = &results[num_results++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->unit = unit;
+    result->work = work;
+    return result;
+}
+
+/// @brief Gets the rate of a result from a time, in millions of instructions or in MB per second
+static double rate(const Result *result, double seconds)
+{
+    return result->work / seconds / 1e6;
+}
+
+/// @brief Prints a result and sorts its timings
+static void print_result(Result *result)
+{
+    qsort(result->seconds, BENCH_REPEATS, sizeof(double), compare_seconds);
+    printf("%-28s %10.1f %-8s (median %.1f)\n", result->name, rate(result, result->seconds[0]),
+           !strcmp(result->unit, "MB/s") ? "MB/s" : "Minstr/s", rate(result, result->seconds[BENCH_REPEATS / 2]));
+}
+
+/// @brief Writes the results as JSON, the rates are for the fastest (min time) and the median repeat
+static int write_results(const char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if (f == NULL)
+    {
+        printf("error: Couldn't open %s\n", filename);
+        return 1;
+    }
+
+    fprintf(f, "{\n  \"repeats\": %d,\n  \"benchmarks\": [", BENCH_REPEATS);
+    for (int n = 0; n < num_results; n++)
+    {
+        const Result *result = &results[n];
+        double scale = !strcmp(result->unit, "MB/s") ? 1 : 1e6;
+        fprintf(f,
+                "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"work\": %.0f, \"min_seconds\": %.6f, "
+                "\"median_seconds\": %.6f, \"best\": %.1f, \"median\": %.1f}",
+                n ? "," : "", result->name, result->unit, result->work, result->seconds[0],
+                result->seconds[BENCH_REPEATS / 2], rate(result, result->seconds[0]) * scale,
+                rate(result, result->seconds[BENCH_REPEATS / 2]) * scale);
+    }
+    fprintf(f, "\n  ]\n}\n");
+
+    fclose(f);
+    return 0;
+}
+
+/// @brief Assembles a kernel of the corpus into a new state
+static StateMIPS *load_kernel(const char *dir, const Kernel *kernel)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, kernel->file);
+
+    StateMIPS *state = init_mips(0);
+    if (state == NULL || load_program_at(state, path, 0, NULL) != 0)
+    {
+        printf("error: Couldn't load %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return state;
+}
+
+/// @brief Runs a kernel of the corpus once to count its instructions and check its exit code, then times it
+static int bench_kernel(const char *dir, const Kernel *kernel)
+{
+    StateMIPS *state = load_kernel(dir, kernel);
+    uint64_t count = 0;
+    int ret;
+    do
+    {
+        ret = emulate_mips(state);
+        count++;
+    } while (ret == STOP_NONE);
+
+    if (ret != STOP_EXIT || (uint32_t)state->exit_code != kernel->exit_code)
+    {
+        printf("error: %s exited with %u instead of %u\n", kernel->file, (uint32_t)state->exit_code,
+               kernel->exit_code);
+        free_mips(state);
+        return 1;
+    }
+    free_mips(state);
+
+    char name[48];
+    snprintf(name, sizeof(name), "guest/%.*s", (int)(strlen(kernel->file) - 4), kernel->file);
+    Result *result = add_result(name, "instructions/s", count);
+
+    for (int n = 0; n < BENCH_REPEATS; n++)
+    {
+        state = load_kernel(dir, kernel);
+        double start = now();
+        run_mips(state, count);
+        result->seconds[n] = now() - start;
+        free_mips(state);
+    }
+
+    print_result(result);
+    return 0;
+}
+
+/// @brief Times emulate_mips on a loop of ALU, load and store instructions, one call per instruction
+static void bench_dispatch(void)
+{
+    static const char *source = "loop: addu $t1, $t1, $t0\n"
+                                "      xor $t2, $t1, $t0\n"
+                                "      sll $t3, $t2, 3\n"
+                                "      sw $t3, 0x800($zero)\n"
+                                "      lw $t4, 0x800($zero)\n"
+                                "      slt $t5, $t4, $t1\n"
+                                "      ori $t6, $t5, 0x55\n"
+                                "      j loop\n";
+
+    StateMIPS *state = init_mips(0);
+    if (state == NULL || assemble_into_mem_at(state, source, 0, NULL) != 0)
+        exit(EXIT_FAILURE);
+
+    Result *result = add_result("host/emulate_mips", "instructions/s", DISPATCH_STEPS);
+    for (int n = 0; n < BENCH_REPEATS; n++)
+    {
+        double start = now();
+        for (uint32_t step = 0; step < DISPATCH_STEPS; step++)
+            emulate_mips(state);
+        result->seconds[n] = now() - start;
+    }
+
+    free_mips(state);
+    print_result(result);
+}
+
+/// @brief Times decode_instr on the words of the kernels of the corpus
+static void bench_decode(const char *dir)
+{
+    static uint32_t table[DECODE_TABLE_WORDS];
+    uint32_t num_words = 0;
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]) && num_words < DECODE_TABLE_WORDS; k++)
+    {
+        StateMIPS *state = load_kernel(dir, &kernels[k]);
+        for (uint32_t n = 0; state->mem[n] != 0 && num_words < DECODE_TABLE_WORDS; n++)
+            table[num_words++] = state->mem[n];
+        free_mips(state);
+    }
+
+    Result *result = add_result("host/decode_instr", "instructions/s", DECODE_STEPS);
+    for (int n = 0; n < BENCH_REPEATS; n++)
+    {
+        uint32_t sum = 0;
+        double start = now();
+        for (uint32_t step = 0; step < DECODE_STEPS; step++)
+        {
+            Instruction instr = decode_instr(table[step % num_words]);
+            sum += instr.id + instr.i.imm;
+        }
+        result->seconds[n] = now() - start;
+        sink = sum;
+    }
+
+    print_result(result);
+}
+
+/// @brief Times read_file_into_mem_at on a binary in the temporary directory
+static void bench_load_file(void)
+{
+    char path[] = "/tmp/mips_bench_XXXXXX";
+    int fd = mkstemp(path);
+    uint8_t *data = malloc(LOAD_FILE_SIZE);
+    if (fd < 0 || data == NULL)
+    {
+        printf("error: Couldn't create the file to load\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t n = 0; n < LOAD_FILE_SIZE; n++)
+        data[n] = n * 31 + 7;
+    int written = write(fd, data, LOAD_FILE_SIZE) == LOAD_FILE_SIZE;
+    close(fd);
+    free(data);
+    if (!written)
+    {
+        printf("error: Couldn't write %s\n", path);
+        unlink(path);
+        exit(EXIT_FAILURE);
+    }
+
+    StateMIPS *state = init_mips(0);
+    Result *result = add_result("host/read_file_into_mem_at", "MB/s", (double)LOAD_FILE_SIZE * LOAD_FILE_LOADS);
+    for (int n = 0; n < BENCH_REPEATS; n++)
+    {
+        double start = now();
+        for (int load = 0; load < LOAD_FILE_LOADS; load++)
+            read_file_into_mem_at(state, path, 0);
+        result->seconds[n] = now() - start;
+    }
+
+    free_mips(state);
+    unlink(path);
+    print_result(result);
+}
+
+/// @brief Generates a source with a mix of instructions, labels and branches
+static char *generate_source(size_t *len)
+{
+    size_t capacity = (size_t)SOURCE_LINES * 48 + 1;
+    char *source = malloc(capacity);
+    if (source == NULL)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+
+    *len = 0;
+    for (uint32_t n = 0; n < SOURCE_LINES; n++)
+    {
+        const char *line;
+        char text[64];
+        switch (n % 8)
+        {
+        case 0:
+            snprintf(text, sizeof(text), "L%u: addi $t0, $t0, %d\n", n / 8, (int)(n % 200) - 100);
+            line = text;
+            break;
+        case 1:
+            line = "    addu $t1, $t1, $t0   # running sum\n";
+            break;
+        case 2:
+            line = "    lw $t2, 16($sp)\n";
+            break;
+        case 3:
+            line = "    sll $t3, $t2, 2\n";
+            break;
+        case 4:
+            line = "    sw $t3, -8($sp)\n";
+            break;
+        case 5:
+            line = "    ori $t4, $t3, 0xff\n";
+            break;
+        case 6:
+            snprintf(text, sizeof(text), "    bne $t0, $zero, L%u\n", n / 8);
+            line = text;
+            break;
+        default:
+            snprintf(text, sizeof(text), "    j L%u\n", (n / 8 + 1) % (SOURCE_LINES / 8));
+            line = text;
+            break;
+        }
+
+        size_t line_len = strlen(line);
+        memcpy(source + *len, line, line_len);
+        *len += line_len;
+    }
+
+    source[*len] = '\0';
+    return source;
+}
+
+/// @brief Times tokenize and the whole assembly on a generated source, serially and on every online CPU
+static void bench_assembler(void)
+{
+    size_t len;
+    char *source = generate_source(&len);
+
+    TokenList tokens = {0};
+    Result *result = add_result("host/tokenize", "MB/s", len);
+    for (int n = 0; n < BENCH_REPEATS; n++)
+    {
+        tokens.size = 0;
+        double start = now();
+        if (tokenize(source, &tokens))
+            exit(EXIT_FAILURE);
+        result->seconds[n] = now() - start;
+    }
+    free_tokens(&tokens);
+    print_result(result);
+
+    result = add_result("host/assemble", "MB/s", len);
+    for (int n = 0; n < BENCH_REPEATS; n++)
+    {
+        Assembler as;
+        FILE *in = fmemopen(source, len, "r");
+        init_assembler(&as, NULL, 0);
+
+        double start = now();
+        if (assemble_lines(&as, in))
+            exit(EXIT_FAILURE);
+        result->seconds[n] = now() - start;
+
+        sink = as.count;
+        free_assembler(&as);
+        fclose(in);
+    }
+    print_result(result);
+
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    result = add_result("host/assemble_parallel", "MB/s", len);
+    for (int n = 0; n < BENCH_REPEATS; n++)
+    {
+        Output out;
+        if (open_output(&out, "/dev/null", FORMAT_RAW, 0))
+            exit(EXIT_FAILURE);
+
+        double start = now();
+        if (assemble_parallel(source, len, &out, threads > 1 ? threads : 1))
+            exit(EXIT_FAILURE);
+        result->seconds[n] = now() - start;
+
+        if (close_output(&out))
+            exit(EXIT_FAILURE);
+    }
+    print_result(result);
+
+    free(source);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <directory of the guest kernels>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int status = 0;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        status |= bench_kernel(argv[1], &kernels[k]);
+
+    bench_dispatch();
+    bench_decode(argv[1]);
+    bench_load_file();
+    bench_assembler();
+
+    const char *filename = getenv("BENCH_FILE");
+    status |= write_results(filename ? filename : BENCH_FILE);
+    return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
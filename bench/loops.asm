@@ -0,0 +1,17 @@
+# Nested counting loops with dependent arithmetic in the body, about 12M instructions.
+# Exits with the final value of the accumulator.
+        li $s0, 2000            # outer iterations
+        move $t1, $zero
+outer:  li $t0, 1000            # inner iterations
+inner:  addu $t1, $t1, $t0
+        xor $t2, $t1, $t0
+        sll $t3, $t2, 3
+        subu $t1, $t1, $t3
+        addi $t0, $t0, -1
+        bgtz $t0, inner
+        addi $s0, $s0, -1
+        bgtz $s0, outer
+
+        move $a0, $t1
+        li $v0, 17
+        syscall
@@ -0,0 +1,60 @@
+# Multiplies two 32x32 matrices of words 50 times, about 15M instructions.
+# Exits with the sum of the elements of the product.
+        la $t0, a
+        la $t1, b
+        move $t2, $zero
+        li $t3, 1024
+fill:   sw $t2, 0($t0)          # a[i] = i
+        sll $t4, $t2, 1
+        addu $t4, $t4, $t2
+        sw $t4, 0($t1)          # b[i] = 3 * i
+        addi $t0, $t0, 4
+        addi $t1, $t1, 4
+        addi $t2, $t2, 1
+        bne $t2, $t3, fill
+
+        li $s7, 50              # repeats
+repeat: la $s0, a               # row of a
+        la $s2, c               # element of c
+        li $s3, 32              # rows left
+row:    la $s1, b               # column of b
+        li $s4, 32              # columns left
+col:    move $t0, $s0           # a[i][k]
+        move $t1, $s1           # b[k][j]
+        li $t2, 32              # k left
+        move $t3, $zero         # sum
+dot:    lw $t4, 0($t0)
+        lw $t5, 0($t1)
+        mult $t4, $t5
+        mflo $t6
+        addu $t3, $t3, $t6
+        addi $t0, $t0, 4
+        addi $t1, $t1, 128
+        addi $t2, $t2, -1
+        bgtz $t2, dot
+        sw $t3, 0($s2)
+        addi $s2, $s2, 4
+        addi $s1, $s1, 4
+        addi $s4, $s4, -1
+        bgtz $s4, col
+        addi $s0, $s0, 128
+        addi $s3, $s3, -1
+        bgtz $s3, row
+        addi $s7, $s7, -1
+        bgtz $s7, repeat
+
+        la $t0, c
+        li $t1, 1024
+        move $a0, $zero
+sum:    lw $t2, 0($t0)
+        addu $a0, $a0, $t2
+        addi $t0, $t0, 4
+        addi $t1, $t1, -1
+        bgtz $t1, sum
+        li $v0, 17
+        syscall
+
+.data
+a: .space 4096
+b: .space 4096
+c: .space 4096
@@ -0,0 +1,37 @@
+# Copies a 64 KiB buffer 300 times, four words per iteration, about 13.5M instructions.
+# Exits with the last word copied.
+        la $t0, src
+        li $t1, 16384
+        li $t2, 7
+init:   sw $t2, 0($t0)          # src[i] = 7 + 3 * i
+        addi $t2, $t2, 3
+        addi $t0, $t0, 4
+        addi $t1, $t1, -1
+        bgtz $t1, init
+
+        li $s0, 300             # copies
+again:  la $t0, src
+        la $t1, dst
+        la $t2, src_end
+copy:   lw $t3, 0($t0)
+        lw $t4, 4($t0)
+        lw $t5, 8($t0)
+        lw $t6, 12($t0)
+        sw $t3, 0($t1)
+        sw $t4, 4($t1)
+        sw $t5, 8($t1)
+        sw $t6, 12($t1)
+        addi $t0, $t0, 16
+        addi $t1, $t1, 16
+        bne $t0, $t2, copy
+        addi $s0, $s0, -1
+        bgtz $s0, again
+
+        lw $a0, -4($t1)
+        li $v0, 17
+        syscall
+
+.data
+src:     .space 65536
+src_end: .space 0
+dst:     .space 65536
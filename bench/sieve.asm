@@ -0,0 +1,36 @@
+# Sieve of Eratosthenes over 200000 byte flags, 4 times, about 16M instructions.
+# Exits with the number of primes below 200000.
+        li $s7, 4               # repeats
+        li $s2, 1
+again:  la $t0, flags
+        li $t1, 50000           # words of flags
+clear:  sw $zero, 0($t0)
+        addi $t0, $t0, 4
+        addi $t1, $t1, -1
+        bgtz $t1, clear
+
+        la $s0, flags
+        li $s1, 200000          # n
+        li $t0, 2               # i
+        move $v1, $zero         # primes found
+outer:  addu $t1, $s0, $t0
+        lbu $t2, 0($t1)
+        bne $t2, $zero, next
+        addi $v1, $v1, 1
+        addu $t3, $t0, $t0      # multiples of i from 2i on
+mark:   bge $t3, $s1, next
+        addu $t4, $s0, $t3
+        sb $s2, 0($t4)
+        addu $t3, $t3, $t0
+        b mark
+next:   addi $t0, $t0, 1
+        blt $t0, $s1, outer
+        addi $s7, $s7, -1
+        bgtz $s7, again
+
+        move $a0, $v1
+        li $v0, 17
+        syscall
+
+.data
+flags: .space 200000
@@ -0,0 +1,52 @@
+# Insertion sort of 2000 pseudo random words, twice, about 14M instructions.
+# Exits with the smallest word plus 65536 times the number of pairs left out of order.
+        la $s0, data
+        li $s1, 2000            # words
+        li $s7, 2               # repeats
+        li $t5, 1103515245
+again:  li $t0, 12345           # seed of the linear congruential generator
+        move $t1, $s0
+        move $t2, $s1
+fill:   mult $t0, $t5
+        mflo $t0
+        addiu $t0, $t0, 12345
+        srl $t3, $t0, 16
+        sw $t3, 0($t1)
+        addi $t1, $t1, 4
+        addi $t2, $t2, -1
+        bgtz $t2, fill
+
+        li $t0, 1               # i
+outer:  sll $t1, $t0, 2
+        addu $t1, $s0, $t1      # &data[i]
+        lw $t2, 0($t1)          # key
+inner:  beq $t1, $s0, insert
+        lw $t3, -4($t1)
+        ble $t3, $t2, insert
+        sw $t3, 0($t1)
+        addi $t1, $t1, -4
+        b inner
+insert: sw $t2, 0($t1)
+        addi $t0, $t0, 1
+        blt $t0, $s1, outer
+        addi $s7, $s7, -1
+        bgtz $s7, again
+
+        move $a0, $zero
+        li $t0, 1
+check:  sll $t1, $t0, 2
+        addu $t1, $s0, $t1
+        lw $t2, -4($t1)
+        lw $t3, 0($t1)
+        ble $t2, $t3, sorted
+        addi $a0, $a0, 1
+sorted: addi $t0, $t0, 1
+        blt $t0, $s1, check
+        sll $a0, $a0, 16
+        lw $t2, 0($s0)
+        addu $a0, $a0, $t2
+        li $v0, 17
+        syscall
+
+.data
+data: .space 8000
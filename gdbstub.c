@@ -0,0 +1,594 @@
+#include "gdbstub.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/// @brief Connection to gdb with a small receive buffer
+typedef struct GdbConn
+{
+    int fd;
+    unsigned char buf[GDB_PACKET_SIZE];
+    size_t len;
+    size_t pos;
+    // set when a write failed, which ends the session
+    int failed;
+} GdbConn;
+
+static const char hex_chars[] = "0123456789abcdef";
+
+// Stop reason of continue_execution when gdb interrupts it, after the reasons of emulate_mips
+#define STOP_INTERRUPT (STOP_STEP_LIMIT + 1)
+
+/// @brief Opens a listening socket for the address, see gdbstub_serve.
+/// @return The socket, or -1 on failure
+static int open_listener(const char *address)
+{
+    int fd;
+
+    if (strchr(address, '/') != NULL)
+    {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "error: Socket path %s is too long\n", address);
+            return -1;
+        }
+        strcpy(addr.sun_path, address);
+        unlink(address);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("error: Couldn't bind socket");
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        // accept both "port" and "host:port", but only ever listen on localhost
+        const char *port_str = strrchr(address, ':');
+        port_str = port_str ? port_str + 1 : address;
+        long port = parse_number(port_str);
+        if (port <= 0 || port > 0xFFFF)
+        {
+            fprintf(stderr, "error: Invalid port %s\n", port_str);
+            return -1;
+        }
+
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        int one = 1;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("error: Couldn't bind socket");
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, 1) < 0)
+    {
+        perror("error: Couldn't listen on socket");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/// @brief Reads a single byte from gdb.
+/// @return The byte, or -1 if the connection was closed
+static int read_byte(GdbConn *conn)
+{
+    if (conn->pos == conn->len)
+    {
+        ssize_t n;
+        do
+        {
+            n = read(conn->fd, conn->buf, sizeof(conn->buf));
+        } while (n < 0 && errno == EINTR);
+
+        if (n <= 0)
+            return -1;
+
+        conn->len = n;
+        conn->pos = 0;
+    }
+
+    return conn->buf[conn->pos++];
+}
+
+static int hex_value(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/// @brief Writes all bytes to gdb. A closed connection is an error rather than a SIGPIPE.
+/// @return 0 if successful, 1 otherwise
+static int write_all(GdbConn *conn, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t written = send(conn->fd, buf, len, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0)
+        {
+            perror("error: Couldn't write to gdb");
+            conn->failed = 1;
+            return 1;
+        }
+        buf += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/// @brief Reads the next packet from gdb and acknowledges it.
+/// Stray acks and interrupts between packets are skipped.
+/// @return Length of the payload written to out, or -1 if the connection was closed or failed
+static int read_packet(GdbConn *conn, char *out, size_t max)
+{
+    for (;;)
+    {
+        int c;
+        do
+        {
+            c = read_byte(conn);
+            if (c < 0)
+                return -1;
+        } while (c != '$');
+
+        size_t len = 0;
+        uint8_t sum = 0;
+        while ((c = read_byte(conn)) != '#')
+        {
+            if (c < 0)
+                return -1;
+            if (len < max - 1)
+                out[len++] = c;
+            sum += c;
+        }
+        out[len] = '\0';
+
+        int hi = hex_value(read_byte(conn));
+        int lo = hex_value(read_byte(conn));
+
+        if (hi >= 0 && lo >= 0 && ((hi << 4) | lo) == sum)
+            return write_all(conn, "+", 1) ? -1 : (int)len;
+
+        // bad checksum, ask gdb to send the packet again
+        if (write_all(conn, "-", 1))
+            return -1;
+    }
+}
+
+/// @brief Sends a packet to gdb, the payload is framed and checksummed.
+/// @return 0 if successful, 1 if the connection failed
+static int send_packet(GdbConn *conn, const char *data)
+{
+    static char frame[GDB_PACKET_SIZE * 2 + 4];
+    size_t len = strlen(data);
+    uint8_t sum = 0;
+
+    frame[0] = '$';
+    for (size_t i = 0; i < len; i++)
+    {
+        frame[i + 1] = data[i];
+        sum += (uint8_t)data[i];
+    }
+    frame[len + 1] = '#';
+    frame[len + 2] = hex_chars[sum >> 4];
+    frame[len + 3] = hex_chars[sum & 0xF];
+
+    // one write per packet, gdb acks are consumed by read_packet
+    return write_all(conn, frame, len + 4);
+}
+
+/// @brief Writes a 32 bit value as 8 hex digits in big endian (target) order.
+static char *put_hex32(char *out, uint32_t value)
+{
+    for (int shift = 28; shift >= 0; shift -= 4)
+        *out++ = hex_chars[(value >> shift) & 0xF];
+    return out;
+}
+
+/// @brief Parses up to 8 hex digits, advancing the pointer past them.
+static uint32_t get_hex(const char **p)
+{
+    uint32_t value = 0;
+    int digit;
+    while ((digit = hex_value(**p)) >= 0)
+    {
+        value = (value << 4) | digit;
+        (*p)++;
+    }
+    return value;
+}
+
+/// @brief Gets the value of a register in gdb's numbering.
+static uint32_t get_gdb_reg(StateMIPS *state, int reg)
+{
+    if (reg < 32)
+        return state->regs[reg];
+    switch (reg)
+    {
+    case 32:
+        return state->cp0.status;
+    case 33:
+        return state->lo;
+    case 34:
+        return state->hi;
+    case 35:
+        return state->cp0.badvaddr;
+    case 36:
+        return state->cp0.cause;
+    case 37:
+        return state->pc;
+    default:
+        return 0;
+    }
+}
+
+/// @brief Sets the value of a register in gdb's numbering.
+static void set_gdb_reg(StateMIPS *state, int reg, uint32_t value)
+{
+    if (reg > 0 && reg < 32)
+        state->regs[reg] = value;
+    else if (reg == 32)
+        state->cp0.status = value;
+    else if (reg == 33)
+        state->lo = value;
+    else if (reg == 34)
+        state->hi = value;
+    else if (reg == 35)
+        state->cp0.badvaddr = value;
+    else if (reg == 36)
+        state->cp0.cause = value;
+    else if (reg == 37)
+        state->pc = value;
+}
+
+/// @brief Maps an exception code to the signal number reported to gdb.
+static int exception_signal(uint32_t code)
+{
+    switch (code)
+    {
+    case AdEL:
+    case AdES:
+        return 10; // SIGBUS
+    case RI:
+        return 4; // SIGILL
+    case Ov:
+        return 8; // SIGFPE
+    case Sys:
+        return 12; // SIGSYS
+    default:
+        return 5; // SIGTRAP
+    }
+}
+
+/// @brief Builds the stop reply packet for a stop reason.
+static void stop_reply(StateMIPS *state, int reason, char *out)
+{
+    switch (reason)
+    {
+    case STOP_WATCHPOINT:
+        sprintf(out, "T05%swatch:%x;", state->watch_hit.type == WATCH_READ ? "r" : "", state->watch_hit.addr);
+        break;
+    case STOP_EXCEPTION:
+        sprintf(out, "S%02x", exception_signal((state->cp0.cause & CAUSE_EXC_MASK) >> CAUSE_EXC_SHIFT));
+        break;
+    case STOP_INTERRUPT:
+        // SIGINT
+        strcpy(out, "S02");
+        break;
+    case STOP_EXIT:
+        // the process exited, gdb only sees the low byte of the code
+        sprintf(out, "W%02x", state->exit_code & 0xFF);
+        break;
+    default:
+        // SIGTRAP
+        strcpy(out, "S05");
+        break;
+    }
+}
+
+/// @brief Checks if gdb sent an interrupt (Ctrl-C) without blocking.
+static int interrupt_pending(GdbConn *conn)
+{
+    struct pollfd pfd = {conn->fd, POLLIN, 0};
+
+    while (conn->pos < conn->len || poll(&pfd, 1, 0) > 0)
+    {
+        int c = read_byte(conn);
+        if (c < 0 || c == 0x03)
+            return 1;
+    }
+
+    return 0;
+}
+
+/// @brief Continues execution in batches until a stop or an interrupt from gdb.
+static int continue_execution(StateMIPS *state, GdbConn *conn)
+{
+    for (;;)
+    {
+        int ret = run_mips(state, GDB_RUN_BATCH);
+        if (ret != STOP_STEP_LIMIT)
+            return ret;
+
+        if (interrupt_pending(conn))
+            return STOP_INTERRUPT;
+    }
+}
+
+/// @brief Handles a Z or z packet, inserting or removing a breakpoint or watchpoint.
+static void handle_point(StateMIPS *state, const char *packet, char *reply)
+{
+    int insert = packet[0] == 'Z';
+    int type = packet[1] - '0';
+    const char *p = packet + 3;
+
+    uint32_t addr = get_hex(&p);
+    if (*p++ != ',')
+    {
+        strcpy(reply, "E01");
+        return;
+    }
+    uint32_t len = get_hex(&p);
+
+    int res;
+    switch (type)
+    {
+    case 0: // software breakpoint
+    case 1: // hardware breakpoint, handled the same way
+        res = insert ? add_breakpoint(state, addr) : remove_breakpoint(state, addr);
+        break;
+    case 2: // write watchpoint
+        res = insert ? add_watchpoint(state, addr, len, WATCH_WRITE) : remove_watchpoint(state, addr, len, WATCH_WRITE);
+        break;
+    case 3: // read watchpoint
+        res = insert ? add_watchpoint(state, addr, len, WATCH_READ) : remove_watchpoint(state, addr, len, WATCH_READ);
+        break;
+    case 4: // access watchpoint
+        res = insert ? add_watchpoint(state, addr, len, WATCH_ACCESS) : remove_watchpoint(state, addr, len, WATCH_ACCESS);
+        break;
+    default:
+        // not supported
+        reply[0] = '\0';
+        return;
+    }
+
+    strcpy(reply, res == 0 ? "OK" : "E01");
+}
+
+/// @brief Handles one packet from gdb.
+/// @return 1 if the session should end or the reply could not be sent, 0 otherwise
+static int handle_packet(StateMIPS *state, GdbConn *conn, const char *packet, char *reply)
+{
+    const char *p = packet + 1;
+    reply[0] = '\0';
+
+    switch (packet[0])
+    {
+    case '?':
+        strcpy(reply, "S05");
+        break;
+
+    case 'g':
+    {
+        char *out = reply;
+        for (int reg = 0; reg < GDB_NUM_REGS; reg++)
+            out = put_hex32(out, get_gdb_reg(state, reg));
+        *out = '\0';
+        break;
+    }
+
+    case 'G':
+        for (int reg = 0; reg < GDB_NUM_REGS && strlen(p) >= 8; reg++)
+        {
+            char word[9];
+            const char *w = word;
+            memcpy(word, p, 8);
+            word[8] = '\0';
+            set_gdb_reg(state, reg, get_hex(&w));
+            p += 8;
+        }
+        strcpy(reply, "OK");
+        break;
+
+    case 'p':
+    {
+        int reg = get_hex(&p);
+        *put_hex32(reply, get_gdb_reg(state, reg)) = '\0';
+        break;
+    }
+
+    case 'P':
+    {
+        int reg = get_hex(&p);
+        if (*p++ != '=')
+        {
+            strcpy(reply, "E01");
+            break;
+        }
+        set_gdb_reg(state, reg, get_hex(&p));
+        strcpy(reply, "OK");
+        break;
+    }
+
+    case 'm':
+    {
+        uint32_t addr = get_hex(&p);
+        p++;
+        uint32_t len = get_hex(&p);
+        if (addr >= MEM_SIZE || len > MEM_SIZE - addr || len > GDB_PACKET_SIZE / 2)
+        {
+            strcpy(reply, "E01");
+            break;
+        }
+
+        char *out = reply;
+        for (uint32_t i = 0; i < len; i++)
+        {
+            uint8_t byte = read_guest_byte(state, addr + i);
+            *out++ = hex_chars[byte >> 4];
+            *out++ = hex_chars[byte & 0xF];
+        }
+        *out = '\0';
+        break;
+    }
+
+    case 'M':
+    {
+        uint32_t addr = get_hex(&p);
+        p++;
+        uint32_t len = get_hex(&p);
+        if (*p++ != ':' || addr >= MEM_SIZE || len > MEM_SIZE - addr || strlen(p) < len * 2)
+        {
+            strcpy(reply, "E01");
+            break;
+        }
+
+        // nothing is written unless every digit is valid
+        uint32_t digits = 0;
+        while (digits < len * 2 && hex_value(p[digits]) >= 0)
+            digits++;
+        if (digits < len * 2)
+        {
+            strcpy(reply, "E01");
+            break;
+        }
+
+        for (uint32_t i = 0; i < len; i++)
+            write_guest_byte(state, addr + i, (hex_value(p[2 * i]) << 4) | hex_value(p[2 * i + 1]));
+        strcpy(reply, "OK");
+        break;
+    }
+
+    case 'c':
+        if (*p)
+            state->pc = get_hex(&p);
+        stop_reply(state, continue_execution(state, conn), reply);
+        break;
+
+    case 's':
+    {
+        if (*p)
+            state->pc = get_hex(&p);
+        stop_reply(state, emulate_mips(state), reply);
+        break;
+    }
+
+    case 'Z':
+    case 'z':
+        handle_point(state, packet, reply);
+        break;
+
+    case 'H':
+        // there is only one thread
+        strcpy(reply, "OK");
+        break;
+
+    case 'q':
+        if (strncmp(packet, "qSupported", 10) == 0)
+            sprintf(reply, "PacketSize=%x", GDB_PACKET_SIZE);
+        else if (strcmp(packet, "qAttached") == 0)
+            strcpy(reply, "1");
+        else if (strcmp(packet, "qC") == 0)
+            strcpy(reply, "QC1");
+        else if (strcmp(packet, "qfThreadInfo") == 0)
+            strcpy(reply, "m1");
+        else if (strcmp(packet, "qsThreadInfo") == 0)
+            strcpy(reply, "l");
+        break;
+
+    case 'D':
+        send_packet(conn, "OK");
+        return 1;
+
+    case 'k':
+        return 1;
+
+    default:
+        // an empty reply tells gdb the packet is not supported
+        break;
+    }
+
+    return send_packet(conn, reply);
+}
+
+int gdbstub_session(StateMIPS *state, int fd)
+{
+    GdbConn *conn = calloc(1, sizeof(GdbConn));
+    conn->fd = fd;
+
+    // payload buffers, the reply to 'm' is two hex characters per byte
+    char *packet = malloc(GDB_PACKET_SIZE + 1);
+    char *reply = malloc(GDB_PACKET_SIZE + 1);
+
+    while (read_packet(conn, packet, GDB_PACKET_SIZE + 1) >= 0)
+    {
+        if (handle_packet(state, conn, packet, reply))
+            break;
+    }
+
+    int failed = conn->failed;
+    free(conn);
+    free(packet);
+    free(reply);
+    return failed;
+}
+
+int gdbstub_serve(StateMIPS *state, const char *address)
+{
+    int listen_fd = open_listener(address);
+    if (listen_fd < 0)
+        return 1;
+
+    printf("Waiting for gdb on %s\n", address);
+    fflush(stdout);
+
+    int fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+
+    if (fd < 0)
+    {
+        perror("error: Couldn't accept connection");
+        return 1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int res = gdbstub_session(state, fd);
+    close(fd);
+
+    if (strchr(address, '/') != NULL)
+        unlink(address);
+
+    return res;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "mips_emul.h"
+
+// Maximum size of a packet payload, reported to gdb in qSupported
+#define GDB_PACKET_SIZE 4096
+
+// Number of instructions run between checks for an interrupt from gdb while continuing
+#define GDB_RUN_BATCH 100000
+
+// Number of registers sent in a 'g' packet: 32 gprs, sr, lo, hi, bad, cause, pc
+#define GDB_NUM_REGS 38
+
+/// @brief Serves a GDB remote serial protocol session for the MIPS state.
+/// The address is either a TCP port on localhost (e.g. "1234" or "localhost:1234")
+/// or the path of a Unix socket (anything containing a '/').
+/// Returns when gdb detaches, kills the target or the connection is closed.
+/// @param state
+/// @param address
+/// @return returns 0 on success, 1 on failure
+int gdbstub_serve(StateMIPS *state, const char *address);
+
+/// @brief Serves gdb on a connected socket until gdb detaches, kills the target or the connection is closed.
+/// The socket is not closed. A failed write drops the connection.
+/// @param state
+/// @param fd
+/// @return returns 0 on success, 1 if writing to gdb failed
+int gdbstub_session(StateMIPS *state, int fd);
@@ -0,0 +1,88 @@
+#pragma once
+
+// Single description of the instruction set. The decoder and encoder tables in utils.c, the
+// disassembler, the emulator dispatch table in mips_emul.c and the assembler parser are all
+// generated from these lists, so adding an instruction means adding one entry here (plus its
+// exec_ function in mips_emul.c, which the build enforces).
+//
+// Entries are X(ID, mnemonic, opcode, rs, funct, template):
+//   ISA_SPECIAL  opcode 0 instructions, decoded by funct
+//   ISA_COP0     opcode 0x10 instructions, decoded by the rs field
+//   ISA_OPCODE   every other instruction, decoded by opcode
+// The fixed bits of an instruction are (opcode << 26) | (rs << 21) | funct.
+//
+// NOTE: beq uses opcode 0x0c in this project (0x04 on real MIPS), so andi is not available.
+
+#define ISA_SPECIAL(X)                                   \
+    X(SLL, sll, 0x00, 0x00, 0x00, R_RD_RT_SHAMT)         \
+    X(SRL, srl, 0x00, 0x00, 0x02, R_RD_RT_SHAMT)         \
+    X(SRA, sra, 0x00, 0x00, 0x03, R_RD_RT_SHAMT)         \
+    X(SLLV, sllv, 0x00, 0x00, 0x04, R_RD_RT_RS)          \
+    X(SRLV, srlv, 0x00, 0x00, 0x06, R_RD_RT_RS)          \
+    X(SRAV, srav, 0x00, 0x00, 0x07, R_RD_RT_RS)          \
+    X(JR, jr, 0x00, 0x00, 0x08, R_RS)                    \
+    X(JALR, jalr, 0x00, 0x00, 0x09, R_RD_RS)             \
+    X(SYSCALL, syscall, 0x00, 0x00, 0x0c, NO_ARGS)       \
+    X(BREAK, break, 0x00, 0x00, 0x0d, NO_ARGS)           \
+    X(MFHI, mfhi, 0x00, 0x00, 0x10, R_RD)                \
+    X(MTHI, mthi, 0x00, 0x00, 0x11, R_RS)                \
+    X(MFLO, mflo, 0x00, 0x00, 0x12, R_RD)                \
+    X(MTLO, mtlo, 0x00, 0x00, 0x13, R_RS)                \
+    X(MULT, mult, 0x00, 0x00, 0x18, R_RS_RT)             \
+    X(MULTU, multu, 0x00, 0x00, 0x19, R_RS_RT)           \
+    X(DIV, div, 0x00, 0x00, 0x1a, R_RS_RT)               \
+    X(DIVU, divu, 0x00, 0x00, 0x1b, R_RS_RT)             \
+    X(ADD, add, 0x00, 0x00, 0x20, R_RD_RS_RT)            \
+    X(ADDU, addu, 0x00, 0x00, 0x21, R_RD_RS_RT)          \
+    X(SUB, sub, 0x00, 0x00, 0x22, R_RD_RS_RT)            \
+    X(SUBU, subu, 0x00, 0x00, 0x23, R_RD_RS_RT)          \
+    X(AND, and, 0x00, 0x00, 0x24, R_RD_RS_RT)            \
+    X(OR, or, 0x00, 0x00, 0x25, R_RD_RS_RT)              \
+    X(XOR, xor, 0x00, 0x00, 0x26, R_RD_RS_RT)            \
+    X(NOR, nor, 0x00, 0x00, 0x27, R_RD_RS_RT)            \
+    X(SLT, slt, 0x00, 0x00, 0x2a, R_RD_RS_RT)            \
+    X(SLTU, sltu, 0x00, 0x00, 0x2b, R_RD_RS_RT)
+
+#define ISA_COP0(X)                                      \
+    X(MFC0, mfc0, 0x10, 0x00, 0x00, C0_RT_RD)            \
+    X(MTC0, mtc0, 0x10, 0x04, 0x00, C0_RT_RD)            \
+    X(ERET, eret, 0x10, 0x10, 0x18, NO_ARGS)
+
+#define ISA_OPCODE(X)                                    \
+    X(J, j, 0x02, 0x00, 0x00, J_LABEL)                   \
+    X(JAL, jal, 0x03, 0x00, 0x00, J_LABEL)               \
+    X(BNE, bne, 0x05, 0x00, 0x00, I_RS_RT_LABEL)         \
+    X(BLEZ, blez, 0x06, 0x00, 0x00, I_RS_LABEL)          \
+    X(BGTZ, bgtz, 0x07, 0x00, 0x00, I_RS_LABEL)          \
+    X(ADDI, addi, 0x08, 0x00, 0x00, I_RT_RS_I)           \
+    X(ADDIU, addiu, 0x09, 0x00, 0x00, I_RT_RS_I)         \
+    X(SLTI, slti, 0x0a, 0x00, 0x00, I_RT_RS_I)           \
+    X(SLTIU, sltiu, 0x0b, 0x00, 0x00, I_RT_RS_I)         \
+    X(BEQ, beq, 0x0c, 0x00, 0x00, I_RS_RT_LABEL)         \
+    X(ORI, ori, 0x0d, 0x00, 0x00, I_RT_RS_I)             \
+    X(XORI, xori, 0x0e, 0x00, 0x00, I_RT_RS_I)           \
+    X(LUI, lui, 0x0f, 0x00, 0x00, I_RT_I)                \
+    X(LB, lb, 0x20, 0x00, 0x00, I_RT_I_RS)               \
+    X(LH, lh, 0x21, 0x00, 0x00, I_RT_I_RS)               \
+    X(LW, lw, 0x23, 0x00, 0x00, I_RT_I_RS)               \
+    X(LBU, lbu, 0x24, 0x00, 0x00, I_RT_I_RS)             \
+    X(LHU, lhu, 0x25, 0x00, 0x00, I_RT_I_RS)             \
+    X(SB, sb, 0x28, 0x00, 0x00, I_RT_I_RS)               \
+    X(SH, sh, 0x29, 0x00, 0x00, I_RT_I_RS)               \
+    X(SW, sw, 0x2b, 0x00, 0x00, I_RT_I_RS)
+
+#define ISA_TABLE(X) ISA_SPECIAL(X) ISA_COP0(X) ISA_OPCODE(X)
+
+// Opcodes that select a second decode table
+#define OPCODE_SPECIAL 0x00
+#define OPCODE_COP0 0x10
+
+/// @brief Identifies an instruction, INSTR_UNKNOWN is 0 so unset decode table entries are unknown
+typedef enum InstrId
+{
+    INSTR_UNKNOWN,
+#define ISA_ENUM(id, name, opcode, rs, funct, format) INSTR_##id,
+    ISA_TABLE(ISA_ENUM)
+#undef ISA_ENUM
+    INSTR_COUNT
+} InstrId;
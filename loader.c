@@ -0,0 +1,86 @@
+#include "loader.h"
+
+#include <limits.h>
+#include <unistd.h>
+
+/// @brief Assembles the lines of a stream into guest memory at addr
+static int assemble_stream_at(StateMIPS *state, FILE *in, uint32_t addr, const char *name, SourceMap *map)
+{
+    if (addr & 3 || addr >= MEM_SIZE)
+    {
+        printf("error: Can't assemble to 0x%08x\n", addr);
+        return 1;
+    }
+
+    // the assembler stores words as host integers, the same as guest memory, so they go straight in
+    Assembler as;
+    init_assembler_at(&as, state->mem + addr / 4, (MEM_SIZE - addr) / 4, addr);
+    if (map != NULL)
+    {
+        as.map = map;
+        set_source_file(map, name);
+    }
+
+    int res = assemble_lines(&as, in);
+    free_assembler(&as);
+    return res;
+}
+
+int assemble_into_mem_at(StateMIPS *state, const char *source, uint32_t addr, SourceMap *map)
+{
+    FILE *in = fmemopen((void *)source, strlen(source), "r");
+    if (in == NULL)
+    {
+        printf("error: Couldn't read the source\n");
+        return 1;
+    }
+
+    if (map != NULL)
+        *map = (SourceMap){0};
+
+    int res = assemble_stream_at(state, in, addr, "source", map);
+    fclose(in);
+    return res;
+}
+
+/// @brief Checks if a file name ends with an extension
+static int has_extension(const char *filename, const char *ext)
+{
+    size_t len = strlen(filename);
+    size_t ext_len = strlen(ext);
+    return len > ext_len && !strcmp(filename + len - ext_len, ext);
+}
+
+/// @brief Loads the source map next to a binary, if there is one
+static void load_map_of(const char *filename, SourceMap *map)
+{
+    char map_filename[PATH_MAX];
+    if (snprintf(map_filename, sizeof(map_filename), "%s.map", filename) < (int)sizeof(map_filename) &&
+        access(map_filename, R_OK) == 0)
+        load_source_map(map, map_filename);
+}
+
+int load_program_at(StateMIPS *state, char *filename, uint32_t addr, SourceMap *map)
+{
+    if (map != NULL)
+        *map = (SourceMap){0};
+
+    if (!has_extension(filename, ".asm") && !has_extension(filename, ".s"))
+    {
+        int res = read_file_into_mem_at(state, filename, addr);
+        if (res == 0 && map != NULL)
+            load_map_of(filename, map);
+        return res;
+    }
+
+    FILE *in = fopen(filename, "r");
+    if (in == NULL)
+    {
+        printf("error: Couldn't open %s\n", filename);
+        return 1;
+    }
+
+    int res = assemble_stream_at(state, in, addr, filename, map);
+    fclose(in);
+    return res;
+}
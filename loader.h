@@ -0,0 +1,24 @@
+#pragma once
+
+#include "mips_emul.h"
+#include "assembler/mips_asm.h"
+
+/// @brief Assembles source text straight into guest memory, with no intermediate file or byte swapping.
+/// Labels are addresses relative to addr.
+/// @param state
+/// @param source
+/// @param addr address of the first instruction, must be a multiple of 4
+/// @param map filled with the source lines and labels of the program, free with free_source_map. Can be NULL.
+/// @return returns 0 on success, 1 on failure
+int assemble_into_mem_at(StateMIPS *state, const char *source, uint32_t addr, SourceMap *map);
+
+/// @brief Loads a program into guest memory. Files ending in .asm or .s are assembled, any other file is
+/// read as a big endian binary with read_file_into_mem_at.
+/// @param state
+/// @param filename
+/// @param addr
+/// @param map filled with the source lines and labels of an assembled program, for a binary the source map
+/// written next to it by the assembler (filename with .map appended) is loaded if there is one. Free with
+/// free_source_map. Can be NULL.
+/// @return returns 0 on success, 1 on failure
+int load_program_at(StateMIPS *state, char *filename, uint32_t addr, SourceMap *map);
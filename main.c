@@ -1,8 +1,146 @@
 #include "mips_emul.h"
+#include "gdbstub.h"
+#include "syscalls.h"
 #include "tui.h"
+#include "loader.h"
 
-int main()
+// File the instruction mix counters are written to, can be changed with the MIPS_STATS_FILE environment variable
+#define STATS_FILE "mips_stats.json"
+// Number of the most executed instructions printed after a headless run built with -DMIPS_STATS
+#define HOT_PC_REPORT_SIZE 10
+// Size of the location of an address in traces and reports
+#define SOURCE_TEXT_SIZE 96
+
+/// @brief Writes the instruction mix counters as JSON if the emulator was built with -DMIPS_STATS.
+/// @param state
+void dump_stats(StateMIPS *state)
+{
+#ifdef MIPS_STATS
+    const char *filename = getenv("MIPS_STATS_FILE");
+    write_mips_stats_json(state, filename ? filename : STATS_FILE);
+#else
+    (void)state;
+#endif
+}
+
+/// @brief Prints the most executed instructions with their labels and source lines to stderr if the emulator
+/// was built with -DMIPS_STATS.
+/// @param state
+/// @param map
+void print_hot_pcs(StateMIPS *state, const SourceMap *map)
+{
+#ifdef MIPS_STATS
+    uint32_t pcs[HOT_PC_REPORT_SIZE];
+    uint32_t num_pcs = get_hot_pcs(state, pcs, HOT_PC_REPORT_SIZE);
+    uint64_t total = get_mips_stats(state)->instructions;
+
+    fprintf(stderr, "Most executed instructions of %llu:\n", (unsigned long long)total);
+    for (uint32_t n = 0; n < num_pcs; n++)
+    {
+        uint64_t count = get_mips_stats(state)->pc_counts[pcs[n] / 4];
+        char text[64] = "", source[SOURCE_TEXT_SIZE];
+        disassemble_instr(state->mem[pcs[n] / 4], text, sizeof(text));
+        format_source(map, pcs[n], source, sizeof(source));
+        fprintf(stderr, "%12llu %5.1f%%  0x%08x  %-24s %s\n", (unsigned long long)count, 100.0 * count / total, pcs[n],
+                text, source);
+    }
+#else
+    (void)state;
+    (void)map;
+#endif
+}
+
+/// @brief Prints an instruction that is about to be executed with its label and source line to stderr.
+/// @param state
+/// @param map
+void trace_instr(StateMIPS *state, const SourceMap *map)
+{
+    char text[64] = "", source[SOURCE_TEXT_SIZE];
+    if (state->pc < MEM_SIZE)
+        disassemble_instr(state->mem[state->pc / 4], text, sizeof(text));
+    format_source(map, state->pc, source, sizeof(source));
+    fprintf(stderr, "0x%08x  %-24s %s\n", state->pc, text, source);
+}
+
+/// @brief Runs a program without the TUI until it exits or stops.
+/// @param filename binary, or assembly source ending in .asm or .s
+/// @param address
+/// @param trace print every instruction before it is executed
+/// @return The exit code of the guest, or 1 if it did not exit normally
+int run_headless(char *filename, uint32_t address, int trace)
+{
+    SourceMap map;
+    StateMIPS *state = init_mips(address);
+    if (state == NULL || load_program_at(state, filename, address, &map) != 0)
+        return EXIT_FAILURE;
+
+    int ret;
+    if (trace)
+    {
+        // one instruction at a time, the guest output is flushed so it appears between the instructions
+        do
+        {
+            trace_instr(state, &map);
+            ret = emulate_mips(state);
+            flush_output(state);
+        } while (ret == STOP_NONE);
+    }
+    else
+    {
+        do
+        {
+            ret = run_mips(state, RUN_BATCH_SIZE);
+        } while (ret == STOP_STEP_LIMIT);
+    }
+
+    flush_output(state);
+
+    int exit_code = EXIT_FAILURE;
+    if (ret == STOP_EXIT)
+    {
+        exit_code = state->exit_code;
+    }
+    else if (ret == STOP_EXCEPTION)
+    {
+        fprintf(stderr, "error: Exception %u at pc 0x%08x\n",
+                (state->cp0.cause & CAUSE_EXC_MASK) >> CAUSE_EXC_SHIFT, state->cp0.epc);
+    }
+    else
+    {
+        fprintf(stderr, "error: Stopped at pc 0x%08x\n", state->pc);
+    }
+
+    dump_stats(state);
+    print_hot_pcs(state, &map);
+    free_source_map(&map);
+    free_mips(state);
+    return exit_code;
+}
+
+int main(int argc, char *argv[])
 {
+    // headless mode, the emulator is controlled by gdb instead of the TUI
+    if (argc == 3 && strcmp(argv[1], "--gdb") == 0)
+    {
+        StateMIPS *state = init_mips(0x0);
+        int res = gdbstub_serve(state, argv[2]);
+        dump_stats(state);
+        free_mips(state);
+        return res;
+    }
+    // headless mode, the program runs until it exits with guest output going to stdout
+    else if ((argc == 3 || argc == 4) && (strcmp(argv[1], "--run") == 0 || strcmp(argv[1], "--trace") == 0))
+    {
+        long address = argc == 4 ? strtol(argv[3], NULL, 16) : 0;
+        return run_headless(argv[2], address, strcmp(argv[1], "--trace") == 0);
+    }
+    else if (argc != 1)
+    {
+        fprintf(stderr, "Usage: %s [--gdb <port or socket path> | --run <file> [address (hex)] | --trace <file> [address (hex)]]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
     // ncurses options
     initscr(); /* Start curses mode 		  */
     curs_set(0);
@@ -11,6 +149,8 @@ int main()
     init_pair(1, COLOR_YELLOW, COLOR_BLACK);
 
     StateMIPS *state = init_mips(0x0);
+    // guest output is shown in the window instead of being written to the terminal
+    state->out_fd = -1;
 
     WINDOW *win = create_win(50, 160, 0, 0);
 
@@ -23,6 +163,14 @@ int main()
         if (op == 1)
         {
             ret = emulate_mips(state);
+            print_stop_reason(win, state, ret);
+            print_guest_output(win, state);
+        }
+        else if (op == 2)
+        {
+            ret = run_mips(state, RUN_BATCH_SIZE);
+            print_stop_reason(win, state, ret);
+            print_guest_output(win, state);
         }
 
         print_pc(win, state);
@@ -33,6 +181,7 @@ int main()
         op = handle_input(win, state);
     } while (op != -1);
 
+    dump_stats(state);
     free_mips(state);
 
     endwin(); /* End curses mode		  */
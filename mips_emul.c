@@ -1,49 +1,713 @@
 #include "mips_emul.h"
+#include "syscalls.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// Instruction mix counters, compiled out unless built with -DMIPS_STATS
+#ifdef MIPS_STATS
+#define STAT_INC(state, counter) ((state)->stats.counter++)
+#else
+#define STAT_INC(state, counter) ((void)0)
+#endif
+
+/// @brief Checks if an access of size bytes at addr overlaps a watchpoint of the given type.
+/// @param state
+/// @param addr
+/// @param size
+/// @param type
+/// @return 1 if a watchpoint matches, 0 otherwise
+static int watch_matches(StateMIPS *state, uint32_t addr, uint32_t size, WatchType type)
+{
+    for (int n = 0; n < state->num_watchpoints; n++)
+    {
+        Watchpoint *w = &state->watchpoints[n];
+        if ((w->type & type) && addr < w->end && addr + size > w->start)
+            return 1;
+    }
+
+    return 0;
+}
+
+/// @brief Slow path for loads from a page that has a watchpoint, called after the load.
+__attribute__((noinline)) static int load_watched(StateMIPS *state, uint32_t addr, uint32_t size, uint32_t pc)
+{
+    if (!watch_matches(state, addr, size, WATCH_READ))
+        return STOP_NONE;
+
+    uint32_t value = state->mem[addr / 4];
+    state->watch_hit = (WatchHit){pc, addr & ~3u, value, value, WATCH_READ};
+    return STOP_WATCHPOINT;
+}
+
+/// @brief Slow path for stores to a page that has a watchpoint, called after the store.
+__attribute__((noinline)) static int store_watched(StateMIPS *state, uint32_t addr, uint32_t size, uint32_t old_value, uint32_t pc)
+{
+    if (!watch_matches(state, addr, size, WATCH_WRITE))
+        return STOP_NONE;
+
+    state->watch_hit = (WatchHit){pc, addr & ~3u, old_value, state->mem[addr / 4], WATCH_WRITE};
+    return STOP_WATCHPOINT;
+}
+
+/// @brief Recomputes the page flags from the lists of watchpoints and breakpoints.
+static void update_page_flags(StateMIPS *state)
+{
+    memset(state->page_flags, 0, sizeof(state->page_flags));
+
+    for (int n = 0; n < state->num_breakpoints; n++)
+        state->page_flags[state->breakpoints[n] >> GUEST_PAGE_SHIFT] |= PAGE_BREAK;
+
+    for (int n = 0; n < state->num_watchpoints; n++)
+    {
+        Watchpoint *w = &state->watchpoints[n];
+        uint32_t last = (w->end - 1) >> GUEST_PAGE_SHIFT;
+        if (last >= NUM_GUEST_PAGES)
+            last = NUM_GUEST_PAGES - 1;
+
+        for (uint32_t page = w->start >> GUEST_PAGE_SHIFT; page <= last; page++)
+            state->page_flags[page] |= w->type;
+    }
+}
+
+int add_watchpoint(StateMIPS *state, uint32_t addr, uint32_t len, WatchType type)
+{
+    if (state->num_watchpoints >= MAX_WATCHPOINTS || len == 0 || addr >= MEM_SIZE)
+        return 1;
+
+    // clamp the range to the end of memory
+    uint32_t end = (len > MEM_SIZE - addr) ? MEM_SIZE : addr + len;
+
+    state->watchpoints[state->num_watchpoints++] = (Watchpoint){addr, end, type};
+    update_page_flags(state);
+    return 0;
+}
+
+int remove_watchpoint(StateMIPS *state, uint32_t addr, uint32_t len, WatchType type)
+{
+    // add_watchpoint rejects these, so no watchpoint can match them
+    if (len == 0 || addr >= MEM_SIZE)
+        return 1;
+
+    uint32_t end = (len > MEM_SIZE - addr) ? MEM_SIZE : addr + len;
+
+    for (int n = 0; n < state->num_watchpoints; n++)
+    {
+        Watchpoint *w = &state->watchpoints[n];
+        if (w->start == addr && w->end == end && w->type == type)
+        {
+            // keep the list packed by moving the last watchpoint into the hole
+            *w = state->watchpoints[--state->num_watchpoints];
+            update_page_flags(state);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int add_breakpoint(StateMIPS *state, uint32_t addr)
+{
+    if (state->num_breakpoints >= MAX_BREAKPOINTS || addr >= MEM_SIZE)
+        return 1;
+
+    state->breakpoints[state->num_breakpoints++] = addr;
+    update_page_flags(state);
+    return 0;
+}
+
+int remove_breakpoint(StateMIPS *state, uint32_t addr)
+{
+    for (int n = 0; n < state->num_breakpoints; n++)
+    {
+        if (state->breakpoints[n] == addr)
+        {
+            state->breakpoints[n] = state->breakpoints[--state->num_breakpoints];
+            update_page_flags(state);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/// @brief Checks if there is a breakpoint at the current pc.
+static int breakpoint_at_pc(StateMIPS *state)
+{
+    for (int n = 0; n < state->num_breakpoints; n++)
+    {
+        if (state->breakpoints[n] == state->pc)
+            return 1;
+    }
+
+    return 0;
+}
+
+/// @brief Raises an exception for the instruction at pc.
+/// Kept out of line so the non-faulting path stays small.
+/// @return STOP_NONE if the exception is handled by the guest, STOP_EXCEPTION otherwise
+__attribute__((noinline, cold)) static int raise_exception(StateMIPS *state, ExceptionCode code, uint32_t pc)
+{
+    // a fault inside the handler keeps the return address of the first exception
+    if (!(state->cp0.status & STATUS_EXL))
+        state->cp0.epc = pc;
+    state->cp0.cause = (state->cp0.cause & ~CAUSE_EXC_MASK) | (code << CAUSE_EXC_SHIFT);
+
+    if (state->exc_handler_enabled)
+    {
+        state->cp0.status |= STATUS_EXL;
+        state->pc = state->exc_vector;
+        return STOP_NONE;
+    }
+
+    // leave the pc on the faulting instruction so the host sees a precise state
+    state->pc = pc;
+    return STOP_EXCEPTION;
+}
+
+/// @brief Raises an address error exception for an access to addr.
+__attribute__((noinline, cold)) static int address_error(StateMIPS *state, ExceptionCode code, uint32_t pc, uint32_t addr)
+{
+    state->cp0.badvaddr = addr;
+    return raise_exception(state, code, pc);
+}
+
+// Checks if an access of size bytes to addr is misaligned or outside of memory
+#define BAD_ADDR(addr, size) __builtin_expect(((addr) & ((size) - 1)) || (addr) >= MEM_SIZE, 0)
+#define BAD_WORD_ADDR(addr) BAD_ADDR(addr, 4)
+
+/// @brief Returns a pointer to a coprocessor 0 register, or NULL if it is not modelled.
+static uint32_t *get_cp0_reg(StateMIPS *state, uint8_t reg)
+{
+    switch (reg)
+    {
+    case CP0_BADVADDR:
+        return &state->cp0.badvaddr;
+    case CP0_STATUS:
+        return &state->cp0.status;
+    case CP0_CAUSE:
+        return &state->cp0.cause;
+    case CP0_EPC:
+        return &state->cp0.epc;
+    default:
+        return NULL;
+    }
+}
+
+// Loads and stores go through these so that only pages with a watchpoint take the slow path
+
+/// @brief Checks the watchpoints after a load from a watched page.
+static inline int check_load(StateMIPS *state, uint32_t addr, uint32_t size, uint32_t pc)
+{
+    if (__builtin_expect(state->page_flags[addr >> GUEST_PAGE_SHIFT] & PAGE_WATCH_READ, 0))
+        return load_watched(state, addr, size, pc);
+    return STOP_NONE;
+}
+
+/// @brief Stores the bits of value selected by mask into the word holding addr.
+static inline int store_masked(StateMIPS *state, uint32_t addr, uint32_t size, uint32_t value, uint32_t mask, uint32_t pc)
+{
+    uint32_t *word = &state->mem[addr / 4];
+    uint32_t old_value = *word;
+    *word = (old_value & ~mask) | (value & mask);
+
+    STAT_INC(state, stores);
+    if (__builtin_expect(state->page_flags[addr >> GUEST_PAGE_SHIFT] & PAGE_WATCH_WRITE, 0))
+        return store_watched(state, addr, size, old_value, pc);
+    return STOP_NONE;
+}
+
+/// @brief Takes or skips a branch, the offset is in words relative to the next instruction.
+static inline int branch(StateMIPS *state, int taken, uint32_t instr)
+{
+    if (taken)
+    {
+        STAT_INC(state, branches_taken);
+        state->pc += INSTR_SIMM(instr) * 4;
+    }
+    else
+    {
+        STAT_INC(state, branches_not_taken);
+    }
+    return STOP_NONE;
+}
+
+// Instruction handlers, one for each entry of the ISA table in isa.h.
+// The pc argument is the address of the instruction, state->pc already points to the next one.
+#define EXEC(name) static int exec_##name(StateMIPS *state, __attribute__((unused)) uint32_t instr, __attribute__((unused)) uint32_t pc)
+
+#define RS state->regs[INSTR_RS(instr)]
+#define RT state->regs[INSTR_RT(instr)]
+#define RD state->regs[INSTR_RD(instr)]
+
+EXEC(unknown)
+{
+    return raise_exception(state, RI, pc);
+}
+
+// Shifts, sll is also the nop encoding
+
+EXEC(sll)
+{
+    RD = RT << INSTR_SHAMT(instr);
+    return STOP_NONE;
+}
+
+EXEC(srl)
+{
+    RD = RT >> INSTR_SHAMT(instr);
+    return STOP_NONE;
+}
+
+EXEC(sra)
+{
+    RD = (int32_t)RT >> INSTR_SHAMT(instr);
+    return STOP_NONE;
+}
+
+EXEC(sllv)
+{
+    RD = RT << (RS & 0x1F);
+    return STOP_NONE;
+}
+
+EXEC(srlv)
+{
+    RD = RT >> (RS & 0x1F);
+    return STOP_NONE;
+}
+
+EXEC(srav)
+{
+    RD = (int32_t)RT >> (RS & 0x1F);
+    return STOP_NONE;
+}
+
+// Jumps
+
+EXEC(jr)
+{
+    STAT_INC(state, jumps);
+    state->pc = RS;
+    return STOP_NONE;
+}
+
+EXEC(jalr)
+{
+    STAT_INC(state, jumps);
+    uint32_t target = RS;
+    RD = state->pc;
+    state->pc = target;
+    return STOP_NONE;
+}
+
+EXEC(j)
+{
+    STAT_INC(state, jumps);
+    state->pc = INSTR_TARGET(instr);
+    return STOP_NONE;
+}
+
+EXEC(jal)
+{
+    STAT_INC(state, jumps);
+    state->regs[RA] = state->pc;
+    state->pc = INSTR_TARGET(instr);
+    return STOP_NONE;
+}
+
+// Traps
+
+EXEC(syscall)
+{
+    int ret = state->host_syscalls ? handle_syscall(state) : -1;
+    if (ret < 0)
+        return raise_exception(state, Sys, pc);
+    return ret;
+}
+
+EXEC(break)
+{
+    return raise_exception(state, Bp, pc);
+}
+
+// Multiply and divide, results go to hi and lo
+
+EXEC(mfhi)
+{
+    RD = state->hi;
+    return STOP_NONE;
+}
+
+EXEC(mthi)
+{
+    state->hi = RS;
+    return STOP_NONE;
+}
+
+EXEC(mflo)
+{
+    RD = state->lo;
+    return STOP_NONE;
+}
+
+EXEC(mtlo)
+{
+    state->lo = RS;
+    return STOP_NONE;
+}
+
+EXEC(mult)
+{
+    int64_t product = (int64_t)(int32_t)RS * (int32_t)RT;
+    state->lo = product;
+    state->hi = (uint64_t)product >> 32;
+    return STOP_NONE;
+}
+
+EXEC(multu)
+{
+    uint64_t product = (uint64_t)RS * RT;
+    state->lo = product;
+    state->hi = product >> 32;
+    return STOP_NONE;
+}
+
+EXEC(div)
+{
+    int32_t dividend = RS;
+    int32_t divisor = RT;
+
+    // the result of a division by zero is unpredictable, leave hi and lo unchanged
+    if (divisor == 0)
+        return STOP_NONE;
+
+    if (dividend == INT32_MIN && divisor == -1)
+    {
+        state->lo = INT32_MIN;
+        state->hi = 0;
+    }
+    else
+    {
+        state->lo = dividend / divisor;
+        state->hi = dividend % divisor;
+    }
+    return STOP_NONE;
+}
+
+EXEC(divu)
+{
+    if (RT == 0)
+        return STOP_NONE;
+
+    uint32_t dividend = RS;
+    uint32_t divisor = RT;
+    state->lo = dividend / divisor;
+    state->hi = dividend % divisor;
+    return STOP_NONE;
+}
+
+// Arithmetic and logic
+
+EXEC(add)
+{
+    int32_t sum;
+    if (__builtin_expect(__builtin_add_overflow((int32_t)RS, (int32_t)RT, &sum), 0))
+        return raise_exception(state, Ov, pc);
+    RD = sum;
+    return STOP_NONE;
+}
+
+EXEC(addu)
+{
+    RD = RS + RT;
+    return STOP_NONE;
+}
+
+EXEC(sub)
+{
+    int32_t difference;
+    if (__builtin_expect(__builtin_sub_overflow((int32_t)RS, (int32_t)RT, &difference), 0))
+        return raise_exception(state, Ov, pc);
+    RD = difference;
+    return STOP_NONE;
+}
+
+EXEC(subu)
+{
+    RD = RS - RT;
+    return STOP_NONE;
+}
+
+EXEC(and)
+{
+    RD = RS & RT;
+    return STOP_NONE;
+}
+
+EXEC(or)
+{
+    RD = RS | RT;
+    return STOP_NONE;
+}
+
+EXEC(xor)
+{
+    RD = RS ^ RT;
+    return STOP_NONE;
+}
+
+EXEC(nor)
+{
+    RD = ~(RS | RT);
+    return STOP_NONE;
+}
+
+EXEC(slt)
+{
+    RD = (int32_t)RS < (int32_t)RT;
+    return STOP_NONE;
+}
+
+EXEC(sltu)
+{
+    RD = RS < RT;
+    return STOP_NONE;
+}
+
+EXEC(addi)
+{
+    int32_t sum;
+    if (__builtin_expect(__builtin_add_overflow((int32_t)RS, INSTR_SIMM(instr), &sum), 0))
+        return raise_exception(state, Ov, pc);
+    RT = sum;
+    return STOP_NONE;
+}
+
+EXEC(addiu)
+{
+    RT = RS + INSTR_SIMM(instr);
+    return STOP_NONE;
+}
+
+EXEC(slti)
+{
+    RT = (int32_t)RS < INSTR_SIMM(instr);
+    return STOP_NONE;
+}
+
+EXEC(sltiu)
+{
+    // the immediate is sign extended and then compared as unsigned
+    RT = RS < (uint32_t)INSTR_SIMM(instr);
+    return STOP_NONE;
+}
+
+EXEC(ori)
+{
+    RT = RS | INSTR_IMM(instr);
+    return STOP_NONE;
+}
+
+EXEC(xori)
+{
+    RT = RS ^ INSTR_IMM(instr);
+    return STOP_NONE;
+}
+
+EXEC(lui)
+{
+    RT = INSTR_IMM(instr) << 16;
+    return STOP_NONE;
+}
+
+// Branches
+
+EXEC(beq)
+{
+    return branch(state, RS == RT, instr);
+}
+
+EXEC(bne)
+{
+    return branch(state, RS != RT, instr);
+}
+
+EXEC(blez)
+{
+    return branch(state, (int32_t)RS <= 0, instr);
+}
+
+EXEC(bgtz)
+{
+    return branch(state, (int32_t)RS > 0, instr);
+}
+
+// Loads and stores, memory words are big endian so byte 0 of a word is its most significant byte
+
+EXEC(lw)
+{
+    uint32_t addr = RS + INSTR_SIMM(instr);
+    if (BAD_ADDR(addr, 4))
+        return address_error(state, AdEL, pc, addr);
+    STAT_INC(state, loads);
+    RT = state->mem[addr / 4];
+    return check_load(state, addr, 4, pc);
+}
+
+EXEC(lh)
+{
+    uint32_t addr = RS + INSTR_SIMM(instr);
+    if (BAD_ADDR(addr, 2))
+        return address_error(state, AdEL, pc, addr);
+    STAT_INC(state, loads);
+    RT = (int16_t)(state->mem[addr / 4] >> (16 - 8 * (addr & 2)));
+    return check_load(state, addr, 2, pc);
+}
+
+EXEC(lhu)
+{
+    uint32_t addr = RS + INSTR_SIMM(instr);
+    if (BAD_ADDR(addr, 2))
+        return address_error(state, AdEL, pc, addr);
+    STAT_INC(state, loads);
+    RT = (uint16_t)(state->mem[addr / 4] >> (16 - 8 * (addr & 2)));
+    return check_load(state, addr, 2, pc);
+}
+
+EXEC(lb)
+{
+    uint32_t addr = RS + INSTR_SIMM(instr);
+    if (BAD_ADDR(addr, 1))
+        return address_error(state, AdEL, pc, addr);
+    STAT_INC(state, loads);
+    RT = (int8_t)(state->mem[addr / 4] >> (24 - 8 * (addr & 3)));
+    return check_load(state, addr, 1, pc);
+}
+
+EXEC(lbu)
+{
+    uint32_t addr = RS + INSTR_SIMM(instr);
+    if (BAD_ADDR(addr, 1))
+        return address_error(state, AdEL, pc, addr);
+    STAT_INC(state, loads);
+    RT = (uint8_t)(state->mem[addr / 4] >> (24 - 8 * (addr & 3)));
+    return check_load(state, addr, 1, pc);
+}
+
+EXEC(sw)
+{
+    uint32_t addr = RS + INSTR_SIMM(instr);
+    if (BAD_ADDR(addr, 4))
+        return address_error(state, AdES, pc, addr);
+    return store_masked(state, addr, 4, RT, 0xFFFFFFFF, pc);
+}
+
+EXEC(sh)
+{
+    uint32_t addr = RS + INSTR_SIMM(instr);
+    if (BAD_ADDR(addr, 2))
+        return address_error(state, AdES, pc, addr);
+    int shift = 16 - 8 * (addr & 2);
+    return store_masked(state, addr, 2, RT << shift, 0xFFFFu << shift, pc);
+}
+
+EXEC(sb)
+{
+    uint32_t addr = RS + INSTR_SIMM(instr);
+    if (BAD_ADDR(addr, 1))
+        return address_error(state, AdES, pc, addr);
+    int shift = 24 - 8 * (addr & 3);
+    return store_masked(state, addr, 1, RT << shift, 0xFFu << shift, pc);
+}
+
+// Coprocessor 0
+
+EXEC(mfc0)
+{
+    uint32_t *reg = get_cp0_reg(state, INSTR_RD(instr));
+    if (reg == NULL)
+        return raise_exception(state, RI, pc);
+    RT = *reg;
+    return STOP_NONE;
+}
+
+EXEC(mtc0)
+{
+    uint32_t *reg = get_cp0_reg(state, INSTR_RD(instr));
+    if (reg == NULL)
+        return raise_exception(state, RI, pc);
+    *reg = RT;
+    return STOP_NONE;
+}
+
+EXEC(eret)
+{
+    // the decode table only looks at the rs field, the rest of the word must match too
+    if (instr != isa_desc[INSTR_ERET].match)
+        return raise_exception(state, RI, pc);
+    state->pc = state->cp0.epc;
+    state->cp0.status &= ~STATUS_EXL;
+    return STOP_NONE;
+}
+
+#undef RS
+#undef RT
+#undef RD
+
+typedef int (*ExecFn)(StateMIPS *state, uint32_t instr, uint32_t pc);
+
+/// @brief Dispatch table indexed by InstrId, generated from the ISA table
+#define ISA_EXEC(id, mnemonic, opcode, rs, funct, format) [INSTR_##id] = exec_##mnemonic,
+static const ExecFn exec_table[INSTR_COUNT] = {
+    [INSTR_UNKNOWN] = exec_unknown,
+    ISA_TABLE(ISA_EXEC)};
 
 int emulate_mips(StateMIPS *state)
 {
     // If keeping track of cycles
     // int cycles = 1;
 
-    // Get instruction from memory, divide by 4 to get index from address
-    uint32_t instr = state->mem[state->pc / 4];
-    uint8_t opcode = (instr >> 26) & 0x3F;
+    uint32_t pc = state->pc;
+    if (BAD_WORD_ADDR(pc))
+        return address_error(state, AdEL, pc, pc);
 
-    RArgs r = decode_r_type(instr);
-    JArgs j = decode_j_type(instr);
-    IArgs i = decode_i_type(instr);
+    // Get instruction from memory, divide by 4 to get index from address
+    uint32_t instr = state->mem[pc / 4];
 
     // Increment by 4 bytes (32 bits) to point to next instruction
     state->pc += 4;
 
-    switch (opcode)
-    {
-    case 0x00:               // arith/logic
-        if (r.funct == 0x20) // add
-            state->regs[r.rd] = state->regs[r.rs] + state->regs[r.rt];
-        break;
+    STAT_INC(state, instructions);
+    STAT_INC(state, pc_counts[pc / 4]);
+    STAT_INC(state, opcode[instr >> 26]);
+#ifdef MIPS_STATS
+    if ((instr >> 26) == OPCODE_SPECIAL)
+        STAT_INC(state, funct[INSTR_FUNCT(instr)]);
+#endif
 
-    case 0x02: // j
-        state->pc = j.target;
-        break;
+    int ret = exec_table[get_instr_id(instr)](state, instr, pc);
 
-    case 0x0c: // beq
-        if (state->regs[i.rs] == state->regs[i.rt])
-        {
-            state->pc += i.imm * 4; // jump by offset (in words, so multiply by 4 bytes)
-        }
-        break;
+    // $zero is hardwired, a write to it is undone here rather than checked in every handler
+    state->regs[ZERO] = 0;
+    return ret;
+}
 
-    case 0x23: // lw
-        state->regs[i.rt] = state->mem[(state->regs[i.rs] + i.imm) / 4];
-        break;
+StopReason run_mips(StateMIPS *state, uint64_t max_steps)
+{
+    for (uint64_t n = 0; n < max_steps; n++)
+    {
+        int ret = emulate_mips(state);
+        if (ret != STOP_NONE)
+            return ret;
 
-    case 0x2b: // sw
-        state->mem[(state->regs[i.rs] + i.imm) / 4] = state->regs[i.rt];
-        break;
+        // the breakpoint list is only searched for pages that have a breakpoint
+        if ((state->page_flags[(state->pc >> GUEST_PAGE_SHIFT) % NUM_GUEST_PAGES] & PAGE_BREAK) && breakpoint_at_pc(state))
+            return STOP_BREAKPOINT;
     }
 
-    return 0;
+    return STOP_STEP_LIMIT;
 }
 
 int read_file_into_mem_at(StateMIPS *state, char *filename, uint32_t offset)
@@ -59,6 +723,13 @@ int read_file_into_mem_at(StateMIPS *state, char *filename, uint32_t offset)
     long unsigned fsize = ftell(f);
     fseek(f, 0L, SEEK_SET);
 
+    if (offset > MEM_SIZE || fsize > MEM_SIZE - offset)
+    {
+        printf("error: %s does not fit in memory at 0x%08x\n", filename, offset);
+        fclose(f);
+        return 1;
+    }
+
     // Allocate buffer for reading
     uint32_t *buffer = malloc(fsize);
     if (buffer == NULL)
@@ -83,16 +754,143 @@ int read_file_into_mem_at(StateMIPS *state, char *filename, uint32_t offset)
     return 0;
 }
 
+uint8_t read_guest_byte(StateMIPS *state, uint32_t addr)
+{
+    return state->mem[addr / 4] >> (24 - 8 * (addr & 3));
+}
+
+void write_guest_byte(StateMIPS *state, uint32_t addr, uint8_t value)
+{
+    int shift = 24 - 8 * (addr & 3);
+    uint32_t *word = &state->mem[addr / 4];
+    *word = (*word & ~(0xFFu << shift)) | ((uint32_t)value << shift);
+}
+
 StateMIPS *init_mips(uint32_t pc_start)
 {
     StateMIPS *state = calloc(1, sizeof(StateMIPS));
-    state->mem = malloc(MEM_SIZE); // change to 2^32 for full 4GB address space
+
+#ifdef _WIN32
+    state->mem = calloc(1, MEM_SIZE);
+#else
+    // Reserve the memory without committing it, the host only backs the guest pages that are touched
+    state->mem = mmap(NULL, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (state->mem == MAP_FAILED)
+    {
+        free(state);
+        return NULL;
+    }
+#endif
+
     state->pc = pc_start;
+    state->host_syscalls = 1;
+    state->brk = HEAP_BASE;
+    state->out_fd = 1;
     return state;
 }
 
 void free_mips(StateMIPS *state)
 {
+    flush_output(state);
+
+#ifdef _WIN32
     free(state->mem);
+#else
+    munmap(state->mem, MEM_SIZE);
+#endif
     free(state);
 }
+
+#ifdef MIPS_STATS
+const MipsStats *get_mips_stats(StateMIPS *state)
+{
+    return &state->stats;
+}
+
+void reset_mips_stats(StateMIPS *state)
+{
+    memset(&state->stats, 0, sizeof(state->stats));
+}
+
+uint32_t get_hot_pcs(StateMIPS *state, uint32_t *pcs, uint32_t max)
+{
+    const uint64_t *counts = state->stats.pc_counts;
+    uint32_t found = 0;
+
+    for (uint32_t n = 0; max > 0 && n < MEM_SIZE / 4; n++)
+    {
+        if (counts[n] == 0 || (found == max && counts[n] <= counts[pcs[max - 1] / 4]))
+            continue;
+
+        // insert into the sorted list, the least executed one drops out once it is full
+        uint32_t at = found < max ? found++ : max - 1;
+        for (; at > 0 && counts[pcs[at - 1] / 4] < counts[n]; at--)
+            pcs[at] = pcs[at - 1];
+        pcs[at] = n * 4;
+    }
+
+    return found;
+}
+
+/// @brief Writes the non zero entries of a per opcode or per funct counter array.
+static void write_counts_json(FILE *f, const uint64_t counts[64], const char *key, uint32_t shift)
+{
+    int first = 1;
+
+    fprintf(f, "  \"%ss\": [", key);
+    for (uint32_t n = 0; n < 64; n++)
+    {
+        if (counts[n] == 0)
+            continue;
+
+        // build an instruction word with only the opcode or funct set to get the mnemonic,
+        // opcodes 0 and 0x10 are shared by several instructions
+        const char *mnemonic = get_mnemonic_from_instr(n << shift);
+        if (shift == 26 && n == OPCODE_SPECIAL)
+            mnemonic = "special";
+        else if (shift == 26 && n == OPCODE_COP0)
+            mnemonic = "cop0";
+        fprintf(f, "%s\n    {\"%s\": \"0x%02x\", \"mnemonic\": \"%s\", \"count\": %llu}", first ? "" : ",",
+                key, n, mnemonic, (unsigned long long)counts[n]);
+        first = 0;
+    }
+    fprintf(f, "\n  ]");
+}
+
+int write_mips_stats_json(StateMIPS *state, const char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if (f == NULL)
+    {
+        printf("error: Couldn't open %s\n", filename);
+        return 1;
+    }
+
+    const MipsStats *stats = &state->stats;
+    fprintf(f, "{\n");
+    fprintf(f, "  \"instructions\": %llu,\n", (unsigned long long)stats->instructions);
+    fprintf(f, "  \"loads\": %llu,\n", (unsigned long long)stats->loads);
+    fprintf(f, "  \"stores\": %llu,\n", (unsigned long long)stats->stores);
+    fprintf(f, "  \"branches_taken\": %llu,\n", (unsigned long long)stats->branches_taken);
+    fprintf(f, "  \"branches_not_taken\": %llu,\n", (unsigned long long)stats->branches_not_taken);
+    fprintf(f, "  \"jumps\": %llu,\n", (unsigned long long)stats->jumps);
+    write_counts_json(f, stats->opcode, "opcode", 26);
+    fprintf(f, ",\n");
+    write_counts_json(f, stats->funct, "funct", 0);
+
+    uint32_t pcs[STATS_HOT_PCS];
+    uint32_t num_pcs = get_hot_pcs(state, pcs, STATS_HOT_PCS);
+    fprintf(f, ",\n  \"hot_pcs\": [");
+    for (uint32_t n = 0; n < num_pcs; n++)
+    {
+        char text[64] = "";
+        disassemble_instr(state->mem[pcs[n] / 4], text, sizeof(text));
+        fprintf(f, "%s\n    {\"pc\": \"0x%08x\", \"instr\": \"%s\", \"count\": %llu}", n ? "," : "", pcs[n], text,
+                (unsigned long long)stats->pc_counts[pcs[n] / 4]);
+    }
+    fprintf(f, "\n  ]\n}\n");
+
+    fclose(f);
+    return 0;
+}
+#endif
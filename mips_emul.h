@@ -17,7 +17,28 @@
 #define TEST_BIT(variable, bit_pos) (((variable) & BIT_MASK(bit_pos)) ? 1 : 0)
 
 // This is the size of the memory in bytes
-#define MEM_SIZE 0x1000
+#define MEM_SIZE 0x100000
+
+// Start of the heap grown by the sbrk syscall, the heap uses the top half of memory
+#define HEAP_BASE (MEM_SIZE / 2)
+
+// Size of the buffer that guest output is collected in before it is written to the host
+#define OUT_BUF_SIZE 0x10000
+
+// Guest memory is split into pages so that watched pages can be routed through a slow path
+#define GUEST_PAGE_SHIFT 8
+#define GUEST_PAGE_SIZE (1 << GUEST_PAGE_SHIFT)
+#define NUM_GUEST_PAGES (MEM_SIZE >> GUEST_PAGE_SHIFT)
+
+// Page flags, any access to a page with the matching flag set goes through the watchpoint checks
+#define PAGE_WATCH_READ 0x01
+#define PAGE_WATCH_WRITE 0x02
+#define PAGE_BREAK 0x04
+
+// Maximum number of watchpoints that can be set at once
+#define MAX_WATCHPOINTS 16
+// Maximum number of breakpoints that can be set at once
+#define MAX_BREAKPOINTS 64
 
 // MIPS registers, use as index into the regs array in StateMIPS
 typedef enum Register
@@ -72,6 +93,90 @@ typedef enum ExceptionCode
     FPE = 15  // floating point exception
 } ExceptionCode;
 
+// Exception level bit of the status register, set while an exception is being handled
+#define STATUS_EXL 0x2
+// Position and mask of the exception code in the cause register
+#define CAUSE_EXC_SHIFT 2
+#define CAUSE_EXC_MASK (0x1F << CAUSE_EXC_SHIFT)
+
+// Coprocessor 0 register numbers, as used by mfc0 and mtc0
+#define CP0_BADVADDR 8
+#define CP0_STATUS 12
+#define CP0_CAUSE 13
+#define CP0_EPC 14
+
+/// @brief Coprocessor 0 registers used for exceptions
+typedef struct CP0
+{
+    uint32_t status;
+    uint32_t cause;
+    // address of the instruction that caused the last exception
+    uint32_t epc;
+    // address that caused the last address error
+    uint32_t badvaddr;
+} CP0;
+
+/// @brief Reasons for the emulator to stop executing
+typedef enum StopReason
+{
+    STOP_NONE = 0,   // instruction executed normally
+    STOP_WATCHPOINT, // a watchpoint was hit, see StateMIPS.watch_hit
+    STOP_BREAKPOINT, // the pc reached a breakpoint
+    STOP_EXCEPTION,  // an exception was raised and there is no handler, see StateMIPS.cp0
+    STOP_EXIT,       // the guest called the exit syscall, see StateMIPS.exit_code
+    STOP_STEP_LIMIT  // run_mips executed the maximum number of instructions
+} StopReason;
+
+/// @brief Type of access a watchpoint triggers on
+typedef enum WatchType
+{
+    WATCH_READ = PAGE_WATCH_READ,
+    WATCH_WRITE = PAGE_WATCH_WRITE,
+    WATCH_ACCESS = PAGE_WATCH_READ | PAGE_WATCH_WRITE
+} WatchType;
+
+/// @brief A watchpoint on the guest address range [start, end)
+typedef struct Watchpoint
+{
+    uint32_t start;
+    uint32_t end;
+    WatchType type;
+} Watchpoint;
+
+/// @brief Information about the last watchpoint that was hit
+typedef struct WatchHit
+{
+    // address of the instruction that accessed the watched memory
+    uint32_t pc;
+    // address of the accessed word
+    uint32_t addr;
+    uint32_t old_value;
+    uint32_t new_value;
+    WatchType type;
+} WatchHit;
+
+#ifdef MIPS_STATS
+// Number of the most executed instructions written by write_mips_stats_json
+#define STATS_HOT_PCS 16
+
+/// @brief Counters for the mix of executed instructions, only present when built with -DMIPS_STATS
+typedef struct MipsStats
+{
+    uint64_t instructions;
+    // executed instructions by opcode
+    uint64_t opcode[64];
+    // executed R-type (opcode 0) instructions by funct
+    uint64_t funct[64];
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t branches_taken;
+    uint64_t branches_not_taken;
+    uint64_t jumps;
+    // executed instructions by word address, see get_hot_pcs
+    uint64_t pc_counts[MEM_SIZE / 4];
+} MipsStats;
+#endif
+
 /// @brief Struct to hold the state of the MIPS processor
 typedef struct StateMIPS
 {
@@ -81,8 +186,48 @@ typedef struct StateMIPS
     // program counter, holds the address (not index) of the current instruction
     uint32_t pc;
 
+    // results of multiply and divide
+    uint32_t hi;
+    uint32_t lo;
+
     // pointer to program in memory
     uint32_t *mem;
+
+    CP0 cp0;
+
+    // if set, exceptions jump to exc_vector, otherwise emulate_mips returns STOP_EXCEPTION
+    // with the pc left on the faulting instruction
+    uint8_t exc_handler_enabled;
+    uint32_t exc_vector;
+
+    // if set, syscall is serviced by the host (see syscalls.h) instead of raising an exception
+    uint8_t host_syscalls;
+    // current end of the heap, moved by the sbrk syscall, 0 means HEAP_BASE
+    uint32_t brk;
+    // exit code given by the guest to the exit syscalls
+    int exit_code;
+
+    // flags for each guest page, a non zero entry means the page has a watchpoint or breakpoint
+    uint8_t page_flags[NUM_GUEST_PAGES];
+
+    Watchpoint watchpoints[MAX_WATCHPOINTS];
+    int num_watchpoints;
+
+    // addresses of the breakpoints, only checked by run_mips
+    uint32_t breakpoints[MAX_BREAKPOINTS];
+    int num_breakpoints;
+
+    // filled in when emulate_mips returns STOP_WATCHPOINT
+    WatchHit watch_hit;
+
+#ifdef MIPS_STATS
+    MipsStats stats;
+#endif
+
+    // guest output is collected in out_buf and written to out_fd in bulk
+    int out_fd;
+    uint32_t out_len;
+    char out_buf[OUT_BUF_SIZE];
 } StateMIPS;
 
 /// @brief Read a file into memory at a specific offset
@@ -95,6 +240,18 @@ typedef struct StateMIPS
 /// @return returns 0 on success, 1 on failure
 int read_file_into_mem_at(StateMIPS *state, char *filename, uint32_t offset);
 
+/// @brief Reads a byte of guest memory, memory words are big endian
+/// @param state
+/// @param addr
+/// @return
+uint8_t read_guest_byte(StateMIPS *state, uint32_t addr);
+
+/// @brief Writes a byte of guest memory, memory words are big endian
+/// @param state
+/// @param addr
+/// @param value
+void write_guest_byte(StateMIPS *state, uint32_t addr, uint8_t value);
+
 /// @brief Initialize the MIPS processor
 /// @param pc_start
 /// @return StateMIPS*
@@ -106,5 +263,64 @@ void free_mips(StateMIPS *state);
 
 /// @brief Emulate the MIPS processor
 /// @param state
+/// @return STOP_NONE, or the reason the instruction stopped execution
+int emulate_mips(StateMIPS *state);
+
+/// @brief Runs instructions until something stops execution or max_steps instructions were executed
+/// Breakpoints are checked after each instruction, so execution can resume from a breakpoint.
+/// @param state
+/// @param max_steps
+/// @return The reason execution stopped
+StopReason run_mips(StateMIPS *state, uint64_t max_steps);
+
+/// @brief Adds a watchpoint on the address range [addr, addr + len)
+/// @param state
+/// @param addr
+/// @param len
+/// @param type
+/// @return returns 0 on success, 1 on failure
+int add_watchpoint(StateMIPS *state, uint32_t addr, uint32_t len, WatchType type);
+
+/// @brief Removes a watchpoint previously added with the same arguments
+/// @param state
+/// @param addr
+/// @param len
+/// @param type
+/// @return returns 0 on success, 1 if no such watchpoint exists or the range is invalid
+int remove_watchpoint(StateMIPS *state, uint32_t addr, uint32_t len, WatchType type);
+
+/// @brief Adds a breakpoint at addr, run_mips stops before executing the instruction at addr
+/// @param state
+/// @param addr
+/// @return returns 0 on success, 1 on failure
+int add_breakpoint(StateMIPS *state, uint32_t addr);
+
+/// @brief Removes the breakpoint at addr
+/// @param state
+/// @param addr
+/// @return returns 0 on success, 1 if no such breakpoint exists
+int remove_breakpoint(StateMIPS *state, uint32_t addr);
+
+#ifdef MIPS_STATS
+/// @brief Gets the instruction mix counters
+/// @param state
 /// @return
-int emulate_mips(StateMIPS *state);
\ No newline at end of file
+const MipsStats *get_mips_stats(StateMIPS *state);
+
+/// @brief Sets all instruction mix counters to 0
+/// @param state
+void reset_mips_stats(StateMIPS *state);
+
+/// @brief Finds the most executed instructions
+/// @param state
+/// @param pcs filled with the addresses of the instructions, the most executed one first
+/// @param max room in pcs
+/// @return Number of addresses in pcs, fewer than max if fewer instructions were executed
+uint32_t get_hot_pcs(StateMIPS *state, uint32_t *pcs, uint32_t max);
+
+/// @brief Writes the instruction mix counters and the most executed instructions to a file as JSON
+/// @param state
+/// @param filename
+/// @return returns 0 on success, 1 on failure
+int write_mips_stats_json(StateMIPS *state, const char *filename);
+#endif
@@ -1,5 +1,10 @@
 #include "minunit.h"
 #include "mips_emul.h"
+#include "syscalls.h"
+#include "loader.h"
+#include "gdbstub.h"
+
+#include <sys/socket.h>
 
 void print_state();
 void print_full();
@@ -75,11 +80,168 @@ MU_TEST(test_decode_j_type)
     mu_assert(j.target == 0x2345678, "Target was not set correctly");
 }
 
+MU_TEST(test_decode_batch)
+{
+    // an odd count so the scalar tail runs after the vector loop
+    enum { COUNT = 1003 };
+    static uint32_t words[COUNT];
+    static uint8_t bytes[2][6][COUNT];
+    static int32_t imm[2][COUNT];
+    static uint32_t target[2][COUNT];
+
+    uint32_t x = 0x12345678;
+    for (int n = 0; n < COUNT; n++)
+    {
+        // xorshift, covers every bit pattern of the fields
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        words[n] = x;
+    }
+
+    DecodedBatch out[2];
+    for (int k = 0; k < 2; k++)
+        out[k] = (DecodedBatch){bytes[k][0], bytes[k][1], bytes[k][2], bytes[k][3], bytes[k][4], bytes[k][5], imm[k], target[k]};
+
+    decode_batch(words, COUNT, &out[0]);
+    decode_batch_scalar(words, 0, COUNT, &out[1]);
+
+    mu_assert(memcmp(bytes[0], bytes[1], sizeof(bytes[0])) == 0, "Batch fields differ from the scalar decoder");
+    mu_assert(memcmp(imm[0], imm[1], sizeof(imm[0])) == 0, "Batch immediates differ from the scalar decoder");
+    mu_assert(memcmp(target[0], target[1], sizeof(target[0])) == 0, "Batch targets differ from the scalar decoder");
+
+    // and the scalar decoder agrees with the single word decoders
+    RArgs r = decode_r_type(words[7]);
+    IArgs i = decode_i_type(words[7]);
+    mu_assert_int_eq(words[7] >> 26, out[1].opcode[7]);
+    mu_assert_int_eq(r.rd, out[1].rd[7]);
+    mu_assert_int_eq(r.shamt, out[1].shamt[7]);
+    mu_assert_int_eq(r.funct, out[1].funct[7]);
+    mu_assert_int_eq((int16_t)i.imm, out[1].imm[7]);
+    mu_assert_int_eq(decode_j_type(words[7]).target, out[1].target[7]);
+}
+
+MU_TEST(test_register_lookup)
+{
+    mu_assert_int_eq(0, get_register_number_from_name("$zero"));
+    mu_assert_int_eq(1, get_register_number_from_name("$at"));
+    mu_assert_int_eq(5, get_register_number_from_name("$a1"));
+    mu_assert_int_eq(15, get_register_number_from_name("$t7"));
+    mu_assert_int_eq(25, get_register_number_from_name("$t9"));
+    mu_assert_int_eq(29, get_register_number_from_name("$sp"));
+    mu_assert_int_eq(31, get_register_number_from_name("$ra"));
+
+    // numeric aliases
+    mu_assert_int_eq(0, get_register_number_from_name("$0"));
+    mu_assert_int_eq(8, get_register_number_from_name("$8"));
+    mu_assert_int_eq(31, get_register_number_from_name("$31"));
+
+    // views into a larger string
+    mu_assert_int_eq(9, get_register_number("$t1, $t2", 3));
+
+    mu_assert_int_eq(-1, get_register_number_from_name("$32"));
+    mu_assert_int_eq(-1, get_register_number_from_name("$08"));
+    mu_assert_int_eq(-1, get_register_number_from_name("$t"));
+    mu_assert_int_eq(-1, get_register_number_from_name("$a4"));
+    mu_assert_int_eq(-1, get_register_number_from_name("t0"));
+
+    // every register name maps back to its number
+    char name[8];
+    for (int reg = 0; reg < 32; reg++)
+    {
+        sprintf(name, "$%s", get_reg_name(reg));
+        mu_assert_int_eq(reg, get_register_number_from_name(name));
+    }
+}
+
+MU_TEST(test_mnemonic_lookup)
+{
+    mu_assert_int_eq(0x00, get_opcode_from_mnemonic("add"));
+    mu_assert_int_eq(0x02, get_opcode_from_mnemonic("j"));
+    mu_assert_int_eq(0x0c, get_opcode_from_mnemonic("beq"));
+    mu_assert_int_eq(0x23, get_opcode_from_mnemonic("lw"));
+    mu_assert_int_eq(0x2b, get_opcode_from_mnemonic("sw"));
+    mu_assert_int_eq(0xFF, get_opcode_from_mnemonic("addx"));
+    mu_assert_int_eq(0xFF, get_opcode_from_mnemonic("w"));
+
+    const InstrDesc *info = get_mnemonic_info("add $t0", 3);
+    mu_assert(info != NULL && info->funct == 0x20, "Lookup of a view failed");
+    mu_assert(get_mnemonic_info("ad", 2) == NULL, "Prefix of a mnemonic was found");
+
+    // every instruction in the ISA table can be found by its mnemonic
+    for (int id = INSTR_UNKNOWN + 1; id < INSTR_COUNT; id++)
+        mu_assert(get_mnemonic_info(isa_desc[id].name, isa_desc[id].len) == &isa_desc[id], isa_desc[id].name);
+    mu_assert(get_mnemonic_info("unknown", 7) == NULL, "The unknown entry was found");
+}
+
+MU_TEST(test_isa_encode_decode)
+{
+    // encoding any operands and decoding the result gives back the same instruction
+    for (int id = INSTR_UNKNOWN + 1; id < INSTR_COUNT; id++)
+    {
+        Instruction instr = {.id = id, .format = isa_desc[id].format};
+        switch (get_instr_type(instr.format))
+        {
+        case R_TYPE:
+            instr.r = (RArgs){.rs = isa_desc[id].opcode == OPCODE_COP0 ? 0 : 7, .rt = 9, .rd = 14, .shamt = 3};
+            break;
+        case I_TYPE:
+            instr.i = (IArgs){.rs = 7, .rt = 9, .imm = 0xfffc};
+            break;
+        case J_TYPE:
+            instr.j.target = 0x40;
+            break;
+        }
+
+        Instruction decoded = decode_instr(encode_instr(&instr));
+        mu_assert(decoded.id == (InstrId)id, isa_desc[id].name);
+    }
+
+    mu_assert_int_eq(0x14b4820, encode_instr(&(Instruction){.id = INSTR_ADD, .r = {.rs = T2, .rt = T3, .rd = T1}}));
+    mu_assert_int_eq(INSTR_UNKNOWN, get_instr_id(0xFC000000));
+    mu_assert_int_eq(INSTR_UNKNOWN, get_instr_id(0x00000001));
+}
+
+MU_TEST(test_disassemble)
+{
+    char text[64];
+
+    disassemble_instr(0x14b4820, text, sizeof(text));
+    mu_assert_string_eq("add $t1, $t2, $t3", text);
+    disassemble_instr(0x8d49000c, text, sizeof(text));
+    mu_assert_string_eq("lw $t1, 0x000c($t2)", text);
+    // sign extended immediates are written as the assembler takes them back, the others as they are
+    disassemble_instr(0x2508fff0, text, sizeof(text));
+    mu_assert_string_eq("addiu $t0, $t0, -0x0010", text);
+    disassemble_instr(0x3508fff0, text, sizeof(text));
+    mu_assert_string_eq("ori $t0, $t0, 0xfff0", text);
+    disassemble_instr(0x800000A, text, sizeof(text));
+    mu_assert_string_eq("j 0x0000000a", text);
+    disassemble_instr(0xa4903, text, sizeof(text));
+    mu_assert_string_eq("sra $t1, $t2, 4", text);
+    disassemble_instr(0x40087000, text, sizeof(text));
+    mu_assert_string_eq("mfc0 $t0, $14", text);
+    disassemble_instr(0x0000000c, text, sizeof(text));
+    mu_assert_string_eq("syscall", text);
+
+    mu_assert_int_eq(0, disassemble_instr(0xFC000000, text, sizeof(text)));
+    mu_assert_string_eq("", text);
+
+    // the text is cut off to fit the buffer
+    mu_assert_int_eq(7, disassemble_instr(0x14b4820, text, 8));
+    mu_assert_string_eq("add $t1", text);
+}
+
 MU_TEST_SUITE(function_tests)
 {
     MU_RUN_TEST(test_decode_r_type);
     MU_RUN_TEST(test_decode_i_type);
     MU_RUN_TEST(test_decode_j_type);
+    MU_RUN_TEST(test_decode_batch);
+    MU_RUN_TEST(test_register_lookup);
+    MU_RUN_TEST(test_mnemonic_lookup);
+    MU_RUN_TEST(test_isa_encode_decode);
+    MU_RUN_TEST(test_disassemble);
 }
 
 // ********* opcode tests ********* //
@@ -155,11 +317,132 @@ MU_TEST(test_0x2b_sw)
     sm(0, instruction);
 
     sr(T1, 0x9ABC);
-    sr(T2, 0x01);
+    sr(T2, 0x10);
+
+    emulate_mips(pState);
+
+    mu_assert(pState->mem[(0x10 + 12) / 4] == 0x9ABC, "Sw did not work correctly");
+}
+
+MU_TEST(test_alu)
+{
+    sr(T2, 0xFFFFFFF0); // -16
+    sr(T3, 0x3);
+
+    sm(0x00, 0x14b4822); // sub $t1, $t2, $t3
+    sm(0x04, 0x14b482a); // slt $t1, $t2, $t3
+    sm(0x08, 0x14b482b); // sltu $t1, $t2, $t3
+    sm(0x0c, 0x14b4827); // nor $t1, $t2, $t3
+    sm(0x10, 0xa4903);   // sra $t1, $t2, 4
+    sm(0x14, 0x16a4806); // srlv $t1, $t2, $t3
+    sm(0x18, 0x2149fffc); // addi $t1, $t2, -4
+    sm(0x1c, 0x2d49ffff); // sltiu $t1, $t2, -1
+    sm(0x20, 0x3c091234); // lui $t1, 0x1234
+    sm(0x24, 0x35298000); // ori $t1, $t1, 0x8000
+
+    emulate_mips(pState);
+    mu_assert_int_eq(-19, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(1, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(0, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(0xC, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(-1, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(0x1FFFFFFE, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(-20, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(1, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(0x12340000, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(0x12348000, pState->regs[T1]);
+}
+
+MU_TEST(test_mult_div)
+{
+    sr(T2, 0xFFFFFFF9); // -7
+    sr(T3, 0x2);
+
+    sm(0x00, 0x14b0018); // mult $t2, $t3
+    sm(0x04, 0x4010);    // mfhi $t0
+    sm(0x08, 0x4812);    // mflo $t1
+    sm(0x0c, 0x14b001a); // div $t2, $t3
+    sm(0x10, 0x4010);    // mfhi $t0
+    sm(0x14, 0x4812);    // mflo $t1
+
+    for (int n = 0; n < 3; n++)
+        emulate_mips(pState);
+    mu_assert_int_eq(-1, pState->regs[T0]);
+    mu_assert_int_eq(-14, pState->regs[T1]);
+
+    for (int n = 0; n < 3; n++)
+        emulate_mips(pState);
+    mu_assert_int_eq(-1, pState->regs[T0]);
+    mu_assert_int_eq(-3, pState->regs[T1]);
+}
+
+MU_TEST(test_branch_and_link)
+{
+    // bne with a negative offset branches backwards
+    sm(0x10, 0x152afffe); // bne $t1, $t2, -2
+    pState->pc = 0x10;
+    sr(T1, 1);
+    emulate_mips(pState);
+    mu_assert_int_eq(0x0c, pState->pc);
+
+    // jal links to the next instruction, jr returns to it
+    sm(0x20, 0xc000040); // jal 0x40
+    sm(0x40, 0x3e00008); // jr $ra
+    pState->pc = 0x20;
+    emulate_mips(pState);
+    mu_assert_int_eq(0x40, pState->pc);
+    mu_assert_int_eq(0x24, pState->regs[RA]);
+    emulate_mips(pState);
+    mu_assert_int_eq(0x24, pState->pc);
+}
+
+MU_TEST(test_byte_half_access)
+{
+    sr(T2, 0x80);
+    sm(0x80, 0x12F4A6B8);
+
+    sm(0x00, 0x81490001); // lb $t1, 1($t2)
+    sm(0x04, 0x91490001); // lbu $t1, 1($t2)
+    sm(0x08, 0x85490002); // lh $t1, 2($t2)
+    sm(0x0c, 0xa1490003); // sb $t1, 3($t2)
+    sm(0x10, 0xa5490000); // sh $t1, 0($t2)
+    sm(0x14, 0x85490001); // lh $t1, 1($t2)
+
+    emulate_mips(pState);
+    mu_assert_int_eq(0xFFFFFFF4, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(0xF4, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(0xFFFFA6B8, pState->regs[T1]);
+    emulate_mips(pState);
+    mu_assert_int_eq(0x12F4A6B8, pState->mem[0x80 / 4]);
+    sr(T1, 0xCAFE);
+    emulate_mips(pState);
+    mu_assert_int_eq(0xCAFEA6B8, pState->mem[0x80 / 4]);
+
+    // halfword loads must be aligned
+    mu_assert_int_eq(STOP_EXCEPTION, emulate_mips(pState));
+    mu_assert_int_eq(0x81, pState->cp0.badvaddr);
+}
+
+MU_TEST(test_zero_register)
+{
+    // addi $zero, $t2, 5 leaves $zero at 0
+    sm(0, 0x21400005);
+    sr(T2, 1);
 
     emulate_mips(pState);
 
-    mu_assert(pState->mem[(0x01 + 12) / 4] == 0x9ABC, "Sw did not work correctly");
+    mu_assert_int_eq(0, pState->regs[ZERO]);
 }
 
 MU_TEST_SUITE(opcode_tests)
@@ -171,12 +454,665 @@ MU_TEST_SUITE(opcode_tests)
     MU_RUN_TEST(test_0x0c_beq);
     MU_RUN_TEST(test_0x23_lw);
     MU_RUN_TEST(test_0x2b_sw);
+    MU_RUN_TEST(test_alu);
+    MU_RUN_TEST(test_mult_div);
+    MU_RUN_TEST(test_branch_and_link);
+    MU_RUN_TEST(test_byte_half_access);
+    MU_RUN_TEST(test_zero_register);
+}
+
+// ********* watchpoint tests ********* //
+
+MU_TEST(test_watch_write)
+{
+    // sw $t1, 12($t2)
+    sm(0, 0xad49000c);
+    sr(T1, 0x9ABC);
+    sr(T2, 0x10);
+    sm(0x1c, 0x1111);
+
+    mu_assert(add_watchpoint(pState, 0x1c, 4, WATCH_WRITE) == 0, "Could not add watchpoint");
+
+    mu_assert(emulate_mips(pState) == STOP_WATCHPOINT, "Write watchpoint was not hit");
+    mu_assert(pState->watch_hit.pc == 0x0, "Wrong pc for watchpoint hit");
+    mu_assert(pState->watch_hit.addr == 0x1c, "Wrong address for watchpoint hit");
+    mu_assert(pState->watch_hit.old_value == 0x1111, "Wrong old value for watchpoint hit");
+    mu_assert(pState->watch_hit.new_value == 0x9ABC, "Wrong new value for watchpoint hit");
+    mu_assert(pState->mem[0x1c / 4] == 0x9ABC, "Store was not completed");
+}
+
+MU_TEST(test_watch_same_page_miss)
+{
+    // sw $t1, 12($t2), stores to 0x1c while 0x20 is watched
+    sm(0, 0xad49000c);
+    sr(T1, 0x9ABC);
+    sr(T2, 0x10);
+
+    add_watchpoint(pState, 0x20, 4, WATCH_WRITE);
+
+    mu_assert(emulate_mips(pState) == STOP_NONE, "Watchpoint hit for an unwatched word");
+    mu_assert(pState->mem[0x1c / 4] == 0x9ABC, "Sw did not work correctly");
+}
+
+MU_TEST(test_watch_read)
+{
+    // lw $t1, 12($t2)
+    sm(0, 0x8d49000c);
+    sr(T2, 0x10);
+    sm(0x1c, 0x9ABC);
+
+    add_watchpoint(pState, 0x1c, 4, WATCH_WRITE);
+    mu_assert(emulate_mips(pState) == STOP_NONE, "Write watchpoint hit on a read");
+
+    pState->pc = 0;
+    mu_assert(remove_watchpoint(pState, 0x1c, 4, WATCH_WRITE) == 0, "Could not remove watchpoint");
+    add_watchpoint(pState, 0x1c, 4, WATCH_READ);
+    mu_assert(emulate_mips(pState) == STOP_WATCHPOINT, "Read watchpoint was not hit");
+    mu_assert(pState->watch_hit.type == WATCH_READ, "Wrong watchpoint type");
+    mu_assert(pState->regs[T1] == 0x9ABC, "Load was not completed");
+}
+
+MU_TEST(test_run_until_watch)
+{
+    // add $t1, $t2, $t3 three times, then sw $t1, 12($t2)
+    sm(0, 0x14b4820);
+    sm(4, 0x14b4820);
+    sm(8, 0x14b4820);
+    sm(12, 0xad49000c);
+    sr(T2, 0x10);
+    sr(T3, 0x1);
+
+    add_watchpoint(pState, 0x1c, 4, WATCH_ACCESS);
+
+    mu_assert(run_mips(pState, 100) == STOP_WATCHPOINT, "Run did not stop on watchpoint");
+    mu_assert(pState->watch_hit.pc == 12, "Wrong pc for watchpoint hit");
+    mu_assert(pState->pc == 16, "Run did not stop after the store");
+}
+
+MU_TEST(test_watch_out_of_range)
+{
+    mu_assert(add_watchpoint(pState, MEM_SIZE, 4, WATCH_WRITE) == 1, "Added a watchpoint past the end of memory");
+    mu_assert(add_watchpoint(pState, 0x1c, 0, WATCH_WRITE) == 1, "Added an empty watchpoint");
+
+    // a watchpoint clamped to the end of memory must not match a range past the end
+    mu_assert(add_watchpoint(pState, MEM_SIZE - 4, 8, WATCH_WRITE) == 0, "Could not add watchpoint");
+    mu_assert(remove_watchpoint(pState, MEM_SIZE, 4, WATCH_WRITE) == 1, "Removed a watchpoint past the end of memory");
+    mu_assert(remove_watchpoint(pState, 0xFFFFFFFC, 8, WATCH_WRITE) == 1, "Removed a wrapped watchpoint");
+    mu_assert(remove_watchpoint(pState, MEM_SIZE - 4, 0, WATCH_WRITE) == 1, "Removed an empty watchpoint");
+    mu_assert(pState->num_watchpoints == 1, "Watchpoint was removed");
+    mu_assert(remove_watchpoint(pState, MEM_SIZE - 4, 8, WATCH_WRITE) == 0, "Could not remove watchpoint");
+}
+
+MU_TEST_SUITE(watchpoint_tests)
+{
+    MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+    MU_RUN_TEST(test_watch_write);
+    MU_RUN_TEST(test_watch_same_page_miss);
+    MU_RUN_TEST(test_watch_read);
+    MU_RUN_TEST(test_run_until_watch);
+    MU_RUN_TEST(test_watch_out_of_range);
+}
+
+// ********* exception tests ********* //
+
+/// @brief Gets the exception code from the cause register
+uint32_t exc_code()
+{
+    return (pState->cp0.cause & CAUSE_EXC_MASK) >> CAUSE_EXC_SHIFT;
+}
+
+MU_TEST(test_exc_add_overflow)
+{
+    // add $t1, $t2, $t3 at 0x8
+    pState->pc = 0x8;
+    sm(0x8, 0x14b4820);
+    sr(T1, 0x1);
+    sr(T2, 0x7FFFFFFF);
+    sr(T3, 0x1);
+
+    mu_assert(emulate_mips(pState) == STOP_EXCEPTION, "Overflow did not stop execution");
+    mu_assert(exc_code() == Ov, "Wrong exception code");
+    mu_assert(pState->cp0.epc == 0x8, "Wrong EPC");
+    mu_assert(pState->pc == 0x8, "PC was not left on the faulting instruction");
+    mu_assert(pState->regs[T1] == 0x1, "Destination was written on overflow");
+}
+
+MU_TEST(test_exc_add_negative)
+{
+    // add $t1, $t2, $t3 with a negative result does not overflow
+    sm(0, 0x14b4820);
+    sr(T2, 0x1);
+    sr(T3, 0xFFFFFFFE);
+
+    mu_assert(emulate_mips(pState) == STOP_NONE, "Add raised an exception");
+    mu_assert(pState->regs[T1] == 0xFFFFFFFF, "Add did not work correctly");
+}
+
+MU_TEST(test_exc_address_error)
+{
+    // lw $t1, 12($t2) from an unaligned address
+    sm(0, 0x8d49000c);
+    sr(T2, 0x1);
+
+    mu_assert(emulate_mips(pState) == STOP_EXCEPTION, "Unaligned load did not stop execution");
+    mu_assert(exc_code() == AdEL, "Wrong exception code for load");
+    mu_assert(pState->cp0.badvaddr == 0xd, "Wrong BadVAddr for load");
+
+    // sw $t1, 12($t2) outside of memory
+    sm(0, 0xad49000c);
+    sr(T2, MEM_SIZE);
+
+    mu_assert(emulate_mips(pState) == STOP_EXCEPTION, "Store outside of memory did not stop execution");
+    mu_assert(exc_code() == AdES, "Wrong exception code for store");
+    mu_assert(pState->cp0.badvaddr == MEM_SIZE + 12, "Wrong BadVAddr for store");
+
+    // fetch from an unaligned pc
+    pState->pc = 0x2;
+    mu_assert(emulate_mips(pState) == STOP_EXCEPTION, "Unaligned fetch did not stop execution");
+    mu_assert(exc_code() == AdEL, "Wrong exception code for fetch");
+    mu_assert(pState->cp0.badvaddr == 0x2, "Wrong BadVAddr for fetch");
+}
+
+MU_TEST(test_exc_reserved_syscall_break)
+{
+    // opcode 0x3f is not an instruction
+    sm(0, 0xFC000000);
+    mu_assert(emulate_mips(pState) == STOP_EXCEPTION, "Reserved instruction did not stop execution");
+    mu_assert(exc_code() == RI, "Wrong exception code for reserved instruction");
+
+    // syscall
+    sm(0, 0x0000000c);
+    mu_assert(emulate_mips(pState) == STOP_EXCEPTION, "Syscall did not stop execution");
+    mu_assert(exc_code() == Sys, "Wrong exception code for syscall");
+
+    // break
+    sm(0, 0x0000000d);
+    mu_assert(emulate_mips(pState) == STOP_EXCEPTION, "Break did not stop execution");
+    mu_assert(exc_code() == Bp, "Wrong exception code for break");
+}
+
+MU_TEST(test_exc_handler)
+{
+    // syscall at 0x4, handler at 0x20 reads EPC into $t0 and returns with eret
+    sm(0x4, 0x0000000c);
+    sm(0x20, 0x40087000); // mfc0 $t0, $14
+    sm(0x24, 0x42000018); // eret
+    pState->pc = 0x4;
+    pState->exc_handler_enabled = 1;
+    pState->exc_vector = 0x20;
+
+    mu_assert(emulate_mips(pState) == STOP_NONE, "Handled exception stopped execution");
+    mu_assert(pState->pc == 0x20, "Did not jump to the exception vector");
+    mu_assert(pState->cp0.status & STATUS_EXL, "EXL was not set");
+
+    emulate_mips(pState);
+    mu_assert(pState->regs[T0] == 0x4, "mfc0 did not read EPC");
+
+    emulate_mips(pState);
+    mu_assert(pState->pc == 0x4, "eret did not return to EPC");
+    mu_assert(!(pState->cp0.status & STATUS_EXL), "EXL was not cleared");
+}
+
+MU_TEST(test_exc_nested)
+{
+    // the handler at 0x20 faults with a break, which must not overwrite EPC
+    sm(0x4, 0x0000000c);  // syscall
+    sm(0x20, 0x0000000d); // break
+    pState->pc = 0x4;
+    pState->exc_handler_enabled = 1;
+    pState->exc_vector = 0x20;
+
+    emulate_mips(pState);
+    mu_assert(emulate_mips(pState) == STOP_NONE, "Handled exception stopped execution");
+    mu_assert(exc_code() == Bp, "Wrong exception code for break");
+    mu_assert(pState->cp0.epc == 0x4, "EPC was overwritten inside the handler");
+    mu_assert(pState->cp0.status & STATUS_EXL, "EXL was cleared");
+}
+
+MU_TEST_SUITE(exception_tests)
+{
+    MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+    MU_RUN_TEST(test_exc_add_overflow);
+    MU_RUN_TEST(test_exc_add_negative);
+    MU_RUN_TEST(test_exc_address_error);
+    MU_RUN_TEST(test_exc_reserved_syscall_break);
+    MU_RUN_TEST(test_exc_handler);
+    MU_RUN_TEST(test_exc_nested);
+}
+
+// ********* syscall tests ********* //
+
+MU_TEST(test_syscall_buffered_output)
+{
+    int fds[2];
+    mu_assert(pipe(fds) == 0, "Could not create pipe");
+    pState->host_syscalls = 1;
+    pState->out_fd = fds[1];
+
+    // "hi" at 0x40
+    sm(0x40, 0x68690000);
+    sm(0, 0x0000000c);
+
+    sr(V0, SYS_PRINT_INT);
+    sr(A0, -42);
+    mu_assert(emulate_mips(pState) == STOP_NONE, "print_int stopped execution");
+    mu_assert(pState->pc == 4, "Syscall did not advance the pc");
+
+    pState->pc = 0;
+    sr(V0, SYS_PRINT_STRING);
+    sr(A0, 0x40);
+    emulate_mips(pState);
+
+    pState->pc = 0;
+    sr(V0, SYS_PRINT_CHAR);
+    sr(A0, '\n');
+    emulate_mips(pState);
+
+    mu_assert(pState->out_len == 6, "Output was not buffered");
+
+    flush_output(pState);
+    close(fds[1]);
+
+    char buf[16] = {0};
+    read(fds[0], buf, sizeof(buf) - 1);
+    close(fds[0]);
+    mu_assert_string_eq("-42hi\n", buf);
+}
+
+MU_TEST(test_syscall_sbrk)
+{
+    pState->host_syscalls = 1;
+    sm(0, 0x0000000c);
+
+    sr(V0, SYS_SBRK);
+    sr(A0, 6);
+    emulate_mips(pState);
+    mu_assert(pState->regs[V0] == HEAP_BASE, "sbrk did not return the start of the heap");
+
+    pState->pc = 0;
+    sr(V0, SYS_SBRK);
+    sr(A0, 4);
+    emulate_mips(pState);
+    mu_assert(pState->regs[V0] == HEAP_BASE + 8, "sbrk did not keep the break word aligned");
+
+    pState->pc = 0;
+    sr(V0, SYS_SBRK);
+    sr(A0, MEM_SIZE);
+    emulate_mips(pState);
+    mu_assert(pState->regs[V0] == 0xFFFFFFFF, "sbrk past the end of memory did not fail");
+
+    // rounding the largest amounts must not overflow
+    pState->pc = 0;
+    sr(V0, SYS_SBRK);
+    sr(A0, INT32_MAX);
+    emulate_mips(pState);
+    mu_assert(pState->regs[V0] == 0xFFFFFFFF, "sbrk of INT32_MAX did not fail");
+
+    pState->pc = 0;
+    sr(V0, SYS_SBRK);
+    sr(A0, 0);
+    emulate_mips(pState);
+    mu_assert(pState->regs[V0] == HEAP_BASE + 12, "failed sbrk moved the break");
+}
+
+MU_TEST(test_syscall_exit)
+{
+    pState->host_syscalls = 1;
+    sm(0, 0x0000000c);
+
+    sr(V0, SYS_EXIT2);
+    sr(A0, 3);
+    mu_assert(emulate_mips(pState) == STOP_EXIT, "exit2 did not stop execution");
+    mu_assert(pState->exit_code == 3, "Wrong exit code");
+
+    // unknown services raise a syscall exception
+    pState->pc = 0;
+    sr(V0, 99);
+    mu_assert(emulate_mips(pState) == STOP_EXCEPTION, "Unknown syscall did not raise an exception");
+    mu_assert(exc_code() == Sys, "Wrong exception code for unknown syscall");
+}
+
+MU_TEST_SUITE(syscall_tests)
+{
+    MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+    MU_RUN_TEST(test_syscall_buffered_output);
+    MU_RUN_TEST(test_syscall_sbrk);
+    MU_RUN_TEST(test_syscall_exit);
+}
+
+// ********* loader tests ********* //
+
+MU_TEST(test_assemble_into_mem)
+{
+    // needs the whole memory, so it does not use the small state of test_setup
+    StateMIPS *state = init_mips(0x100);
+    SourceMap map;
+    const char *source = "    addi $t0, $zero, 4\n"
+                         "    addi $t1, $zero, 0\n"
+                         "loop: add $t1, $t1, $t0\n"
+                         "    addi $t0, $t0, -1\n"
+                         "    bgtz $t0, loop\n"
+                         "    j done\n"
+                         "    break\n"
+                         "done: addi $v0, $zero, 17\n"
+                         "    add $a0, $zero, $t1\n"
+                         "    syscall\n";
+
+    mu_assert(assemble_into_mem_at(state, source, 0x100, &map) == 0, "Assembly failed");
+    mu_assert_int_eq(0x20080004, state->mem[0x100 / 4]);
+
+    // the labels and source lines of the program are looked up by address
+    SourceLocation loc;
+    mu_check(lookup_source(&map, 0x11c, &loc));
+    mu_check(strcmp(loc.label, "done") == 0);
+    mu_assert_int_eq(0, loc.offset);
+    mu_assert_int_eq(8, loc.line);
+    mu_assert_int_eq(2, map.num_labels);
+
+    char text[64];
+    mu_check(format_source(&map, 0x110, text, sizeof(text)) > 0);
+    mu_check(strcmp(text, "loop+0x8 source:5") == 0);
+    mu_check(format_source(&map, 0x128, text, sizeof(text)) == 0);
+    mu_check(format_source(&map, 0xfc, text, sizeof(text)) == 0);
+
+    state->host_syscalls = 1;
+    mu_assert(run_mips(state, 100) == STOP_EXIT, "Program did not exit");
+    mu_assert_int_eq(10, state->exit_code);
+
+    // errors are reported, programs must fit in memory
+    free_source_map(&map);
+    mu_check(assemble_into_mem_at(state, "j nowhere\n", 0, NULL) == 1);
+    mu_check(assemble_into_mem_at(state, "syscall\nsyscall\n", MEM_SIZE - 4, NULL) == 1);
+
+    free_mips(state);
+}
+
+MU_TEST_SUITE(loader_tests)
+{
+    MU_RUN_TEST(test_assemble_into_mem);
+}
+
+// ********* gdb stub tests ********* //
+
+/// @brief Appends a packet framed like gdb frames it, with its checksum
+static void gdb_frame(char *out, const char *payload)
+{
+    uint8_t sum = 0;
+    for (const char *c = payload; *c; c++)
+        sum += (uint8_t)*c;
+    sprintf(out + strlen(out), "$%s#%02x", payload, sum);
+}
+
+/// @brief Appends the ack and the framed reply the stub sends for a packet
+static void gdb_reply(char *out, const char *payload)
+{
+    strcat(out, "+");
+    gdb_frame(out, payload);
+}
+
+/// @brief Runs a gdb session on a socketpair, feeding it the input and collecting everything it sends back.
+/// The session ends at the end of the input.
+static int gdb_exchange(StateMIPS *state, const char *input, char *output, size_t size)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        return -1;
+
+    if (write(fds[0], input, strlen(input)) != (ssize_t)strlen(input))
+        return -1;
+    shutdown(fds[0], SHUT_WR);
+
+    int res = gdbstub_session(state, fds[1]);
+    close(fds[1]);
+
+    size_t len = 0;
+    ssize_t n;
+    while (len < size - 1 && (n = read(fds[0], output + len, size - 1 - len)) > 0)
+        len += n;
+    output[len] = '\0';
+    close(fds[0]);
+    return res;
+}
+
+MU_TEST(test_gdb_checksum)
+{
+    StateMIPS *state = init_mips(0);
+    char input[256] = "", expected[256] = "", output[256];
+
+    // a bad checksum is rejected and the packet sent again is accepted, stray acks are skipped
+    strcat(input, "+$?#00");
+    gdb_frame(input, "?");
+    strcat(expected, "-");
+    gdb_reply(expected, "S05");
+
+    mu_assert_int_eq(0, gdb_exchange(state, input, output, sizeof(output)));
+    mu_check(strcmp(output, expected) == 0);
+
+    // the connection is dropped when gdb cannot be written to
+    int fds[2];
+    mu_check(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    mu_check(write(fds[0], "$?#3f", 5) == 5);
+    close(fds[0]);
+    mu_assert_int_eq(1, gdbstub_session(state, fds[1]));
+    close(fds[1]);
+
+    free_mips(state);
+}
+
+MU_TEST(test_gdb_registers)
+{
+    StateMIPS *state = init_mips(0x40);
+    char input[256] = "", expected[1024] = "", output[1024];
+    state->regs[T0] = 0x12345678;
+    state->lo = 0xCAFE;
+
+    gdb_frame(input, "g");
+    gdb_frame(input, "p8");
+    gdb_frame(input, "p25");
+    gdb_frame(input, "P9=0000abcd");
+    gdb_frame(input, "P0=00000001");
+
+    char regs[GDB_NUM_REGS * 8 + 1] = "";
+    for (int reg = 0; reg < GDB_NUM_REGS; reg++)
+    {
+        uint32_t value = reg == T0 ? 0x12345678 : reg == 33 ? 0xCAFE : reg == 37 ? 0x40 : 0;
+        sprintf(regs + reg * 8, "%08x", value);
+    }
+    gdb_reply(expected, regs);
+    gdb_reply(expected, "12345678");
+    gdb_reply(expected, "00000040");
+    gdb_reply(expected, "OK");
+    gdb_reply(expected, "OK");
+
+    mu_assert_int_eq(0, gdb_exchange(state, input, output, sizeof(output)));
+    mu_check(strcmp(output, expected) == 0);
+    mu_assert_int_eq(0xabcd, state->regs[T1]);
+    mu_assert_int_eq(0, state->regs[ZERO]);
+
+    free_mips(state);
+}
+
+MU_TEST(test_gdb_memory_bounds)
+{
+    StateMIPS *state = init_mips(0);
+    char input[256] = "", expected[256] = "", output[256];
+    write_guest_byte(state, MEM_SIZE - 4, 0xde);
+    write_guest_byte(state, MEM_SIZE - 3, 0xad);
+    write_guest_byte(state, MEM_SIZE - 2, 0xbe);
+    write_guest_byte(state, MEM_SIZE - 1, 0xef);
+
+    gdb_frame(input, "mffffc,4");
+    gdb_frame(input, "mfffff,2");
+    gdb_frame(input, "m100000,1");
+    gdb_frame(input, "Mfffff,1:ab");
+    gdb_frame(input, "Mfffff,2:abcd");
+    gdb_frame(input, "M100000,1:ab");
+    gdb_frame(input, "Mffffe,2:12zz");
+    gdb_frame(input, "mffffc,4");
+
+    gdb_reply(expected, "deadbeef");
+    gdb_reply(expected, "E01");
+    gdb_reply(expected, "E01");
+    gdb_reply(expected, "OK");
+    gdb_reply(expected, "E01");
+    gdb_reply(expected, "E01");
+    // a byte that is not hex is rejected before any byte is written
+    gdb_reply(expected, "E01");
+    gdb_reply(expected, "deadbeab");
+
+    mu_assert_int_eq(0, gdb_exchange(state, input, output, sizeof(output)));
+    mu_check(strcmp(output, expected) == 0);
+
+    free_mips(state);
+}
+
+MU_TEST(test_gdb_breakpoints)
+{
+    // nops, then add $t1, $t2, $t3 overflows at 0x10
+    StateMIPS *state = init_mips(0);
+    char input[256] = "", expected[256] = "", output[256];
+    state->mem[0x10 / 4] = 0x14b4820;
+    state->regs[T2] = 0x7FFFFFFF;
+    state->regs[T3] = 1;
+
+    gdb_frame(input, "Z0,8,4");
+    gdb_frame(input, "c");
+    gdb_frame(input, "p25");
+    gdb_frame(input, "s");
+    gdb_frame(input, "p25");
+    gdb_frame(input, "z0,8,4");
+    gdb_frame(input, "z0,8,4");
+    gdb_frame(input, "c");
+    gdb_frame(input, "p25");
+    gdb_frame(input, "k");
+
+    gdb_reply(expected, "OK");
+    gdb_reply(expected, "S05");
+    gdb_reply(expected, "00000008");
+    gdb_reply(expected, "S05");
+    gdb_reply(expected, "0000000c");
+    gdb_reply(expected, "OK");
+    gdb_reply(expected, "E01");
+    // overflow is reported as SIGFPE with the pc on the faulting instruction
+    gdb_reply(expected, "S08");
+    gdb_reply(expected, "00000010");
+    strcat(expected, "+");
+
+    mu_assert_int_eq(0, gdb_exchange(state, input, output, sizeof(output)));
+    mu_check(strcmp(output, expected) == 0);
+
+    free_mips(state);
+}
+
+MU_TEST(test_gdb_exit)
+{
+    // addi $v0, $zero, 17; addi $a0, $zero, 3; syscall (exit2)
+    StateMIPS *state = init_mips(0);
+    char input[256] = "", expected[256] = "", output[256];
+    state->mem[0] = 0x20020011;
+    state->mem[1] = 0x20040003;
+    state->mem[2] = 0xc;
+
+    gdb_frame(input, "c");
+    gdb_reply(expected, "W03");
+
+    mu_assert_int_eq(0, gdb_exchange(state, input, output, sizeof(output)));
+    mu_check(strcmp(output, expected) == 0);
+
+    free_mips(state);
+}
+
+MU_TEST(test_gdb_interrupt)
+{
+    // j 0 loops until gdb sends Ctrl-C, which stops it with SIGINT
+    StateMIPS *state = init_mips(0);
+    char input[256] = "", expected[256] = "", output[256];
+    state->mem[0] = 0x08000000;
+
+    gdb_frame(input, "c");
+    strcat(input, "\x03");
+    gdb_reply(expected, "S02");
+
+    mu_assert_int_eq(0, gdb_exchange(state, input, output, sizeof(output)));
+    mu_check(strcmp(output, expected) == 0);
+
+    free_mips(state);
+}
+
+MU_TEST_SUITE(gdb_tests)
+{
+    MU_RUN_TEST(test_gdb_checksum);
+    MU_RUN_TEST(test_gdb_registers);
+    MU_RUN_TEST(test_gdb_memory_bounds);
+    MU_RUN_TEST(test_gdb_breakpoints);
+    MU_RUN_TEST(test_gdb_exit);
+    MU_RUN_TEST(test_gdb_interrupt);
+}
+
+// ********* stats tests ********* //
+
+#ifdef MIPS_STATS
+MU_TEST(test_stats_mix)
+{
+    // add, lw, sw, beq (taken), beq (not taken), j
+    sm(0x00, 0x14b4820);
+    sm(0x04, 0x8d49000c);
+    sm(0x08, 0xad49000c);
+    sm(0x0c, 0x31290000);
+    sm(0x10, 0x312a0000);
+    sm(0x14, 0x08000000);
+    sr(T2, 0x10);
+    sr(T3, 0x1);
+
+    reset_mips_stats(pState);
+    for (int n = 0; n < 6; n++)
+        emulate_mips(pState);
+
+    const MipsStats *stats = get_mips_stats(pState);
+    mu_assert(stats->instructions == 6, "Wrong instruction count");
+    mu_assert(stats->opcode[0x0c] == 2, "Wrong beq count");
+    mu_assert(stats->funct[0x20] == 1, "Wrong add count");
+    mu_assert(stats->loads == 1, "Wrong load count");
+    mu_assert(stats->stores == 1, "Wrong store count");
+    mu_assert(stats->branches_taken == 1, "Wrong taken branch count");
+    mu_assert(stats->branches_not_taken == 1, "Wrong not taken branch count");
+    mu_assert(stats->jumps == 1, "Wrong jump count");
+
+    // every instruction ran once, ties are listed by address
+    uint32_t pcs[8];
+    mu_assert_int_eq(6, get_hot_pcs(pState, pcs, 8));
+    mu_assert_int_eq(0x00, pcs[0]);
+    mu_assert_int_eq(0x14, pcs[5]);
+
+    emulate_mips(pState);
+    mu_assert_int_eq(2, get_hot_pcs(pState, pcs, 2));
+    mu_assert_int_eq(0x00, pcs[0]);
+    mu_assert(stats->pc_counts[0] == 2, "Wrong count of the jump target");
+}
+
+MU_TEST_SUITE(stats_tests)
+{
+    MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
+
+    MU_RUN_TEST(test_stats_mix);
 }
+#endif
 
 int main()
 {
     MU_RUN_SUITE(function_tests);
     MU_RUN_SUITE(opcode_tests);
+    MU_RUN_SUITE(watchpoint_tests);
+    MU_RUN_SUITE(exception_tests);
+    MU_RUN_SUITE(syscall_tests);
+    MU_RUN_SUITE(loader_tests);
+    MU_RUN_SUITE(gdb_tests);
+#ifdef MIPS_STATS
+    MU_RUN_SUITE(stats_tests);
+#endif
 
     MU_REPORT();
     return MU_EXIT_CODE;
@@ -0,0 +1,197 @@
+#include "syscalls.h"
+
+#include <errno.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#else
+#include <io.h>
+#endif
+
+typedef int (*SyscallFn)(StateMIPS *state);
+
+/// @brief Writes all of data to fd, a negative fd drops the data.
+static void write_all(int fd, const char *data, uint32_t len)
+{
+    while (fd >= 0 && len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        data += n;
+        len -= n;
+    }
+}
+
+void flush_output(StateMIPS *state)
+{
+    write_all(state->out_fd, state->out_buf, state->out_len);
+    state->out_len = 0;
+}
+
+/// @brief Appends guest output to the output buffer, flushing it only when it is full.
+static void emit_output(StateMIPS *state, const char *data, uint32_t len)
+{
+    if (state->out_len + len > OUT_BUF_SIZE)
+        flush_output(state);
+
+    // output larger than the buffer is written straight through
+    if (len > OUT_BUF_SIZE)
+    {
+        write_all(state->out_fd, data, len);
+        return;
+    }
+
+    memcpy(state->out_buf + state->out_len, data, len);
+    state->out_len += len;
+}
+
+/// @brief Reads a line from stdin for the read syscalls, flushing pending output first so prompts show up.
+static char *read_line(StateMIPS *state, char *buf, int size)
+{
+    flush_output(state);
+    return fgets(buf, size, stdin);
+}
+
+static int sys_print_int(StateMIPS *state)
+{
+    char buf[16];
+    int len = sprintf(buf, "%d", (int32_t)state->regs[A0]);
+    emit_output(state, buf, len);
+    return STOP_NONE;
+}
+
+static int sys_print_string(StateMIPS *state)
+{
+    // copy the string in runs so long strings only cost a memcpy per run
+    char run[256];
+    uint32_t len = 0;
+
+    for (uint32_t addr = state->regs[A0]; addr < MEM_SIZE; addr++)
+    {
+        char c = read_guest_byte(state, addr);
+        if (c == '\0')
+            break;
+
+        run[len++] = c;
+        if (len == sizeof(run))
+        {
+            emit_output(state, run, len);
+            len = 0;
+        }
+    }
+
+    emit_output(state, run, len);
+    return STOP_NONE;
+}
+
+static int sys_print_char(StateMIPS *state)
+{
+    char c = state->regs[A0];
+    emit_output(state, &c, 1);
+    return STOP_NONE;
+}
+
+static int sys_read_int(StateMIPS *state)
+{
+    char buf[64];
+    state->regs[V0] = read_line(state, buf, sizeof(buf)) ? (uint32_t)strtol(buf, NULL, 0) : 0;
+    return STOP_NONE;
+}
+
+static int sys_read_string(StateMIPS *state)
+{
+    uint32_t addr = state->regs[A0];
+    uint32_t size = state->regs[A1];
+    if (size == 0 || addr >= MEM_SIZE)
+        return STOP_NONE;
+    if (size > MEM_SIZE - addr)
+        size = MEM_SIZE - addr;
+
+    // like fgets, reads at most size - 1 characters and null terminates the string
+    char buf[1024];
+    uint32_t len = 0;
+    if (read_line(state, buf, size < sizeof(buf) ? size : sizeof(buf)))
+    {
+        for (; buf[len] != '\0'; len++)
+            write_guest_byte(state, addr + len, buf[len]);
+    }
+    write_guest_byte(state, addr + len, '\0');
+    return STOP_NONE;
+}
+
+static int sys_read_char(StateMIPS *state)
+{
+    flush_output(state);
+    int c = getchar();
+    state->regs[V0] = c == EOF ? 0 : c;
+    return STOP_NONE;
+}
+
+static int sys_sbrk(StateMIPS *state)
+{
+    uint32_t old_brk = state->brk ? state->brk : HEAP_BASE;
+    int32_t amount = state->regs[A0];
+    // keep the break word aligned, rounded in 64 bits so amounts near INT32_MAX cannot overflow
+    int64_t new_brk = (int64_t)old_brk + (((int64_t)amount + 3) & ~(int64_t)3);
+
+    if (new_brk < HEAP_BASE || new_brk > MEM_SIZE)
+    {
+        state->regs[V0] = (uint32_t)-1;
+        return STOP_NONE;
+    }
+
+#ifndef _WIN32
+    // Give whole pages above the new break back to the host, they are committed again when touched
+    if (new_brk < old_brk)
+    {
+        long page_size = sysconf(_SC_PAGESIZE);
+        uint32_t start = (new_brk + page_size - 1) & ~(page_size - 1);
+        uint32_t end = old_brk & ~(page_size - 1);
+        if (start < end)
+            madvise((char *)state->mem + start, end - start, MADV_DONTNEED);
+    }
+#endif
+
+    state->brk = new_brk;
+    state->regs[V0] = old_brk;
+    return STOP_NONE;
+}
+
+static int sys_exit(StateMIPS *state)
+{
+    state->exit_code = 0;
+    return STOP_EXIT;
+}
+
+static int sys_exit2(StateMIPS *state)
+{
+    state->exit_code = (int32_t)state->regs[A0];
+    return STOP_EXIT;
+}
+
+/// @brief Syscall dispatch table, indexed by the service number in $v0
+static const SyscallFn syscall_table[NUM_SYSCALLS] = {
+    [SYS_PRINT_INT] = sys_print_int,
+    [SYS_PRINT_STRING] = sys_print_string,
+    [SYS_READ_INT] = sys_read_int,
+    [SYS_READ_STRING] = sys_read_string,
+    [SYS_SBRK] = sys_sbrk,
+    [SYS_EXIT] = sys_exit,
+    [SYS_PRINT_CHAR] = sys_print_char,
+    [SYS_READ_CHAR] = sys_read_char,
+    [SYS_EXIT2] = sys_exit2,
+};
+
+int handle_syscall(StateMIPS *state)
+{
+    uint32_t service = state->regs[V0];
+
+    if (service >= NUM_SYSCALLS || syscall_table[service] == NULL)
+        return -1;
+
+    return syscall_table[service](state);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "mips_emul.h"
+
+// SPIM/MARS syscall service numbers, passed in $v0
+typedef enum SyscallService
+{
+    SYS_PRINT_INT = 1,
+    SYS_PRINT_STRING = 4,
+    SYS_READ_INT = 5,
+    SYS_READ_STRING = 8,
+    SYS_SBRK = 9,
+    SYS_EXIT = 10,
+    SYS_PRINT_CHAR = 11,
+    SYS_READ_CHAR = 12,
+    SYS_EXIT2 = 17
+} SyscallService;
+
+// Number of entries in the syscall dispatch table
+#define NUM_SYSCALLS 18
+
+/// @brief Services the syscall in $v0 for the guest, using $a0 and $a1 as arguments.
+/// @param state
+/// @return STOP_NONE, STOP_EXIT for the exit services, or -1 if the service is unknown
+int handle_syscall(StateMIPS *state);
+
+/// @brief Writes the buffered guest output to state->out_fd.
+/// If out_fd is negative the output is dropped, the TUI reads out_buf directly instead.
+/// @param state
+void flush_output(StateMIPS *state);
+
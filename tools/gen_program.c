@@ -0,0 +1,517 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "../utils.h"
+
+// Labels ahead of an instruction that a branch picks its target from
+#define BRANCH_WINDOW 8
+// Labels ahead of an instruction that a jump picks its target from
+#define JUMP_WINDOW 64
+// Farthest a branch reaches, in words after the instruction that follows it
+#define BRANCH_REACH 32767
+// Memory instructions address the data from $gp, so they reach the bytes their 16 bit offset covers
+#define DATA_REACH 32768
+// Highest address a jump reaches
+#define JUMP_REACH 0x3FFFFFF
+// Data words per .word line
+#define WORDS_PER_LINE 8
+// Size of the buffers of the outputs
+#define GEN_BUFFER_SIZE (1 << 20)
+
+// Words before the body: $gp and $s7 are loaded with lui and ori
+#define PROLOGUE_WORDS 4
+// Words after the body: the loop count is decremented, the body runs again or the program exits
+#define EPILOGUE_WORDS 5
+
+// Registers the generated instructions write. $zero, $at, $v0, $s7, $k0, $k1, $gp, $sp, $fp and $ra are left alone
+static const uint8_t dest_regs[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 24, 25};
+// Registers the generated instructions read
+static const uint8_t src_regs[] = {0, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 24, 25};
+
+// Instructions of each kind, none of them can raise an exception
+static const InstrId alu_instrs[] = {INSTR_ADDU, INSTR_SUBU,  INSTR_AND,  INSTR_OR,  INSTR_XOR,  INSTR_NOR,
+                                     INSTR_SLT,  INSTR_SLTU,  INSTR_SLL,  INSTR_SRL, INSTR_SRA,  INSTR_SLLV,
+                                     INSTR_SRLV, INSTR_SRAV,  INSTR_ADDIU, INSTR_SLTI, INSTR_SLTIU, INSTR_ORI,
+                                     INSTR_XORI, INSTR_LUI,   INSTR_MULT, INSTR_MFLO, INSTR_MFHI};
+static const InstrId mem_instrs[] = {INSTR_LW, INSTR_SW, INSTR_LH, INSTR_LHU, INSTR_SH, INSTR_LB, INSTR_LBU, INSTR_SB};
+static const InstrId branch_instrs[] = {INSTR_BEQ, INSTR_BNE, INSTR_BLEZ, INSTR_BGTZ};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+// Registers of the prologue and epilogue
+#define REG_V0 2
+#define REG_S7 23
+#define REG_GP 28
+
+/// @brief Kinds of generated instructions, their weights are set with --mix
+typedef enum
+{
+    KIND_ALU,
+    KIND_MEM,
+    KIND_BRANCH,
+    KIND_JUMP,
+    NUM_KINDS
+} Kind;
+
+/// @brief Shape of the generated program
+typedef struct Options
+{
+    uint64_t seed;
+    uint64_t instructions;
+    uint64_t labels;
+    uint64_t data_bytes;
+    uint32_t loops;
+    uint32_t origin;
+    uint32_t weights[NUM_KINDS];
+} Options;
+
+/// @brief Generator state. Labels are spread evenly over the body, so every address is known before the first
+/// line is written and the binary is written along with the source.
+typedef struct Generator
+{
+    Options options;
+    uint64_t rng;
+    FILE *source;
+    FILE *binary;
+
+    // address of the first instruction of the body, the label start
+    uint32_t body;
+    // number of body instructions from one label to the next
+    uint64_t spacing;
+    // address of the epilogue, the label end
+    uint32_t end;
+    uint32_t data;
+    uint64_t data_words;
+} Generator;
+
+/// @brief Next number of the splitmix64 sequence, the same on every host for a seed
+static uint64_t next_random(Generator *gen)
+{
+    uint64_t z = (gen->rng += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/// @brief Random number below bound, which must not be 0
+static uint64_t random_below(Generator *gen, uint64_t bound)
+{
+    return next_random(gen) % bound;
+}
+
+/// @brief Builds an instruction from its id and operands. Only the operands in the pattern of its template are
+/// set, so the word is the one the assembler makes of the disassembly. imm is the shift amount of R-type
+/// instructions and the target of jumps.
+static Instruction make_instr(InstrId id, uint8_t rs, uint8_t rt, uint8_t rd, uint32_t imm)
+{
+    Instruction instr = {.id = id, .format = isa_desc[id].format};
+    const char *operands = get_template_operands(instr.format);
+    rs = strchr(operands, 's') ? rs : 0;
+    rt = strchr(operands, 't') ? rt : 0;
+    rd = strchr(operands, 'd') ? rd : 0;
+
+    switch (get_instr_type(instr.format))
+    {
+    case R_TYPE:
+        instr.r = (RArgs){.rs = rs, .rt = rt, .rd = rd, .shamt = strchr(operands, 'h') ? imm & 0x1F : 0};
+        break;
+    case I_TYPE:
+        instr.i = (IArgs){.rs = rs, .rt = rt, .imm = imm};
+        break;
+    case J_TYPE:
+        instr.j.target = imm & 0x3FFFFFF;
+        break;
+    }
+    return instr;
+}
+
+/// @brief Writes an instruction to both outputs. The text is the disassembly of the word unless it is given.
+/// @param label label of the line, or NULL
+static void emit(Generator *gen, const char *label, const Instruction *instr, const char *text)
+{
+    uint32_t word = encode_instr(instr);
+    char buf[64];
+    if (text == NULL)
+    {
+        disassemble_instr(word, buf, sizeof(buf));
+        text = buf;
+    }
+
+    if (label != NULL)
+        fprintf(gen->source, "%s: %s\n", label, text);
+    else
+        fprintf(gen->source, "    %s\n", text);
+
+    if (gen->binary != NULL)
+    {
+        // big endian, the format the assembler writes and the emulator loads
+        uint32_t be = htonl(word);
+        fwrite(&be, sizeof(be), 1, gen->binary);
+    }
+}
+
+/// @brief Gets the address of a label of the body
+static uint32_t label_addr(const Generator *gen, uint64_t label)
+{
+    return gen->body + label * gen->spacing * 4;
+}
+
+/// @brief Picks a label after the instruction at index that a branch or jump can go to, so every program
+/// ends. The end of the body counts as a label as well.
+/// @param window number of labels ahead to pick from
+/// @param label set to the number of the label, or to options.labels for end
+/// @return The address of the label
+static uint32_t pick_target(Generator *gen, uint64_t index, uint64_t window, uint64_t *label)
+{
+    // the instructions after the last label only reach end
+    uint64_t first = index / gen->spacing < gen->options.labels ? index / gen->spacing + 1 : gen->options.labels;
+    uint64_t last = first + window < gen->options.labels ? first + window : gen->options.labels;
+
+    *label = first + random_below(gen, last - first + 1);
+    return *label < gen->options.labels ? label_addr(gen, *label) : gen->end;
+}
+
+/// @brief Formats the name of a target picked by pick_target
+static const char *target_name(const Generator *gen, uint64_t label, char *buf, size_t size)
+{
+    if (label >= gen->options.labels)
+        return "end";
+    snprintf(buf, size, "L%llu", (unsigned long long)label);
+    return buf;
+}
+
+static void gen_alu(Generator *gen, const char *label)
+{
+    InstrId id = alu_instrs[random_below(gen, COUNT(alu_instrs))];
+    uint8_t rd = dest_regs[random_below(gen, COUNT(dest_regs))];
+    uint8_t rs = src_regs[random_below(gen, COUNT(src_regs))];
+    uint8_t rt = src_regs[random_below(gen, COUNT(src_regs))];
+    uint32_t imm = random_below(gen, 0x10000);
+
+    // I-type instructions write rt
+    if (get_instr_type(isa_desc[id].format) == I_TYPE)
+        rt = rd;
+
+    Instruction instr = make_instr(id, rs, rt, rd, imm);
+    emit(gen, label, &instr, NULL);
+}
+
+static void gen_mem(Generator *gen, const char *label)
+{
+    InstrId id = mem_instrs[random_below(gen, COUNT(mem_instrs))];
+    uint32_t size = id == INSTR_LW || id == INSTR_SW ? 4 : id == INSTR_LB || id == INSTR_LBU || id == INSTR_SB ? 1 : 2;
+    uint64_t reach = gen->data_words * 4 < DATA_REACH ? gen->data_words * 4 : DATA_REACH;
+    uint32_t offset = random_below(gen, reach / size) * size;
+
+    // loads write rt, stores read it
+    int store = id == INSTR_SW || id == INSTR_SH || id == INSTR_SB;
+    uint8_t rt = store ? src_regs[random_below(gen, COUNT(src_regs))] : dest_regs[random_below(gen, COUNT(dest_regs))];
+
+    Instruction instr = make_instr(id, REG_GP, rt, 0, offset);
+    emit(gen, label, &instr, NULL);
+}
+
+static void gen_branch(Generator *gen, const char *label, uint64_t index, uint32_t pc)
+{
+    uint64_t target;
+    uint32_t addr = pick_target(gen, index, BRANCH_WINDOW, &target);
+    if ((addr - pc - 4) / 4 > BRANCH_REACH)
+    {
+        gen_alu(gen, label);
+        return;
+    }
+
+    InstrId id = branch_instrs[random_below(gen, COUNT(branch_instrs))];
+    uint8_t rs = src_regs[random_below(gen, COUNT(src_regs))];
+    uint8_t rt = id == INSTR_BEQ || id == INSTR_BNE ? src_regs[random_below(gen, COUNT(src_regs))] : 0;
+    Instruction instr = make_instr(id, rs, rt, 0, (addr - pc - 4) / 4);
+
+    char buf[32], text[64];
+    const char *name = target_name(gen, target, buf, sizeof(buf));
+    if (id == INSTR_BEQ || id == INSTR_BNE)
+        snprintf(text, sizeof(text), "%s $%s, $%s, %s", isa_desc[id].name, get_reg_name(rs), get_reg_name(rt), name);
+    else
+        snprintf(text, sizeof(text), "%s $%s, %s", isa_desc[id].name, get_reg_name(rs), name);
+    emit(gen, label, &instr, text);
+}
+
+static void gen_jump(Generator *gen, const char *label, uint64_t index)
+{
+    uint64_t target;
+    uint32_t addr = pick_target(gen, index, JUMP_WINDOW, &target);
+    // jump targets are byte addresses in 26 bits
+    if (addr > JUMP_REACH)
+    {
+        gen_alu(gen, label);
+        return;
+    }
+
+    Instruction instr = make_instr(INSTR_J, 0, 0, 0, addr);
+    char buf[32], text[64];
+    snprintf(text, sizeof(text), "j %s", target_name(gen, target, buf, sizeof(buf)));
+    emit(gen, label, &instr, text);
+}
+
+/// @brief Emits lui and ori that load a 32 bit value
+static void load_value(Generator *gen, const char *label, uint8_t reg, uint32_t value)
+{
+    Instruction instr = make_instr(INSTR_LUI, 0, reg, 0, value >> 16);
+    emit(gen, label, &instr, NULL);
+    instr = make_instr(INSTR_ORI, reg, reg, 0, value & 0xFFFF);
+    emit(gen, NULL, &instr, NULL);
+}
+
+/// @brief Writes the whole program
+static void generate(Generator *gen)
+{
+    const Options *options = &gen->options;
+    uint32_t weights_total = 0;
+    for (int kind = 0; kind < NUM_KINDS; kind++)
+        weights_total += options->weights[kind];
+
+    fprintf(gen->source, "# generated by gen_program --seed %llu --instructions %llu --labels %llu --data %llu "
+                         "--mix %u,%u,%u,%u --loops %u --origin %x\n",
+            (unsigned long long)options->seed, (unsigned long long)options->instructions,
+            (unsigned long long)options->labels, (unsigned long long)options->data_bytes, options->weights[0],
+            options->weights[1], options->weights[2], options->weights[3], options->loops, options->origin);
+
+    load_value(gen, NULL, REG_GP, gen->data);
+    load_value(gen, NULL, REG_S7, options->loops);
+
+    char label[32];
+    uint32_t pc = gen->body;
+    for (uint64_t index = 0; index < options->instructions; index++, pc += 4)
+    {
+        const char *name = NULL;
+        if (index % gen->spacing == 0 && index / gen->spacing < options->labels)
+        {
+            snprintf(label, sizeof(label), "L%llu", (unsigned long long)(index / gen->spacing));
+            name = label;
+        }
+
+        uint32_t pick = random_below(gen, weights_total);
+        Kind kind = KIND_ALU;
+        while (pick >= options->weights[kind])
+            pick -= options->weights[kind++];
+
+        switch (kind)
+        {
+        case KIND_MEM:
+            gen_mem(gen, name);
+            break;
+        case KIND_BRANCH:
+            gen_branch(gen, name, index, pc);
+            break;
+        case KIND_JUMP:
+            gen_jump(gen, name, index);
+            break;
+        default:
+            gen_alu(gen, name);
+            break;
+        }
+    }
+
+    // end: addiu $s7, $s7, -1; blez $s7, exit; j L0; exit: addiu $v0, $zero, 10; syscall
+    Instruction instr = make_instr(INSTR_ADDIU, REG_S7, REG_S7, 0, 0xFFFF);
+    emit(gen, "end", &instr, NULL);
+    instr = make_instr(INSTR_BLEZ, REG_S7, 0, 0, 1);
+    emit(gen, NULL, &instr, "blez $s7, exit");
+    if (options->instructions > 0 && gen->body <= JUMP_REACH)
+    {
+        instr = make_instr(INSTR_J, 0, 0, 0, gen->body);
+        emit(gen, NULL, &instr, "j L0");
+    }
+    else
+    {
+        // the body is empty or out of reach of j, see main, so it runs once
+        instr = make_instr(INSTR_SLL, 0, 0, 0, 0);
+        emit(gen, NULL, &instr, "nop");
+    }
+    instr = make_instr(INSTR_ADDIU, 0, REG_V0, 0, 10);
+    emit(gen, "exit", &instr, NULL);
+    instr = make_instr(INSTR_SYSCALL, 0, 0, 0, 0);
+    emit(gen, NULL, &instr, NULL);
+
+    if (gen->data_words > 0)
+        fprintf(gen->source, ".data\n");
+    for (uint64_t n = 0; n < gen->data_words; n++)
+    {
+        uint32_t word = next_random(gen);
+        fprintf(gen->source, "%s0x%08x%s", n % WORDS_PER_LINE ? "" : n ? "    .word " : "data: .word ", word,
+                n % WORDS_PER_LINE == WORDS_PER_LINE - 1 || n + 1 == gen->data_words ? "\n" : ", ");
+
+        if (gen->binary != NULL)
+        {
+            uint32_t be = htonl(word);
+            fwrite(&be, sizeof(be), 1, gen->binary);
+        }
+    }
+}
+
+/// @brief Parses a count with an optional k, m or g suffix for powers of 1024, exiting if it is not valid
+static uint64_t parse_size(const char *arg)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 0);
+    int shift = *end == 'k' || *end == 'K' ? 10 : *end == 'm' || *end == 'M' ? 20 : *end == 'g' || *end == 'G' ? 30 : 0;
+    if (shift)
+        end++;
+
+    if (errno != 0 || end == arg || *end != '\0' || arg[0] == '-' || value > (UINT64_MAX >> shift))
+    {
+        fprintf(stderr, "Invalid number: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    return (uint64_t)value << shift;
+}
+
+/// @brief Parses the weights of --mix, exiting if they are not valid
+static void parse_mix(const char *arg, uint32_t weights[NUM_KINDS])
+{
+    unsigned int alu, mem, branch, jump;
+    char extra;
+    if (sscanf(arg, "%u,%u,%u,%u%c", &alu, &mem, &branch, &jump, &extra) != 4 || alu + mem + branch + jump == 0 ||
+        alu + mem + branch + jump > 1000000)
+    {
+        fprintf(stderr, "Invalid mix: %s, expected 4 weights such as 60,25,12,3\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    weights[KIND_ALU] = alu;
+    weights[KIND_MEM] = mem;
+    weights[KIND_BRANCH] = branch;
+    weights[KIND_JUMP] = jump;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] <source file or -> [binary file]\n", name);
+    fprintf(stderr, "Writes a valid MIPS program, and the big endian words the assembler makes of it\n");
+    fprintf(stderr, "  --seed N            same seed and options give the same program, 1 by default\n");
+    fprintf(stderr, "  --instructions N    instructions of the body, 1k by default, k m g suffixes\n");
+    fprintf(stderr, "  --mix A,M,B,J       weights of ALU, memory, branch and jump instructions, 60,25,12,3 by default\n");
+    fprintf(stderr, "  --labels N          labels spread over the body, one per 16 instructions by default\n");
+    fprintf(stderr, "  --data N            bytes of .word data, 4k by default, k m g suffixes\n");
+    fprintf(stderr, "  --loops N           times the body runs before the program exits, 1 by default\n");
+    fprintf(stderr, "  --origin X          address the program is assembled for (hex), 0 by default\n");
+    fprintf(stderr, "  -h, --help          prints this help\n");
+}
+
+int main(int argc, char const *argv[])
+{
+    Options options = {.seed = 1, .instructions = 1024, .labels = UINT64_MAX, .data_bytes = 4096, .loops = 1,
+                       .weights = {60, 25, 12, 3}};
+    int arg = 1;
+
+    while (argc - arg > 1 && !strncmp(argv[arg], "--", 2))
+    {
+        const char *option = argv[arg], *value = argv[arg + 1];
+        if (!strcmp(option, "--help"))
+            break;
+        else if (!strcmp(option, "--seed"))
+            options.seed = parse_size(value);
+        else if (!strcmp(option, "--instructions"))
+            options.instructions = parse_size(value);
+        else if (!strcmp(option, "--labels"))
+            options.labels = parse_size(value);
+        else if (!strcmp(option, "--data"))
+            options.data_bytes = parse_size(value);
+        else if (!strcmp(option, "--mix"))
+            parse_mix(value, options.weights);
+        else if (!strcmp(option, "--loops") && parse_size(value) > 0 && parse_size(value) <= INT32_MAX)
+            options.loops = parse_size(value);
+        else if (!strcmp(option, "--origin"))
+            options.origin = strtoul(value, NULL, 16);
+        else
+        {
+            fprintf(stderr, "Unknown option %s %s\n", option, value);
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        arg += 2;
+    }
+
+    // an option left over is not a file name, only - is
+    for (int n = arg; n < argc; n++)
+    {
+        if (!strcmp(argv[n], "-h") || !strcmp(argv[n], "--help"))
+        {
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (argv[n][0] == '-' && argv[n][1] != '\0')
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[n]);
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - arg != 1 && argc - arg != 2)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Generator gen = {.options = options, .rng = options.seed};
+    Options *opts = &gen.options;
+    if (opts->labels == UINT64_MAX)
+        opts->labels = opts->instructions / 16 ? opts->instructions / 16 : 1;
+    // L0 starts the body, the epilogue jumps back to it
+    if (opts->labels == 0)
+        opts->labels = 1;
+    if (opts->labels > opts->instructions)
+        opts->labels = opts->instructions;
+
+    gen.spacing = opts->labels ? opts->instructions / opts->labels : 1;
+    gen.data_words = (opts->data_bytes + 3) / 4;
+    uint64_t text_words = PROLOGUE_WORDS + opts->instructions + EPILOGUE_WORDS;
+
+    if (opts->origin & 3)
+    {
+        fprintf(stderr, "The origin must be a multiple of 4\n");
+        return EXIT_FAILURE;
+    }
+    if (opts->origin + (text_words + gen.data_words) * 4 > (uint64_t)UINT32_MAX + 1)
+    {
+        fprintf(stderr, "The program does not fit below 4 GiB\n");
+        return EXIT_FAILURE;
+    }
+    if (opts->weights[KIND_MEM] > 0 && gen.data_words == 0)
+    {
+        fprintf(stderr, "Memory instructions need data, give --data or a mix without them\n");
+        return EXIT_FAILURE;
+    }
+
+    gen.body = opts->origin + PROLOGUE_WORDS * 4;
+    gen.end = gen.body + opts->instructions * 4;
+    gen.data = opts->origin + text_words * 4;
+    if (opts->loops > 1 && (opts->instructions == 0 || gen.body > JUMP_REACH))
+    {
+        fprintf(stderr, "--loops needs a body that j can jump back to, below 0x4000000\n");
+        return EXIT_FAILURE;
+    }
+
+    gen.source = strcmp(argv[arg], "-") ? fopen(argv[arg], "w") : stdout;
+    gen.binary = argc - arg == 2 ? fopen(argv[arg + 1], "wb") : NULL;
+    if (gen.source == NULL || (argc - arg == 2 && gen.binary == NULL))
+    {
+        fprintf(stderr, "Could not open the output files\n");
+        return EXIT_FAILURE;
+    }
+    setvbuf(gen.source, NULL, _IOFBF, GEN_BUFFER_SIZE);
+    if (gen.binary != NULL)
+        setvbuf(gen.binary, NULL, _IOFBF, GEN_BUFFER_SIZE);
+
+    generate(&gen);
+
+    int status = ferror(gen.source) || fclose(gen.source);
+    if (gen.binary != NULL)
+        status = ferror(gen.binary) || fclose(gen.binary) || status;
+    if (status)
+        perror("Failed to write the program");
+    return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
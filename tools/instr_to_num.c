@@ -2,50 +2,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
 
-long parse_number(const char *arg)
-{
-    char *endptr;
-    long number = 0;
-
-    if (strlen(arg) > 2 && arg[0] == '0')
-    {
-        if (arg[1] == 'x' || arg[1] == 'X')
-        {
-            // Hexadecimal
-            number = strtol(arg, &endptr, 16);
-        }
-        else if (arg[1] == 'b' || arg[1] == 'B')
-        {
-            // Binary (using custom parsing as strtol doesn't support binary)
-            number = strtol(arg + 2, &endptr, 2);
-        }
-        else
-        {
-            // Assume octal
-            number = strtol(arg, &endptr, 8);
-        }
-    }
-    else
-    {
-        // Decimal
-        number = strtol(arg, &endptr, 10);
-    }
+#include "../utils.h"
+#include "stream.h"
 
-    if (endptr == arg || *endptr != '\0')
-    {
-        fprintf(stderr, "Invalid number: %s\n", arg);
-        exit(EXIT_FAILURE);
-    }
+// Maximum number of fields on a line in streaming mode: type, opcode, rs, rt, rd, shamt, funct
+#define MAX_FIELDS 7
 
-    if (errno == ERANGE)
-    {
-        fprintf(stderr, "Number out of range: %s\n", arg);
-        exit(EXIT_FAILURE);
-    }
-
-    return number;
-}
+/// @brief Options shared by the threads of the streaming mode
+typedef struct StreamOptions
+{
+    int binary;
+    int error;
+} StreamOptions;
 
 // Function to print bits from a number within a specified range [start, end]
 void printBitsSection(unsigned int num, int start, int end)
@@ -93,11 +63,111 @@ void print_j_instr(unsigned int opcode, unsigned int address)
     printf("\n");
 }
 
+/// @brief Encodes one line of fields, in the same order as the command line arguments.
+/// @return returns 0 on success, 1 if the line is invalid
+static int encode_line(const char *line, size_t len, uint32_t *instr)
+{
+    long fields[MAX_FIELDS];
+    int count = 0;
+    char type = 0;
+
+    for (size_t pos = 0; pos < len;)
+    {
+        if (isspace((unsigned char)line[pos]))
+        {
+            pos++;
+            continue;
+        }
+
+        size_t end = pos;
+        while (end < len && !isspace((unsigned char)line[end]))
+            end++;
+
+        char field[32];
+        if (count == MAX_FIELDS || end - pos >= sizeof(field))
+            return 1;
+        memcpy(field, line + pos, end - pos);
+        field[end - pos] = '\0';
+
+        if (count == 0)
+            type = field[0];
+        else if ((fields[count] = parse_number(field)) < 0)
+            return 1;
+        count++;
+        pos = end;
+    }
+
+    if (type == 'r' && count == 7)
+        *instr = fields[1] << 26 | fields[2] << 21 | fields[3] << 16 | fields[4] << 11 | fields[5] << 6 | fields[6];
+    else if (type == 'i' && count == 5)
+        *instr = fields[1] << 26 | fields[2] << 21 | fields[3] << 16 | fields[4];
+    else if (type == 'j' && count == 3)
+        *instr = fields[1] << 26 | fields[2];
+    else
+        return 1;
+    return 0;
+}
+
+/// @brief Encodes the lines in one part of the input, writing hex text or raw big endian words.
+static void encode_part(const char *data, size_t len, OutBuf *out, void *ctx)
+{
+    StreamOptions *options = ctx;
+
+    for (size_t pos = 0; pos < len;)
+    {
+        const char *newline = memchr(data + pos, '\n', len - pos);
+        size_t end = newline ? (size_t)(newline - data) : len;
+
+        // skip empty lines
+        size_t first = pos;
+        while (first < end && isspace((unsigned char)data[first]))
+            first++;
+
+        uint32_t instr;
+        if (first < end && encode_line(data + first, end - first, &instr))
+        {
+            fprintf(stderr, "Invalid line: %.*s\n", (int)(end - first), data + first);
+            __atomic_store_n(&options->error, 1, __ATOMIC_RELAXED);
+        }
+        else if (first < end && options->binary)
+        {
+            uint8_t *bytes = (uint8_t *)out_reserve(out, 4);
+            bytes[0] = instr >> 24;
+            bytes[1] = instr >> 16;
+            bytes[2] = instr >> 8;
+            bytes[3] = instr;
+            out->len += 4;
+        }
+        else if (first < end)
+        {
+            out_printf(out, "%08x\n", instr);
+        }
+
+        pos = end + 1;
+    }
+}
+
 int main(int argc, char const *argv[])
 {
+    if (argc >= 2 && strcmp(argv[1], "--stream") == 0)
+    {
+        StreamOptions options = {0};
+        int nthreads;
+        FILE *in = parse_stream_args(argc, argv, 2, &options.binary, &nthreads);
+        if (in == NULL)
+            return EXIT_FAILURE;
+
+        // the input is always text, --binary selects the output format
+        int res = stream_process(in, stdout, 0, nthreads, encode_part, &options);
+        if (in != stdin)
+            fclose(in);
+        return res || options.error ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
     if (argc <= 1)
     {
         fprintf(stderr, "Usage: %s <instruction type (r or i or j)> <opcode> <var args depending on instruction type>\n", argv[0]);
+        fprintf(stderr, "       %s --stream [--binary] [--threads N] [file]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -111,12 +181,12 @@ int main(int argc, char const *argv[])
             return EXIT_FAILURE;
         }
 
-        unsigned int opcode = parse_number(argv[2]);
-        unsigned int rs = parse_number(argv[3]);
-        unsigned int rt = parse_number(argv[4]);
-        unsigned int rd = parse_number(argv[5]);
-        unsigned int shamt = parse_number(argv[6]);
-        unsigned int funct = parse_number(argv[7]);
+        unsigned int opcode = parse_arg(argv[2]);
+        unsigned int rs = parse_arg(argv[3]);
+        unsigned int rt = parse_arg(argv[4]);
+        unsigned int rd = parse_arg(argv[5]);
+        unsigned int shamt = parse_arg(argv[6]);
+        unsigned int funct = parse_arg(argv[7]);
 
         printf("Opcode: %d (0x%x), Rs: %d (0x%x), Rt: %d (0x%x), Rd: %d (0x%x), Shamt: %d (0x%x), Funct: %d (0x%x)\n",
                opcode, opcode, rs, rs, rt, rt, rd, rd, shamt, shamt, funct, funct);
@@ -130,10 +200,10 @@ int main(int argc, char const *argv[])
             return EXIT_FAILURE;
         }
 
-        unsigned int opcode = parse_number(argv[2]);
-        unsigned int rs = parse_number(argv[3]);
-        unsigned int rt = parse_number(argv[4]);
-        unsigned int immediate = parse_number(argv[5]);
+        unsigned int opcode = parse_arg(argv[2]);
+        unsigned int rs = parse_arg(argv[3]);
+        unsigned int rt = parse_arg(argv[4]);
+        unsigned int immediate = parse_arg(argv[5]);
 
         printf("Opcode: %d (0x%x), Rs: %d (0x%x), Rt: %d (0x%x), Imm: %d (0x%x)\n",
                opcode, opcode, rs, rs, rt, rt, immediate, immediate);
@@ -147,8 +217,8 @@ int main(int argc, char const *argv[])
             return EXIT_FAILURE;
         }
 
-        unsigned int opcode = parse_number(argv[2]);
-        unsigned int address = parse_number(argv[3]);
+        unsigned int opcode = parse_arg(argv[2]);
+        unsigned int address = parse_arg(argv[3]);
 
         printf("Opcode: %d (0x%x), Addr: %d (0x%x)\n",
                opcode, opcode, address, address);
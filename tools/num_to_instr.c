@@ -1,52 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 
-long parse_number(const char *arg)
-{
-    char *endptr;
-    long number = 0;
+#include "../utils.h"
+#include "stream.h"
 
-    if (strlen(arg) > 2 && arg[0] == '0')
-    {
-        if (arg[1] == 'x' || arg[1] == 'X')
-        {
-            // Hexadecimal
-            number = strtol(arg, &endptr, 16);
-        }
-        else if (arg[1] == 'b' || arg[1] == 'B')
-        {
-            // Binary (using custom parsing as strtol doesn't support binary)
-            number = strtol(arg + 2, &endptr, 2);
-        }
-        else
-        {
-            // Assume octal
-            number = strtol(arg, &endptr, 8);
-        }
-    }
-    else
-    {
-        // Decimal
-        number = strtol(arg, &endptr, 10);
-    }
-
-    if (endptr == arg || *endptr != '\0')
-    {
-        fprintf(stderr, "Invalid number: %s\n", arg);
-        exit(EXIT_FAILURE);
-    }
-
-    if (errno == ERANGE)
-    {
-        fprintf(stderr, "Number out of range: %s\n", arg);
-        exit(EXIT_FAILURE);
-    }
-
-    return number;
-}
+// Number of words decoded together in streaming mode
+#define DECODE_BATCH_SIZE 4096
 
+/// @brief Options shared by the threads of the streaming mode
+typedef struct StreamOptions
+{
+    int binary;
+    int error;
+} StreamOptions;
 
 // Function to print bits from a number within a specified range [start, end]
 void printBitsSection(unsigned int num, int start, int end) {
@@ -130,16 +99,125 @@ void print_j_instruction(long number)
            opcode, opcode, addr, addr);
 }
 
+/// @brief Parses a hexadecimal word with an optional 0x prefix from text that is not null terminated.
+/// @return The number of characters used, or 0 if the text is not a valid word
+static size_t parse_hex_word(const char *text, size_t len, uint32_t *word)
+{
+    size_t n = 0;
+    if (len >= 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+        n = 2;
+
+    size_t digits = 0;
+    uint32_t value = 0;
+    for (; n < len && !isspace((unsigned char)text[n]); n++, digits++)
+    {
+        char c = text[n];
+        int digit = (c >= '0' && c <= '9') ? c - '0' : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : -1;
+        if (digit < 0 || digits == 8)
+            return 0;
+        value = value << 4 | digit;
+    }
+
+    *word = value;
+    return digits > 0 ? n : 0;
+}
+
+/// @brief Writes one line for each decoded word:
+/// word, opcode, rs, rt, rd, shamt, funct, sign extended immediate, target and disassembly, separated by tabs.
+static void write_decoded(const uint32_t *words, size_t count, OutBuf *out)
+{
+    uint8_t fields[6][DECODE_BATCH_SIZE];
+    int32_t imm[DECODE_BATCH_SIZE];
+    uint32_t target[DECODE_BATCH_SIZE];
+    DecodedBatch batch = {fields[0], fields[1], fields[2], fields[3], fields[4], fields[5], imm, target};
+
+    decode_batch(words, count, &batch);
+
+    for (size_t n = 0; n < count; n++)
+    {
+        char text[64];
+        if (disassemble_instr(words[n], text, sizeof(text)) == 0)
+            strcpy(text, "unknown");
+
+        out_printf(out, "%08x\t%u\t%u\t%u\t%u\t%u\t%u\t%d\t%07x\t%s\n", words[n], batch.opcode[n], batch.rs[n],
+                   batch.rt[n], batch.rd[n], batch.shamt[n], batch.funct[n], batch.imm[n], batch.target[n], text);
+    }
+}
+
+/// @brief Decodes the words in one part of the input, raw big endian words or whitespace separated hex text.
+static void decode_part(const char *data, size_t len, OutBuf *out, void *ctx)
+{
+    StreamOptions *options = ctx;
+    uint32_t words[DECODE_BATCH_SIZE];
+    size_t count = 0;
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        if (options->binary)
+        {
+            const uint8_t *bytes = (const uint8_t *)data + pos;
+            words[count++] = (uint32_t)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+            pos += 4;
+        }
+        else
+        {
+            if (isspace((unsigned char)data[pos]))
+            {
+                pos++;
+                continue;
+            }
+
+            size_t used = parse_hex_word(data + pos, len - pos, &words[count]);
+            if (used == 0)
+            {
+                size_t end = pos;
+                while (end < len && !isspace((unsigned char)data[end]))
+                    end++;
+                fprintf(stderr, "Invalid word: %.*s\n", (int)(end - pos), data + pos);
+                __atomic_store_n(&options->error, 1, __ATOMIC_RELAXED);
+                pos = end;
+                continue;
+            }
+            count++;
+            pos += used;
+        }
+
+        if (count == DECODE_BATCH_SIZE)
+        {
+            write_decoded(words, count, out);
+            count = 0;
+        }
+    }
+
+    write_decoded(words, count, out);
+}
+
 int main(int argc, char *argv[])
 {
+    if (argc >= 2 && strcmp(argv[1], "--stream") == 0)
+    {
+        StreamOptions options = {0};
+        int nthreads;
+        FILE *in = parse_stream_args(argc, (const char **)argv, 2, &options.binary, &nthreads);
+        if (in == NULL)
+            return EXIT_FAILURE;
+
+        int res = stream_process(in, stdout, options.binary, nthreads, decode_part, &options);
+        if (in != stdin)
+            fclose(in);
+        return res || options.error ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
     if (argc != 3)
     {
         fprintf(stderr, "Usage: %s <instruction type, (r or i or j)> <number>\n", argv[0]);
+        fprintf(stderr, "       %s --stream [--binary] [--threads N] [file]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
     char *instruction_type = argv[1];
-    long number = parse_number(argv[2]);
+    long number = parse_arg(argv[2]);
 
     switch (instruction_type[0])
     {
@@ -0,0 +1,204 @@
+#include "stream.h"
+#include "../utils.h"
+
+#include <stdarg.h>
+#include <pthread.h>
+
+char *out_reserve(OutBuf *out, size_t size)
+{
+    if (out->len + size > out->cap)
+    {
+        size_t cap = out->cap ? out->cap : 1 << 16;
+        while (out->len + size > cap)
+            cap *= 2;
+
+        char *data = realloc(out->data, cap);
+        if (data == NULL)
+        {
+            perror("Failed to allocate memory");
+            exit(EXIT_FAILURE);
+        }
+        out->data = data;
+        out->cap = cap;
+    }
+
+    return out->data + out->len;
+}
+
+void out_printf(OutBuf *out, const char *format, ...)
+{
+    va_list args;
+
+    // lines are short, so this is enough for the first try almost always
+    char *end = out_reserve(out, 256);
+    va_start(args, format);
+    int len = vsnprintf(end, out->cap - out->len, format, args);
+    va_end(args);
+
+    if ((size_t)len >= out->cap - out->len)
+    {
+        end = out_reserve(out, len + 1);
+        va_start(args, format);
+        vsnprintf(end, len + 1, format, args);
+        va_end(args);
+    }
+
+    out->len += len;
+}
+
+/// @brief Arguments of a thread processing one part of a chunk
+typedef struct Part
+{
+    const char *data;
+    size_t len;
+    OutBuf out;
+    ChunkFn fn;
+    void *ctx;
+} Part;
+
+static void *run_part(void *arg)
+{
+    Part *part = arg;
+    part->fn(part->data, part->len, &part->out, part->ctx);
+    return NULL;
+}
+
+/// @brief Finds where a part should end: on a word boundary for binary, after a newline for text.
+static size_t part_end(const char *data, size_t len, size_t start, size_t target, int binary)
+{
+    if (target <= start)
+        target = start + 1;
+    if (binary)
+        return target & ~(size_t)3;
+
+    while (target < len && data[target - 1] != '\n')
+        target++;
+    return target;
+}
+
+int stream_process(FILE *in, FILE *out, int binary, int nthreads, ChunkFn fn, void *ctx)
+{
+    static Part parts[STREAM_MAX_THREADS];
+    pthread_t threads[STREAM_MAX_THREADS];
+
+    char *chunk = malloc(STREAM_CHUNK_SIZE);
+    if (chunk == NULL)
+    {
+        perror("Failed to allocate memory");
+        return 1;
+    }
+
+    size_t carry = 0;
+    int eof = 0;
+    while (!eof)
+    {
+        size_t len = carry + fread(chunk + carry, 1, STREAM_CHUNK_SIZE - carry, in);
+        eof = len < STREAM_CHUNK_SIZE;
+
+        // keep a partial line or word for the next chunk, a partial word at the end is left over
+        size_t end = binary ? len & ~(size_t)3 : len;
+        if (!eof)
+        {
+            if (!binary)
+                while (end > 0 && chunk[end - 1] != '\n')
+                    end--;
+
+            if (end == 0)
+            {
+                fprintf(stderr, "Input line longer than %d bytes\n", STREAM_CHUNK_SIZE);
+                free(chunk);
+                return 1;
+            }
+        }
+
+        // split the chunk into parts of about the same size
+        int count = 0;
+        for (size_t start = 0; start < end && count < nthreads; count++)
+        {
+            size_t stop = count == nthreads - 1 ? end : part_end(chunk, end, start, start + (end - start) / (nthreads - count), binary);
+            if (stop <= start)
+                stop = end;
+            parts[count].data = chunk + start;
+            parts[count].len = stop - start;
+            parts[count].fn = fn;
+            parts[count].ctx = ctx;
+            parts[count].out.len = 0;
+            start = stop;
+        }
+
+        if (count == 1)
+            run_part(&parts[0]);
+        else
+        {
+            for (int n = 0; n < count; n++)
+                pthread_create(&threads[n], NULL, run_part, &parts[n]);
+            for (int n = 0; n < count; n++)
+                pthread_join(threads[n], NULL);
+        }
+
+        for (int n = 0; n < count; n++)
+            fwrite(parts[n].out.data, 1, parts[n].out.len, out);
+
+        carry = len - end;
+        memmove(chunk, chunk + end, carry);
+    }
+
+    if (carry > 0)
+        fprintf(stderr, "Ignoring %zu trailing bytes\n", carry);
+
+    for (int n = 0; n < STREAM_MAX_THREADS; n++)
+    {
+        free(parts[n].out.data);
+        parts[n].out = (OutBuf){0};
+    }
+    free(chunk);
+    return 0;
+}
+
+long parse_arg(const char *arg)
+{
+    long number = parse_number(arg);
+    if (number < 0)
+    {
+        fprintf(stderr, "Invalid number: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+
+    return number;
+}
+
+FILE *parse_stream_args(int argc, const char *argv[], int first, int *binary, int *nthreads)
+{
+    const char *filename = NULL;
+    *binary = 0;
+    *nthreads = 1;
+
+    for (int n = first; n < argc; n++)
+    {
+        if (strcmp(argv[n], "--binary") == 0)
+            *binary = 1;
+        else if (strcmp(argv[n], "--threads") == 0 && n + 1 < argc)
+            *nthreads = parse_arg(argv[++n]);
+        else if (filename == NULL && argv[n][0] != '-')
+            filename = argv[n];
+        else
+        {
+            fprintf(stderr, "Invalid option: %s\n", argv[n]);
+            return NULL;
+        }
+    }
+
+    if (*nthreads < 1 || *nthreads > STREAM_MAX_THREADS)
+    {
+        fprintf(stderr, "Number of threads must be between 1 and %d\n", STREAM_MAX_THREADS);
+        return NULL;
+    }
+
+    if (filename == NULL)
+        return stdin;
+
+    FILE *in = fopen(filename, "rb");
+    if (in == NULL)
+        fprintf(stderr, "Could not open file %s\n", filename);
+    return in;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Size of the chunks that input is read and processed in
+#define STREAM_CHUNK_SIZE (4 << 20)
+// Maximum number of threads a chunk is split across
+#define STREAM_MAX_THREADS 64
+
+/// @brief Growable output buffer, each thread formats into its own one
+typedef struct OutBuf
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} OutBuf;
+
+/// @brief Processes one part of a chunk. Text parts hold whole lines, binary parts whole words.
+typedef void (*ChunkFn)(const char *data, size_t len, OutBuf *out, void *ctx);
+
+/// @brief Makes room for at least size more bytes in the buffer.
+/// @param out
+/// @param size
+/// @return Pointer to the end of the buffer
+char *out_reserve(OutBuf *out, size_t size);
+
+/// @brief Appends formatted text to the buffer.
+/// @param out
+/// @param format
+void out_printf(OutBuf *out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/// @brief Reads the input in chunks, splits each chunk into nthreads parts and runs fn on them in parallel.
+/// The outputs are written in input order with one fwrite per part.
+/// @param in
+/// @param out
+/// @param binary if set, parts are cut on 4 byte words, otherwise on lines
+/// @param nthreads
+/// @param fn
+/// @param ctx passed to fn
+/// @return returns 0 on success, 1 on failure
+int stream_process(FILE *in, FILE *out, int binary, int nthreads, ChunkFn fn, void *ctx);
+
+/// @brief Parses a number argument, exiting with an error if it is not a valid number.
+/// @param arg
+/// @return
+long parse_arg(const char *arg);
+
+/// @brief Parses the options of a streaming mode: [--binary] [--threads N] [file]
+/// @param argc
+/// @param argv
+/// @param first index of the first option
+/// @param binary set if --binary is given
+/// @param nthreads set to the number of threads, 1 by default
+/// @return The input file, stdin if no file is given, or NULL on failure
+FILE *parse_stream_args(int argc, const char *argv[], int first, int *binary, int *nthreads);
@@ -1,8 +1,15 @@
 #include "tui.h"
+#include "loader.h"
 
 /// @brief The memory address to display.
 int memory_address = 0;
 
+/// @brief Formatted memory rows, direct mapped by word index
+static DisasmRow disasm_cache[DISASM_CACHE_SIZE];
+
+/// @brief Source lines and labels of the last loaded program
+static SourceMap program_map;
+
 /**
  * Creates a new window based on parameters.
  */
@@ -18,7 +25,7 @@ WINDOW *create_win(int height, int width, int starty, int startx)
 
 void clear_output(WINDOW *win)
 {
-    for (int i = 0; i < 6; i++)
+    for (int i = 0; i < OUTPUT_LINES; i++)
     {
         wmove(win, OUTPUT_LINE + i, 1);
         wclrtoeol(win);
@@ -96,7 +103,7 @@ void load_file(WINDOW *win, StateMIPS *state)
     int address;
 
     echo();
-    mvwprintw(win, OUTPUT_LINE, 1, "Enter filename: ");
+    mvwprintw(win, OUTPUT_LINE, 1, "Enter filename (binary, or .asm source): ");
     wrefresh(win);
     wgetnstr(win, filename, 100);
     clear_output(win);
@@ -112,10 +119,16 @@ void load_file(WINDOW *win, StateMIPS *state)
     if (address == -1)
         return;
 
-    int res = read_file_into_mem_at(state, filename, address);
+    // .asm and .s files are assembled straight into memory
+    free_source_map(&program_map);
+    int res = load_program_at(state, filename, address, &program_map);
+    // the rows hold the source of the previous map
+    memset(disasm_cache, 0, sizeof(disasm_cache));
     if (res == 0)
     {
         mvwprintw(win, OUTPUT_LINE, 1, "File %s loaded successfully at 0x%08x", filename, address);
+        if (program_map.num_lines > 0)
+            wprintw(win, ", %u source lines and %u labels", program_map.num_lines, program_map.num_labels);
     }
     else
     {
@@ -132,14 +145,138 @@ void load_file(WINDOW *win, StateMIPS *state)
     wrefresh(win);
 }
 
+void add_watch(WINDOW *win, StateMIPS *state)
+{
+    int address;
+    int length;
+    char type[4];
+
+    echo();
+    mvwprintw(win, OUTPUT_LINE, 1, "Enter address (hex): ");
+    wrefresh(win);
+    wscanw(win, "%x", &address);
+    clear_output(win);
+
+    mvwprintw(win, OUTPUT_LINE, 1, "Enter length in bytes (hex): ");
+    wrefresh(win);
+    wscanw(win, "%x", &length);
+    clear_output(win);
+
+    mvwprintw(win, OUTPUT_LINE, 1, "Watch on (r)ead, (w)rite or (a)ccess: ");
+    wrefresh(win);
+    wgetnstr(win, type, 3);
+    noecho();
+    clear_output(win);
+
+    WatchType watch_type;
+    switch (type[0])
+    {
+    case 'r':
+        watch_type = WATCH_READ;
+        break;
+    case 'w':
+        watch_type = WATCH_WRITE;
+        break;
+    case 'a':
+        watch_type = WATCH_ACCESS;
+        break;
+    default:
+        mvwprintw(win, OUTPUT_LINE, 1, "Invalid watchpoint type");
+        wrefresh(win);
+        return;
+    }
+
+    if (address < 0 || length <= 0 || add_watchpoint(state, address, length, watch_type) != 0)
+    {
+        mvwprintw(win, OUTPUT_LINE, 1, "Could not add watchpoint");
+    }
+    else
+    {
+        mvwprintw(win, OUTPUT_LINE, 1, "Watching 0x%08x - 0x%08x", address, address + length);
+    }
+    wrefresh(win);
+}
+
+const char *get_exception_name(uint32_t code)
+{
+    switch (code)
+    {
+    case AdEL:
+        return "AdEL (address error on load or fetch)";
+    case AdES:
+        return "AdES (address error on store)";
+    case Sys:
+        return "Sys (syscall)";
+    case Bp:
+        return "Bp (break)";
+    case RI:
+        return "RI (reserved instruction)";
+    case Ov:
+        return "Ov (arithmetic overflow)";
+    default:
+        return "unknown";
+    }
+}
+
+void print_stop_reason(WINDOW *win, StateMIPS *state, int reason)
+{
+    switch (reason)
+    {
+    case STOP_WATCHPOINT:
+    {
+        WatchHit *hit = &state->watch_hit;
+        mvwprintw(win, OUTPUT_LINE + 1, 1, "%s watchpoint hit at pc 0x%08x: [0x%08x] 0x%08x -> 0x%08x",
+                  hit->type == WATCH_READ ? "Read" : "Write", hit->pc, hit->addr, hit->old_value, hit->new_value);
+        break;
+    }
+    case STOP_EXCEPTION:
+    {
+        uint32_t code = (state->cp0.cause & CAUSE_EXC_MASK) >> CAUSE_EXC_SHIFT;
+        mvwprintw(win, OUTPUT_LINE + 1, 1, "Exception %s at pc 0x%08x", get_exception_name(code), state->cp0.epc);
+        if (code == AdEL || code == AdES)
+            wprintw(win, ", bad address 0x%08x", state->cp0.badvaddr);
+        break;
+    }
+    case STOP_EXIT:
+        mvwprintw(win, OUTPUT_LINE + 1, 1, "Program exited with code %d", state->exit_code);
+        break;
+    case STOP_STEP_LIMIT:
+        mvwprintw(win, OUTPUT_LINE + 1, 1, "Stopped after %d instructions", RUN_BATCH_SIZE);
+        break;
+    default:
+        break;
+    }
+}
+
+void print_guest_output(WINDOW *win, StateMIPS *state)
+{
+    // skip the trailing newline and show the last line that was printed
+    uint32_t end = state->out_len;
+    while (end > 0 && state->out_buf[end - 1] == '\n')
+        end--;
+
+    if (end > 0)
+    {
+        uint32_t start = end;
+        while (start > 0 && state->out_buf[start - 1] != '\n')
+            start--;
+
+        mvwprintw(win, OUTPUT_LINE + 2, 1, "Output: %.*s", (int)(end - start), state->out_buf + start);
+    }
+
+    state->out_len = 0;
+}
+
 void print_help(WINDOW *win)
 {
     mvwprintw(win, OUTPUT_LINE, 1, "n: Next instruction");
-    mvwprintw(win, OUTPUT_LINE + 1, 1, "l: Load file");
-    mvwprintw(win, OUTPUT_LINE + 2, 1, "j: Jump to instruction");
-    mvwprintw(win, OUTPUT_LINE + 3, 1, "m: Jump to memory");
-    mvwprintw(win, OUTPUT_LINE + 4, 1, "h: Help");
-    mvwprintw(win, OUTPUT_LINE + 5, 1, "q: Quit");
+    mvwprintw(win, OUTPUT_LINE + 1, 1, "r: Run until a watchpoint or exception");
+    mvwprintw(win, OUTPUT_LINE + 2, 1, "l: Load file");
+    mvwprintw(win, OUTPUT_LINE + 3, 1, "j: Jump to instruction");
+    mvwprintw(win, OUTPUT_LINE + 4, 1, "m: Jump to memory");
+    mvwprintw(win, OUTPUT_LINE + 5, 1, "W: Add watchpoint");
+    mvwprintw(win, OUTPUT_LINE + 6, 1, "h: Help");
+    mvwprintw(win, OUTPUT_LINE + 7, 1, "q: Quit");
     wrefresh(win);
 }
 
@@ -157,6 +294,12 @@ int handle_input(WINDOW *win, StateMIPS *state)
         mvwprintw(win, OUTPUT_LINE, 1, "Completed instruction at 0x%08x: ", state->pc);
         print_instr_at(win, state->mem[state->pc / 4], OUTPUT_LINE, 38);
         return 1;
+    case 'r':
+        mvwprintw(win, OUTPUT_LINE, 1, "Running from 0x%08x", state->pc);
+        return 2;
+    case 'W':
+        add_watch(win, state);
+        return 0;
     case 'j':
         jump_to_instruction(win, state);
         return 0;
@@ -200,33 +343,10 @@ void print_instr_at(WINDOW *win, uint32_t instr, int y, int x)
         return;
     }
 
-    uint8_t opcode = instr >> 26;
-
-    const char *mnemonic = get_mnemonic_from_instr(instr);
-
-    if (strcmp(mnemonic, "unknown") == 0)
+    char text[64];
+    if (disassemble_instr(instr, text, sizeof(text)) > 0)
     {
-        return;
-    }
-
-    Instruction i = decode_instr(instr);
-
-    switch (i.format)
-    {
-    case R_RD_RS_RT:
-        mvwprintw(win, y, x, "%s $%s, $%s, $%s", mnemonic, get_reg_name(i.r.rd), get_reg_name(i.r.rs), get_reg_name(i.r.rt));
-        break;
-    case I_RS_RT_I:
-        mvwprintw(win, y, x, "%s $%s, $%s, 0x%04x", mnemonic, get_reg_name(i.i.rs), get_reg_name(i.i.rt), i.i.imm);
-        break;
-    case I_RT_I_RS:
-        mvwprintw(win, y, x, "%s $%s, 0x%04x($%s)", mnemonic, get_reg_name(i.i.rt), i.i.imm, get_reg_name(i.i.rs));
-        break;
-    case J_I:
-        mvwprintw(win, y, x, "%s 0x%08x", mnemonic, get_reg_name(i.j.target));
-        break;
-    default:
-        break;
+        mvwprintw(win, y, x, "%s", text);
     }
 }
 
@@ -239,6 +359,28 @@ void print_registers(WINDOW *win, StateMIPS *state)
     }
 }
 
+void disassemble_range(StateMIPS *state, uint32_t addr, uint32_t count, const DisasmRow **rows)
+{
+    for (uint32_t i = 0; i < count; i++, addr += 4)
+    {
+        DisasmRow *row = &disasm_cache[(addr / 4) & (DISASM_CACHE_SIZE - 1)];
+        uint32_t word = state->mem[addr / 4];
+
+        if (!row->valid || row->addr != addr || row->word != word)
+        {
+            row->addr = addr;
+            row->word = word;
+            row->valid = 1;
+            snprintf(row->hex, sizeof(row->hex), "0x%08x:\t 0x%08x", addr, word);
+            if (word == 0 || disassemble_instr(word, row->text, sizeof(row->text)) == 0)
+                row->text[0] = '\0';
+            format_source(&program_map, addr, row->source, sizeof(row->source));
+        }
+
+        rows[i] = row;
+    }
+}
+
 void print_memory(WINDOW *win, StateMIPS *state)
 {
 
@@ -253,23 +395,32 @@ void print_memory(WINDOW *win, StateMIPS *state)
 
     mvwprintw(win, MEM_ROW_LOC, MEM_COL_LOC, "Memory:");
 
+    const DisasmRow *rows[MEM_VIEW_SIZE];
+    disassemble_range(state, memory_address, MEM_VIEW_SIZE, rows);
+
     for (int i = 0; i < MEM_VIEW_SIZE; i++)
     {
-        uint32_t current_address = memory_address + i * 4;
-        uint32_t instr = state->mem[current_address / 4];
+        int y = i + MEM_ROW_LOC + 1;
 
         // Highlight the current instruction
-        if (memory_address + i * 4 == state->pc)
+        int current = rows[i]->addr == state->pc;
+        if (current)
         {
             wattron(win, COLOR_PAIR(1));
-            mvwprintw(win, i + MEM_ROW_LOC + 1, MEM_COL_LOC, "0x%08x:\t 0x%08x", current_address, instr);
-            print_instr_at(win, instr, i + MEM_ROW_LOC + 1, MEM_COL_LOC + 32);
-            wattroff(win, COLOR_PAIR(1));
         }
-        else
+
+        mvwaddstr(win, y, MEM_COL_LOC, rows[i]->hex);
+        wmove(win, y, MEM_COL_LOC + 32);
+        wclrtoeol(win);
+        waddstr(win, rows[i]->text);
+
+        // label and line of the source the word was assembled from
+        if (rows[i]->source[0])
+            mvwaddstr(win, y, MEM_COL_LOC + MEM_SOURCE_COL, rows[i]->source);
+
+        if (current)
         {
-            mvwprintw(win, i + MEM_ROW_LOC + 1, MEM_COL_LOC, "0x%08x:\t 0x%08x", current_address, instr);
-            print_instr_at(win, instr, i + MEM_ROW_LOC + 1, MEM_COL_LOC + 32);
+            wattroff(win, COLOR_PAIR(1));
         }
     }
 }
@@ -18,11 +18,39 @@
 
 // Size of the memory view, these many memory locations will be displayed
 #define MEM_VIEW_SIZE 32
+// Column of the label and source line of a memory row, relative to MEM_COL_LOC, and its size
+#define MEM_SOURCE_COL 60
+#define MEM_SOURCE_SIZE 56
+
 // Move by 4 bytes at a time when scrolling through memory
 #define MEM_VIEW_STEP 4
 
 // Output line for messages
 #define OUTPUT_LINE MEM_ROW_LOC + MEM_VIEW_SIZE + 2
+// Number of lines used for messages
+#define OUTPUT_LINES 8
+
+// Maximum number of instructions executed by a single run command
+#define RUN_BATCH_SIZE 1000000
+
+// Number of memory rows kept in the disassembly cache, must be a power of 2
+#define DISASM_CACHE_SIZE 256
+// Size of the disassembly text of a row
+#define DISASM_TEXT_SIZE 48
+
+/// @brief A row of the memory view, formatted once and reused while the word at addr is unchanged
+typedef struct DisasmRow
+{
+    uint32_t addr;
+    uint32_t word;
+    uint8_t valid;
+    // address and word, e.g. "0x00000000:\t 0x014b4820"
+    char hex[32];
+    // disassembly of the word, empty for 0 and unknown instructions
+    char text[DISASM_TEXT_SIZE];
+    // label and line of the source the word was assembled from, empty without a source map
+    char source[MEM_SOURCE_SIZE];
+} DisasmRow;
 
 /// @brief Creates a new window based on parameters.
 /// @param height
@@ -56,6 +84,31 @@ void print_current_instr(WINDOW *win, StateMIPS *state);
 /// @param win
 void print_help(WINDOW *win);
 
+/// @brief Gets a readable name for an exception code.
+/// @param code
+/// @return
+const char *get_exception_name(uint32_t code);
+
+/// @brief Prints why the emulator stopped, e.g. the pc and values of a watchpoint hit.
+/// @param win
+/// @param state
+/// @param reason
+void print_stop_reason(WINDOW *win, StateMIPS *state, int reason);
+
+/// @brief Prints the last line of output from the guest and empties the output buffer.
+/// @param win
+/// @param state
+void print_guest_output(WINDOW *win, StateMIPS *state);
+
+/// @brief Disassembles count words of memory starting at addr in one call.
+/// Rows are cached by address and word, so only words that changed since the last call are formatted again.
+/// The cache is emptied when a program is loaded, since its source map changes the source of every row.
+/// @param state
+/// @param addr
+/// @param count
+/// @param rows filled with pointers into the cache, valid until the next call
+void disassemble_range(StateMIPS *state, uint32_t addr, uint32_t count, const DisasmRow **rows);
+
 /// @brief Prints the instruction at a specific memory location.
 /// @param win
 /// @param instr
@@ -81,7 +134,8 @@ void print_instr_at(WINDOW *win, uint32_t instr, int y, int x);
 /// @brief Handles input from the user.
 /// @param win
 /// @param state
-/// @return Returns 1 if the user wants to emulate the MIPS, -1 if the user wants to exit, and 0 otherwise.
+/// @return Returns 1 if the user wants to emulate the MIPS, 2 if the user wants to run until stopped,
+/// -1 if the user wants to exit, and 0 otherwise.
 int handle_input(WINDOW *win, StateMIPS *state);
 
 // /// @brief Prints the help menu.
@@ -1,30 +1,29 @@
 #include "utils.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_DECODER
+#endif
+
+// Descriptions and decode tables generated from the ISA table
+
+#define ISA_DESC(id, mnemonic, opcode, rs, funct, format) \
+    [INSTR_##id] = {#mnemonic, sizeof(#mnemonic) - 1, opcode, funct, format, INSTR_##id, ((uint32_t)(opcode) << 26) | ((rs) << 21) | (funct)},
+#define ISA_BY_OPCODE(id, mnemonic, opcode, rs, funct, format) [opcode] = INSTR_##id,
+#define ISA_BY_RS(id, mnemonic, opcode, rs, funct, format) [rs] = INSTR_##id,
+#define ISA_BY_FUNCT(id, mnemonic, opcode, rs, funct, format) [funct] = INSTR_##id,
+
+const InstrDesc isa_desc[INSTR_COUNT] = {
+    [INSTR_UNKNOWN] = {"unknown", 7, 0, 0, UNKNOWN, INSTR_UNKNOWN, 0},
+    ISA_TABLE(ISA_DESC)};
+
+const uint8_t isa_opcode_table[64] = {ISA_OPCODE(ISA_BY_OPCODE)};
+const uint8_t isa_special_table[64] = {ISA_SPECIAL(ISA_BY_FUNCT)};
+const uint8_t isa_cop0_table[32] = {ISA_COP0(ISA_BY_RS)};
+
 const char *get_mnemonic_from_instr(const uint32_t instr)
 {
-    uint8_t opcode = (instr >> 26) & 0x3F;
-    const uint8_t funct = instr & 0x3F;
-
-    switch (opcode)
-    {
-    case 0x00:
-        if (funct == 0x20)
-        {
-            return "add";
-        } else {
-            return "unknown";
-        }
-    case 0x02:
-        return "j";
-    case 0x0C:
-        return "beq";
-    case 0x23:
-        return "lw";
-    case 0x2B:
-        return "sw";
-    default:
-        return "unknown";
-    }
+    return isa_desc[get_instr_id(instr)].name;
 }
 
 long parse_number(const char *arg)
@@ -32,6 +31,12 @@ long parse_number(const char *arg)
     char *endptr;
     long number = 0;
 
+    if (arg[0] == '-')
+    {
+        number = parse_number(arg + 1);
+        return number < 0 ? -1 : -number;
+    }
+
     if (strlen(arg) > 2 && arg[0] == '0')
     {
         if (arg[1] == 'x' || arg[1] == 'X')
@@ -94,218 +99,357 @@ JArgs decode_j_type(uint32_t instruction)
     return j;
 }
 
-ITemplate get_template_from_opcode(uint8_t opcode)
+void decode_batch_scalar(const uint32_t *words, size_t start, size_t count, DecodedBatch *out)
 {
-    switch (opcode)
+    for (size_t n = start; n < count; n++)
     {
-    // R-type
-    case 0x00: // add
-        return R_RD_RS_RT;
+        uint32_t word = words[n];
+        out->opcode[n] = word >> 26;
+        out->rs[n] = INSTR_RS(word);
+        out->rt[n] = INSTR_RT(word);
+        out->rd[n] = INSTR_RD(word);
+        out->shamt[n] = INSTR_SHAMT(word);
+        out->funct[n] = INSTR_FUNCT(word);
+        out->imm[n] = INSTR_SIMM(word);
+        out->target[n] = INSTR_TARGET(word);
+    }
+}
 
+#ifdef HAVE_AVX2_DECODER
+/// @brief Narrows eight 32 bit lanes holding values below 256 to bytes and stores them at dst.
+__attribute__((target("avx2"))) static inline void store_bytes8(uint8_t *dst, __m256i lanes)
+{
+    // gather the low byte of each lane into the first 4 bytes of each 128 bit half, then join the halves
+    const __m256i low_bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                               0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(lanes, low_bytes), _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+    _mm_storel_epi64((__m128i *)dst, _mm256_castsi256_si128(packed));
+}
 
-    // I-type
-     // I_RS_RT_I
-    case 0x0C: // beq
-        return I_RS_RT_I;
+/// @brief Decodes words eight at a time, returns the number of words decoded.
+__attribute__((target("avx2"))) static size_t decode_batch_avx2(const uint32_t *words, size_t count, DecodedBatch *out)
+{
+    const __m256i mask5 = _mm256_set1_epi32(0x1F);
+    const __m256i mask6 = _mm256_set1_epi32(0x3F);
+    const __m256i mask26 = _mm256_set1_epi32(0x3FFFFFF);
 
-    // I_RT_I_RS
-    case 0x23: // lw
-    case 0x2B: // sw
-        return I_RT_I_RS;
+    size_t n = 0;
+    for (; n + 8 <= count; n += 8)
+    {
+        __m256i w = _mm256_loadu_si256((const __m256i *)(words + n));
 
+        store_bytes8(out->opcode + n, _mm256_srli_epi32(w, 26));
+        store_bytes8(out->rs + n, _mm256_and_si256(_mm256_srli_epi32(w, 21), mask5));
+        store_bytes8(out->rt + n, _mm256_and_si256(_mm256_srli_epi32(w, 16), mask5));
+        store_bytes8(out->rd + n, _mm256_and_si256(_mm256_srli_epi32(w, 11), mask5));
+        store_bytes8(out->shamt + n, _mm256_and_si256(_mm256_srli_epi32(w, 6), mask5));
+        store_bytes8(out->funct + n, _mm256_and_si256(w, mask6));
+        _mm256_storeu_si256((__m256i *)(out->imm + n), _mm256_srai_epi32(_mm256_slli_epi32(w, 16), 16));
+        _mm256_storeu_si256((__m256i *)(out->target + n), _mm256_and_si256(w, mask26));
+    }
 
-    // J-type
-    // J_I
-    case 0x02: // j
-        return J_I;
+    return n;
+}
+#endif
+
+void decode_batch(const uint32_t *words, size_t count, DecodedBatch *out)
+{
+    size_t done = 0;
+
+#ifdef HAVE_AVX2_DECODER
+    if (__builtin_cpu_supports("avx2"))
+        done = decode_batch_avx2(words, count, out);
+#endif
+
+    // the tail, or everything on hosts without AVX2
+    decode_batch_scalar(words, done, count, out);
+}
+
+InstrType get_instr_type(ITemplate format)
+{
+    switch (format)
+    {
+    case I_RT_RS_I:
+    case I_RT_IMM32:
+    case I_RS_RT_LABEL:
+    case I_RS_LABEL:
+    case I_RT_I_RS:
+    case I_RS_RT_I:
+    case I_RT_I:
+    case I_RS_I:
+        return I_TYPE;
+    case J_LABEL:
+    case J_I:
+        return J_TYPE;
     default:
-        return UNKNOWN;
+        return R_TYPE;
     }
 }
 
+/// @brief Operand patterns indexed by template, see get_template_operands
+static const char *const template_operands[UNKNOWN + 1] = {
+    [R_RD_RS_RT] = "d,s,t",
+    [R_RS_RT] = "s,t",
+    [R_RD_RT_SHAMT] = "d,t,h",
+    [R_RD_RT_RS] = "d,t,s",
+    [R_RS] = "s",
+    [R_RD] = "d",
+    [R_RD_RS] = "d,s",
+    [I_RT_RS_I] = "t,s,i",
+    [I_RT_IMM32] = "t,i",
+    [I_RS_RT_LABEL] = "s,t,b",
+    [I_RS_LABEL] = "s,b",
+    [I_RT_I_RS] = "t,i(s)",
+    [I_RS_RT_I] = "s,t,i",
+    [I_RT_I] = "t,i",
+    [I_RS_I] = "s,i",
+    [J_LABEL] = "a",
+    [J_I] = "a",
+    [C0_RT_RD] = "t,c",
+    [NO_ARGS] = "",
+    [UNKNOWN] = NULL,
+};
+
+const char *get_template_operands(ITemplate format)
+{
+    return format <= UNKNOWN ? template_operands[format] : NULL;
+}
+
 Instruction decode_instr(uint32_t instruction)
 {
     Instruction instr;
-
-    uint8_t opcode = instruction >> 26;
-    ITemplate template = get_template_from_opcode(opcode);
+    const InstrDesc *desc = &isa_desc[get_instr_id(instruction)];
 
     instr.instr = instruction;
-    instr.opcode = opcode;
-    instr.format = template;
+    instr.opcode = instruction >> 26;
+    instr.id = desc->id;
+    instr.format = desc->format;
 
-    switch (template)
+    switch (get_instr_type(desc->format))
     {
-    case R_RD_RS_RT:
+    case R_TYPE:
         instr.r = decode_r_type(instruction);
         break;
-    case I_RS_RT_I:
-    case I_RT_I_RS:
+    case I_TYPE:
         instr.i = decode_i_type(instruction);
         break;
-    case J_I:
+    case J_TYPE:
         instr.j = decode_j_type(instruction);
         break;
-    default:
-        break;
     }
 
     return instr;
 }
 
+uint32_t encode_instr(const Instruction *instr)
+{
+    const InstrDesc *desc = &isa_desc[instr->id];
+
+    switch (get_instr_type(desc->format))
+    {
+    case R_TYPE:
+        return desc->match | (instr->r.rs & 0x1Fu) << 21 | (instr->r.rt & 0x1Fu) << 16 | (instr->r.rd & 0x1Fu) << 11 |
+               (instr->r.shamt & 0x1Fu) << 6;
+    case I_TYPE:
+        return desc->match | (instr->i.rs & 0x1Fu) << 21 | (instr->i.rt & 0x1Fu) << 16 | instr->i.imm;
+    default:
+        return desc->match | (instr->j.target & 0x3FFFFFF);
+    }
+}
+
+int disassemble_instr(uint32_t instr, char *buf, size_t size)
+{
+    const InstrDesc *desc = &isa_desc[get_instr_id(instr)];
+    const char *operands = get_template_operands(desc->format);
+
+    if (size == 0)
+        return 0;
+    buf[0] = '\0';
+    if (desc->id == INSTR_UNKNOWN || operands == NULL)
+        return 0;
+
+    // each operand is appended with snprintf, which keeps the text null terminated if buf fills up
+    size_t len = snprintf(buf, size, "%s%s", desc->name, operands[0] ? " " : "");
+    for (const char *op = operands; *op && len < size; op++)
+    {
+        switch (*op)
+        {
+        case 'd':
+            len += snprintf(buf + len, size - len, "$%s", get_reg_name(INSTR_RD(instr)));
+            break;
+        case 's':
+            len += snprintf(buf + len, size - len, "$%s", get_reg_name(INSTR_RS(instr)));
+            break;
+        case 't':
+            len += snprintf(buf + len, size - len, "$%s", get_reg_name(INSTR_RT(instr)));
+            break;
+        case 'c':
+            len += snprintf(buf + len, size - len, "$%u", INSTR_RD(instr));
+            break;
+        case 'h':
+            len += snprintf(buf + len, size - len, "%u", INSTR_SHAMT(instr));
+            break;
+        case 'i':
+            // written the way the assembler takes it back: sign extended immediates as negative numbers
+            if (!imm_zero_extended(desc->id) && INSTR_SIMM(instr) < 0)
+                len += snprintf(buf + len, size - len, "-0x%04x", -INSTR_SIMM(instr));
+            else
+                len += snprintf(buf + len, size - len, "0x%04x", INSTR_IMM(instr));
+            break;
+        case 'b':
+            len += snprintf(buf + len, size - len, "0x%04x", INSTR_IMM(instr));
+            break;
+        case 'a':
+            len += snprintf(buf + len, size - len, "0x%08x", INSTR_TARGET(instr));
+            break;
+        case ',':
+            len += snprintf(buf + len, size - len, ", ");
+            break;
+        default:
+            len += snprintf(buf + len, size - len, "%c", *op);
+            break;
+        }
+    }
+
+    return len < size ? (int)len : (int)size - 1;
+}
+
+/// @brief Open addressing hash table of pointers into isa_desc, built once at startup
+static const InstrDesc *mnemonic_table[MNEMONIC_TABLE_SIZE];
+
+/// @brief Hashes a mnemonic from its length and its first, second and last characters,
+/// which separates all the mnemonics without looking at the whole string.
+static uint32_t hash_mnemonic(const char *name, size_t len)
+{
+    uint32_t h = len * 0x9E3779B1u;
+    h ^= (uint8_t)name[0] * 0x85EBCA77u;
+    h ^= (uint8_t)name[len > 1] * 0xC2B2AE3Du;
+    h ^= (uint8_t)name[len - 1] * 0x27D4EB2Fu;
+    return (h ^ (h >> 15)) & (MNEMONIC_TABLE_SIZE - 1);
+}
+
+/// @brief Fills the mnemonic hash table before main runs, so lookups never need to check or lock it.
+__attribute__((constructor)) static void build_mnemonic_table(void)
+{
+    // skip INSTR_UNKNOWN, "unknown" is not a mnemonic
+    for (size_t n = INSTR_UNKNOWN + 1; n < INSTR_COUNT; n++)
+    {
+        uint32_t slot = hash_mnemonic(isa_desc[n].name, isa_desc[n].len);
+        // linear probing, the table is kept at most half full so probe sequences stay short
+        while (mnemonic_table[slot] != NULL)
+            slot = (slot + 1) & (MNEMONIC_TABLE_SIZE - 1);
+        mnemonic_table[slot] = &isa_desc[n];
+    }
+}
+
+const InstrDesc *get_mnemonic_info(const char *mnemonic, size_t len)
+{
+    if (len == 0)
+        return NULL;
+
+    for (uint32_t slot = hash_mnemonic(mnemonic, len);; slot = (slot + 1) & (MNEMONIC_TABLE_SIZE - 1))
+    {
+        const InstrDesc *info = mnemonic_table[slot];
+        if (info == NULL)
+            return NULL;
+        if (info->len == len && memcmp(info->name, mnemonic, len) == 0)
+            return info;
+    }
+}
+
 uint8_t get_opcode_from_mnemonic(const char *mnemonic)
 {
-    if (strcmp(mnemonic, "add") == 0)
-        return 0x00;
-    if (strcmp(mnemonic, "j") == 0)
-        return 0x02;
-    if (strcmp(mnemonic, "beq") == 0)
-        return 0x0c;
-    if (strcmp(mnemonic, "lw") == 0)
-        return 0x23;
-    if (strcmp(mnemonic, "sw") == 0)
-        return 0x2b;
-    
-    return 0xFF;
+    const InstrDesc *info = get_mnemonic_info(mnemonic, strlen(mnemonic));
+    return info ? info->opcode : 0xFF;
 }
 
+/// @brief Register names indexed by number
+static const char *const reg_names[32] = {
+    "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"};
+
 const char *get_reg_name(uint8_t reg)
 {
-    switch (reg)
+    return reg < 32 ? reg_names[reg] : "unknown";
+}
+
+int get_register_number(const char *reg, size_t len)
+{
+    if (len < 2 || reg[0] != '$')
+        return -1;
+
+    const char *name = reg + 1;
+    len--;
+
+    // numeric alias, $0 to $31
+    if (name[0] >= '0' && name[0] <= '9')
     {
-    case 0:
-        return "zero";
-    case 1:
-        return "at";
-    case 2:
-        return "v0";
-    case 3:
-        return "v1";
-    case 4:
-        return "a0";
-    case 5:
-        return "1";
-    case 6:
-        return "a2";
-    case 7:
-        return "a3";
-    case 8:
-        return "t0";
-    case 9:
-        return "t1";
-    case 10:
-        return "t2";
-    case 11:
-        return "t3";
-    case 12:
-        return "t4";
-    case 13:
-        return "t5";
-    case 14:
-        return "t6";
-    case 15:
-        return "t7";
-    case 16:
-        return "s0";
-    case 17:
-        return "s1";
-    case 18:
-        return "s2";
-    case 19:
-        return "s3";
-    case 20:
-        return "s4";
-    case 21:
-        return "s5";
-    case 22:
-        return "s6";
-    case 23:
-        return "s7";
-    case 24:
-        return "t8";
-    case 25:
-        return "t9";
-    case 26:
-        return "k0";
-    case 27:
-        return "k1";
-    case 28:
-        return "gp";
-    case 29:
-        return "sp";
-    case 30:
-        return "fp";
-    case 31:
-        return "ra";
-    default:
-        return "unknown";
+        if (len == 1)
+            return name[0] - '0';
+        if (len == 2 && name[0] != '0' && name[1] >= '0' && name[1] <= '9')
+        {
+            int number = (name[0] - '0') * 10 + (name[1] - '0');
+            return number < 32 ? number : -1;
+        }
+        return -1;
+    }
+
+    if (len == 4)
+        return memcmp(name, "zero", 4) == 0 ? 0 : -1;
+    if (len != 2)
+        return -1;
+
+    // every other name is a letter followed by a digit or a second letter
+    char c = name[1];
+    int digit = c - '0';
+    switch (name[0])
+    {
+    case 'a':
+        if (c == 't')
+            return 1;
+        if (digit >= 0 && digit <= 3)
+            return 4 + digit;
+        break;
+    case 'v':
+        if (digit >= 0 && digit <= 1)
+            return 2 + digit;
+        break;
+    case 't':
+        if (digit >= 0 && digit <= 7)
+            return 8 + digit;
+        if (digit >= 8 && digit <= 9)
+            return 24 + digit - 8;
+        break;
+    case 's':
+        if (c == 'p')
+            return 29;
+        if (digit >= 0 && digit <= 7)
+            return 16 + digit;
+        break;
+    case 'k':
+        if (digit >= 0 && digit <= 1)
+            return 26 + digit;
+        break;
+    case 'g':
+        if (c == 'p')
+            return 28;
+        break;
+    case 'f':
+        if (c == 'p')
+            return 30;
+        break;
+    case 'r':
+        if (c == 'a')
+            return 31;
+        break;
     }
+
+    return -1;
 }
+
 int get_register_number_from_name(const char *reg)
 {
-    if (strcmp(reg, "$zero") == 0)
-        return 0;
-    if (strcmp(reg, "$at") == 0)
-        return 1;
-    if (strcmp(reg, "$v0") == 0)
-        return 2;
-    if (strcmp(reg, "$v1") == 0)
-        return 3;
-    if (strcmp(reg, "$a0") == 0)
-        return 4;
-    if (strcmp(reg, "$a1") == 0)
-        return 5;
-    if (strcmp(reg, "$a2") == 0)
-        return 6;
-    if (strcmp(reg, "$a3") == 0)
-        return 7;
-    if (strcmp(reg, "$t0") == 0)
-        return 8;
-    if (strcmp(reg, "$t1") == 0)
-        return 9;
-    if (strcmp(reg, "$t2") == 0)
-        return 10;
-    if (strcmp(reg, "$t3") == 0)
-        return 11;
-    if (strcmp(reg, "$t4") == 0)
-        return 12;
-    if (strcmp(reg, "$t5") == 0)
-        return 13;
-    if (strcmp(reg, "$t6") == 0)
-        return 14;
-    if (strcmp(reg, "$t7") == 0)
-        return 15;
-    if (strcmp(reg, "$s0") == 0)
-        return 16;
-    if (strcmp(reg, "$s1") == 0)
-        return 17;
-    if (strcmp(reg, "$s2") == 0)
-        return 18;
-    if (strcmp(reg, "$s3") == 0)
-        return 19;
-    if (strcmp(reg, "$s4") == 0)
-        return 20;
-    if (strcmp(reg, "$s5") == 0)
-        return 21;
-    if (strcmp(reg, "$s6") == 0)
-        return 22;
-    if (strcmp(reg, "$s7") == 0)
-        return 23;
-    if (strcmp(reg, "$t8") == 0)
-        return 24;
-    if (strcmp(reg, "$t9") == 0)
-        return 25;
-    if (strcmp(reg, "$k0") == 0)
-        return 26;
-    if (strcmp(reg, "$k1") == 0)
-        return 27;
-    if (strcmp(reg, "$gp") == 0)
-        return 28;
-    if (strcmp(reg, "$sp") == 0)
-        return 29;
-    if (strcmp(reg, "$fp") == 0)
-        return 30;
-    if (strcmp(reg, "$ra") == 0)
-        return 31;
-    return -1;
+    return get_register_number(reg, strlen(reg));
 }
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "isa.h"
+
 /// @brief Enum to hold the type and template of the instruction.
 // See: https://uweb.engr.arizona.edu/~ece369/Resources/spim/MIPSReference.pdf
 typedef enum ITemplate
@@ -15,6 +17,7 @@ typedef enum ITemplate
     R_RD_RT_RS,    // sllv rd, rt, rs     -- shift left logical variable
     R_RS,          // jr rs
     R_RD,          // mfhi rd
+    R_RD_RS,       // jalr rd, rs
 
     I_RT_RS_I,     // addi rt, rs, i
     I_RT_IMM32,    // lhi rt, imm32
@@ -22,10 +25,15 @@ typedef enum ITemplate
     I_RS_LABEL,    // bgtz rs, label
     I_RT_I_RS,     // lw rt, i(rs)
     I_RS_RT_I,     // beq rs, rt, i
+    I_RT_I,        // lui rt, i
+    I_RS_I,        // bgtz rs, i
 
     J_LABEL, // j label
     J_I,      // j i
 
+    C0_RT_RD, // mfc0 rt, rd       -- rd is a coprocessor 0 register number
+    NO_ARGS,  // syscall
+
     UNKNOWN
 } ITemplate;
 
@@ -53,11 +61,20 @@ typedef struct JArgs
     uint32_t target;
 } JArgs;
 
+/// @brief Encoding types, the fields an instruction has
+typedef enum InstrType
+{
+    R_TYPE,
+    I_TYPE,
+    J_TYPE
+} InstrType;
+
 /// @brief Struct to hold instruction
 typedef struct Instruction
 {
     uint32_t instr;
     uint8_t opcode;
+    InstrId id;
     ITemplate format;
     union
     {
@@ -67,6 +84,88 @@ typedef struct Instruction
     };
 } Instruction;
 
+// Fields of an instruction word
+#define INSTR_RS(instr) (((instr) >> 21) & 0x1F)
+#define INSTR_RT(instr) (((instr) >> 16) & 0x1F)
+#define INSTR_RD(instr) (((instr) >> 11) & 0x1F)
+#define INSTR_SHAMT(instr) (((instr) >> 6) & 0x1F)
+#define INSTR_FUNCT(instr) ((instr) & 0x3F)
+#define INSTR_IMM(instr) ((instr) & 0xFFFF)
+// Immediate sign extended to 32 bits
+#define INSTR_SIMM(instr) ((int32_t)(int16_t)((instr) & 0xFFFF))
+#define INSTR_TARGET(instr) ((instr) & 0x3FFFFFF)
+
+// Size of the mnemonic hash table, must be a power of 2
+#define MNEMONIC_TABLE_SIZE 128
+
+/// @brief Description of an instruction, generated from the ISA table in isa.h
+typedef struct InstrDesc
+{
+    const char *name;
+    uint8_t len;
+    uint8_t opcode;
+    uint8_t funct;
+    ITemplate format;
+    InstrId id;
+    // fixed bits of the encoding: the opcode, funct and rs field of coprocessor instructions
+    uint32_t match;
+} InstrDesc;
+
+// Instruction descriptions indexed by InstrId, entry INSTR_UNKNOWN is named "unknown"
+extern const InstrDesc isa_desc[INSTR_COUNT];
+
+// Decode tables generated from isa.h, unused entries are INSTR_UNKNOWN
+extern const uint8_t isa_opcode_table[64];
+extern const uint8_t isa_special_table[64];
+extern const uint8_t isa_cop0_table[32];
+
+/// @brief Identifies the instruction in a 32 bit word with at most two table reads.
+/// @param instr
+/// @return The instruction, or INSTR_UNKNOWN
+static inline InstrId get_instr_id(uint32_t instr)
+{
+    uint8_t opcode = instr >> 26;
+    if (opcode == OPCODE_SPECIAL)
+        return isa_special_table[INSTR_FUNCT(instr)];
+    if (opcode == OPCODE_COP0)
+        return isa_cop0_table[INSTR_RS(instr)];
+    return isa_opcode_table[opcode];
+}
+
+/// @brief Checks if an instruction takes its immediate zero extended, ori, xori and lui do, the others sign extend it.
+/// @param id
+/// @return 1 if the immediate is zero extended, 0 otherwise
+static inline int imm_zero_extended(InstrId id)
+{
+    return id == INSTR_ORI || id == INSTR_XORI || id == INSTR_LUI;
+}
+
+/// @brief Gets the encoding type of an instruction template.
+/// @param format
+/// @return
+InstrType get_instr_type(ITemplate format);
+
+/// @brief Gets the operands of an instruction template as a pattern, which both the assembler parser and
+/// the disassembler follow. Letters are operands and other characters are matched literally:
+/// d, s, t are the rd, rs, rt registers, c is a coprocessor 0 register in rd,
+/// h is the shift amount, i the 16 bit immediate, b a branch offset in words stored in the immediate
+/// and a the jump target. The assembler accepts a label for b and a.
+/// @param format
+/// @return The pattern, e.g. "t,i(s)" for lw, or NULL for UNKNOWN
+const char *get_template_operands(ITemplate format);
+
+/// @brief Encodes an instruction, the inverse of decode_instr. Uses the id, format and operand fields.
+/// @param instr
+/// @return The 32 bit instruction word
+uint32_t encode_instr(const Instruction *instr);
+
+/// @brief Writes the assembly text of an instruction, e.g. "lw $t0, 0x0010($sp)".
+/// @param instr
+/// @param buf
+/// @param size
+/// @return The length of the text, or 0 if the instruction is unknown
+int disassemble_instr(uint32_t instr, char *buf, size_t size);
+
 /// @brief Decode an instruction from a 32 bit number.
 /// @param instruction
 /// @return
@@ -79,6 +178,7 @@ const char *get_mnemonic_from_instr(uint32_t instruction);
 
 /// @brief Parses a number from a string.
 /// @param arg
+/// Accepts decimal, 0x hexadecimal, 0b binary and 0 octal numbers with an optional leading minus sign.
 /// @return Returns the parsed number, or returns -1 if the number is invalid.
 long parse_number(const char *arg);
 
@@ -97,16 +197,39 @@ IArgs decode_i_type(uint32_t instruction);
 /// @return JType
 JArgs decode_j_type(uint32_t instruction);
 
+/// @brief Instruction fields in structure of arrays form, each array holds one entry per decoded word.
+/// Every field is extracted from every word regardless of its type.
+typedef struct DecodedBatch
+{
+    uint8_t *opcode;
+    uint8_t *rs;
+    uint8_t *rt;
+    uint8_t *rd;
+    uint8_t *shamt;
+    uint8_t *funct;
+    // immediate sign extended to 32 bits
+    int32_t *imm;
+    uint32_t *target;
+} DecodedBatch;
+
+/// @brief Decodes count instruction words into the arrays of out, using AVX2 when the host supports it.
+/// @param words
+/// @param count
+/// @param out arrays with room for count entries
+void decode_batch(const uint32_t *words, size_t count, DecodedBatch *out);
+
+/// @brief Scalar reference for decode_batch, decodes words [start, count).
+/// @param words
+/// @param start
+/// @param count
+/// @param out
+void decode_batch_scalar(const uint32_t *words, size_t start, size_t count, DecodedBatch *out);
+
 /// @brief Get the name of a register.
 /// @param reg
 /// @return
 const char *get_reg_name(uint8_t reg);
 
-/// @brief Get the the template of an instruction from the opcode.
-/// @param opcode 
-/// @return 
-ITemplate get_template_from_opcode(uint8_t opcode);
-
 /// @brief Get the opcode from a mnemonic.
 /// @param mnemonic 
 /// @return 
@@ -117,7 +240,15 @@ uint8_t get_opcode_from_mnemonic(const char *mnemonic);
 /// @return 
 int get_register_number_from_name(const char *reg);
 
-/// @brief Gets the opcode from the mnemonic.
-/// @param mnemonic 
-/// @return 
-uint8_t get_opcode_from_mnemonic(const char *mnemonic);
+/// @brief Gets the register number from a register name that is not null terminated, e.g. a view into the source.
+/// Accepts names like $t0 and numeric aliases like $8.
+/// @param reg
+/// @param len
+/// @return The register number, or -1 if the name is not a register
+int get_register_number(const char *reg, size_t len);
+
+/// @brief Looks up a mnemonic that is not null terminated, in constant time.
+/// @param mnemonic
+/// @param len
+/// @return The instruction description, or NULL if the mnemonic is unknown
+const InstrDesc *get_mnemonic_info(const char *mnemonic, size_t len);